@@ -0,0 +1,34 @@
+#include "frustum.h"
+
+// planes straight from the rows of the matrix, glm stores it by column
+Frustum::Frustum(const glm::mat4& viewProjection)
+{
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0]; // left
+	planes[1] = rows[3] - rows[0]; // right
+	planes[2] = rows[3] + rows[1]; // bottom
+	planes[3] = rows[3] - rows[1]; // top
+	planes[4] = rows[3] + rows[2]; // near
+	planes[5] = rows[3] - rows[2]; // far
+}
+
+bool Frustum::intersectsBox(glm::vec3 boxMin, glm::vec3 boxMax) const
+{
+	for (const glm::vec4& plane : planes)
+	{
+		// the corner furthest along the plane normal
+		glm::vec3 corner = glm::vec3(
+			plane.x >= 0.0f ? boxMax.x : boxMin.x,
+			plane.y >= 0.0f ? boxMax.y : boxMin.y,
+			plane.z >= 0.0f ? boxMax.z : boxMin.z);
+
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
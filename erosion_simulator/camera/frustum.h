@@ -0,0 +1,15 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// the six planes of a view volume, pointing inwards
+class Frustum
+{
+public:
+	Frustum(const glm::mat4& viewProjection);
+
+	// false only if the box is completely outside one of the planes
+	bool intersectsBox(glm::vec3 boxMin, glm::vec3 boxMax) const;
+
+private:
+	glm::vec4 planes[6];
+};
@@ -1,6 +1,12 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdio>
 #include <vector>
+#include "simulation/convergence.h"
+#include "io/mapped_file.h"
+
+const float GRAVITY_ACCELERATION = 9.807f;
 
 enum class TerrainDebugMode
 {
@@ -73,13 +79,14 @@ struct WaterSource
 	glm::vec3 position;
 	float radius;
 	float intensity;
+
+	bool operator==(const WaterSource&) const = default;
 };
 
-struct ErosionModel
+// everything the user can tune, kept apart from the grids so the UI can edit
+// its own copy while the simulation thread works on the model
+struct ErosionParameters
 {
-	int width;
-	int length;
-
 	int simulationSpeed = 1;
 
 	int rainIntensity = 1;
@@ -87,17 +94,14 @@ struct ErosionModel
 	float evaporationRate = 0.02f;
 
 	float fluidDensity = 1.0f;
-	// dont know if there should be more
-	float lx = 1.0f;
-	float ly = 1.0f;
-	float area = lx * ly;
 
-	float sedimentCapacity = 0.1f;
+	float sedimentCapacity = 0.01f;
 	float maxErosionDepth = 10.f;
-	float slippageAngle;
+	float slippageAngle = 45.0f;
 	float seaLevel = -20;
 
 	bool useSedimentSlippage = true;
+	bool useHydrologyPrepass = true;
 
 	bool isRaining = false;
 	bool isModelRunning = false;
@@ -116,6 +120,77 @@ struct ErosionModel
 
 	std::vector<WaterSource> waterSources = std::vector<WaterSource>(0);
 
+	int warmStartLevels = 3;
+	int warmStartMaxSteps = 2000;
+	float warmStartTolerance = 0.0001f;
+
+	bool useTileThrottling = true;
+	bool pauseOnConvergence = false;
+	int convergedUpdateInterval = 8;
+	float convergenceWaterTolerance = 0.001f;
+	float convergenceTerrainTolerance = 0.0001f;
+	// per cell and step change of the sediment a tile carries, so a river still cutting its bed is not throttled
+	float convergenceSedimentTolerance = 0.0001f;
+
+	bool operator==(const ErosionParameters&) const = default;
+
+	void ToggleModelRunning()
+	{
+		isModelRunning = !isModelRunning;
+		printf("Model is %s\n", isModelRunning ? "Enabled" : "Disabled");	
+	}
+
+	void ToggleModelRaining()
+	{
+		isRaining = !isRaining;
+		printf("%s Rain\n", isRaining ? "Enabled" : "Disabled");
+	}
+
+	void TogglePaintMode()
+	{
+		int current = (int)paintMode;
+		if (current >= (int)PaintMode::COUNT - 1)
+			paintMode = static_cast<PaintMode>(0);
+		else
+			paintMode = static_cast<PaintMode>(current + 1);
+	}
+
+	void ToggleTerrainDebugMode()
+	{
+		int current = (int)terrainDebugMode;
+		if (current >= (int)TerrainDebugMode::COUNT - 1)
+			terrainDebugMode = static_cast<TerrainDebugMode>(0);
+		else
+			terrainDebugMode = static_cast<TerrainDebugMode>(current + 1);
+		printf("Terrain Debugging mode %d Enabled\n", (int)terrainDebugMode);
+	}
+
+	void ToggleWaterDebugMode()
+	{
+		int current = (int)waterDebugMode;
+		if (current >= (int)WaterDebugMode::COUNT - 1)
+			waterDebugMode = static_cast<WaterDebugMode>(0);
+		else
+			waterDebugMode = static_cast<WaterDebugMode>(current + 1);
+		printf("Water Debugging mode %d Enabled\n", (int)waterDebugMode);
+	}
+};
+
+struct ErosionModel : public ErosionParameters
+{
+	int width;
+	int length;
+
+	// dont know if there should be more
+	float lx = 1.0f;
+	float ly = 1.0f;
+	float area = lx * ly;
+
+	ConvergenceMonitor* convergence;
+
+	// world xz position of cell (0, 0), cells are lx by ly apart
+	glm::vec2 gridOrigin;
+
 	float** terrainHeights; // b
 	float** waterHeights; // d
 	float** suspendedSedimentAmounts; // s
@@ -123,26 +198,13 @@ struct ErosionModel
 	glm::vec2** velocities; // v
 	float** terrainHardness;
 
+	// set when the fields live in a mapped checkpoint instead of their own columns
+	MappedFile* fieldMapping = nullptr;
+
 	ErosionModel(int width, int length)
 		: width(width), length(length) {
-		simulationSpeed = 1;
-
-		rainIntensity = 1;
-		rainAmount = 1;
-		evaporationRate = 0.02f;
-
-		fluidDensity = 1.0f;
-		// dont know if there should be more
-		lx = 1.0f;
-		ly = 1.0f;
-		area = lx * ly;
-
-		sedimentCapacity = 0.01f;
-		maxErosionDepth = 10.0f;
-		slippageAngle = 45.0f;
-
-		waterSources = std::vector<WaterSource>(0);
-
+		gridOrigin = glm::vec2(-(width / 2), -(length / 2));
+		convergence = new ConvergenceMonitor(width, length);
 
 		terrainHeights = new float* [width];
 		waterHeights = new float* [width];
@@ -162,6 +224,79 @@ struct ErosionModel
 		}
 	}
 
+	// the columns are owned, or belong to the mapping, so a copy would free them twice
+	ErosionModel(const ErosionModel&) = delete;
+	ErosionModel& operator=(const ErosionModel&) = delete;
+
+	~ErosionModel()
+	{
+		freeFieldColumns();
+
+		delete[] terrainHeights;
+		delete[] waterHeights;
+		delete[] suspendedSedimentAmounts;
+		delete[] outflowFlux;
+		delete[] velocities;
+		delete[] terrainHardness;
+
+		delete convergence;
+	}
+
+	// points every column into planes of width * length cells, column after column, that
+	// live in mapping. the model takes over the mapping and unmaps it with itself or in ownFields
+	void adoptFields(MappedFile* mapping, float* terrainPlane, float* waterPlane, float* sedimentPlane,
+		FlowFlux* fluxPlane, glm::vec2* velocityPlane, float* hardnessPlane)
+	{
+		freeFieldColumns();
+		fieldMapping = mapping;
+
+		for (int i = 0; i < width; i++)
+		{
+			terrainHeights[i] = terrainPlane + (size_t)i * length;
+			waterHeights[i] = waterPlane + (size_t)i * length;
+			suspendedSedimentAmounts[i] = sedimentPlane + (size_t)i * length;
+			outflowFlux[i] = fluxPlane + (size_t)i * length;
+			velocities[i] = velocityPlane + (size_t)i * length;
+			terrainHardness[i] = hardnessPlane + (size_t)i * length;
+		}
+	}
+
+	// gives fields that live in a mapping columns of their own and unmaps it, so the file can be
+	// replaced, which windows refuses while it is mapped. keepValues copies the cells over, without
+	// it they are left uninitialized for a caller that overwrites them anyway
+	void ownFields(bool keepValues = true)
+	{
+		if (!fieldMapping) return;
+
+		for (int i = 0; i < width; i++)
+		{
+			float* terrain = new float[length];
+			float* water = new float[length];
+			float* sediment = new float[length];
+			FlowFlux* flux = new FlowFlux[length];
+			glm::vec2* velocity = new glm::vec2[length];
+			float* hardness = new float[length];
+			if (keepValues)
+			{
+				std::copy(terrainHeights[i], terrainHeights[i] + length, terrain);
+				std::copy(waterHeights[i], waterHeights[i] + length, water);
+				std::copy(suspendedSedimentAmounts[i], suspendedSedimentAmounts[i] + length, sediment);
+				std::copy(outflowFlux[i], outflowFlux[i] + length, flux);
+				std::copy(velocities[i], velocities[i] + length, velocity);
+				std::copy(terrainHardness[i], terrainHardness[i] + length, hardness);
+			}
+			terrainHeights[i] = terrain;
+			waterHeights[i] = water;
+			suspendedSedimentAmounts[i] = sediment;
+			outflowFlux[i] = flux;
+			velocities[i] = velocity;
+			terrainHardness[i] = hardness;
+		}
+
+		delete fieldMapping;
+		fieldMapping = nullptr;
+	}
+
 	ErosionCell* getCell(int x, int y) {
 		if (x < 0 || x >= width || y < 0 || y >= length)
 			return nullptr;
@@ -178,44 +313,44 @@ struct ErosionModel
 
 	}
 
-	void ToggleModelRunning()
-	{
-		isModelRunning = !isModelRunning;
-		printf("Model is %s\n", isModelRunning ? "Enabled" : "Disabled");	
+	bool isInBounds(int x, int y) {
+		return x >= 0 && x < width && y >= 0 && y < length;
 	}
 
-	void ToggleModelRaining()
-	{
-		isRaining = !isRaining;
-		printf("%s Rain\n", isRaining ? "Enabled" : "Disabled");
+	glm::vec2 getCellPosition(int x, int y) {
+		return gridOrigin + glm::vec2(x * lx, y * ly);
 	}
 
-	void TogglePaintMode()
-	{
-		int current = (int)paintMode;
-		if (current >= (int)PaintMode::COUNT - 1)
-			paintMode = static_cast<PaintMode>(0);
-		else
-			paintMode = static_cast<PaintMode>(current + 1);
-	}
+	// central differences, one sided on the border
+	glm::vec3 getTerrainNormal(int x, int y) {
+		int left = std::max(x - 1, 0);
+		int right = std::min(x + 1, width - 1);
+		int bottom = std::max(y - 1, 0);
+		int top = std::min(y + 1, length - 1);
 
-	void ToggleTerrainDebugMode()
-	{
-		int current = (int)terrainDebugMode;
-		if (current >= (int)TerrainDebugMode::COUNT - 1)
-			terrainDebugMode = static_cast<TerrainDebugMode>(0);
-		else
-			terrainDebugMode = static_cast<TerrainDebugMode>(current + 1);
-		printf("Terrain Debugging mode %d Enabled\n", (int)terrainDebugMode);
+		float dx = (terrainHeights[right][y] - terrainHeights[left][y]) / ((right - left) * lx);
+		float dy = (terrainHeights[x][top] - terrainHeights[x][bottom]) / ((top - bottom) * ly);
+		return glm::normalize(glm::vec3(-dx, 1.0f, -dy));
 	}
 
-	void ToggleWaterDebugMode()
+private:
+	void freeFieldColumns()
 	{
-		int current = (int)waterDebugMode;
-		if (current >= (int)WaterDebugMode::COUNT - 1)
-			waterDebugMode = static_cast<WaterDebugMode>(0);
-		else
-			waterDebugMode = static_cast<WaterDebugMode>(current + 1);
-		printf("Water Debugging mode %d Enabled\n", (int)waterDebugMode);
+		if (fieldMapping)
+		{
+			delete fieldMapping;
+			fieldMapping = nullptr;
+			return;
+		}
+
+		for (int i = 0; i < width; i++)
+		{
+			delete[] terrainHeights[i];
+			delete[] waterHeights[i];
+			delete[] suspendedSedimentAmounts[i];
+			delete[] outflowFlux[i];
+			delete[] velocities[i];
+			delete[] terrainHardness[i];
+		}
 	}
 };
\ No newline at end of file
@@ -0,0 +1,340 @@
+#include "heightfield_simplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <execution>
+
+// one tile of the grid, with the error of every vertex as the midpoint of a triangle's hypotenuse
+struct SimplifyTile
+{
+	int x = 0;
+	int y = 0;
+	// how far the triangles split at a vertex are from the grid, grown by the errors of their children
+	std::vector<float> errors;
+	// corners as global vertex ids, y * width + x
+	std::vector<uint32_t> triangles;
+};
+
+struct Heightfield
+{
+	float** heights;
+	uint8_t** mask;
+	int width;
+	int length;
+
+	// the tiles can reach past the grid, those vertices are never part of a kept triangle
+	float sample(int x, int y) const { return heights[std::min(x, width - 1)][std::min(y, length - 1)]; }
+};
+
+static const int TILE_VERTICES = SIMPLIFY_TILE_SIZE + 1;
+
+// corners of one triangle of a tile's implicit binary tree, a and b span the hypotenuse, c is the right angle
+struct TileTriangle
+{
+	uint16_t ax, ay, bx, by, cx, cy;
+
+	int midpoint() const { return ((ay + by) >> 1) * TILE_VERTICES + ((ax + bx) >> 1); }
+	int leftChild() const { return ((ay + cy) >> 1) * TILE_VERTICES + ((ax + cx) >> 1); }
+	int rightChild() const { return ((by + cy) >> 1) * TILE_VERTICES + ((bx + cx) >> 1); }
+};
+
+// every triangle of the tree that is not a single cell, finest first. all tiles share the same tree
+static const std::vector<TileTriangle>& getTileTriangles()
+{
+	static const std::vector<TileTriangle> triangles = []
+	{
+		const int size = SIMPLIFY_TILE_SIZE;
+		std::vector<TileTriangle> triangles(size * size * 2 - 2);
+		for (int i = (int)triangles.size() - 1; i >= 0; i--)
+		{
+			int id = i + 2;
+			int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+			if (id & 1)
+			{
+				bx = by = cx = size;
+			}
+			else
+			{
+				ax = ay = cy = size;
+			}
+			while ((id >>= 1) > 1)
+			{
+				int mx = (ax + bx) >> 1;
+				int my = (ay + by) >> 1;
+				if (id & 1)
+				{
+					bx = ax; by = ay;
+					ax = cx; ay = cy;
+				}
+				else
+				{
+					ax = bx; ay = by;
+					bx = cx; by = cy;
+				}
+				cx = mx; cy = my;
+			}
+			triangles[triangles.size() - 1 - i] = TileTriangle{ (uint16_t)ax, (uint16_t)ay, (uint16_t)bx, (uint16_t)by, (uint16_t)cx, (uint16_t)cy };
+		}
+		return triangles;
+	}();
+	return triangles;
+}
+
+static int floorDivide(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// narrows [low, high] to the y where p + q * y >= 0
+static void clipToHalfPlane(int p, int q, int& low, int& high)
+{
+	if (q > 0)
+		low = std::max(low, -floorDivide(p, q));
+	else if (q < 0)
+		high = std::min(high, floorDivide(p, -q));
+	else if (p < 0)
+		high = low - 1;
+}
+
+// largest height difference between the triangle's plane and the grid points it covers, in tile coordinates
+static float getTriangleError(const Heightfield& field, const SimplifyTile& tile, int ax, int ay, int bx, int by, int cx, int cy)
+{
+	int minX = std::min({ ax, bx, cx });
+	int maxX = std::max({ ax, bx, cx });
+	int minY = std::min({ ay, by, cy });
+	int maxY = std::max({ ay, by, cy });
+	if (tile.x + minX >= field.width - 1 || tile.y + minY >= field.length - 1) return 0.0f;
+	// split until every triangle is either inside the grid or outside of it
+	if (tile.x + maxX > field.width - 1 || tile.y + maxY > field.length - 1) return INFINITY;
+
+	// barycentric weights scaled by twice the area, which has to be positive
+	int area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+	if (area < 0)
+	{
+		std::swap(bx, cx);
+		std::swap(by, cy);
+		area = -area;
+	}
+	float ha = field.sample(tile.x + ax, tile.y + ay);
+	float hb = field.sample(tile.x + bx, tile.y + by);
+	float hc = field.sample(tile.x + cx, tile.y + cy);
+
+	// the weights are linear in y, so every column of the triangle is one run of grid points
+	float error = 0.0f;
+	for (int x = minX; x <= maxX; x++)
+	{
+		int pa = (bx - x) * cy - by * (cx - x);
+		int qa = cx - bx;
+		int pb = (cx - x) * ay - cy * (ax - x);
+		int qb = ax - cx;
+		int low = minY;
+		int high = maxY;
+		clipToHalfPlane(pa, qa, low, high);
+		clipToHalfPlane(pb, qb, low, high);
+		clipToHalfPlane(area - pa - pb, -qa - qb, low, high);
+
+		float interpolated = (pa * ha + pb * hb + (area - pa - pb) * hc) / area;
+		float slope = (qa * ha + qb * hb + (-qa - qb) * hc) / area;
+		const float* column = field.heights[tile.x + x] + tile.y;
+		for (int y = low; y <= high; y++)
+		{
+			error = std::max(error, std::abs(interpolated + slope * y - column[y]));
+		}
+	}
+	return error;
+}
+
+// both triangles that share a hypotenuse are split at its midpoint, so the vertex keeps the larger error
+static void computeTriangleErrors(const Heightfield& field, SimplifyTile& tile)
+{
+	tile.errors.assign(TILE_VERTICES * TILE_VERTICES, 0.0f);
+	for (const TileTriangle& t : getTileTriangles())
+	{
+		float& error = tile.errors[t.midpoint()];
+		error = std::max(error, getTriangleError(field, tile, t.ax, t.ay, t.bx, t.by, t.cx, t.cy));
+	}
+}
+
+// grows every vertex's error by the errors of its children, so a split triangle always has split parents.
+// errors only ever grow, so it can run again after the borders were raised
+static void propagateErrors(SimplifyTile& tile)
+{
+	// the finest triangles come first and have no children
+	const std::vector<TileTriangle>& triangles = getTileTriangles();
+	int parentCount = SIMPLIFY_TILE_SIZE * SIMPLIFY_TILE_SIZE - 2;
+	for (size_t i = triangles.size() - parentCount; i < triangles.size(); i++)
+	{
+		const TileTriangle& t = triangles[i];
+		float& error = tile.errors[t.midpoint()];
+		error = std::max({ error, tile.errors[t.leftChild()], tile.errors[t.rightChild()] });
+	}
+}
+
+// gives every vertex on a border between tiles the largest error any of its tiles has for it,
+// true if some tile's error grew
+static bool equalizeBorders(std::vector<SimplifyTile>& tiles, int tileCountX, int tileCountY)
+{
+	const int size = SIMPLIFY_TILE_SIZE;
+	int columnLength = tileCountY * size + 1;
+	int rowLength = tileCountX * size + 1;
+	// vertices on the vertical and horizontal tile borders
+	std::vector<float> columns((tileCountX + 1) * columnLength, 0.0f);
+	std::vector<float> rows((tileCountY + 1) * rowLength, 0.0f);
+
+	for (const SimplifyTile& tile : tiles)
+	{
+		int column = tile.x / size;
+		int row = tile.y / size;
+		for (int i = 0; i <= size; i++)
+		{
+			float& left = columns[column * columnLength + tile.y + i];
+			float& right = columns[(column + 1) * columnLength + tile.y + i];
+			float& bottom = rows[row * rowLength + tile.x + i];
+			float& top = rows[(row + 1) * rowLength + tile.x + i];
+			left = std::max(left, tile.errors[i * TILE_VERTICES]);
+			right = std::max(right, tile.errors[i * TILE_VERTICES + size]);
+			bottom = std::max(bottom, tile.errors[i]);
+			top = std::max(top, tile.errors[size * TILE_VERTICES + i]);
+		}
+	}
+
+	// tile corners are on both kinds of border
+	for (int row = 0; row <= tileCountY; row++)
+	{
+		for (int column = 0; column <= tileCountX; column++)
+		{
+			float& inColumn = columns[column * columnLength + row * size];
+			float& inRow = rows[row * rowLength + column * size];
+			inColumn = inRow = std::max(inColumn, inRow);
+		}
+	}
+
+	bool raised = false;
+	auto raise = [&](float& error, float border)
+	{
+		if (border <= error) return;
+		error = border;
+		raised = true;
+	};
+	for (SimplifyTile& tile : tiles)
+	{
+		int column = tile.x / size;
+		int row = tile.y / size;
+		for (int i = 0; i <= size; i++)
+		{
+			raise(tile.errors[i * TILE_VERTICES], columns[column * columnLength + tile.y + i]);
+			raise(tile.errors[i * TILE_VERTICES + size], columns[(column + 1) * columnLength + tile.y + i]);
+			raise(tile.errors[i], rows[row * rowLength + tile.x + i]);
+			raise(tile.errors[size * TILE_VERTICES + i], rows[(row + 1) * rowLength + tile.x + i]);
+		}
+	}
+	return raised;
+}
+
+static void addTileTriangle(const Heightfield& field, SimplifyTile& tile, int ax, int ay, int bx, int by, int cx, int cy)
+{
+	ax += tile.x; bx += tile.x; cx += tile.x;
+	ay += tile.y; by += tile.y; cy += tile.y;
+	if (std::max({ ax, bx, cx }) > field.width - 1 || std::max({ ay, by, cy }) > field.length - 1) return;
+	if (field.mask && !field.mask[ax][ay] && !field.mask[bx][by] && !field.mask[cx][cy]) return;
+
+	// counter clockwise seen from above, the mesh's y is the grid's height and z its y
+	if ((by - ay) * (cx - ax) - (bx - ax) * (cy - ay) < 0)
+		std::swap(bx, cx), std::swap(by, cy);
+
+	tile.triangles.push_back(ay * field.width + ax);
+	tile.triangles.push_back(by * field.width + bx);
+	tile.triangles.push_back(cy * field.width + cx);
+}
+
+static void extractTileTriangles(const Heightfield& field, SimplifyTile& tile, float maxError, int ax, int ay, int bx, int by, int cx, int cy)
+{
+	int mx = (ax + bx) >> 1;
+	int my = (ay + by) >> 1;
+	if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && tile.errors[my * TILE_VERTICES + mx] > maxError)
+	{
+		extractTileTriangles(field, tile, maxError, cx, cy, ax, ay, mx, my);
+		extractTileTriangles(field, tile, maxError, bx, by, cx, cy, mx, my);
+	}
+	else
+	{
+		addTileTriangle(field, tile, ax, ay, bx, by, cx, cy);
+	}
+}
+
+SimplifiedMesh simplifyHeightfield(float** heights, int width, int length, float maxError, uint8_t** mask)
+{
+	const int size = SIMPLIFY_TILE_SIZE;
+	Heightfield field{ heights, mask, width, length };
+	int tileCountX = (width - 1 + size - 1) / size;
+	int tileCountY = (length - 1 + size - 1) / size;
+
+	std::vector<SimplifyTile> tiles(tileCountX * tileCountY);
+	for (int ty = 0; ty < tileCountY; ty++)
+	{
+		for (int tx = 0; tx < tileCountX; tx++)
+		{
+			SimplifyTile& tile = tiles[ty * tileCountX + tx];
+			tile.x = tx * size;
+			tile.y = ty * size;
+		}
+	}
+
+	std::for_each(std::execution::par, tiles.begin(), tiles.end(), [&](SimplifyTile& tile) { computeTriangleErrors(field, tile); });
+	// raising a border vertex raises its parents, which can be on other borders, so this repeats until nothing grows
+	do
+	{
+		std::for_each(std::execution::par, tiles.begin(), tiles.end(), [&](SimplifyTile& tile) { propagateErrors(tile); });
+	} while (equalizeBorders(tiles, tileCountX, tileCountY));
+
+	std::for_each(std::execution::par, tiles.begin(), tiles.end(), [&](SimplifyTile& tile)
+	{
+		extractTileTriangles(field, tile, maxError, 0, 0, size, size, size, 0);
+		extractTileTriangles(field, tile, maxError, size, size, 0, 0, 0, size);
+	});
+
+	// vertices on tile borders are shared, numbering the used grid points in order gives every vertex one index
+	std::vector<uint32_t> vertexIndices((size_t)width * length, 0);
+	for (const SimplifyTile& tile : tiles)
+	{
+		for (uint32_t id : tile.triangles)
+		{
+			vertexIndices[id] = 1;
+		}
+	}
+	std::vector<uint32_t> vertexIds;
+	for (uint32_t id = 0; id < (uint32_t)vertexIndices.size(); id++)
+	{
+		if (!vertexIndices[id]) continue;
+		vertexIndices[id] = (uint32_t)vertexIds.size();
+		vertexIds.push_back(id);
+	}
+
+	SimplifiedMesh mesh;
+	mesh.positions.resize(vertexIds.size());
+	mesh.normals.resize(vertexIds.size());
+	std::for_each(std::execution::par, vertexIds.begin(), vertexIds.end(), [&](const uint32_t& id)
+	{
+		int x = id % width;
+		int y = id / width;
+		size_t vertex = &id - vertexIds.data();
+		mesh.positions[vertex] = glm::vec3(x, heights[x][y], y);
+
+		// central differences, one sided on the edges
+		int left = std::max(x - 1, 0);
+		int right = std::min(x + 1, width - 1);
+		int bottom = std::max(y - 1, 0);
+		int top = std::min(y + 1, length - 1);
+		float dx = (heights[right][y] - heights[left][y]) / (right - left);
+		float dz = (heights[x][top] - heights[x][bottom]) / (top - bottom);
+		mesh.normals[vertex] = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+	});
+
+	for (const SimplifyTile& tile : tiles)
+	{
+		for (uint32_t id : tile.triangles)
+		{
+			mesh.indices.push_back(vertexIndices[id]);
+		}
+	}
+	return mesh;
+}
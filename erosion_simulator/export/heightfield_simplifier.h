@@ -0,0 +1,22 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// cells along the side of a simplification tile, has to be a power of two
+const int SIMPLIFY_TILE_SIZE = 256;
+
+// triangle mesh in grid coordinates, x is the column, y the height and z the row
+struct SimplifiedMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<uint32_t> indices;
+};
+
+// right triangulated irregular network (RTIN) simplification of a height field given as
+// columns [x][y], no point of the full grid ends up further than maxError from the mesh.
+// the grid is cut into tiles that are simplified in parallel, their errors along shared
+// borders are kept equal so the tiles split their edges the same way and meet without cracks.
+// with a mask, also columns [x][y], triangles without a masked corner are dropped
+SimplifiedMesh simplifyHeightfield(float** heights, int width, int length, float maxError, uint8_t** mask = nullptr);
@@ -0,0 +1,231 @@
+#include "mesh_export.h"
+#include "heightfield_simplifier.h"
+#include "mesh/water_mesh.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+struct ExportedMesh
+{
+	std::string name;
+	SimplifiedMesh mesh;
+	// rgba
+	float color[4];
+};
+
+MeshExportFormat getMeshExportFormat(const std::string& filePath)
+{
+	std::string extension = filePath.substr(filePath.find_last_of('.') + 1);
+	return extension == "obj" || extension == "OBJ" ? MeshExportFormat::OBJ : MeshExportFormat::GLTF_BINARY;
+}
+
+static std::string formatFloat(float value)
+{
+	char text[32];
+	snprintf(text, sizeof(text), "%.9g", value);
+	return text;
+}
+
+static bool writeObj(const std::string& filePath, const std::vector<ExportedMesh>& meshes)
+{
+	std::ofstream file(filePath, std::ios_base::out | std::ios_base::binary);
+	if (!file)
+	{
+		printf("Failed to write the mesh to %s\n", filePath.c_str());
+		return false;
+	}
+
+	// lines are formatted into a buffer that is written whenever it fills up
+	std::string text;
+	char line[128];
+	auto addLine = [&](int length)
+	{
+		text.append(line, length);
+		if (text.size() > (1 << 20))
+		{
+			file.write(text.data(), text.size());
+			text.clear();
+		}
+	};
+
+	// obj indices count from one and run on across objects
+	size_t firstVertex = 1;
+	for (const ExportedMesh& exported : meshes)
+	{
+		const SimplifiedMesh& mesh = exported.mesh;
+		addLine(snprintf(line, sizeof(line), "o %s\n", exported.name.c_str()));
+		for (const glm::vec3& position : mesh.positions)
+		{
+			addLine(snprintf(line, sizeof(line), "v %.6g %.6g %.6g\n", position.x, position.y, position.z));
+		}
+		for (const glm::vec3& normal : mesh.normals)
+		{
+			addLine(snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", normal.x, normal.y, normal.z));
+		}
+		for (size_t i = 0; i < mesh.indices.size(); i += 3)
+		{
+			size_t a = firstVertex + mesh.indices[i];
+			size_t b = firstVertex + mesh.indices[i + 1];
+			size_t c = firstVertex + mesh.indices[i + 2];
+			addLine(snprintf(line, sizeof(line), "f %zu//%zu %zu//%zu %zu//%zu\n", a, a, b, b, c, c));
+		}
+		firstVertex += mesh.positions.size();
+	}
+	file.write(text.data(), text.size());
+
+	if (!file)
+	{
+		printf("Failed to write the mesh to %s\n", filePath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// one binary chunk holds the positions, normals and indices of every mesh, one after the other
+static bool writeGltfBinary(const std::string& filePath, const std::vector<ExportedMesh>& meshes)
+{
+	std::vector<uint8_t> binary;
+	auto appendData = [&](const void* data, size_t size)
+	{
+		size_t offset = binary.size();
+		binary.insert(binary.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+		binary.resize((binary.size() + 3) & ~(size_t)3, 0);
+		return offset;
+	};
+
+	std::string nodes, gltfMeshes, materials, bufferViews, accessors;
+	int accessorCount = 0;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		const SimplifiedMesh& mesh = meshes[m].mesh;
+		const float* color = meshes[m].color;
+		std::string separator = m == 0 ? "" : ",";
+
+		glm::vec3 minPosition = glm::vec3(INFINITY);
+		glm::vec3 maxPosition = glm::vec3(-INFINITY);
+		for (const glm::vec3& position : mesh.positions)
+		{
+			minPosition = glm::min(minPosition, position);
+			maxPosition = glm::max(maxPosition, position);
+		}
+
+		size_t positionsOffset = appendData(mesh.positions.data(), sizeof(mesh.positions[0]) * mesh.positions.size());
+		size_t normalsOffset = appendData(mesh.normals.data(), sizeof(mesh.normals[0]) * mesh.normals.size());
+		size_t indicesOffset = appendData(mesh.indices.data(), sizeof(mesh.indices[0]) * mesh.indices.size());
+
+		bufferViews += separator +
+			"{\"buffer\":0,\"byteOffset\":" + std::to_string(positionsOffset) + ",\"byteLength\":" + std::to_string(sizeof(mesh.positions[0]) * mesh.positions.size()) + ",\"target\":34962}," +
+			"{\"buffer\":0,\"byteOffset\":" + std::to_string(normalsOffset) + ",\"byteLength\":" + std::to_string(sizeof(mesh.normals[0]) * mesh.normals.size()) + ",\"target\":34962}," +
+			"{\"buffer\":0,\"byteOffset\":" + std::to_string(indicesOffset) + ",\"byteLength\":" + std::to_string(sizeof(mesh.indices[0]) * mesh.indices.size()) + ",\"target\":34963}";
+
+		int positions = accessorCount;
+		accessors += separator +
+			"{\"bufferView\":" + std::to_string(positions) + ",\"componentType\":5126,\"count\":" + std::to_string(mesh.positions.size()) + ",\"type\":\"VEC3\"," +
+			"\"min\":[" + formatFloat(minPosition.x) + "," + formatFloat(minPosition.y) + "," + formatFloat(minPosition.z) + "]," +
+			"\"max\":[" + formatFloat(maxPosition.x) + "," + formatFloat(maxPosition.y) + "," + formatFloat(maxPosition.z) + "]}," +
+			"{\"bufferView\":" + std::to_string(positions + 1) + ",\"componentType\":5126,\"count\":" + std::to_string(mesh.normals.size()) + ",\"type\":\"VEC3\"}," +
+			"{\"bufferView\":" + std::to_string(positions + 2) + ",\"componentType\":5125,\"count\":" + std::to_string(mesh.indices.size()) + ",\"type\":\"SCALAR\"}";
+		accessorCount += 3;
+
+		nodes += separator + "{\"mesh\":" + std::to_string(m) + ",\"name\":\"" + meshes[m].name + "\"}";
+		gltfMeshes += separator + "{\"name\":\"" + meshes[m].name + "\",\"primitives\":[{\"attributes\":{\"POSITION\":" + std::to_string(positions) +
+			",\"NORMAL\":" + std::to_string(positions + 1) + "},\"indices\":" + std::to_string(positions + 2) + ",\"material\":" + std::to_string(m) + "}]}";
+		materials += separator + "{\"name\":\"" + meshes[m].name + "\",\"pbrMetallicRoughness\":{\"baseColorFactor\":[" +
+			formatFloat(color[0]) + "," + formatFloat(color[1]) + "," + formatFloat(color[2]) + "," + formatFloat(color[3]) + "],\"metallicFactor\":0,\"roughnessFactor\":1}" +
+			(color[3] < 1.0f ? ",\"alphaMode\":\"BLEND\"" : "") + "}";
+	}
+
+	std::string sceneNodes;
+	for (size_t m = 0; m < meshes.size(); m++)
+	{
+		sceneNodes += (m == 0 ? "" : ",") + std::to_string(m);
+	}
+
+	std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"erosion_simulator\"},\"scene\":0,\"scenes\":[{\"nodes\":[" + sceneNodes + "]}]," +
+		"\"nodes\":[" + nodes + "],\"meshes\":[" + gltfMeshes + "],\"materials\":[" + materials + "]," +
+		"\"buffers\":[{\"byteLength\":" + std::to_string(binary.size()) + "}],\"bufferViews\":[" + bufferViews + "],\"accessors\":[" + accessors + "]}";
+	// chunks are padded to four bytes, the json with spaces
+	json.resize((json.size() + 3) & ~(size_t)3, ' ');
+
+	uint32_t jsonLength = (uint32_t)json.size();
+	uint32_t binaryLength = (uint32_t)binary.size();
+	uint32_t header[3] = { 0x46546C67, 2, 12 + 8 + jsonLength + 8 + binaryLength };
+	uint32_t jsonHeader[2] = { jsonLength, 0x4E4F534A };
+	uint32_t binaryHeader[2] = { binaryLength, 0x004E4942 };
+
+	std::ofstream file(filePath, std::ios_base::out | std::ios_base::binary);
+	if (!file)
+	{
+		printf("Failed to write the mesh to %s\n", filePath.c_str());
+		return false;
+	}
+	file.write((const char*)header, sizeof(header));
+	file.write((const char*)jsonHeader, sizeof(jsonHeader));
+	file.write(json.data(), json.size());
+	file.write((const char*)binaryHeader, sizeof(binaryHeader));
+	file.write((const char*)binary.data(), binary.size());
+
+	if (!file)
+	{
+		printf("Failed to write the mesh to %s\n", filePath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// grid coordinates to the viewer's, centered on the origin
+static void toWorldPositions(SimplifiedMesh& mesh, int width, int length)
+{
+	for (glm::vec3& position : mesh.positions)
+	{
+		position.x -= width / 2;
+		position.z -= length / 2;
+	}
+}
+
+bool exportTerrainMesh(const std::string& filePath, MeshExportFormat format, float** terrainHeights, float** waterHeights, int width, int length, float maxError, MeshExportStats* stats)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::vector<ExportedMesh> meshes;
+	meshes.push_back(ExportedMesh{ "terrain", simplifyHeightfield(terrainHeights, width, length, maxError), { 0.45f, 0.4f, 0.3f, 1.0f } });
+
+	if (waterHeights)
+	{
+		// the surface is simplified as a whole, only the triangles the viewer would draw are kept
+		std::vector<float> surfacePlane(width * length);
+		std::vector<uint8_t> wetPlane(width * length);
+		std::vector<float*> surfaceColumns(width);
+		std::vector<uint8_t*> wetColumns(width);
+		for (int x = 0; x < width; x++)
+		{
+			surfaceColumns[x] = &surfacePlane[x * length];
+			wetColumns[x] = &wetPlane[x * length];
+			for (int y = 0; y < length; y++)
+			{
+				surfaceColumns[x][y] = terrainHeights[x][y] + waterHeights[x][y];
+				wetColumns[x][y] = waterHeights[x][y] >= MIN_VISIBLE_WATER_HEIGHT;
+			}
+		}
+
+		ExportedMesh water{ "water", simplifyHeightfield(surfaceColumns.data(), width, length, maxError, wetColumns.data()), { 0.1f, 0.3f, 0.6f, 0.7f } };
+		if (!water.mesh.indices.empty())
+			meshes.push_back(std::move(water));
+	}
+
+	int triangleCount = 0;
+	for (ExportedMesh& exported : meshes)
+	{
+		toWorldPositions(exported.mesh, width, length);
+		triangleCount += (int)exported.mesh.indices.size() / 3;
+	}
+
+	bool written = format == MeshExportFormat::OBJ ? writeObj(filePath, meshes) : writeGltfBinary(filePath, meshes);
+	if (stats)
+	{
+		stats->triangleCount = triangleCount;
+		stats->seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+	return written;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+
+enum class MeshExportFormat
+{
+	GLTF_BINARY,
+	OBJ,
+};
+
+struct MeshExportStats
+{
+	int triangleCount = 0;
+	float seconds = 0.0f;
+};
+
+// .glb or .obj, from the end of filePath
+MeshExportFormat getMeshExportFormat(const std::string& filePath);
+// simplifies the terrain, and the water surface if waterHeights is given, to within maxError and
+// writes both to one file. fields are columns [x][y], positions match the meshes in the viewer.
+// false if the file could not be written
+bool exportTerrainMesh(const std::string& filePath, MeshExportFormat format, float** terrainHeights, float** waterHeights, int width, int length, float maxError, MeshExportStats* stats = nullptr);
@@ -1,9 +0,0 @@
-
-#include <fstream>
-#include <cstdio>
-#include <vector>
-#include <string>
-
-int save_ppm(std::string file_name, const std::vector<double>& buffer, int dimx, int dimy);
-
-int test_save_ppm();
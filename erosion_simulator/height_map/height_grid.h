@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// heights in a single plane, columns [x][y] one after another like the model keeps them
+struct HeightGrid
+{
+	int width = 0;
+	int length = 0;
+	std::vector<float> plane;
+	std::vector<float*> columns;
+
+	void resize(int width, int length)
+	{
+		this->width = width;
+		this->length = length;
+		plane.assign((size_t)width * length, 0.0f);
+		columns.resize(width);
+		for (int x = 0; x < width; x++)
+		{
+			columns[x] = plane.data() + (size_t)x * length;
+		}
+	}
+};
@@ -1,20 +1,15 @@
 #include "height_map.h"
-#include "external/simpleppm.h"
-
+#include "io/dem_file.h"
+#include "io/obj_height_file.h"
+#include "io/raw_height_file.h"
+
+#include <algorithm>
+#include <execution>
+#include <filesystem>
+#include <numeric>
 #include <vector>
 #include <iostream>
 
-#include "external/stb_image.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "external/tiny_obj_loader.h"
-
-#include <glm/glm.hpp>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
-
-#include <unordered_map>
-
 
 HeightMap::HeightMap(double minHeight, double maxHeight)
 	:minHeight(minHeight), maxHeight(maxHeight)
@@ -34,99 +29,64 @@ void HeightMap::createProceduralHeightMap(int size, double random)
 
 void HeightMap::loadHeightMapFromFile(std::string fileName)
 {
-	int width, height, channels;
-	unsigned char* img = stbi_load(fileName.c_str(), &width, &height, &channels, 1);
-	if (img == NULL) {
-		throw "Error reading the image";
+	std::string extension = std::filesystem::path(fileName).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == ".r32" || extension == ".raw" || extension == ".npy")
+	{
+		loadHeightMapFromRawFile(fileName);
+		return;
 	}
-	printf("loaded heigthmap from file");
-
-	this->width = width;
-	this->length = height;
 
-	heightMap = new double* [width];
-	for (int i = 0; i < width; i++) {
-		heightMap[i] = new double[height];
-	}
+	// images and GeoTIFF DEMs are decoded into the float grid, cropped and resampled on the way
+	std::shared_ptr<HeightGrid> imported = std::make_shared<HeightGrid>();
+	if (!importDem(fileName, importOptions, (float)maxHeight, *imported))
+		throw "Error reading the image";
+	printf("loaded heigthmap from file, %d x %d\n", imported->width, imported->length);
 
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			const stbi_uc* p = img + (y * height + x);
-			
-			float h = p[0] / 255.0f * maxHeight;
-			heightMap[x][y] = h;
-		}
-	}
+	grid = imported;
+	this->width = grid->width;
+	this->length = grid->length;
+}
 
-	stbi_image_free(img);
+void HeightMap::loadHeightMapFromRawFile(std::string fileName)
+{
+	// converted straight from the mapped pages in one pass, the file is unmapped again once it is
+	// in the grid. the grid keeps its own copy in columns, which the pristine reset copies from
+	// and the mesh uploads as is, where the file holds rows, possibly big endian, half or scaled
+	RawHeightFile file;
+	if (!file.open(fileName))
+		throw "Error reading the raw height file";
+	printf("mapped raw heightmap %s, %d x %d\n", fileName.c_str(), file.getWidth(), file.getLength());
+
+	grid = std::make_shared<HeightGrid>();
+	grid->resize(file.getWidth(), file.getLength());
+	file.convert(grid->columns.data());
+	this->width = grid->width;
+	this->length = grid->length;
 }
 
 void HeightMap::loadHeightMapFromOBJFile(std::string fileName, float heightDiff)
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
-
-	std::vector<glm::vec3> vertices;
-	std::vector<uint32_t> indices;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, fileName.c_str())) {
-		throw std::runtime_error(warn + err);
-	}
-
-	std::unordered_map<glm::vec3, int> uniqueVertices{};
-
-	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
-			glm::vec3 vertex{};
-
-			if (index.vertex_index >= 0) {
-				vertex = {
-					attrib.vertices[3 * index.vertex_index + 0],
-					attrib.vertices[3 * index.vertex_index + 1],
-					attrib.vertices[3 * index.vertex_index + 2],
-				};
-			}
-
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(vertex);
-			}
-
-			indices.push_back(uniqueVertices[vertex]);
-		}
-	}
-
-	int width = 0;
-	int length = 0;
-
-	float Xval = vertices[0].x;
-	float Zval = vertices[0].z;
-
-	for (auto vert : vertices)
+	std::shared_ptr<HeightGrid> imported = std::make_shared<HeightGrid>();
+	if (!importObjHeightfield(fileName, *imported))
+		throw "Error reading the obj heightfield";
+	printf("loaded heightmap from obj, %d x %d\n", imported->width, imported->length);
+
+	grid = imported;
+	this->width = grid->width;
+	this->length = grid->length;
+
+	// the vertices are scaled down by 256, heightDiff tilts the terrain by that much along x
+	std::vector<int> xs(width);
+	std::iota(xs.begin(), xs.end(), 0);
+	std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
 	{
-		if (vert.x == Xval) width++;
-		if (vert.z == Zval) length++;
-	}
-
-	this->width = width;
-	this->length = length;
-
-	heightMap = new double* [width];
-	for (int i = 0; i < width; i++) {
-		heightMap[i] = new double[length];
-	}
-
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
+		float tilt = (float)x / (width / heightDiff);
+		for (int y = 0; y < length; y++)
 		{
-			heightMap[x][y] = vertices[y * width + x].y * 256.0 + (float)x / (width / heightDiff);
+			grid->columns[x][y] = grid->columns[x][y] * 256.0f + tilt;
 		}
-	}
+	});
 }
 
 void HeightMap::setHeightRange(double minHeight, double maxHeight)
@@ -146,8 +106,8 @@ void HeightMap::printMap()
 {
 	for (int y = 0; y < length; y++) {
 		for (int x = 0; x < width; x++) {
-			if (heightMap[x][y] > 0)
-				std::cout << heightMap[x][y] << " ";
+			if (samplePoint(x, y) > 0)
+				std::cout << samplePoint(x, y) << " ";
 			else
 				std::cout << "." << " ";
 		}
@@ -156,40 +116,6 @@ void HeightMap::printMap()
 	}
 }
 
-void HeightMap::saveHeightMapPPM(std::string fileName)
-{
-	std::vector<double> buffer(3 * width * length);
-
-	for (int y = 0; y < length; y++) {
-		for (int x = 0; x < width; x++) {
-			double color = getRGBA(x, y);
-			buffer[3 * y * width + 3 * x + 0] = color;
-			buffer[3 * y * width + 3 * x + 1] = color;
-			buffer[3 * y * width + 3 * x + 2] = color;
-		}
-	}
-
-	save_ppm(fileName +".ppm", buffer, width, length);
-	buffer.clear();
-}
-
-void HeightMap::saveHeightMapPPM(std::string fileName, float*** hmp)
-{
-	std::vector<double> buffer(3 * width * length);
-
-	for (int y = 0; y < length; y++) {
-		for (int x = 0; x < width; x++) {
-			double color = std::clamp((double)(*hmp[x][y] + minHeight) / (double)(maxHeight + minHeight), 0.0, 1.0);
-			buffer[3 * y * width + 3 * x + 0] = color;
-			buffer[3 * y * width + 3 * x + 1] = color;
-			buffer[3 * y * width + 3 * x + 2] = color;
-		}
-	}
-
-	save_ppm(fileName + ".ppm", buffer, width, length);
-	buffer.clear();
-}
-
 void HeightMap::generateHeightMap()
 {
 	if (width != length)
@@ -219,6 +145,20 @@ void HeightMap::generateHeightMap()
 		randomDistr = std::uniform_real_distribution<>(-roughness, roughness);
 	}
 
+	updateGridFromHeightMap();
+}
+
+void HeightMap::updateGridFromHeightMap()
+{
+	std::shared_ptr<HeightGrid> generated = std::make_shared<HeightGrid>();
+	generated->resize(width, length);
+	std::vector<int> xs(width);
+	std::iota(xs.begin(), xs.end(), 0);
+	std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
+	{
+		std::copy(heightMap[x], heightMap[x] + length, generated->columns[x]);
+	});
+	grid = generated;
 }
 
 void HeightMap::regenerateHeightMap()
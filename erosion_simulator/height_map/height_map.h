@@ -1,4 +1,7 @@
 #pragma once
+#include "height_map/height_grid.h"
+#include "io/dem_file.h"
+#include <memory>
 #include <random>
 #include <string>
 
@@ -7,7 +10,13 @@ class HeightMap
 public:
 	HeightMap(double minHeight, double maxHeight);
 	void createProceduralHeightMap(int size, double random);
+	// .r32, .raw and .npy files are read as raw heights, .tif and .tiff as GeoTIFF DEMs,
+	// anything else is decoded as an 8 or 16 bit image. DEMs and images take the import options
 	void loadHeightMapFromFile(std::string);
+	void setImportOptions(DemImportOptions options) { importOptions = options; }
+	// the file is mapped only while it is converted into the float grid, then unmapped
+	void loadHeightMapFromRawFile(std::string);
+	// an obj of vertices on a regular x, z grid, streamed into the float grid without its faces
 	void loadHeightMapFromOBJFile(std::string, float heightDiff);
 	void setHeightRange(double minHeight, double maxHeight);
 	void setRandomRange(double random);
@@ -16,10 +25,11 @@ public:
 	int getLength() { return length; }
 	void printMap();
 	void changeSeed() {mapGenerator.seed(seedDistr(seedGenerator)); regenerateHeightMap(); }
-	void saveHeightMapPPM(std::string fileName);
-	void saveHeightMapPPM(std::string fileName, float*** hmp);
-	double samplePoint(int x, int y) { return heightMap[x][y]; }
-	double getRGBA(int x, int y) { return std::clamp((double)heightMap[x][y] + minHeight / (double)maxHeight + minHeight, 0.0, 1.0); }
+	double samplePoint(int x, int y) { return grid->columns[x][y]; }
+	// the heights of every kind of map as floats. a new grid is made whenever the map changes,
+	// so one handed out is never written to again and can be shared
+	std::shared_ptr<const HeightGrid> getGrid() const { return grid; }
+	double getRGBA(int x, int y) { return std::clamp(samplePoint(x, y) + minHeight / (double)maxHeight + minHeight, 0.0, 1.0); }
 	int getMaxHeight() { return maxHeight; }
 
 
@@ -30,7 +40,12 @@ private:
 	void squareStep(int chunkSize, int halfChunkSize);
 	void diamondStep(int chunkSize, int halfChunkSize);
 
-	double** heightMap;
+	// procedural maps are generated in doubles, then converted into the grid
+	void updateGridFromHeightMap();
+
+	double** heightMap = nullptr;
+	std::shared_ptr<HeightGrid> grid;
+	DemImportOptions importOptions;
 
 	int width;
 	int length;
@@ -0,0 +1,586 @@
+#include "dem_file.h"
+#include "io/height_map_writer.h"
+#include "io/mapped_file.h"
+#include "external/stb_image.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <vector>
+
+// fewest source rows read at once, so every band has enough tiles to decode in parallel
+const int DEM_BAND_ROWS = 256;
+
+enum TiffTag
+{
+	TIFF_IMAGE_WIDTH = 256,
+	TIFF_IMAGE_LENGTH = 257,
+	TIFF_BITS_PER_SAMPLE = 258,
+	TIFF_COMPRESSION = 259,
+	TIFF_STRIP_OFFSETS = 273,
+	TIFF_SAMPLES_PER_PIXEL = 277,
+	TIFF_ROWS_PER_STRIP = 278,
+	TIFF_STRIP_BYTE_COUNTS = 279,
+	TIFF_PLANAR_CONFIGURATION = 284,
+	TIFF_PREDICTOR = 317,
+	TIFF_TILE_WIDTH = 322,
+	TIFF_TILE_LENGTH = 323,
+	TIFF_TILE_OFFSETS = 324,
+	TIFF_TILE_BYTE_COUNTS = 325,
+	TIFF_SAMPLE_FORMAT = 339,
+	TIFF_GDAL_NODATA = 42113,
+};
+
+enum TiffCompression
+{
+	TIFF_UNCOMPRESSED = 1,
+	TIFF_DEFLATE = 8,
+	TIFF_OLD_DEFLATE = 32946,
+};
+
+enum TiffPredictor
+{
+	TIFF_NO_PREDICTOR = 1,
+	TIFF_HORIZONTAL_PREDICTOR = 2,
+	TIFF_FLOATING_POINT_PREDICTOR = 3,
+};
+
+enum TiffSampleFormat
+{
+	TIFF_UNSIGNED = 1,
+	TIFF_SIGNED = 2,
+	TIFF_FLOAT = 3,
+};
+
+// the rectangle of the source image that is imported
+struct DemCrop
+{
+	int x;
+	int y;
+	int width;
+	int length;
+};
+
+// reads source rows [firstRow, firstRow + rowCount) into rows, only the columns of the crop,
+// one row of crop width after the other
+using DemRowReader = std::function<bool(int firstRow, int rowCount, float* rows)>;
+
+// a classic (not Big) TIFF of one channel. strips are handled as tiles as wide as the image
+struct TiffImage
+{
+	MappedFile file;
+	bool isBigEndian = false;
+	int width = 0;
+	int length = 0;
+	int bitsPerSample = 0;
+	int sampleFormat = TIFF_UNSIGNED;
+	int compression = TIFF_UNCOMPRESSED;
+	int predictor = TIFF_NO_PREDICTOR;
+	int blockWidth = 0;
+	int blockLength = 0;
+	int blocksAcross = 0;
+	bool isStripped = false;
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> byteCounts;
+	bool hasNoData = false;
+	float noData = 0.0f;
+
+	uint32_t read16(size_t offset) const;
+	uint32_t read32(size_t offset) const;
+	bool open(const std::string& filePath);
+	bool readEntry(size_t entry, std::vector<uint64_t>& values) const;
+	// decodes block into the rows of the band that fall in it
+	bool decodeBlock(int block, const DemCrop& crop, int bandStart, int bandEnd, float* rows) const;
+};
+
+uint32_t TiffImage::read16(size_t offset) const
+{
+	if (offset + 2 > file.getSize()) return 0;
+	const uint8_t* p = file.getData() + offset;
+	return isBigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+uint32_t TiffImage::read32(size_t offset) const
+{
+	if (offset + 4 > file.getSize()) return 0;
+	const uint8_t* p = file.getData() + offset;
+	return isBigEndian ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] : p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// reads the values of an entry of byte, short or long type, wherever they are stored
+bool TiffImage::readEntry(size_t entry, std::vector<uint64_t>& values) const
+{
+	uint32_t type = read16(entry + 2);
+	uint32_t count = read32(entry + 4);
+	size_t typeSize = type == 1 ? 1 : type == 3 ? 2 : type == 4 ? 4 : 0;
+	if (typeSize == 0) return false;
+
+	size_t offset = typeSize * count <= 4 ? entry + 8 : read32(entry + 8);
+	if (offset > file.getSize() || (file.getSize() - offset) / typeSize < count) return false;
+	values.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		size_t position = offset + i * typeSize;
+		values[i] = typeSize == 1 ? file.getData()[position] : typeSize == 2 ? read16(position) : read32(position);
+	}
+	return true;
+}
+
+bool TiffImage::open(const std::string& filePath)
+{
+	if (!file.open(filePath) || file.getSize() < 8)
+		return false;
+
+	const uint8_t* data = file.getData();
+	if (data[0] == 'I' && data[1] == 'I')
+		isBigEndian = false;
+	else if (data[0] == 'M' && data[1] == 'M')
+		isBigEndian = true;
+	else
+		return false;
+	if (read16(2) != 42)
+	{
+		printf("%s is not a classic TIFF, BigTIFF is not supported\n", filePath.c_str());
+		return false;
+	}
+
+	// only the first image of the file is read
+	size_t directory = read32(4);
+	uint32_t entryCount = read16(directory);
+	if (directory + 2 + (size_t)entryCount * 12 > file.getSize())
+		return false;
+
+	int samplesPerPixel = 1;
+	int planarConfiguration = 1;
+	int rowsPerStrip = 0;
+	std::vector<uint64_t> stripOffsets, stripByteCounts;
+	for (uint32_t i = 0; i < entryCount; i++)
+	{
+		size_t entry = directory + 2 + (size_t)i * 12;
+		uint32_t tag = read16(entry);
+		std::vector<uint64_t> values;
+
+		if (tag == TIFF_GDAL_NODATA)
+		{
+			// written as text
+			uint32_t count = read32(entry + 4);
+			size_t offset = count <= 4 ? entry + 8 : read32(entry + 8);
+			if (offset > file.getSize() || file.getSize() - offset < count) continue;
+			std::string text((const char*)data + offset, count);
+			hasNoData = !text.empty() && text[0] != '\0';
+			noData = hasNoData ? std::strtof(text.c_str(), nullptr) : 0.0f;
+			continue;
+		}
+		if (!readEntry(entry, values) || values.empty()) continue;
+
+		switch (tag)
+		{
+		case TIFF_IMAGE_WIDTH: width = (int)values[0]; break;
+		case TIFF_IMAGE_LENGTH: length = (int)values[0]; break;
+		case TIFF_BITS_PER_SAMPLE: bitsPerSample = (int)values[0]; break;
+		case TIFF_COMPRESSION: compression = (int)values[0]; break;
+		case TIFF_SAMPLES_PER_PIXEL: samplesPerPixel = (int)values[0]; break;
+		case TIFF_ROWS_PER_STRIP: rowsPerStrip = (int)values[0]; break;
+		case TIFF_PLANAR_CONFIGURATION: planarConfiguration = (int)values[0]; break;
+		case TIFF_PREDICTOR: predictor = (int)values[0]; break;
+		case TIFF_TILE_WIDTH: blockWidth = (int)values[0]; break;
+		case TIFF_TILE_LENGTH: blockLength = (int)values[0]; break;
+		case TIFF_SAMPLE_FORMAT: sampleFormat = (int)values[0]; break;
+		case TIFF_TILE_OFFSETS: offsets = std::move(values); break;
+		case TIFF_TILE_BYTE_COUNTS: byteCounts = std::move(values); break;
+		case TIFF_STRIP_OFFSETS: stripOffsets = std::move(values); break;
+		case TIFF_STRIP_BYTE_COUNTS: stripByteCounts = std::move(values); break;
+		}
+	}
+
+	if (offsets.empty())
+	{
+		isStripped = true;
+		blockWidth = width;
+		blockLength = rowsPerStrip > 0 ? std::min(rowsPerStrip, length) : length;
+		offsets = std::move(stripOffsets);
+		byteCounts = std::move(stripByteCounts);
+	}
+
+	if (samplesPerPixel != 1 || planarConfiguration != 1)
+	{
+		printf("%s has %d channels, a DEM can only have one\n", filePath.c_str(), samplesPerPixel);
+		return false;
+	}
+	if (compression != TIFF_UNCOMPRESSED && compression != TIFF_DEFLATE && compression != TIFF_OLD_DEFLATE)
+	{
+		printf("%s uses compression %d, only uncompressed and deflate are supported\n", filePath.c_str(), compression);
+		return false;
+	}
+	bool integer = (sampleFormat == TIFF_UNSIGNED || sampleFormat == TIFF_SIGNED) && (bitsPerSample == 8 || bitsPerSample == 16 || bitsPerSample == 32);
+	if (!integer && !(sampleFormat == TIFF_FLOAT && bitsPerSample == 32))
+	{
+		printf("%s holds %d bit samples of format %d, which are not supported\n", filePath.c_str(), bitsPerSample, sampleFormat);
+		return false;
+	}
+	if (predictor == TIFF_FLOATING_POINT_PREDICTOR && sampleFormat != TIFF_FLOAT)
+		return false;
+	if (width < 2 || length < 2 || blockWidth < 1 || blockLength < 1)
+		return false;
+
+	blocksAcross = (width + blockWidth - 1) / blockWidth;
+	size_t blockCount = (size_t)blocksAcross * ((length + blockLength - 1) / blockLength);
+	return offsets.size() >= blockCount && byteCounts.size() >= blockCount;
+}
+
+bool TiffImage::decodeBlock(int block, const DemCrop& crop, int bandStart, int bandEnd, float* rows) const
+{
+	int blockX = block % blocksAcross * blockWidth;
+	int blockY = block / blocksAcross * blockLength;
+	// tiles are padded to their full size, the last strip only holds the rows left
+	int storedRows = isStripped ? std::min(blockLength, length - blockY) : blockLength;
+	int sampleSize = bitsPerSample / 8;
+	size_t rowSize = (size_t)blockWidth * sampleSize;
+	size_t blockSize = rowSize * storedRows;
+
+	uint64_t offset = offsets[block];
+	uint64_t byteCount = byteCounts[block];
+	if (offset > file.getSize() || byteCount > file.getSize() - offset)
+		return false;
+	const uint8_t* source = file.getData() + offset;
+
+	// every thread keeps its buffers from one block to the next
+	thread_local std::vector<uint8_t> decoded;
+	thread_local std::vector<uint8_t> unshuffled;
+	const uint8_t* samples = source;
+	if (compression != TIFF_UNCOMPRESSED || predictor == TIFF_FLOATING_POINT_PREDICTOR)
+	{
+		decoded.resize(blockSize);
+		if (compression == TIFF_UNCOMPRESSED)
+		{
+			if (byteCount < blockSize) return false;
+			std::memcpy(decoded.data(), source, blockSize);
+		}
+		else if (stbi_zlib_decode_buffer((char*)decoded.data(), (int)blockSize, (const char*)source, (int)byteCount) != (int)blockSize)
+		{
+			return false;
+		}
+		samples = decoded.data();
+	}
+	else if (byteCount < blockSize)
+	{
+		return false;
+	}
+
+	int firstRow = std::max({ blockY, bandStart, crop.y });
+	int lastRow = std::min({ blockY + storedRows, bandEnd, crop.y + crop.length });
+	int firstColumn = std::max(blockX, crop.x);
+	int lastColumn = std::min({ blockX + blockWidth, width, crop.x + crop.width });
+	uint32_t mask = bitsPerSample == 32 ? 0xffffffffu : (1u << bitsPerSample) - 1;
+
+	for (int y = firstRow; y < lastRow; y++)
+	{
+		const uint8_t* row = samples + (size_t)(y - blockY) * rowSize;
+		float* target = rows + (size_t)(y - bandStart) * crop.width - crop.x;
+
+		// the floating point predictor splits the bytes of a row into planes, most significant
+		// first, and differences them. after undoing it the samples are big endian
+		bool bigEndianSamples = isBigEndian;
+		if (predictor == TIFF_FLOATING_POINT_PREDICTOR)
+		{
+			uint8_t* bytes = decoded.data() + (size_t)(y - blockY) * rowSize;
+			for (size_t i = 1; i < rowSize; i++)
+			{
+				bytes[i] += bytes[i - 1];
+			}
+			unshuffled.resize(rowSize);
+			for (int i = 0; i < blockWidth; i++)
+			{
+				for (int b = 0; b < sampleSize; b++)
+				{
+					unshuffled[(size_t)i * sampleSize + b] = bytes[(size_t)b * blockWidth + i];
+				}
+			}
+			row = unshuffled.data();
+			bigEndianSamples = true;
+		}
+
+		// the horizontal predictor stores differences, so the row is summed up from its first sample
+		int start = predictor == TIFF_HORIZONTAL_PREDICTOR ? blockX : firstColumn;
+		uint32_t previous = 0;
+		for (int x = start; x < lastColumn; x++)
+		{
+			const uint8_t* p = row + (size_t)(x - blockX) * sampleSize;
+			uint32_t bits;
+			if (sampleSize == 1)
+				bits = p[0];
+			else if (sampleSize == 2)
+				bits = bigEndianSamples ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+			else
+				bits = bigEndianSamples ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] : p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+			if (predictor == TIFF_HORIZONTAL_PREDICTOR)
+			{
+				bits = (bits + previous) & mask;
+				previous = bits;
+			}
+			if (x < firstColumn) continue;
+
+			float height;
+			if (sampleFormat == TIFF_FLOAT)
+				std::memcpy(&height, &bits, sizeof(height));
+			else if (sampleFormat == TIFF_SIGNED)
+				height = (float)(sampleSize == 1 ? (int8_t)bits : sampleSize == 2 ? (int16_t)bits : (int32_t)bits);
+			else
+				height = (float)bits;
+			if (hasNoData && height == noData)
+				height = 0.0f;
+			target[x] = height;
+		}
+	}
+	return true;
+}
+
+// reads the crop band after band, and fills grid as soon as the rows its cells fall between are in.
+// bands start on multiples of bandRows. cells are placed corner to corner on the crop
+static bool resampleInto(const DemCrop& crop, int bandRows, const DemRowReader& read, HeightGrid& grid)
+{
+	auto getSource = [](int i, int target, int source) { return target > 1 ? (double)i * (source - 1) / (target - 1) : 0.0; };
+
+	std::vector<int> columns0(grid.width);
+	std::vector<int> columns1(grid.width);
+	std::vector<float> columnWeights(grid.width);
+	for (int x = 0; x < grid.width; x++)
+	{
+		double sourceX = getSource(x, grid.width, crop.width);
+		columns0[x] = std::min((int)sourceX, crop.width - 1);
+		columns1[x] = std::min(columns0[x] + 1, crop.width - 1);
+		columnWeights[x] = (float)(sourceX - columns0[x]);
+	}
+
+	// the last row of the band before comes first, the rows of the band after it
+	std::vector<float> band((size_t)(bandRows + 1) * crop.width);
+	std::vector<int> outputRows;
+	int nextRow = 0;
+	int cropEnd = crop.y + crop.length;
+	for (int bandStart = crop.y; bandStart < cropEnd;)
+	{
+		int bandEnd = std::min(cropEnd, (bandStart / bandRows + 1) * bandRows);
+		if (!read(bandStart, bandEnd - bandStart, band.data() + crop.width))
+			return false;
+		auto getRow = [&](int cropRow) { return band.data() + (size_t)(crop.y + cropRow - bandStart + 1) * crop.width; };
+
+		outputRows.clear();
+		while (nextRow < grid.length)
+		{
+			int row1 = std::min((int)getSource(nextRow, grid.length, crop.length) + 1, crop.length - 1);
+			if (crop.y + row1 >= bandEnd) break;
+			outputRows.push_back(nextRow++);
+		}
+
+		std::for_each(std::execution::par, outputRows.begin(), outputRows.end(), [&](int y)
+		{
+			double sourceY = getSource(y, grid.length, crop.length);
+			int row0 = std::min((int)sourceY, crop.length - 1);
+			float rowWeight = (float)(sourceY - row0);
+			const float* heights0 = getRow(row0);
+			const float* heights1 = getRow(std::min(row0 + 1, crop.length - 1));
+			for (int x = 0; x < grid.width; x++)
+			{
+				float height = heights0[columns0[x]];
+				if (columnWeights[x] != 0.0f)
+					height += (heights0[columns1[x]] - height) * columnWeights[x];
+				if (rowWeight != 0.0f)
+				{
+					float height1 = heights1[columns0[x]];
+					if (columnWeights[x] != 0.0f)
+						height1 += (heights1[columns1[x]] - height1) * columnWeights[x];
+					height += (height1 - height) * rowWeight;
+				}
+				grid.columns[x][y] = height;
+			}
+		});
+
+		std::copy(band.data() + (size_t)(bandEnd - bandStart) * crop.width, band.data() + (size_t)(bandEnd - bandStart + 1) * crop.width, band.begin());
+		bandStart = bandEnd;
+	}
+	return nextRow == grid.length;
+}
+
+// clamps the crop to the image and fills in the sizes left at zero
+static bool prepareGrid(const DemImportOptions& options, int width, int length, DemCrop& crop, HeightGrid& grid)
+{
+	crop.x = std::clamp(options.cropX, 0, width - 1);
+	crop.y = std::clamp(options.cropY, 0, length - 1);
+	crop.width = options.cropWidth > 0 ? std::min(options.cropWidth, width - crop.x) : width - crop.x;
+	crop.length = options.cropLength > 0 ? std::min(options.cropLength, length - crop.y) : length - crop.y;
+	int targetWidth = options.targetWidth > 0 ? options.targetWidth : crop.width;
+	int targetLength = options.targetLength > 0 ? options.targetLength : crop.length;
+	if (crop.width < 2 || crop.length < 2 || targetWidth < 2 || targetLength < 2)
+	{
+		printf("The crop of %d x %d and the target of %d x %d have to be at least 2 x 2\n", crop.width, crop.length, targetWidth, targetLength);
+		return false;
+	}
+	grid.resize(targetWidth, targetLength);
+	return true;
+}
+
+static bool importTiff(const std::string& filePath, const DemImportOptions& options, HeightGrid& grid)
+{
+	TiffImage image;
+	if (!image.open(filePath))
+	{
+		printf("Failed to read %s as a GeoTIFF\n", filePath.c_str());
+		return false;
+	}
+
+	DemCrop crop;
+	if (!prepareGrid(options, image.width, image.length, crop, grid))
+		return false;
+
+	// bands hold whole rows of blocks, so every block is decoded once
+	int bandRows = (DEM_BAND_ROWS + image.blockLength - 1) / image.blockLength * image.blockLength;
+	int firstBlockX = crop.x / image.blockWidth;
+	int lastBlockX = (crop.x + crop.width - 1) / image.blockWidth;
+	std::vector<int> blocks;
+	return resampleInto(crop, bandRows, [&](int firstRow, int rowCount, float* rows)
+	{
+		blocks.clear();
+		for (int blockY = firstRow / image.blockLength; blockY <= (firstRow + rowCount - 1) / image.blockLength; blockY++)
+		{
+			for (int blockX = firstBlockX; blockX <= lastBlockX; blockX++)
+			{
+				blocks.push_back(blockY * image.blocksAcross + blockX);
+			}
+		}
+
+		std::vector<uint8_t> decoded(blocks.size());
+		std::vector<int> indices(blocks.size());
+		std::iota(indices.begin(), indices.end(), 0);
+		std::for_each(std::execution::par, indices.begin(), indices.end(), [&](int i)
+		{
+			decoded[i] = image.decodeBlock(blocks[i], crop, firstRow, firstRow + rowCount, rows);
+		});
+		if (std::all_of(decoded.begin(), decoded.end(), [](uint8_t blockDecoded) { return blockDecoded != 0; }))
+			return true;
+		printf("Failed to decode rows %d to %d of %s\n", firstRow, firstRow + rowCount - 1, filePath.c_str());
+		return false;
+	}, grid);
+}
+
+// the range a 16 bit height map was written with, from its PGM comment or PNG text chunk.
+// false for images that do not record one
+static bool readHeightRange(const std::string& filePath, float& minHeight, float& maxHeight)
+{
+	std::ifstream file(filePath, std::ios_base::in | std::ios_base::binary);
+	char magic[8] = {};
+	if (!file.read(magic, 2))
+		return false;
+
+	std::string text;
+	if (magic[0] == 'P' && magic[1] == '5')
+	{
+		// comments can sit anywhere in the header, which ends after the width, length and maximum
+		int values = 0;
+		char c;
+		while (values < 3 && file.get(c))
+		{
+			if (c == '#')
+			{
+				std::string comment;
+				std::getline(file, comment);
+				if (comment.compare(0, std::strlen(HEIGHT_RANGE_KEYWORD) + 2, std::string(" ") + HEIGHT_RANGE_KEYWORD + " ") == 0)
+					text = comment.substr(std::strlen(HEIGHT_RANGE_KEYWORD) + 2);
+			}
+			else if (!std::isspace((unsigned char)c))
+			{
+				while (file.get(c) && !std::isspace((unsigned char)c) && c != '#');
+				values++;
+				if (c == '#') file.unget();
+			}
+		}
+	}
+	else if (file.read(magic + 2, 6) && std::memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0)
+	{
+		// the text chunks written before the image data
+		uint8_t header[8];
+		while (text.empty() && file.read((char*)header, sizeof(header)))
+		{
+			uint32_t size = ((uint32_t)header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+			if (std::memcmp(header + 4, "IDAT", 4) == 0 || std::memcmp(header + 4, "IEND", 4) == 0)
+				break;
+			if (std::memcmp(header + 4, "tEXt", 4) == 0 && size < 256)
+			{
+				std::string chunk(size, '\0');
+				if (!file.read(chunk.data(), size))
+					break;
+				if (chunk.compare(0, std::strlen(HEIGHT_RANGE_KEYWORD) + 1, HEIGHT_RANGE_KEYWORD, std::strlen(HEIGHT_RANGE_KEYWORD) + 1) == 0)
+					text = chunk.substr(std::strlen(HEIGHT_RANGE_KEYWORD) + 1);
+				file.seekg(4, std::ios_base::cur);
+			}
+			else
+			{
+				file.seekg((std::streamoff)size + 4, std::ios_base::cur);
+			}
+		}
+	}
+	return !text.empty() && std::sscanf(text.c_str(), "%f %f", &minHeight, &maxHeight) == 2;
+}
+
+// unlike GeoTIFF this is not banded: stbi_load_16 decodes the whole image before a row is resampled,
+// and a PNG is one zlib stream that its one shot inflater cannot stop part way through. while it
+// runs the file, the inflated scanlines and the 16 bit image are all held, about three times the
+// image's 16 bit size on top of the grid. large DEMs should come in as GeoTIFF or raw heights
+static bool importImage(const std::string& filePath, const DemImportOptions& options, float maxHeight, HeightGrid& grid)
+{
+	int width, length, channels;
+	stbi_us* image = stbi_load_16(filePath.c_str(), &width, &length, &channels, 1);
+	if (image == NULL)
+	{
+		printf("Failed to read %s: %s\n", filePath.c_str(), stbi_failure_reason());
+		return false;
+	}
+
+	DemCrop crop;
+	bool imported = prepareGrid(options, width, length, crop, grid);
+	// height maps this wrote say what range they span, any other image spans maxHeight.
+	// 8 bit images come out scaled up to 16 bits, so both span it the same way
+	float minHeight = 0.0f;
+	float scale = maxHeight / 65535.0f;
+	float recordedMax;
+	if (readHeightRange(filePath, minHeight, recordedMax))
+		scale = (recordedMax - minHeight) / 65535.0f;
+	else
+		minHeight = 0.0f;
+	// this stb_image hands 16 bit PGM samples back little endian, the format stores them big endian
+	std::string extension = std::filesystem::path(filePath).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	bool swapBytes = (extension == ".pgm" || extension == ".pnm") && stbi_is_16_bit(filePath.c_str());
+	imported = imported && resampleInto(crop, DEM_BAND_ROWS, [&](int firstRow, int rowCount, float* rows)
+	{
+		for (int y = 0; y < rowCount; y++)
+		{
+			const stbi_us* row = image + (size_t)(firstRow + y) * width + crop.x;
+			float* target = rows + (size_t)y * crop.width;
+			for (int x = 0; x < crop.width; x++)
+			{
+				stbi_us sample = swapBytes ? (stbi_us)((row[x] >> 8) | (row[x] << 8)) : row[x];
+				target[x] = minHeight + sample * scale;
+			}
+		}
+		return true;
+	}, grid);
+
+	stbi_image_free(image);
+	return imported;
+}
+
+bool importDem(const std::string& filePath, const DemImportOptions& options, float maxHeight, HeightGrid& grid)
+{
+	std::string extension = std::filesystem::path(filePath).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == ".tif" || extension == ".tiff")
+		return importTiff(filePath, options, grid);
+	return importImage(filePath, options, maxHeight, grid);
+}
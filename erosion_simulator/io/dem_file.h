@@ -0,0 +1,27 @@
+#pragma once
+#include "height_map/height_grid.h"
+#include <string>
+
+// part of a DEM to import and the size to resample it to. zero sizes take the whole
+// image, and the size of the crop
+struct DemImportOptions
+{
+	int cropX = 0;
+	int cropY = 0;
+	int cropWidth = 0;
+	int cropLength = 0;
+	int targetWidth = 0;
+	int targetLength = 0;
+};
+
+// loads a DEM into grid, cropped and, if the target size differs from the crop, resampled bilinearly.
+// .tif and .tiff are read as GeoTIFF: one channel of 8, 16 or 32 bit integers or 32 bit floats, in
+// strips or tiles, uncompressed or deflated. the file is mapped and streamed through in bands of
+// tiles decoded in parallel, so only the grid and one band are ever in memory. their heights are
+// kept as they are, except for the nodata value, which becomes 0.
+// every other image goes through stbi_load_16, so 16 bit PNGs keep their precision, but is decoded
+// whole rather than in bands, so it needs a few times its own size in memory while it loads. a PGM or PNG
+// height map written by writeHeightMap goes back to the range it recorded, any other image is
+// scaled so its full range spans maxHeight, like 8 bit height maps always were.
+// false if the file could not be read
+bool importDem(const std::string& filePath, const DemImportOptions& options, float maxHeight, HeightGrid& grid);
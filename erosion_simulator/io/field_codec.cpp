@@ -0,0 +1,594 @@
+#include "field_codec.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <numeric>
+
+// the stream is a header, the size of every encoded tile and component, and then those one
+// after another. a tile holds the codes of its cells in blocks of BLOCK_SIZE, each block one
+// byte telling how it is coded followed by the codes, and then the raw bits of cells that
+// did not fit the error bound. tiles that would not get smaller are stored raw
+struct FieldCodecHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width;
+	int32_t length;
+	int32_t componentCount;
+	int32_t tileSize;
+	uint32_t mode;
+	float maxError;
+};
+
+static const char FIELD_CODEC_MAGIC[4] = { 'F', 'L', 'D', 'C' };
+static const uint32_t FIELD_CODEC_VERSION = 1;
+static const int BLOCK_SIZE = 32;
+// block header bytes from here on are rice coded blocks, below are packed ones with that many bits
+static const int RICE_BLOCK = 64;
+// lossy code of a cell stored as it is
+static const uint32_t ESCAPE_CODE = UINT32_MAX;
+// first byte of a tile
+static const uint8_t CODED_TILE = 0;
+static const uint8_t RAW_TILE = 1;
+
+// one component of one tile, the unit that is encoded on its own
+struct FieldTile
+{
+	int x;
+	int y;
+	int width;
+	int length;
+	int component;
+};
+
+static uint32_t toBits(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float fromBits(uint32_t bits)
+{
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t code)
+{
+	return (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+}
+
+// the bits of a float as an integer that orders like the float, so close values are close integers
+static int32_t toOrdered(float value)
+{
+	int32_t bits = (int32_t)toBits(value);
+	return bits >= 0 ? bits : bits ^ 0x7fffffff;
+}
+
+static float fromOrdered(int32_t ordered)
+{
+	return fromBits((uint32_t)(ordered >= 0 ? ordered : ordered ^ 0x7fffffff));
+}
+
+// left + lower - lower left, the plane through the three neighbours. the first row and
+// column of a tile only have one neighbour, and the first cell none
+template <typename T, typename Wide>
+static T predict(const T* tile, int tileLength, int x, int y)
+{
+	if (x == 0 && y == 0) return 0;
+	if (x == 0) return tile[y - 1];
+	if (y == 0) return tile[(x - 1) * tileLength];
+
+	Wide left = tile[(x - 1) * tileLength + y];
+	Wide lower = tile[x * tileLength + y - 1];
+	Wide lowerLeft = tile[(x - 1) * tileLength + y - 1];
+	return (T)std::clamp<Wide>(left + lower - lowerLeft, (Wide)std::numeric_limits<T>::lowest(), (Wide)std::numeric_limits<T>::max());
+}
+
+// the encoder and decoder have to round the same way
+static float dequantize(float prediction, int32_t quantized, float step)
+{
+	return prediction + (float)quantized * step;
+}
+
+class BitWriter
+{
+public:
+	BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	// bits has to be 32 at most
+	void write(uint32_t value, int bits)
+	{
+		buffer |= (uint64_t)value << count;
+		count += bits;
+		while (count >= 8)
+		{
+			out.push_back((uint8_t)buffer);
+			buffer >>= 8;
+			count -= 8;
+		}
+	}
+
+	// count zeros and a one
+	void writeUnary(uint32_t count)
+	{
+		for (; count >= 32; count -= 32)
+		{
+			write(0, 32);
+		}
+		write(1u << count, count + 1);
+	}
+
+	void flush()
+	{
+		if (count > 0)
+			out.push_back((uint8_t)buffer);
+		buffer = 0;
+		count = 0;
+	}
+
+private:
+	std::vector<uint8_t>& out;
+	uint64_t buffer = 0;
+	int count = 0;
+};
+
+class BitReader
+{
+public:
+	BitReader(const uint8_t* data, size_t size) : data(data), end(data + size) {}
+
+	// reading past the end gives zeros and marks the reader as failed
+	uint32_t read(int bits)
+	{
+		if (bits == 0) return 0;
+		while (count < bits)
+		{
+			if (data == end)
+			{
+				failed = true;
+				return 0;
+			}
+			buffer |= (uint64_t)*data++ << count;
+			count += 8;
+		}
+		uint32_t value = (uint32_t)(buffer & ((1ull << bits) - 1));
+		buffer >>= bits;
+		count -= bits;
+		return value;
+	}
+
+	// zeros up to the next one
+	uint32_t readUnary()
+	{
+		uint32_t zeros = 0;
+		while (true)
+		{
+			while (count < 56 && data != end)
+			{
+				buffer |= (uint64_t)*data++ << count;
+				count += 8;
+			}
+			if (buffer != 0)
+			{
+				int run = std::countr_zero(buffer);
+				buffer >>= run + 1;
+				count -= run + 1;
+				return zeros + run;
+			}
+			if (count == 0)
+			{
+				failed = true;
+				return 0;
+			}
+			zeros += count;
+			buffer = 0;
+			count = 0;
+		}
+	}
+
+	// the rest of the bits of the current byte are padding, whole bytes read ahead are given back
+	void skipToByte()
+	{
+		data -= count / 8;
+		buffer = 0;
+		count = 0;
+	}
+
+	const uint8_t* getPosition() const { return data; }
+	void fail() { failed = true; }
+	bool hasFailed() const { return failed; }
+
+private:
+	const uint8_t* data;
+	const uint8_t* end;
+	uint64_t buffer = 0;
+	int count = 0;
+	bool failed = false;
+};
+
+// bits a block takes packed at one width, or rice coded with parameter k, whichever is smaller.
+// residuals are mostly small with a few large ones, where rice codes win
+static void writeBlock(const uint32_t* codes, size_t count, BitWriter& writer)
+{
+	uint32_t any = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		any |= codes[i];
+	}
+	int width = std::bit_width(any);
+	uint64_t packedBits = (uint64_t)width * count;
+
+	// the best parameter is close to the log of the mean
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		sum += codes[i];
+	}
+	int meanK = std::bit_width(sum / count);
+	int bestK = 0;
+	uint64_t bestRiceBits = UINT64_MAX;
+	for (int k = std::max(meanK - 2, 0); k <= std::min(meanK, 31); k++)
+	{
+		uint64_t riceBits = (uint64_t)(k + 1) * count;
+		for (size_t i = 0; i < count; i++)
+		{
+			riceBits += codes[i] >> k;
+		}
+		if (riceBits < bestRiceBits)
+		{
+			bestRiceBits = riceBits;
+			bestK = k;
+		}
+	}
+
+	if (packedBits <= bestRiceBits)
+	{
+		writer.write(width, 8);
+		for (size_t i = 0; i < count && width > 0; i++)
+		{
+			writer.write(codes[i], width);
+		}
+		return;
+	}
+
+	writer.write(RICE_BLOCK + bestK, 8);
+	for (size_t i = 0; i < count; i++)
+	{
+		writer.writeUnary(codes[i] >> bestK);
+		writer.write(codes[i] & ((1u << bestK) - 1), bestK);
+	}
+}
+
+static void writeCodes(const std::vector<uint32_t>& codes, std::vector<uint8_t>& out)
+{
+	BitWriter writer(out);
+	for (size_t start = 0; start < codes.size(); start += BLOCK_SIZE)
+	{
+		writeBlock(codes.data() + start, std::min(codes.size() - start, (size_t)BLOCK_SIZE), writer);
+	}
+	writer.flush();
+}
+
+static void readCodes(BitReader& reader, std::vector<uint32_t>& codes)
+{
+	for (size_t start = 0; start < codes.size(); start += BLOCK_SIZE)
+	{
+		size_t end = std::min(codes.size(), start + BLOCK_SIZE);
+		int mode = reader.read(8);
+		if (mode >= RICE_BLOCK && mode < RICE_BLOCK + 32)
+		{
+			int k = mode - RICE_BLOCK;
+			for (size_t i = start; i < end; i++)
+			{
+				uint32_t quotient = reader.readUnary();
+				codes[i] = (quotient << k) | reader.read(k);
+			}
+		}
+		else if (mode <= 32)
+		{
+			for (size_t i = start; i < end; i++)
+			{
+				codes[i] = reader.read(mode);
+			}
+		}
+		else
+		{
+			reader.fail();
+		}
+		if (reader.hasFailed()) return;
+	}
+	reader.skipToByte();
+}
+
+static void encodeTile(const float* const* columns, int componentCount, const FieldTile& tile, FieldCodecOptions options, std::vector<uint8_t>& out)
+{
+	std::vector<uint32_t> codes((size_t)tile.width * tile.length);
+	std::vector<uint32_t> escapes;
+	auto getValue = [&](int x, int y) { return columns[tile.x + x][(size_t)(tile.y + y) * componentCount + tile.component]; };
+
+	if (options.mode == FieldCodecMode::LOSSLESS)
+	{
+		std::vector<int32_t> ordered(codes.size());
+		for (int x = 0; x < tile.width; x++)
+		{
+			for (int y = 0; y < tile.length; y++)
+			{
+				size_t i = (size_t)x * tile.length + y;
+				ordered[i] = toOrdered(getValue(x, y));
+				int32_t prediction = predict<int32_t, int64_t>(ordered.data(), tile.length, x, y);
+				codes[i] = zigzag((int32_t)((uint32_t)ordered[i] - (uint32_t)prediction));
+			}
+		}
+	}
+	else
+	{
+		// predictions are made from the values the decoder will see
+		float step = 2.0f * options.maxError;
+		std::vector<float> decoded(codes.size());
+		for (int x = 0; x < tile.width; x++)
+		{
+			for (int y = 0; y < tile.length; y++)
+			{
+				size_t i = (size_t)x * tile.length + y;
+				float value = getValue(x, y);
+				float prediction = predict<float, double>(decoded.data(), tile.length, x, y);
+
+				float steps = std::round((value - prediction) / step);
+				if (std::isfinite(value) && std::abs(steps) < (float)(1 << 30))
+				{
+					float quantized = dequantize(prediction, (int32_t)steps, step);
+					if (std::abs(quantized - value) <= options.maxError)
+					{
+						codes[i] = zigzag((int32_t)steps);
+						decoded[i] = quantized;
+						continue;
+					}
+				}
+				codes[i] = ESCAPE_CODE;
+				escapes.push_back(toBits(value));
+				decoded[i] = value;
+			}
+		}
+	}
+
+	out.push_back(CODED_TILE);
+	writeCodes(codes, out);
+	out.insert(out.end(), (const uint8_t*)escapes.data(), (const uint8_t*)(escapes.data() + escapes.size()));
+
+	// noise does not predict, it is cheaper as it is
+	size_t rawSize = 1 + codes.size() * sizeof(float);
+	if (out.size() <= rawSize) return;
+
+	out.assign(rawSize, RAW_TILE);
+	for (int x = 0; x < tile.width; x++)
+	{
+		for (int y = 0; y < tile.length; y++)
+		{
+			float value = getValue(x, y);
+			std::memcpy(out.data() + 1 + ((size_t)x * tile.length + y) * sizeof(float), &value, sizeof(value));
+		}
+	}
+}
+
+static bool decodeTile(const uint8_t* data, size_t size, float* const* columns, int componentCount, const FieldTile& tile, FieldCodecOptions options)
+{
+	std::vector<uint32_t> codes((size_t)tile.width * tile.length);
+	auto setValue = [&](int x, int y, float value) { columns[tile.x + x][(size_t)(tile.y + y) * componentCount + tile.component] = value; };
+
+	if (size == 0) return false;
+	if (data[0] == RAW_TILE)
+	{
+		if (size != 1 + codes.size() * sizeof(float)) return false;
+		for (int x = 0; x < tile.width; x++)
+		{
+			for (int y = 0; y < tile.length; y++)
+			{
+				float value;
+				std::memcpy(&value, data + 1 + ((size_t)x * tile.length + y) * sizeof(float), sizeof(value));
+				setValue(x, y, value);
+			}
+		}
+		return true;
+	}
+	if (data[0] != CODED_TILE) return false;
+
+	BitReader reader(data + 1, size - 1);
+	readCodes(reader, codes);
+	if (reader.hasFailed()) return false;
+
+	const uint8_t* escapes = reader.getPosition();
+	const uint8_t* end = data + size;
+
+	if (options.mode == FieldCodecMode::LOSSLESS)
+	{
+		std::vector<int32_t> ordered(codes.size());
+		for (int x = 0; x < tile.width; x++)
+		{
+			for (int y = 0; y < tile.length; y++)
+			{
+				size_t i = (size_t)x * tile.length + y;
+				int32_t prediction = predict<int32_t, int64_t>(ordered.data(), tile.length, x, y);
+				ordered[i] = (int32_t)((uint32_t)prediction + (uint32_t)unzigzag(codes[i]));
+				setValue(x, y, fromOrdered(ordered[i]));
+			}
+		}
+		return true;
+	}
+
+	float step = 2.0f * options.maxError;
+	std::vector<float> decoded(codes.size());
+	for (int x = 0; x < tile.width; x++)
+	{
+		for (int y = 0; y < tile.length; y++)
+		{
+			size_t i = (size_t)x * tile.length + y;
+			if (codes[i] == ESCAPE_CODE)
+			{
+				if (end - escapes < (ptrdiff_t)sizeof(uint32_t)) return false;
+				uint32_t bits;
+				std::memcpy(&bits, escapes, sizeof(bits));
+				escapes += sizeof(bits);
+				decoded[i] = fromBits(bits);
+			}
+			else
+			{
+				float prediction = predict<float, double>(decoded.data(), tile.length, x, y);
+				decoded[i] = dequantize(prediction, unzigzag(codes[i]), step);
+			}
+			setValue(x, y, decoded[i]);
+		}
+	}
+	return true;
+}
+
+static std::vector<FieldTile> getTiles(int width, int length, int componentCount)
+{
+	std::vector<FieldTile> tiles;
+	for (int x = 0; x < width; x += FIELD_CODEC_TILE_SIZE)
+	{
+		for (int y = 0; y < length; y += FIELD_CODEC_TILE_SIZE)
+		{
+			for (int component = 0; component < componentCount; component++)
+			{
+				tiles.push_back(FieldTile{ x, y, std::min(FIELD_CODEC_TILE_SIZE, width - x), std::min(FIELD_CODEC_TILE_SIZE, length - y), component });
+			}
+		}
+	}
+	return tiles;
+}
+
+std::vector<uint8_t> encodeField(const float* const* columns, int width, int length, int componentCount, FieldCodecOptions options)
+{
+	std::vector<FieldTile> tiles = getTiles(width, length, componentCount);
+	std::vector<std::vector<uint8_t>> encodedTiles(tiles.size());
+	std::vector<size_t> tileIndices(tiles.size());
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](size_t i)
+	{
+		encodeTile(columns, componentCount, tiles[i], options, encodedTiles[i]);
+	});
+
+	FieldCodecHeader header = {};
+	std::memcpy(header.magic, FIELD_CODEC_MAGIC, sizeof(header.magic));
+	header.version = FIELD_CODEC_VERSION;
+	header.width = width;
+	header.length = length;
+	header.componentCount = componentCount;
+	header.tileSize = FIELD_CODEC_TILE_SIZE;
+	header.mode = (uint32_t)options.mode;
+	header.maxError = options.maxError;
+
+	size_t size = sizeof(header) + tiles.size() * sizeof(uint32_t);
+	for (const std::vector<uint8_t>& encoded : encodedTiles)
+	{
+		size += encoded.size();
+	}
+
+	std::vector<uint8_t> data(size);
+	std::memcpy(data.data(), &header, sizeof(header));
+	uint8_t* tileSizes = data.data() + sizeof(header);
+	uint8_t* position = tileSizes + tiles.size() * sizeof(uint32_t);
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		uint32_t tileSize = (uint32_t)encodedTiles[i].size();
+		std::memcpy(tileSizes + i * sizeof(uint32_t), &tileSize, sizeof(tileSize));
+		std::memcpy(position, encodedTiles[i].data(), tileSize);
+		position += tileSize;
+	}
+	return data;
+}
+
+bool decodeField(const uint8_t* data, size_t size, float* const* columns, int width, int length, int componentCount)
+{
+	if (size < sizeof(FieldCodecHeader)) return false;
+	FieldCodecHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, FIELD_CODEC_MAGIC, sizeof(header.magic)) != 0 || header.version != FIELD_CODEC_VERSION ||
+		header.width != width || header.length != length || header.componentCount != componentCount ||
+		header.tileSize != FIELD_CODEC_TILE_SIZE || header.mode > (uint32_t)FieldCodecMode::ERROR_BOUNDED)
+		return false;
+
+	FieldCodecOptions options;
+	options.mode = (FieldCodecMode)header.mode;
+	options.maxError = header.maxError;
+
+	// every tile starts where the ones before it end
+	std::vector<FieldTile> tiles = getTiles(width, length, componentCount);
+	if ((size - sizeof(header)) / sizeof(uint32_t) < tiles.size()) return false;
+	std::vector<size_t> tileOffsets(tiles.size() + 1);
+	tileOffsets[0] = sizeof(header) + tiles.size() * sizeof(uint32_t);
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		uint32_t tileSize;
+		std::memcpy(&tileSize, data + sizeof(header) + i * sizeof(uint32_t), sizeof(tileSize));
+		tileOffsets[i + 1] = tileOffsets[i] + tileSize;
+	}
+	if (tileOffsets.back() > size) return false;
+
+	std::vector<size_t> tileIndices(tiles.size());
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::vector<uint8_t> decoded(tiles.size(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](size_t i)
+	{
+		decoded[i] = decodeTile(data + tileOffsets[i], tileOffsets[i + 1] - tileOffsets[i], columns, componentCount, tiles[i], options);
+	});
+	return std::all_of(decoded.begin(), decoded.end(), [](uint8_t tileDecoded) { return tileDecoded != 0; });
+}
+
+int getFieldTileCount(int width, int length)
+{
+	return ((width + FIELD_CODEC_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE) * ((length + FIELD_CODEC_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE);
+}
+
+FieldTileArea getFieldTileArea(int tile, int width, int length)
+{
+	int tilesX = (width + FIELD_CODEC_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE;
+	FieldTileArea area;
+	area.x = tile % tilesX * FIELD_CODEC_TILE_SIZE;
+	area.y = tile / tilesX * FIELD_CODEC_TILE_SIZE;
+	area.width = std::min(FIELD_CODEC_TILE_SIZE, width - area.x);
+	area.length = std::min(FIELD_CODEC_TILE_SIZE, length - area.y);
+	return area;
+}
+
+bool isFieldTileEqual(const float* const* columns, const float* const* otherColumns, int componentCount, FieldTileArea area)
+{
+	size_t rowStart = (size_t)area.y * componentCount;
+	size_t rowSize = (size_t)area.length * componentCount * sizeof(float);
+	for (int x = area.x; x < area.x + area.width; x++)
+	{
+		if (std::memcmp(columns[x] + rowStart, otherColumns[x] + rowStart, rowSize) != 0)
+			return false;
+	}
+	return true;
+}
+
+std::vector<uint8_t> encodeFieldTile(const float* const* columns, int componentCount, FieldTileArea area, FieldCodecOptions options)
+{
+	std::vector<const float*> tileColumns(area.width);
+	for (int x = 0; x < area.width; x++)
+	{
+		tileColumns[x] = columns[area.x + x] + (size_t)area.y * componentCount;
+	}
+	return encodeField(tileColumns.data(), area.width, area.length, componentCount, options);
+}
+
+bool decodeFieldTile(const uint8_t* data, size_t size, float* const* columns, int componentCount, FieldTileArea area)
+{
+	std::vector<float*> tileColumns(area.width);
+	for (int x = 0; x < area.width; x++)
+	{
+		tileColumns[x] = columns[area.x + x] + (size_t)area.y * componentCount;
+	}
+	return decodeField(data, size, tileColumns.data(), area.width, area.length, componentCount);
+}
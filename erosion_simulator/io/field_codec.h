@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// cells along the side of a tile, tiles are encoded and decoded independently and in parallel
+const int FIELD_CODEC_TILE_SIZE = 64;
+
+enum class FieldCodecMode
+{
+	// every float comes back bit for bit
+	LOSSLESS,
+	// every float comes back within maxError, non finite values bit for bit
+	ERROR_BOUNDED,
+};
+
+struct FieldCodecOptions
+{
+	FieldCodecMode mode = FieldCodecMode::LOSSLESS;
+	float maxError = 0.0f;
+};
+
+// compresses a field of width by length cells, componentCount floats each, given as columns [x][y].
+// every cell is predicted from its left, lower and lower left neighbours (2D Lorenzo), and only
+// how far it is from the prediction is stored, in blocks packed to the bits they need
+std::vector<uint8_t> encodeField(const float* const* columns, int width, int length, int componentCount, FieldCodecOptions options);
+// false if data is not an encoded field of that size
+bool decodeField(const uint8_t* data, size_t size, float* const* columns, int width, int length, int componentCount);
+
+// cells of one tile of a field cut into FIELD_CODEC_TILE_SIZE tiles, clipped to the field
+struct FieldTileArea
+{
+	int x;
+	int y;
+	int width;
+	int length;
+};
+
+int getFieldTileCount(int width, int length);
+// tiles are counted along x first
+FieldTileArea getFieldTileArea(int tile, int width, int length);
+// true if the tile holds the same bits in both fields
+bool isFieldTileEqual(const float* const* columns, const float* const* otherColumns, int componentCount, FieldTileArea area);
+// encodes only the cells of area, as a field of its own
+std::vector<uint8_t> encodeFieldTile(const float* const* columns, int componentCount, FieldTileArea area, FieldCodecOptions options);
+bool decodeFieldTile(const uint8_t* data, size_t size, float* const* columns, int componentCount, FieldTileArea area);
@@ -0,0 +1,357 @@
+#include "height_map_writer.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <execution>
+#include <fstream>
+#include <numeric>
+#include <vector>
+
+// rows converted together, so the columns are read along y a block at a time
+const int WRITER_BLOCK_ROWS = 64;
+// data of one IDAT chunk, every chunk has its own crc so they are checksummed in parallel
+const size_t PNG_CHUNK_SIZE = 1 << 20;
+// most bytes a stored deflate block can hold
+const size_t DEFLATE_STORED_BLOCK_SIZE = 65535;
+
+static const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+HeightMapFormat getHeightMapFormat(const std::string& filePath)
+{
+	std::string extension = filePath.substr(filePath.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == "png")
+		return HeightMapFormat::PNG;
+	if (extension == "pfm")
+		return HeightMapFormat::PFM;
+	return HeightMapFormat::PGM;
+}
+
+const char* getHeightMapExtension(HeightMapFormat format)
+{
+	switch (format)
+	{
+	case HeightMapFormat::PNG: return ".png";
+	case HeightMapFormat::PFM: return ".pfm";
+	default: return ".pgm";
+	}
+}
+
+// calls convertRow(y, row) for every row of the image in parallel, with the heights of the row
+// gathered from the columns a block of rows at a time
+template <typename Function>
+static void forEachRow(const float* const* heights, int width, int length, Function convertRow)
+{
+	std::vector<int> blocks((length + WRITER_BLOCK_ROWS - 1) / WRITER_BLOCK_ROWS);
+	std::iota(blocks.begin(), blocks.end(), 0);
+	std::for_each(std::execution::par, blocks.begin(), blocks.end(), [&](int block)
+	{
+		int firstRow = block * WRITER_BLOCK_ROWS;
+		int rowCount = std::min(WRITER_BLOCK_ROWS, length - firstRow);
+		// padded, power of two widths would put every row of a tile in the same cache set
+		size_t rowStride = (size_t)width + 16;
+		thread_local std::vector<float> rows;
+		rows.resize(WRITER_BLOCK_ROWS * rowStride);
+		// square tiles, so the rows written to stay in cache while the columns are read
+		for (int tileX = 0; tileX < width; tileX += WRITER_BLOCK_ROWS)
+		{
+			for (int x = tileX; x < std::min(width, tileX + WRITER_BLOCK_ROWS); x++)
+			{
+				const float* column = heights[x] + firstRow;
+				for (int r = 0; r < rowCount; r++)
+				{
+					rows[r * rowStride + x] = column[r];
+				}
+			}
+		}
+		for (int r = 0; r < rowCount; r++)
+		{
+			convertRow(firstRow + r, rows.data() + r * rowStride);
+		}
+	});
+}
+
+static void writeBigEndian16(uint8_t* target, uint16_t value)
+{
+	target[0] = (uint8_t)(value >> 8);
+	target[1] = (uint8_t)value;
+}
+
+static void writeBigEndian32(uint8_t* target, uint32_t value)
+{
+	target[0] = (uint8_t)(value >> 24);
+	target[1] = (uint8_t)(value >> 16);
+	target[2] = (uint8_t)(value >> 8);
+	target[3] = (uint8_t)value;
+}
+
+// writes a row of heights as big endian 16 bit samples spanning [minHeight, maxHeight]
+static void convertRow16(const float* heights, int width, float minHeight, float scale, uint8_t* target)
+{
+	for (int x = 0; x < width; x++)
+	{
+		float value = (heights[x] - minHeight) * scale;
+		// nan ends up at 0 too
+		uint16_t sample = value > 0.0f ? (uint16_t)std::min(value + 0.5f, 65535.0f) : 0;
+		writeBigEndian16(target + (size_t)x * 2, sample);
+	}
+}
+
+static uint32_t getCrc32(const uint8_t* data, size_t size)
+{
+	static const std::array<uint32_t, 256> table = []()
+	{
+		std::array<uint32_t, 256> table;
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		return table;
+	}();
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+}
+
+const uint32_t ADLER_BASE = 65521;
+
+static uint32_t getAdler32(const uint8_t* data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	while (size > 0)
+	{
+		// the most bytes that cannot overflow b before the modulo
+		size_t count = std::min<size_t>(size, 5552);
+		size -= count;
+		for (size_t i = 0; i < count; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		data += count;
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+	}
+	return (b << 16) | a;
+}
+
+// the adler32 of two pieces one after the other, from the adler32 of each
+static uint32_t combineAdler32(uint32_t first, uint32_t second, size_t secondSize)
+{
+	uint32_t remainder = (uint32_t)(secondSize % ADLER_BASE);
+	uint32_t a = first & 0xffff;
+	uint32_t b = (uint32_t)(((uint64_t)remainder * a) % ADLER_BASE);
+	a += (second & 0xffff) + ADLER_BASE - 1;
+	b += (first >> 16) + (second >> 16) + ADLER_BASE - remainder;
+	if (a >= ADLER_BASE) a -= ADLER_BASE;
+	if (a >= ADLER_BASE) a -= ADLER_BASE;
+	if (b >= ADLER_BASE << 1) b -= ADLER_BASE << 1;
+	if (b >= ADLER_BASE) b -= ADLER_BASE;
+	return (b << 16) | a;
+}
+
+static void appendPngChunk(std::vector<uint8_t>& file, const char type[4], const uint8_t* data, size_t size)
+{
+	size_t start = file.size();
+	file.resize(start + 12 + size);
+	writeBigEndian32(&file[start], (uint32_t)size);
+	std::memcpy(&file[start + 4], type, 4);
+	if (size > 0)
+		std::memcpy(&file[start + 8], data, size);
+	writeBigEndian32(&file[start + 8 + size], getCrc32(&file[start + 4], size + 4));
+}
+
+// the lowest and highest finite height, so the 16 bit formats spend their whole range on the terrain
+// whatever it came from. a flat or empty map gets a range of zero
+static void getHeightRange(const float* const* heights, int width, int length, float& minHeight, float& maxHeight)
+{
+	std::vector<float> columnMin(width, INFINITY);
+	std::vector<float> columnMax(width, -INFINITY);
+	std::vector<int> columns(width);
+	std::iota(columns.begin(), columns.end(), 0);
+	std::for_each(std::execution::par, columns.begin(), columns.end(), [&](int x)
+	{
+		for (int y = 0; y < length; y++)
+		{
+			float height = heights[x][y];
+			if (!std::isfinite(height)) continue;
+			columnMin[x] = std::min(columnMin[x], height);
+			columnMax[x] = std::max(columnMax[x], height);
+		}
+	});
+	minHeight = *std::min_element(columnMin.begin(), columnMin.end());
+	maxHeight = *std::max_element(columnMax.begin(), columnMax.end());
+	if (minHeight > maxHeight)
+		minHeight = maxHeight = 0.0f;
+}
+
+static std::vector<uint8_t> encodePgm(const float* const* heights, int width, int length, float minHeight, float maxHeight, float scale)
+{
+	// the range goes into a comment, which readers skip and the importer maps the samples back with
+	char header[128];
+	int headerSize = snprintf(header, sizeof(header), "P5\n# %s %.9g %.9g\n%d %d\n65535\n",
+		HEIGHT_RANGE_KEYWORD, minHeight, maxHeight, width, length);
+	size_t rowSize = (size_t)width * 2;
+
+	std::vector<uint8_t> file(headerSize + rowSize * length);
+	std::memcpy(file.data(), header, headerSize);
+	uint8_t* pixels = file.data() + headerSize;
+	forEachRow(heights, width, length, [&](int y, const float* row)
+	{
+		convertRow16(row, width, minHeight, scale, pixels + y * rowSize);
+	});
+	return file;
+}
+
+// little endian, which the negative scale says. rows go from the bottom up, so the
+// image shows the same way up as the other formats
+static std::vector<uint8_t> encodePfm(const float* const* heights, int width, int length)
+{
+	char header[64];
+	int headerSize = snprintf(header, sizeof(header), "Pf\n%d %d\n-1.0\n", width, length);
+	size_t rowSize = (size_t)width * sizeof(float);
+
+	std::vector<uint8_t> file(headerSize + rowSize * length);
+	std::memcpy(file.data(), header, headerSize);
+	uint8_t* pixels = file.data() + headerSize;
+	forEachRow(heights, width, length, [&](int y, const float* row)
+	{
+		std::memcpy(pixels + (size_t)(length - 1 - y) * rowSize, row, rowSize);
+	});
+	return file;
+}
+
+// the scanlines go into stored deflate blocks, compressing them would cost far more than
+// writing them. every row is placed straight where it lands in the zlib stream
+static std::vector<uint8_t> encodePng(const float* const* heights, int width, int length, float minHeight, float maxHeight, float scale)
+{
+	size_t scanlineSize = 1 + (size_t)width * 2;
+	size_t rawSize = scanlineSize * length;
+	size_t blockCount = (rawSize + DEFLATE_STORED_BLOCK_SIZE - 1) / DEFLATE_STORED_BLOCK_SIZE;
+	std::vector<uint8_t> stream(2 + blockCount * 5 + rawSize + 4);
+
+	// zlib header without a preset dictionary, check bits make it a multiple of 31
+	stream[0] = 0x78;
+	stream[1] = 0x01;
+	for (size_t block = 0; block < blockCount; block++)
+	{
+		size_t blockSize = std::min(DEFLATE_STORED_BLOCK_SIZE, rawSize - block * DEFLATE_STORED_BLOCK_SIZE);
+		uint8_t* header = &stream[2 + block * (DEFLATE_STORED_BLOCK_SIZE + 5)];
+		header[0] = block == blockCount - 1 ? 1 : 0;
+		header[1] = (uint8_t)blockSize;
+		header[2] = (uint8_t)(blockSize >> 8);
+		header[3] = (uint8_t)~blockSize;
+		header[4] = (uint8_t)(~blockSize >> 8);
+	}
+
+	std::vector<uint32_t> rowChecksums(length);
+	forEachRow(heights, width, length, [&](int y, const float* row)
+	{
+		thread_local std::vector<uint8_t> scanline;
+		scanline.resize(scanlineSize);
+		// no filter
+		scanline[0] = 0;
+		convertRow16(row, width, minHeight, scale, scanline.data() + 1);
+		rowChecksums[y] = getAdler32(scanline.data(), scanlineSize);
+
+		// the row can straddle stored blocks, each raw byte sits behind the headers of the blocks up to its own
+		size_t position = y * scanlineSize;
+		size_t copied = 0;
+		while (copied < scanlineSize)
+		{
+			size_t block = position / DEFLATE_STORED_BLOCK_SIZE;
+			size_t count = std::min(scanlineSize - copied, DEFLATE_STORED_BLOCK_SIZE - position % DEFLATE_STORED_BLOCK_SIZE);
+			std::memcpy(&stream[2 + (block + 1) * 5 + position], scanline.data() + copied, count);
+			position += count;
+			copied += count;
+		}
+	});
+
+	uint32_t checksum = 1;
+	for (uint32_t rowChecksum : rowChecksums)
+	{
+		checksum = combineAdler32(checksum, rowChecksum, scanlineSize);
+	}
+	writeBigEndian32(&stream[stream.size() - 4], checksum);
+
+	size_t chunkCount = (stream.size() + PNG_CHUNK_SIZE - 1) / PNG_CHUNK_SIZE;
+	std::vector<uint8_t> file;
+	file.reserve(sizeof(PNG_SIGNATURE) + 25 + stream.size() + chunkCount * 12 + 12);
+	file.insert(file.end(), PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+
+	// 16 bit grayscale, deflate, no filtering choice, no interlace
+	uint8_t imageHeader[13] = {};
+	writeBigEndian32(imageHeader, (uint32_t)width);
+	writeBigEndian32(imageHeader + 4, (uint32_t)length);
+	imageHeader[8] = 16;
+	appendPngChunk(file, "IHDR", imageHeader, sizeof(imageHeader));
+
+	// the range as a text chunk, the keyword, a null and the text
+	char range[64];
+	int rangeSize = snprintf(range, sizeof(range), "%s%c%.9g %.9g", HEIGHT_RANGE_KEYWORD, '\0', minHeight, maxHeight);
+	appendPngChunk(file, "tEXt", (const uint8_t*)range, rangeSize);
+
+	size_t dataStart = file.size();
+	file.resize(dataStart + stream.size() + chunkCount * 12);
+	std::vector<size_t> chunks(chunkCount);
+	std::iota(chunks.begin(), chunks.end(), 0);
+	std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](size_t chunk)
+	{
+		size_t offset = chunk * PNG_CHUNK_SIZE;
+		size_t size = std::min(PNG_CHUNK_SIZE, stream.size() - offset);
+		uint8_t* target = &file[dataStart + chunk * (PNG_CHUNK_SIZE + 12)];
+		writeBigEndian32(target, (uint32_t)size);
+		std::memcpy(target + 4, "IDAT", 4);
+		std::memcpy(target + 8, &stream[offset], size);
+		writeBigEndian32(target + 8 + size, getCrc32(target + 4, size + 4));
+	});
+
+	appendPngChunk(file, "IEND", nullptr, 0);
+	return file;
+}
+
+bool writeHeightMap(const std::string& filePath, HeightMapFormat format, const float* const* heights, int width, int length,
+	float* seconds)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	float minHeight = 0.0f, maxHeight = 0.0f;
+	if (format != HeightMapFormat::PFM)
+		getHeightRange(heights, width, length, minHeight, maxHeight);
+	float scale = maxHeight > minHeight ? 65535.0f / (maxHeight - minHeight) : 0.0f;
+	std::vector<uint8_t> file;
+	switch (format)
+	{
+	case HeightMapFormat::PGM:
+		file = encodePgm(heights, width, length, minHeight, maxHeight, scale);
+		break;
+	case HeightMapFormat::PNG:
+		file = encodePng(heights, width, length, minHeight, maxHeight, scale);
+		break;
+	case HeightMapFormat::PFM:
+		file = encodePfm(heights, width, length);
+		break;
+	}
+
+	std::ofstream stream(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	if (!stream.write((const char*)file.data(), file.size()))
+	{
+		printf("Failed to write the height map to %s\n", filePath.c_str());
+		return false;
+	}
+
+	if (seconds)
+		*seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - startTime).count();
+	return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+
+enum class HeightMapFormat
+{
+	// binary 16 bit grayscale
+	PGM,
+	// 16 bit grayscale, stored without compression
+	PNG,
+	// 32 bit floats, the heights exactly as they are
+	PFM,
+};
+
+// .pgm, .png or .pfm, from the end of filePath
+HeightMapFormat getHeightMapFormat(const std::string& filePath);
+const char* getHeightMapExtension(HeightMapFormat format);
+
+// keyword of the PNG text chunk and the PGM comment holding the range of a 16 bit height map,
+// followed by its lowest and highest height
+const char* const HEIGHT_RANGE_KEYWORD = "heights";
+
+// writes heights, columns [x][y], as a single channel image with y = 0 as its top row.
+// the 16 bit formats map the lowest to highest height of the map onto their whole range and
+// record that range, so importing the file gives back the heights it was written from. the file
+// is converted in parallel into one buffer and written at once. false if the file could not be written
+bool writeHeightMap(const std::string& filePath, HeightMapFormat format, const float* const* heights, int width, int length,
+	float* seconds = nullptr);
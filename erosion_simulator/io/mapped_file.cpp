@@ -0,0 +1,109 @@
+#include "mapped_file.h"
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& filePath)
+{
+	close();
+
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		printf("Failed to open %s\n", filePath.c_str());
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		printf("Failed to map %s\n", filePath.c_str());
+		CloseHandle(file);
+		return false;
+	}
+
+	// the view keeps the mapping, and the mapping the file, open until it is unmapped
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+	{
+		printf("Failed to map %s\n", filePath.c_str());
+		return false;
+	}
+	void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (view == NULL)
+	{
+		printf("Failed to map %s\n", filePath.c_str());
+		return false;
+	}
+
+	data = (uint8_t*)view;
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	data = nullptr;
+	size = 0;
+}
+#else
+bool MappedFile::open(const std::string& filePath)
+{
+	close();
+
+	int file = ::open(filePath.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		printf("Failed to open %s\n", filePath.c_str());
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size == 0)
+	{
+		printf("Failed to map %s\n", filePath.c_str());
+		::close(file);
+		return false;
+	}
+
+	// the mapping keeps the file open
+	void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (view == MAP_FAILED)
+	{
+		printf("Failed to map %s\n", filePath.c_str());
+		return false;
+	}
+
+	data = (uint8_t*)view;
+	size = (size_t)status.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (data)
+		munmap(data, size);
+	data = nullptr;
+	size = 0;
+}
+#endif
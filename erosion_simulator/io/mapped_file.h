@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// a whole file mapped into memory. the pages can be written to, but are copied on
+// the first write and never reach the file, so planes in it can be used as working memory
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// false if the file could not be opened or is empty
+	bool open(const std::string& filePath);
+	void close();
+
+	uint8_t* getData() { return data; }
+	const uint8_t* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	uint8_t* data = nullptr;
+	size_t size = 0;
+};
@@ -0,0 +1,229 @@
+#include "obj_height_file.h"
+#include "io/mapped_file.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <execution>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+// smallest part of the file a thread parses, so small files are not split into slivers
+const size_t OBJ_MIN_CHUNK_SIZE = 1 << 20;
+// how far off a cell center a vertex can be and still be taken for its grid point
+const float OBJ_GRID_TOLERANCE = 0.25f;
+
+// a run of whole lines and the vertices parsed from them
+struct ObjChunk
+{
+	const char* begin = nullptr;
+	const char* end = nullptr;
+	std::vector<glm::vec3> vertices;
+	glm::vec2 minPosition = glm::vec2(INFINITY);
+	glm::vec2 maxPosition = glm::vec2(-INFINITY);
+	// smallest nonzero step in x and z between vertices that follow each other, the grid spacing
+	glm::vec2 step = glm::vec2(INFINITY);
+	size_t malformed = 0;
+	size_t offGrid = 0;
+};
+
+// exact powers of ten a double can hold
+static const double OBJ_POWERS_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// plain decimals, what exporters write, are read as an integer and scaled by one exact power of ten
+// in double precision. anything longer or stranger goes through from_chars
+static bool parseFloat(const char*& p, const char* end, float& value)
+{
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	if (p < end && *p == '+') p++;
+
+	const char* q = p;
+	bool negative = q < end && *q == '-';
+	if (negative) q++;
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	const char* firstDigit = q;
+	while (q < end && (unsigned)(*q - '0') < 10)
+	{
+		mantissa = mantissa * 10 + (*q++ - '0');
+		digits++;
+	}
+	if (q < end && *q == '.')
+	{
+		q++;
+		while (q < end && (unsigned)(*q - '0') < 10)
+		{
+			mantissa = mantissa * 10 + (*q++ - '0');
+			digits++;
+			exponent--;
+		}
+	}
+	if (q < end && (*q == 'e' || *q == 'E'))
+	{
+		q++;
+		bool negativeExponent = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+')) q++;
+		int power = 0;
+		const char* firstPowerDigit = q;
+		while (q < end && (unsigned)(*q - '0') < 10 && power < 1000)
+		{
+			power = power * 10 + (*q++ - '0');
+		}
+		if (q == firstPowerDigit) digits = 0;
+		exponent += negativeExponent ? -power : power;
+	}
+
+	if (digits > 0 && digits <= 15 && exponent >= -22 && exponent <= 22 && q > firstDigit)
+	{
+		double scaled = exponent < 0 ? (double)mantissa / OBJ_POWERS_OF_TEN[-exponent] : (double)mantissa * OBJ_POWERS_OF_TEN[exponent];
+		value = (float)(negative ? -scaled : scaled);
+		p = q;
+		return true;
+	}
+
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+static void parseChunk(ObjChunk& chunk)
+{
+	// a short v line is about 24 bytes
+	chunk.vertices.reserve((chunk.end - chunk.begin) / 24);
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+		if (!lineEnd) lineEnd = chunk.end;
+
+		// vn, vt and everything that is not a vertex is skipped whole
+		if (lineEnd - p > 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			const char* value = p + 2;
+			glm::vec3 vertex;
+			if (parseFloat(value, lineEnd, vertex.x) && parseFloat(value, lineEnd, vertex.y) && parseFloat(value, lineEnd, vertex.z))
+			{
+				glm::vec2 position = glm::vec2(vertex.x, vertex.z);
+				if (!chunk.vertices.empty())
+				{
+					glm::vec2 delta = glm::abs(position - glm::vec2(chunk.vertices.back().x, chunk.vertices.back().z));
+					if (delta.x > 0.0f) chunk.step.x = std::min(chunk.step.x, delta.x);
+					if (delta.y > 0.0f) chunk.step.y = std::min(chunk.step.y, delta.y);
+				}
+				chunk.minPosition = glm::min(chunk.minPosition, position);
+				chunk.maxPosition = glm::max(chunk.maxPosition, position);
+				chunk.vertices.push_back(vertex);
+			}
+			else
+			{
+				chunk.malformed++;
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+bool importObjHeightfield(const std::string& filePath, HeightGrid& grid)
+{
+	MappedFile file;
+	if (!file.open(filePath))
+	{
+		printf("Failed to open %s\n", filePath.c_str());
+		return false;
+	}
+
+	// every chunk starts on a new line, so no line is split between two of them
+	const char* text = (const char*)file.getData();
+	size_t size = file.getSize();
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()) * 8, size / OBJ_MIN_CHUNK_SIZE));
+	std::vector<ObjChunk> chunks(chunkCount);
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char* begin = text + size * i / chunkCount;
+		if (i > 0)
+		{
+			const char* newLine = (const char*)memchr(begin, '\n', text + size - begin);
+			begin = newLine ? newLine + 1 : text + size;
+		}
+		chunks[i].begin = begin;
+		if (i > 0) chunks[i - 1].end = begin;
+	}
+	chunks.back().end = text + size;
+
+	std::for_each(std::execution::par, chunks.begin(), chunks.end(), parseChunk);
+
+	size_t vertexCount = 0;
+	size_t malformed = 0;
+	glm::vec2 minPosition = glm::vec2(INFINITY);
+	glm::vec2 maxPosition = glm::vec2(-INFINITY);
+	glm::vec2 step = glm::vec2(INFINITY);
+	for (const ObjChunk& chunk : chunks)
+	{
+		vertexCount += chunk.vertices.size();
+		malformed += chunk.malformed;
+		minPosition = glm::min(minPosition, chunk.minPosition);
+		maxPosition = glm::max(maxPosition, chunk.maxPosition);
+		step = glm::min(step, chunk.step);
+	}
+	if (malformed > 0)
+		printf("Skipped %zu malformed vertices in %s\n", malformed, filePath.c_str());
+
+	// the spacing gives the size, and every grid point needs at least one vertex
+	glm::vec2 range = maxPosition - minPosition;
+	if (vertexCount == 0 || !std::isfinite(step.x) || !std::isfinite(step.y) ||
+		std::round(range.x / step.x) + 1.0f > (float)vertexCount || std::round(range.y / step.y) + 1.0f > (float)vertexCount)
+	{
+		printf("%s does not hold a grid of vertices\n", filePath.c_str());
+		return false;
+	}
+	int width = (int)std::lround(range.x / step.x) + 1;
+	int length = (int)std::lround(range.y / step.y) + 1;
+	if ((size_t)width * length > vertexCount)
+	{
+		printf("%s holds %zu vertices, too few for the %d x %d grid they are spaced for\n", filePath.c_str(), vertexCount, width, length);
+		return false;
+	}
+
+	// cells no vertex lands on stay NaN, so holes can be found afterwards
+	grid.resize(width, length);
+	std::fill(std::execution::par, grid.plane.begin(), grid.plane.end(), NAN);
+	glm::vec2 cellSize = range / glm::vec2(width - 1, length - 1);
+	std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](ObjChunk& chunk)
+	{
+		// vertices shared between faces may be written more than once, always with the same height
+		for (const glm::vec3& vertex : chunk.vertices)
+		{
+			glm::vec2 cell = (glm::vec2(vertex.x, vertex.z) - minPosition) / cellSize;
+			glm::vec2 point = glm::round(cell);
+			if (glm::any(glm::greaterThan(glm::abs(cell - point), glm::vec2(OBJ_GRID_TOLERANCE))))
+			{
+				chunk.offGrid++;
+				continue;
+			}
+			grid.columns[(int)point.x][(int)point.y] = vertex.y;
+		}
+		chunk.vertices = std::vector<glm::vec3>();
+	});
+
+	size_t offGrid = 0;
+	for (const ObjChunk& chunk : chunks)
+	{
+		offGrid += chunk.offGrid;
+	}
+	size_t holes = std::count_if(std::execution::par, grid.plane.begin(), grid.plane.end(), [](float height) { return std::isnan(height); });
+	if (offGrid > 0 || holes > 0)
+	{
+		printf("%s is not a complete %d x %d grid: %zu vertices are off the grid points and %zu points have no vertex\n",
+			filePath.c_str(), width, length, offGrid, holes);
+		grid.resize(0, 0);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "height_map/height_grid.h"
+#include <string>
+
+// loads an OBJ whose vertices lie on a regular grid in x and z, like a heightfield exported as
+// a mesh. only the v lines are read: the mapped file is split into chunks parsed in parallel, and
+// every vertex is put straight into the cell its quantized x and z fall in, so the faces and the
+// order of the vertices do not matter. columns follow x, rows follow z and the heights are the
+// y of the vertices. false if the file could not be read or is not a complete grid
+bool importObjHeightfield(const std::string& filePath, HeightGrid& grid);
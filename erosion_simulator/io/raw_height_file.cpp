@@ -0,0 +1,258 @@
+#include "raw_height_file.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+// cells on a side of the blocks rows are turned into columns in, so both stay in cache
+const int RAW_HEIGHT_BLOCK_SIZE = 64;
+
+static const char NUMPY_MAGIC[6] = { '\x93', 'N', 'U', 'M', 'P', 'Y' };
+
+// false unless the whole of text is a number
+template<typename T>
+static bool parseNumber(const std::string& text, T& value)
+{
+	const char* end = text.data() + text.size();
+	std::from_chars_result result = std::from_chars(text.data(), end, value);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+static size_t skipSpaces(const std::string& text, size_t position)
+{
+	while (position < text.size() && text[position] == ' ') position++;
+	return position;
+}
+
+// reads a whole number at position and moves past it
+static bool parseDimension(const std::string& text, size_t& position, long long& value)
+{
+	const char* end = text.data() + text.size();
+	std::from_chars_result result = std::from_chars(text.data() + position, end, value);
+	if (result.ec != std::errc()) return false;
+	position = result.ptr - text.data();
+	return true;
+}
+
+bool RawHeightFile::open(const std::string& filePath)
+{
+	if (!file.open(filePath))
+		return false;
+
+	std::string extension = std::filesystem::path(filePath).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+	bool valid = false;
+	if (extension == ".npy")
+	{
+		valid = readNumpyHeader();
+	}
+	else if (extension == ".raw")
+	{
+		valid = readSidecarHeader(filePath);
+	}
+	else if (extension == ".r32")
+	{
+		// square, the side follows from the size
+		size_t count = file.getSize() / sizeof(float);
+		width = length = (int)std::llround(std::sqrt((double)count));
+		valid = (size_t)width * length == count;
+	}
+
+	size_t elementSize = format == RawHeightFormat::FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+	if (valid && (width < 2 || length < 2 || dataOffset > file.getSize() || (file.getSize() - dataOffset) / elementSize < (size_t)width * length))
+		valid = false;
+	if (!valid)
+	{
+		printf("%s is not a raw height file this can read\n", filePath.c_str());
+		file.close();
+		return false;
+	}
+	return true;
+}
+
+// the .hdr file holds one key and value per line: width, length, format (float32 or float16),
+// byteorder (little or big), and scale and offset to apply to every height
+bool RawHeightFile::readSidecarHeader(const std::string& filePath)
+{
+	std::string headerPath = std::filesystem::path(filePath).replace_extension(".hdr").string();
+	std::ifstream header(headerPath);
+	if (!header)
+	{
+		printf("Failed to open %s, a .raw height file needs it to tell its size\n", headerPath.c_str());
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(header, line))
+	{
+		std::istringstream values(line);
+		std::string key, value;
+		if (!(values >> key >> value)) continue;
+
+		bool parsed = true;
+		if (key == "width")
+			parsed = parseNumber(value, width);
+		else if (key == "length" || key == "height")
+			parsed = parseNumber(value, length);
+		else if (key == "format")
+		{
+			if (value == "float16")
+				format = RawHeightFormat::FLOAT16;
+			else
+				parsed = value == "float32";
+		}
+		else if (key == "byteorder")
+		{
+			isBigEndian = value == "big";
+			parsed = isBigEndian || value == "little";
+		}
+		else if (key == "scale")
+			parsed = parseNumber(value, scale);
+		else if (key == "offset")
+			parsed = parseNumber(value, offset);
+
+		if (!parsed)
+		{
+			printf("%s has a bad %s: %s\n", headerPath.c_str(), key.c_str(), value.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+// only reads two dimensional, C ordered float32 and float16 arrays. the first dimension is y,
+// so the array holds rows along x
+bool RawHeightFile::readNumpyHeader()
+{
+	const uint8_t* data = file.getData();
+	size_t size = file.getSize();
+	if (size < 10 || std::memcmp(data, NUMPY_MAGIC, sizeof(NUMPY_MAGIC)) != 0)
+		return false;
+
+	uint8_t majorVersion = data[6];
+	size_t headerLength;
+	size_t headerStart;
+	if (majorVersion == 1)
+	{
+		headerLength = data[8] | (data[9] << 8);
+		headerStart = 10;
+	}
+	else
+	{
+		if (size < 12) return false;
+		headerLength = data[8] | (data[9] << 8) | (data[10] << 16) | ((size_t)data[11] << 24);
+		headerStart = 12;
+	}
+	if (headerLength > size - headerStart)
+		return false;
+	dataOffset = headerStart + headerLength;
+
+	std::string header((const char*)data + headerStart, headerLength);
+	auto findValue = [&](const std::string& key) -> size_t
+	{
+		size_t position = header.find("'" + key + "'");
+		if (position == std::string::npos) return position;
+		return header.find(':', position);
+	};
+
+	size_t descr = findValue("descr");
+	if (descr == std::string::npos) return false;
+	size_t quote = header.find('\'', descr);
+	if (quote == std::string::npos) return false;
+	std::string type = header.substr(quote + 1, 3);
+	if (type == "<f4" || type == ">f4")
+		format = RawHeightFormat::FLOAT32;
+	else if (type == "<f2" || type == ">f2")
+		format = RawHeightFormat::FLOAT16;
+	else
+		return false;
+	isBigEndian = type[0] == '>';
+
+	size_t order = findValue("fortran_order");
+	if (order == std::string::npos) return false;
+	order = skipSpaces(header, order + 1);
+	if (header.compare(order, 4, "True") == 0)
+	{
+		printf("fortran ordered .npy arrays are not supported, save the array in C order\n");
+		return false;
+	}
+	if (header.compare(order, 5, "False") != 0) return false;
+
+	// exactly two dimensions, (rows, columns) with an optional trailing comma
+	size_t shape = findValue("shape");
+	if (shape == std::string::npos) return false;
+	size_t position = skipSpaces(header, shape + 1);
+	long long rows = 0, columns = 0;
+	if (position >= header.size() || header[position] != '(') return false;
+	position = skipSpaces(header, position + 1);
+	if (!parseDimension(header, position, rows)) return false;
+	position = skipSpaces(header, position);
+	if (position >= header.size() || header[position] != ',') return false;
+	position = skipSpaces(header, position + 1);
+	if (!parseDimension(header, position, columns)) return false;
+	position = skipSpaces(header, position);
+	if (position < header.size() && header[position] == ',')
+		position = skipSpaces(header, position + 1);
+	if (position >= header.size() || header[position] != ')') return false;
+	if (rows > INT_MAX || columns > INT_MAX) return false;
+	length = (int)rows;
+	width = (int)columns;
+	return true;
+}
+
+float RawHeightFile::read(size_t index) const
+{
+	const uint8_t* data = file.getData() + dataOffset;
+	float height;
+	if (format == RawHeightFormat::FLOAT32)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, data + index * sizeof(float), sizeof(bits));
+		if (isBigEndian)
+			bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+		std::memcpy(&height, &bits, sizeof(height));
+	}
+	else
+	{
+		uint16_t bits;
+		std::memcpy(&bits, data + index * sizeof(uint16_t), sizeof(bits));
+		if (isBigEndian)
+			bits = (uint16_t)((bits >> 8) | (bits << 8));
+		height = glm::unpackHalf1x16(bits);
+	}
+	return height * scale + offset;
+}
+
+void RawHeightFile::convert(float* const* columns) const
+{
+	// rows are turned into columns a block at a time
+	int blocksX = (width + RAW_HEIGHT_BLOCK_SIZE - 1) / RAW_HEIGHT_BLOCK_SIZE;
+	int blocksY = (length + RAW_HEIGHT_BLOCK_SIZE - 1) / RAW_HEIGHT_BLOCK_SIZE;
+	std::vector<int> blocks(blocksX * blocksY);
+	std::iota(blocks.begin(), blocks.end(), 0);
+	std::for_each(std::execution::par, blocks.begin(), blocks.end(), [&](int block)
+	{
+		int minX = block % blocksX * RAW_HEIGHT_BLOCK_SIZE;
+		int minY = block / blocksX * RAW_HEIGHT_BLOCK_SIZE;
+		int maxX = std::min(width, minX + RAW_HEIGHT_BLOCK_SIZE);
+		int maxY = std::min(length, minY + RAW_HEIGHT_BLOCK_SIZE);
+		for (int y = minY; y < maxY; y++)
+		{
+			size_t row = (size_t)y * width;
+			for (int x = minX; x < maxX; x++)
+			{
+				columns[x][y] = read(row + x);
+			}
+		}
+	});
+}
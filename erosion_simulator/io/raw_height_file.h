@@ -0,0 +1,40 @@
+#pragma once
+#include "io/mapped_file.h"
+#include <string>
+
+enum class RawHeightFormat
+{
+	FLOAT32,
+	FLOAT16,
+};
+
+// a file of raw heights, mapped into memory while it is open. the heights are read straight
+// from the file's pages with no staging buffer, so converting a large map never holds it twice.
+// reads .r32, square little endian float32 rows, .raw next to a .hdr file describing it, and C ordered .npy
+class RawHeightFile
+{
+public:
+	// false if the file or its header could not be read
+	bool open(const std::string& filePath);
+
+	int getWidth() const { return width; }
+	int getLength() const { return length; }
+
+	// converts every height into columns [x][y], in parallel and in a single pass over the file
+	void convert(float* const* columns) const;
+
+private:
+	bool readSidecarHeader(const std::string& filePath);
+	bool readNumpyHeader();
+	float read(size_t index) const;
+
+	MappedFile file;
+	// offset of the first height in the file
+	size_t dataOffset = 0;
+	int width = 0;
+	int length = 0;
+	RawHeightFormat format = RawHeightFormat::FLOAT32;
+	bool isBigEndian = false;
+	float scale = 1.0f;
+	float offset = 0.0f;
+};
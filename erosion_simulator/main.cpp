@@ -10,16 +10,30 @@
 #include <string>
 #include <vector>
 #include <chrono>
+#include <cstring>
+#include <sstream>
 #include <mesh/water_mesh.h>
-#include "external/simpleppm.h"
+#include "simulation/warm_start.h"
+#include "simulation/hydrology.h"
+#include "simulation/pristine_state.h"
+#include "simulation/simulation_thread.h"
+#include "texture/heightfield_textures.h"
+#include "export/mesh_export.h"
+#include "simulation/checkpoint.h"
+#include "simulation/snapshot_writer.h"
+#include "io/field_codec.h"
+#include "io/height_map_writer.h"
+#include "simulation/frame_recorder.h"
+#include "simulation/simulation_history.h"
 
 #include <iostream>
+#include <mutex>
+#include <optional>
 
 #include <random>
 #include "imgui.h"
 
 #define GLM_FORCE_RADIANS
-const float GRAVITY_ACCELERATION = 9.807f;
 
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
@@ -57,13 +71,25 @@ float minHeight = -128;
 float maxHeight = 128;
 float random = 4;
 HeightMap map(minHeight, maxHeight);
+// what resets go back to, the terrain is shared with the map and the terrain mesh
+PristineState pristine;
 
 TerrainMesh* terrainMesh;
 WaterMesh* waterMesh;
+HeightfieldTextures* heightfieldTextures;
 
 ErosionModel* erosionModel;
 SimulationParametersUI* simParams;
 
+// the ui edits its own copy of the parameters, the simulation thread gets every edit as a command
+ErosionParameters editedParameters;
+// the parameters of a checkpoint the simulation thread restored, for the ui copy to take over
+std::mutex restoredParametersMutex;
+std::optional<ErosionParameters> restoredParameters;
+SimulationThread* simulationThread;
+// recent states the timeline can jump back to. the viewer always keeps them, headless runs only when asked
+SimulationHistory* history = nullptr;
+
 std::default_random_engine gen;
 std::uniform_int_distribution<> distr;
 
@@ -72,6 +98,41 @@ glm::vec3 cursorOverPosition = glm::vec3(INT_MIN);
 
 float timePast = 0.0f;
 
+struct RunOptions
+{
+	bool headless = false;
+	int maxSteps = 10000;
+	bool stopOnConvergence = false;
+	// written after the run if set, .glb or .obj
+	std::string exportPath;
+	// writes the final terrain as .pgm, .png or .pfm
+	std::string saveHeightMapPath;
+	float exportMaxError = 0.25f;
+	bool exportWater = false;
+	// restored before the run and written after it if set
+	std::string resumePath;
+	std::string checkpointPath;
+	// checkpoints written in the background every snapshotInterval steps, if not 0
+	int snapshotInterval = 0;
+	std::string snapshotPrefix = "snapshot";
+	// applies to both the final checkpoint and the snapshots
+	bool compressCheckpoints = false;
+	// prints how well every field of the final model compresses
+	bool benchmarkCodec = false;
+	// fields recorded every recordInterval steps, from the first, if recordPath is set
+	std::string recordPath;
+	int recordInterval = 10;
+	std::vector<CheckpointFieldId> recordFields = { CheckpointFieldId::TERRAIN_HEIGHTS, CheckpointFieldId::WATER_HEIGHTS, CheckpointFieldId::SUSPENDED_SEDIMENT };
+	// 0 records losslessly
+	float recordMaxError = 0.0f;
+	// keeps recent states in memory every historyInterval steps if not 0, to measure what it costs the step
+	int historyInterval = 0;
+	int historyBudgetMB = (int)(DEFAULT_HISTORY_BUDGET >> 20);
+	// part of an image or DEM height map to load, and the size to resample it to
+	DemImportOptions importOptions;
+};
+RunOptions runOptions;
+
 void raycastThroughScene()
 {
 	float pixelSize = (2 * tanf(fov) / 2 / window.getHeight());
@@ -111,301 +172,369 @@ void raycastThroughScene()
 	}
 }
 
-void initModel()
+// fills lakes and seeds rivers with the discharge they would settle at,
+// instead of letting the simulation spin them up from sea level water
+float getPrepassRainPerStep(float dt)
+{
+	if (!erosionModel->isRaining)
+		return 0.0f;
+	float rainChance = (float)(erosionModel->rainAmount * erosionModel->width) / (map.getWidth() * map.getLength());
+	return rainChance * dt * erosionModel->rainIntensity * erosionModel->simulationSpeed;
+}
+void runHydrologyPrepass(float dt)
+{
+	seedLakesAndRivers(erosionModel, getPrepassRainPerStep(dt), dt);
+}
+// everything the prepass result depends on besides the terrain
+std::vector<float> getPrepassSignature(float dt)
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	std::vector<float> signature{
+		erosionModel->seaLevel,
+		getPrepassRainPerStep(dt),
+		dt,
+		erosionModel->lx,
+		erosionModel->ly,
+		erosionModel->area,
+		erosionModel->gridOrigin.x,
+		erosionModel->gridOrigin.y,
+	};
+	for (const WaterSource& waterSource : erosionModel->waterSources)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			erosionModel->terrainHeights[x][y] = map.samplePoint(x, y);
-			erosionModel->waterHeights[x][y] = erosionModel->seaLevel > erosionModel->terrainHeights[x][y] ? erosionModel->seaLevel - erosionModel->terrainHeights[x][y] : 0.0f;
-			erosionModel->suspendedSedimentAmounts[x][y] = 0.0f;
-			erosionModel->outflowFlux[x][y] = FlowFlux{};
-			erosionModel->velocities[x][y] = glm::vec2(0.0f);
-			erosionModel->terrainHardness[x][y] = 0.1f;
-		}
+		signature.insert(signature.end(), { waterSource.position.x, waterSource.position.z, waterSource.radius, waterSource.intensity });
+	}
+	return signature;
+}
+// the pristine terrain and sea, with the lakes filled if that is on. what the prepass settled
+// is kept, it only runs again for a new terrain or when what it depends on changed
+void restorePristineModel()
+{
+	const float dt = 0.033333f;
+	if (!erosionModel->useHydrologyPrepass)
+	{
+		pristine.restore(erosionModel);
+		return;
 	}
+
+	std::vector<float> signature = getPrepassSignature(dt);
+	if (pristine.restoreSettled(erosionModel, signature))
+		return;
+	pristine.restore(erosionModel);
+	runHydrologyPrepass(dt);
+	pristine.captureSettled(erosionModel, std::move(signature));
+}
+
+void initModel()
+{
+	pristine.capture(map.getGrid());
+	restorePristineModel();
 }
+// back to the pristine terrain and sea, the lakes are filled again if that is on
 void resetModel()
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	// every field is overwritten, a checkpoint the model was restored from can be let go
+	erosionModel->ownFields(false);
+	restorePristineModel();
+	erosionModel->convergence->reset();
+	if (history)
+		history->clear();
+}
+// runs function for every cell, for the water kernels, which keep water flowing through throttled tiles
+template <typename Function>
+void forEachCell(ErosionModel* model, Function function)
+{
+	for (int y = 0; y < model->length; y++)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
+		for (int x = 0; x < model->width; x++)
 		{
-			erosionModel->terrainHeights[x][y] = map.samplePoint(x, y);
-			erosionModel->waterHeights[x][y] = erosionModel->seaLevel > erosionModel->terrainHeights[x][y] ? erosionModel->seaLevel - erosionModel->terrainHeights[x][y] : 0.0f;;
-			erosionModel->suspendedSedimentAmounts[x][y] = 0.0f;
-			erosionModel->outflowFlux[x][y] = FlowFlux{};
-			erosionModel->velocities[x][y] = glm::vec2(0.0f);
-			erosionModel->terrainHardness[x][y] = 0.1f;
+			function(x, y);
 		}
 	}
-
-	terrainMesh->updateOriginalHeights(&erosionModel->terrainHeights);
-	terrainMesh->updateMeshFromHeights(&erosionModel->terrainHeights);
-	waterMesh->updateMeshFromHeights(&erosionModel->terrainHeights, &erosionModel->waterHeights, &erosionModel->velocities, &erosionModel->suspendedSedimentAmounts);
 }
-void addPrecipitation(float dt) {
-
-	float sinIntensity = std::max(0.f, std::sinf(timePast / (erosionModel->waveInterval) * erosionModel->simulationSpeed));
-
-	for (int y = 0; y < erosionModel->length; y++)
+// runs function for every cell of the tiles the convergence monitor did not throttle this step
+template <typename Function>
+void forEachActiveCell(ErosionModel* model, Function function)
+{
+	ConvergenceMonitor* convergence = model->convergence;
+	for (int tileY = 0; tileY < convergence->getTileCountY(); tileY++)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
+		for (int tileX = 0; tileX < convergence->getTileCountX(); tileX++)
 		{
-			// adjust sea level minimum water amount
-			if (erosionModel->waterHeights[x][y] + erosionModel->terrainHeights[x][y] < erosionModel->seaLevel)
-				erosionModel->waterHeights[x][y] += dt;
-			if (erosionModel->isRaining) {
-				if (distr(gen) <= erosionModel->rainAmount * erosionModel->width)
-					erosionModel->waterHeights[x][y] += dt * erosionModel->rainIntensity * erosionModel->simulationSpeed;
-			}
+			if (!convergence->isTileActive(tileX, tileY)) continue;
 
-			for (WaterSource waterSource : erosionModel->waterSources)
+			int maxX = std::min(model->width, (tileX + 1) * SIMULATION_TILE_SIZE);
+			int maxY = std::min(model->length, (tileY + 1) * SIMULATION_TILE_SIZE);
+			for (int y = tileY * SIMULATION_TILE_SIZE; y < maxY; y++)
 			{
-				glm::vec3 mapPos = terrainMesh->getPositionAtIndex(x, y);
-				if (glm::length(glm::vec2(waterSource.position.x, waterSource.position.z) - glm::vec2(mapPos.x, mapPos.z)) < waterSource.radius)
+				for (int x = tileX * SIMULATION_TILE_SIZE; x < maxX; x++)
 				{
-					erosionModel->waterHeights[x][y] += dt * waterSource.intensity;
+					function(x, y);
 				}
 			}
+		}
+	}
+}
+void addPrecipitation(ErosionModel* model, float dt) {
 
-			if (erosionModel->generateWaves && (erosionModel->terrainHeights[x][y] - erosionModel->seaLevel) < 0)
+	float sinIntensity = std::max(0.f, std::sinf(timePast / (model->waveInterval) * model->simulationSpeed));
+
+	forEachCell(model, [&](int x, int y)
+	{
+		// adjust sea level minimum water amount
+		if (model->waterHeights[x][y] + model->terrainHeights[x][y] < model->seaLevel)
+			model->waterHeights[x][y] += dt;
+		if (model->isRaining) {
+			// coarse cells cover lx fine cells per row, keep the rain per area the same
+			if (distr(gen) <= model->rainAmount * model->width * model->lx)
+				model->waterHeights[x][y] += dt * model->rainIntensity * model->simulationSpeed;
+		}
+
+		for (WaterSource waterSource : model->waterSources)
+		{
+			glm::vec2 mapPos = model->getCellPosition(x, y);
+			if (glm::length(glm::vec2(waterSource.position.x, waterSource.position.z) - mapPos) < waterSource.radius)
 			{
-				switch (erosionModel->waveDirection)
-				{
-				case WaveDirection::NORTH:
-					if (y == 0)
-						erosionModel->waterHeights[x][y] += dt * sinIntensity * erosionModel->waveStrength * erosionModel->simulationSpeed;
-					break;
-				case WaveDirection::SOUTH:
-					if (y == erosionModel->length - 1)
-						erosionModel->waterHeights[x][y] += dt * sinIntensity * erosionModel->waveStrength * erosionModel->simulationSpeed;
-					break;
-				case WaveDirection::EAST:
-					if (x == erosionModel->width - 1)
-						erosionModel->waterHeights[x][y] += dt * sinIntensity * erosionModel->waveStrength * erosionModel->simulationSpeed;
-					break;
-				case WaveDirection::WEST:
-					if (x == 0)
-						erosionModel->waterHeights[x][y] += dt * sinIntensity * erosionModel->waveStrength * erosionModel->simulationSpeed;
-					break;
-				}
+				model->waterHeights[x][y] += dt * waterSource.intensity;
 			}
+		}
 
+		if (model->generateWaves && (model->terrainHeights[x][y] - model->seaLevel) < 0)
+		{
+			switch (model->waveDirection)
+			{
+			case WaveDirection::NORTH:
+				if (y == 0)
+					model->waterHeights[x][y] += dt * sinIntensity * model->waveStrength * model->simulationSpeed;
+				break;
+			case WaveDirection::SOUTH:
+				if (y == model->length - 1)
+					model->waterHeights[x][y] += dt * sinIntensity * model->waveStrength * model->simulationSpeed;
+				break;
+			case WaveDirection::EAST:
+				if (x == model->width - 1)
+					model->waterHeights[x][y] += dt * sinIntensity * model->waveStrength * model->simulationSpeed;
+				break;
+			case WaveDirection::WEST:
+				if (x == 0)
+					model->waterHeights[x][y] += dt * sinIntensity * model->waveStrength * model->simulationSpeed;
+				break;
+			}
 		}
-	}
+	});
 }
-void paint(float dt) {
-	if (window.getMouseButton(GLFW_MOUSE_BUTTON_LEFT))
+// paints every cell under any of the stamps once, however many stamps were merged into the step.
+// returns the cells that were painted, after handing them to edits so the stroke can be undone
+DirtyRect paint(float dt, const BrushStroke& stroke, EditHistory& edits) {
+	if (stroke.positions.empty()) return DirtyRect{};
+
+	glm::vec2 minCorner = glm::vec2(INFINITY);
+	glm::vec2 maxCorner = glm::vec2(-INFINITY);
+	for (glm::vec2 position : stroke.positions)
 	{
-		for (int y = 0; y < erosionModel->length; y++)
+		minCorner = glm::min(minCorner, position - erosionModel->gridOrigin - erosionModel->brushRadius);
+		maxCorner = glm::max(maxCorner, position - erosionModel->gridOrigin + erosionModel->brushRadius);
+	}
+
+	int minX = std::max(0, (int)std::floor(minCorner.x / erosionModel->lx));
+	int minY = std::max(0, (int)std::floor(minCorner.y / erosionModel->ly));
+	int maxX = std::min(erosionModel->width - 1, (int)std::ceil(maxCorner.x / erosionModel->lx));
+	int maxY = std::min(erosionModel->length - 1, (int)std::ceil(maxCorner.y / erosionModel->ly));
+	if (minX > maxX || minY > maxY) return DirtyRect{};
+
+	erosionModel->convergence->wakeArea(minX, minY, maxX, maxY);
+
+	PaintMode mode = erosionModel->paintMode;
+	bool editsTerrain = mode == PaintMode::TERRAIN_ADD || mode == PaintMode::TERRAIN_REMOVE;
+	bool editsWater = mode == PaintMode::WATER_ADD || mode == PaintMode::WATER_REMOVE;
+	DirtyRect painted = DirtyRect{ minX, minY, maxX, maxY };
+	if (editsTerrain || editsWater)
+		edits.beforeEdit(erosionModel, editsTerrain ? EditField::TERRAIN : EditField::WATER, painted);
+
+	for (int y = minY; y <= maxY; y++)
+	{
+		for (int x = minX; x <= maxX; x++)
 		{
-			for (int x = 0; x < erosionModel->width; x++)
+			glm::vec2 mapPos = erosionModel->getCellPosition(x, y);
+			bool underBrush = false;
+			for (glm::vec2 position : stroke.positions)
 			{
-				glm::vec3 mapPos = terrainMesh->getPositionAtIndex(x, y);
-				if (glm::length(glm::vec2(cursorOverPosition.x, cursorOverPosition.z) - glm::vec2(mapPos.x, mapPos.z)) < erosionModel->brushRadius)
+				if (glm::length(position - mapPos) < erosionModel->brushRadius)
 				{
-					switch (erosionModel->paintMode)
-					{
-					case PaintMode::WATER_ADD:
-						erosionModel->waterHeights[x][y] += dt * erosionModel->brushIntensity;
-						break;
-					case PaintMode::WATER_REMOVE:
-						erosionModel->waterHeights[x][y] -= dt * erosionModel->brushIntensity;
-						erosionModel->waterHeights[x][y] = std::max(erosionModel->waterHeights[x][y], 0.0f);
-						break;
-					case PaintMode::TERRAIN_ADD:
-						erosionModel->terrainHeights[x][y] += dt * erosionModel->brushIntensity;// *(1 - glm::length(cursorOverPosition - mapPos) / brushRadius);
-						break;
-					case PaintMode::TERRAIN_REMOVE:
-						erosionModel->terrainHeights[x][y] -= dt * erosionModel->brushIntensity;//  * (1 - glm::length(cursorOverPosition - mapPos) / brushRadius);
-						break;
-					default:
-						break;
-					}
+					underBrush = true;
+					break;
 				}
 			}
+			if (!underBrush) continue;
+
+			switch (erosionModel->paintMode)
+			{
+			case PaintMode::WATER_ADD:
+				erosionModel->waterHeights[x][y] += dt * erosionModel->brushIntensity;
+				break;
+			case PaintMode::WATER_REMOVE:
+				erosionModel->waterHeights[x][y] -= dt * erosionModel->brushIntensity;
+				erosionModel->waterHeights[x][y] = std::max(erosionModel->waterHeights[x][y], 0.0f);
+				break;
+			case PaintMode::TERRAIN_ADD:
+				erosionModel->terrainHeights[x][y] += dt * erosionModel->brushIntensity;// *(1 - glm::length(cursorOverPosition - mapPos) / brushRadius);
+				break;
+			case PaintMode::TERRAIN_REMOVE:
+				erosionModel->terrainHeights[x][y] -= dt * erosionModel->brushIntensity;//  * (1 - glm::length(cursorOverPosition - mapPos) / brushRadius);
+				break;
+			default:
+				break;
+			}
 		}
 	}
 
-	if (window.getMouseButtonDown(GLFW_MOUSE_BUTTON_LEFT))
+	if (editsTerrain || editsWater)
+		edits.afterEdit(erosionModel, editsTerrain ? EditField::TERRAIN : EditField::WATER, painted);
+	return painted;
+}
+void calculateModelOutflowFlux(ErosionModel* model, float dt)
+{
+	forEachCell(model, [&](int x, int y)
 	{
-		if (erosionModel->paintMode == PaintMode::WATER_SOURCE)
+		for (int j = -1; j <= 1; j++)
 		{
-			for (int y = 0; y < erosionModel->length; y++)
+			for (int i = -1; i <= 1; i++)
 			{
-				for (int x = 0; x < erosionModel->width; x++)
-				{
-					glm::vec3 mapPos = terrainMesh->getPositionAtIndex(x, y);
-					if (glm::length(glm::vec2(cursorOverPosition.x, cursorOverPosition.z) - glm::vec2(mapPos.x, mapPos.z)) < 0.5f)
-					{
-						WaterSource source = WaterSource();
-						source.position = mapPos;
-						source.intensity = erosionModel->brushIntensity;
-						source.radius = erosionModel->brushRadius;
+				if (abs(i) == abs(j)) continue;
+				float f = 0.0f;
+				if (model->getCell(x + i, y + j) != nullptr) {
+					float dHeight = model->terrainHeights[x][y] + model->waterHeights[x][y] - (model->terrainHeights[x + i][y + j] + model->waterHeights[x + i][y + j]);
+					float dPressure = model->fluidDensity * GRAVITY_ACCELERATION * dHeight;
+					float acceleration = dPressure / (model->fluidDensity * model->lx);
+					f = dt * model->simulationSpeed * model->area * acceleration;
+				}
 
-						erosionModel->waterSources.push_back(source);
-					}
+				// compute flux
+				if (j == -1) {
+					model->outflowFlux[x][y].bottom = std::max(0.0f, model->outflowFlux[x][y].bottom + f);
+				}
+				else if (j == 1) {
+					model->outflowFlux[x][y].top = std::max(0.0f, model->outflowFlux[x][y].top + f);
+				}
+				else if (i == -1) {
+					model->outflowFlux[x][y].left = std::max(0.0f, model->outflowFlux[x][y].left + f);
+				}
+				else if (i == 1) {
+					model->outflowFlux[x][y].right = std::max(0.0f, model->outflowFlux[x][y].right + f);
+				}
+
+				// rescale
+				if (j == -1) {
+					model->outflowFlux[x][y].bottom *= std::min(1.0f, model->waterHeights[x][y] * model->area / (model->outflowFlux[x][y].bottom * dt));
+				}
+				else if (j == 1) {
+					model->outflowFlux[x][y].top *= std::min(1.0f, model->waterHeights[x][y] * model->area / (model->outflowFlux[x][y].top * dt));
+				}
+				else if (i == -1) {
+					model->outflowFlux[x][y].left *= std::min(1.0f, model->waterHeights[x][y] * model->area / (model->outflowFlux[x][y].left * dt));
+				}
+				else if (i == 1) {
+					model->outflowFlux[x][y].right *= std::min(1.0f, model->waterHeights[x][y] * model->area / (model->outflowFlux[x][y].right * dt));
 				}
 			}
 		}
-	}
+
+		model->outflowFlux[x][y].bottom = std::max(0.0f, model->outflowFlux[x][y].bottom);
+		model->outflowFlux[x][y].top = std::max(0.0f, model->outflowFlux[x][y].top);
+		model->outflowFlux[x][y].left = std::max(0.0f, model->outflowFlux[x][y].left);
+		model->outflowFlux[x][y].right = std::max(0.0f, model->outflowFlux[x][y].right);
+	});
 }
-void calculateModelOutflowFlux(float dt)
+void calculateModelWaterHeights(ErosionModel* model, float dt)
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachCell(model, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
+		float finX = 0.0f;
+		float finY = 0.0f;
+		float foutX = model->outflowFlux[x][y].left + model->outflowFlux[x][y].right;
+		float foutY = model->outflowFlux[x][y].top + model->outflowFlux[x][y].bottom;
+
+		float finL = 0.0f;
+		float finR = 0.0f;
+		float finT = 0.0f;
+		float finB = 0.0f;
+
+		float foutL = model->outflowFlux[x][y].left;
+		float foutR = model->outflowFlux[x][y].right;
+		float foutT = model->outflowFlux[x][y].top;
+		float foutB = model->outflowFlux[x][y].bottom;
+
+		for (int j = -1; j <= 1; j++)
 		{
-			for (int j = -1; j <= 1; j++)
+			for (int i = -1; i <= 1; i++)
 			{
-				for (int i = -1; i <= 1; i++)
-				{
-					if (abs(i) == abs(j)) continue;
-					float f = 0.0f;
-					if (erosionModel->getCell(x + i, y + j) != nullptr) {
-						float dHeight = erosionModel->terrainHeights[x][y] + erosionModel->waterHeights[x][y] - (erosionModel->terrainHeights[x + i][y + j] + erosionModel->waterHeights[x + i][y + j]);
-						float dPressure = erosionModel->fluidDensity * GRAVITY_ACCELERATION * dHeight;
-						float acceleration = dPressure / (erosionModel->fluidDensity * erosionModel->lx);
-						f = dt * erosionModel->simulationSpeed * erosionModel->area * acceleration;
-					}
-
-					// compute flux
+				if (abs(i) == abs(j)) continue;
+				if (model->getCell(x - i, y - j) != nullptr) {
+					FlowFlux flux = model->outflowFlux[x - i][y - j];
 					if (j == -1) {
-						erosionModel->outflowFlux[x][y].bottom = std::max(0.0f, erosionModel->outflowFlux[x][y].bottom + f);
+						finY += flux.bottom;
+						finB = flux.bottom;
 					}
 					else if (j == 1) {
-						erosionModel->outflowFlux[x][y].top = std::max(0.0f, erosionModel->outflowFlux[x][y].top + f);
+						finY += flux.top;
+						finT = flux.top;
 					}
 					else if (i == -1) {
-						erosionModel->outflowFlux[x][y].left = std::max(0.0f, erosionModel->outflowFlux[x][y].left + f);
+						finX += flux.left;
+						finL = flux.left;
 					}
 					else if (i == 1) {
-						erosionModel->outflowFlux[x][y].right = std::max(0.0f, erosionModel->outflowFlux[x][y].right + f);
-					}
-
-					// rescale
-					if (j == -1) {
-						erosionModel->outflowFlux[x][y].bottom *= std::min(1.0f, erosionModel->waterHeights[x][y] * erosionModel->area / (erosionModel->outflowFlux[x][y].bottom * dt));
-					}
-					else if (j == 1) {
-						erosionModel->outflowFlux[x][y].top *= std::min(1.0f, erosionModel->waterHeights[x][y] * erosionModel->area / (erosionModel->outflowFlux[x][y].top * dt));
-					}
-					else if (i == -1) {
-						erosionModel->outflowFlux[x][y].left *= std::min(1.0f, erosionModel->waterHeights[x][y] * erosionModel->area / (erosionModel->outflowFlux[x][y].left * dt));
-					}
-					else if (i == 1) {
-						erosionModel->outflowFlux[x][y].right *= std::min(1.0f, erosionModel->waterHeights[x][y] * erosionModel->area / (erosionModel->outflowFlux[x][y].right * dt));
+						finX += flux.right;
+						finR = flux.right;
 					}
 				}
 			}
-
-			erosionModel->outflowFlux[x][y].bottom = std::max(0.0f, erosionModel->outflowFlux[x][y].bottom);
-			erosionModel->outflowFlux[x][y].top = std::max(0.0f, erosionModel->outflowFlux[x][y].top);
-			erosionModel->outflowFlux[x][y].left = std::max(0.0f, erosionModel->outflowFlux[x][y].left);
-			erosionModel->outflowFlux[x][y].right = std::max(0.0f, erosionModel->outflowFlux[x][y].right);
 		}
-	}
-}
-void calculateModelWaterHeights(float dt)
-{
-	for (int y = 0; y < erosionModel->length; y++)
-	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			float finX = 0.0f;
-			float finY = 0.0f;
-			float foutX = erosionModel->outflowFlux[x][y].left + erosionModel->outflowFlux[x][y].right;
-			float foutY = erosionModel->outflowFlux[x][y].top + erosionModel->outflowFlux[x][y].bottom;
-
-			float finL = 0.0f;
-			float finR = 0.0f;
-			float finT = 0.0f;
-			float finB = 0.0f;
-
-			float foutL = erosionModel->outflowFlux[x][y].left;
-			float foutR = erosionModel->outflowFlux[x][y].right;
-			float foutT = erosionModel->outflowFlux[x][y].top;
-			float foutB = erosionModel->outflowFlux[x][y].bottom;
-
-			for (int j = -1; j <= 1; j++)
-			{
-				for (int i = -1; i <= 1; i++)
-				{
-					if (abs(i) == abs(j)) continue;
-					if (erosionModel->getCell(x - i, y - j) != nullptr) {
-						FlowFlux flux = erosionModel->outflowFlux[x - i][y - j];
-						if (j == -1) {
-							finY += flux.bottom;
-							finB = flux.bottom;
-						}
-						else if (j == 1) {
-							finY += flux.top;
-							finT = flux.top;
-						}
-						else if (i == -1) {
-							finX += flux.left;
-							finL = flux.left;
-						}
-						else if (i == 1) {
-							finX += flux.right;
-							finR = flux.right;
-						}
-					}
-				}
-			}
 
-			float currentWaterHeight = erosionModel->waterHeights[x][y];
-			float nextWaterHeight = currentWaterHeight + dt * ((finX + finY) - (foutX + foutY)) / (erosionModel->area);
+		float currentWaterHeight = model->waterHeights[x][y];
+		float nextWaterHeight = currentWaterHeight + dt * ((finX + finY) - (foutX + foutY)) / (model->area);
 
-			float wX = (finR - foutL + foutR - finL) / 2;
-			float wY = (finT - foutB + foutT - finB) / 2;
+		float wX = (finR - foutL + foutR - finL) / 2;
+		float wY = (finT - foutB + foutT - finB) / 2;
 
 
-			float avgWaterHeight = (currentWaterHeight + nextWaterHeight) / 2;
+		float avgWaterHeight = (currentWaterHeight + nextWaterHeight) / 2;
 
-			float xVelocity = (wX / (erosionModel->lx * std::max(1.0f, avgWaterHeight)));
-			float yVelocity = (wY / (erosionModel->ly * std::max(1.0f, avgWaterHeight)));
+		float xVelocity = (wX / (model->lx * std::max(1.0f, avgWaterHeight)));
+		float yVelocity = (wY / (model->ly * std::max(1.0f, avgWaterHeight)));
 
-			// paper says to scale velocity with water volume 
-			// but I found to leave it as it is is fine
-			//xVelocity /= std::max(1.0f, avgWaterHeight);
-			//yVelocity /= avgWaterHeight;
+		// paper says to scale velocity with water volume 
+		// but I found to leave it as it is is fine
+		//xVelocity /= std::max(1.0f, avgWaterHeight);
+		//yVelocity /= avgWaterHeight;
 
 
-			erosionModel->velocities[x][y] = glm::vec2(xVelocity, yVelocity);
-			erosionModel->waterHeights[x][y] = nextWaterHeight;
-		}
-	}
+		model->velocities[x][y] = glm::vec2(xVelocity, yVelocity);
+		model->waterHeights[x][y] = nextWaterHeight;
+	});
 }
 void sedimentDeposition(float dt)
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachActiveCell(erosionModel, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			float tiltAngle = acosf(glm::dot(terrainMesh->getNormalAtIndex(x, y), glm::vec3(0, 1, 0)));
-			float mag = glm::length(erosionModel->velocities[x][y]);
+		float tiltAngle = acosf(glm::dot(erosionModel->getTerrainNormal(x, y), glm::vec3(0, 1, 0)));
+		float mag = glm::length(erosionModel->velocities[x][y]);
 
-			float lmax = std::clamp(1 - std::max(0.f, erosionModel->maxErosionDepth - erosionModel->waterHeights[x][y]) / erosionModel->maxErosionDepth, 0.f, 1.f);
-			float sedimentTransportCapacity = mag * erosionModel->sedimentCapacity * std::max(sinf(tiltAngle), 0.05f) * lmax;
+		float lmax = std::clamp(1 - std::max(0.f, erosionModel->maxErosionDepth - erosionModel->waterHeights[x][y]) / erosionModel->maxErosionDepth, 0.f, 1.f);
+		float sedimentTransportCapacity = mag * erosionModel->sedimentCapacity * std::max(sinf(tiltAngle), 0.05f) * lmax;
 
-			if (erosionModel->suspendedSedimentAmounts[x][y] < sedimentTransportCapacity)
-			{
-				//take sediment
-				float diff = dt * 0.5f * (sedimentTransportCapacity - erosionModel->suspendedSedimentAmounts[x][y]);
-				erosionModel->terrainHeights[x][y] -= diff;
-				erosionModel->suspendedSedimentAmounts[x][y] += diff;
-			}
-			else if (erosionModel->suspendedSedimentAmounts[x][y] > sedimentTransportCapacity)
-			{
-				float diff = dt * (erosionModel->suspendedSedimentAmounts[x][y] - sedimentTransportCapacity);
-				erosionModel->terrainHeights[x][y] += diff;
-				erosionModel->suspendedSedimentAmounts[x][y] -= diff;
-			}
+		if (erosionModel->suspendedSedimentAmounts[x][y] < sedimentTransportCapacity)
+		{
+			//take sediment
+			float diff = dt * 0.5f * (sedimentTransportCapacity - erosionModel->suspendedSedimentAmounts[x][y]);
+			erosionModel->terrainHeights[x][y] -= diff;
+			erosionModel->suspendedSedimentAmounts[x][y] += diff;
 		}
-	}
+		else if (erosionModel->suspendedSedimentAmounts[x][y] > sedimentTransportCapacity)
+		{
+			float diff = dt * (erosionModel->suspendedSedimentAmounts[x][y] - sedimentTransportCapacity);
+			erosionModel->terrainHeights[x][y] += diff;
+			erosionModel->suspendedSedimentAmounts[x][y] -= diff;
+		}
+	});
 }
 void transportSediments(float dt)
 {
@@ -415,54 +544,48 @@ void transportSediments(float dt)
 		temp[i] = new float[erosionModel->length];
 	}
 
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachActiveCell(erosionModel, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			temp[x][y] = erosionModel->suspendedSedimentAmounts[x][y];
+		temp[x][y] = erosionModel->suspendedSedimentAmounts[x][y];
 
-			float prevX = x - erosionModel->velocities[x][y].x * dt;
-			float prevY = y - erosionModel->velocities[x][y].y * dt;
+		float prevX = x - erosionModel->velocities[x][y].x * dt;
+		float prevY = y - erosionModel->velocities[x][y].y * dt;
 
-			int x1 = x;
-			int y1 = y;
+		int x1 = x;
+		int y1 = y;
 
-			if (abs((erosionModel->velocities[x][y].y) / (erosionModel->velocities[x][y].x)) < 0.7f)
-				x1 = prevX < x ? std::floor(prevX) : std::ceil(prevX);
+		if (abs((erosionModel->velocities[x][y].y) / (erosionModel->velocities[x][y].x)) < 0.7f)
+			x1 = prevX < x ? std::floor(prevX) : std::ceil(prevX);
 
-			if (abs((erosionModel->velocities[x][y].x) / (erosionModel->velocities[x][y].y)) < 0.7f)
-				y1 = prevY < y ? std::floor(prevY) : std::ceil(prevY);
+		if (abs((erosionModel->velocities[x][y].x) / (erosionModel->velocities[x][y].y)) < 0.7f)
+			y1 = prevY < y ? std::floor(prevY) : std::ceil(prevY);
 
-			if (erosionModel->getCell(x1, y1) != nullptr)
-				temp[x][y] = erosionModel->suspendedSedimentAmounts[x1][y1];
-			else
+		if (erosionModel->getCell(x1, y1) != nullptr)
+			temp[x][y] = erosionModel->suspendedSedimentAmounts[x1][y1];
+		else
+		{
+			int count = 0;
+			float sum = 0.f;
+			for (int j = -1; j <= 1; j++)
 			{
-				int count = 0;
-				float sum = 0.f;
-				for (int j = -1; j <= 1; j++)
+				for (int i = -1; i <= 1; i++)
 				{
-					for (int i = -1; i <= 1; i++)
-					{
-						if (abs(i) == abs(j)) continue;
-						if (erosionModel->getCell(x - i, y - j) != nullptr) {
-							count++;
-							sum += erosionModel->suspendedSedimentAmounts[x - i][y - j];
-						}
+					if (abs(i) == abs(j)) continue;
+					if (erosionModel->getCell(x - i, y - j) != nullptr) {
+						count++;
+						sum += erosionModel->suspendedSedimentAmounts[x - i][y - j];
 					}
 				}
-
-				temp[x][y] = sum / count;
 			}
+
+			temp[x][y] = sum / count;
 		}
-	}
+	});
 
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachActiveCell(erosionModel, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			erosionModel->suspendedSedimentAmounts[x][y] = temp[x][y];
-		}
-	}
+		erosionModel->suspendedSedimentAmounts[x][y] = temp[x][y];
+	});
 
 	for (int x = 0; x < erosionModel->width; x++)
 	{
@@ -472,56 +595,50 @@ void transportSediments(float dt)
 }
 void sedimentSlippage(float dt)
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachActiveCell(erosionModel, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
+		for (int j = -1; j <= 1; j++)
 		{
-			for (int j = -1; j <= 1; j++)
+			for (int i = -1; i <= 1; i++)
 			{
-				for (int i = -1; i <= 1; i++)
-				{
-					if (abs(i) == abs(j)) continue;
-					if (erosionModel->getCell(x - i, y - j) != nullptr) {
-						float dh =
-							(erosionModel->terrainHeights[x][y]) -
-							(erosionModel->terrainHeights[x - i][y - j]);
-						float talus = erosionModel->lx * tanf(glm::radians(erosionModel->slippageAngle));
-						if (dh > talus)
-						{
-							float slippage = dt * (dh - talus);
-							erosionModel->terrainHeights[x][y] -= slippage;
-							erosionModel->terrainHeights[x - i][y - j] += slippage;
-						}
+				if (abs(i) == abs(j)) continue;
+				if (erosionModel->getCell(x - i, y - j) != nullptr) {
+					float dh =
+						(erosionModel->terrainHeights[x][y]) -
+						(erosionModel->terrainHeights[x - i][y - j]);
+					float talus = erosionModel->lx * tanf(glm::radians(erosionModel->slippageAngle));
+					if (dh > talus)
+					{
+						float slippage = dt * (dh - talus);
+						erosionModel->terrainHeights[x][y] -= slippage;
+						erosionModel->terrainHeights[x - i][y - j] += slippage;
 					}
 				}
 			}
 		}
-	}
+	});
 }
-void evaporate(float dt)
+void evaporate(ErosionModel* model, float dt)
 {
-	for (int y = 0; y < erosionModel->length; y++)
+	forEachCell(model, [&](int x, int y)
 	{
-		for (int x = 0; x < erosionModel->width; x++)
-		{
-			//only evaporate above sea level
-			if (erosionModel->waterHeights[x][y] + erosionModel->terrainHeights[x][y] > erosionModel->seaLevel)
-				erosionModel->waterHeights[x][y] *= 1 - (erosionModel->simulationSpeed * erosionModel->evaporationRate * dt);
-		}
-	}
+		//only evaporate above sea level
+		if (model->waterHeights[x][y] + model->terrainHeights[x][y] > model->seaLevel)
+			model->waterHeights[x][y] *= 1 - (model->simulationSpeed * model->evaporationRate * dt);
+	});
 }
-void updateModel(float dt)
+void stepModel(float dt)
 {
-	paint(dt);
+	erosionModel->convergence->beginStep(erosionModel);
 
 	// each frame, water should uniformly increment accross the grid
-	addPrecipitation(dt);
+	addPrecipitation(erosionModel, dt);
 
 	// then calculate the outflow of water to other cells
-	calculateModelOutflowFlux(dt);
+	calculateModelOutflowFlux(erosionModel, dt);
 
 	// receive water from neighbors and send out to neighbors
-	calculateModelWaterHeights(dt);
+	calculateModelWaterHeights(erosionModel, dt);
 
 	sedimentDeposition(dt);
 
@@ -530,66 +647,620 @@ void updateModel(float dt)
 	if (erosionModel->useSedimentSlippage)
 		sedimentSlippage(dt);
 
-	evaporate(dt);
+	evaporate(erosionModel, dt);
+
+	timePast += dt;
+
+	erosionModel->convergence->endStep(erosionModel);
+	if (erosionModel->convergence->consumeConvergedEvent())
+	{
+		printf("Simulation converged after %d steps\n", erosionModel->convergence->getStep());
+		if (erosionModel->pauseOnConvergence)
+			erosionModel->isModelRunning = false;
+	}
+}
+// only the chunks the simulation changed since the last snapshot are rebuilt and uploaded
+void updateMeshes(SimulationSnapshot& snapshot)
+{
+	// the water floor is the terrain
+	DirtyRegion waterDirty = snapshot.waterDirty;
+	waterDirty.add(snapshot.terrainDirty);
+
+	terrainMesh->updateMeshFromHeights(&snapshot.terrainHeights, snapshot.terrainDirty);
+	waterMesh->updateMeshFromHeights(&snapshot.terrainHeights, &snapshot.waterHeights, &snapshot.velocities, &snapshot.suspendedSedimentAmounts, waterDirty);
+}
+
+// brings every vertex up to date, after the height texture path left all but the heights behind
+void rebuildMeshes(SimulationSnapshot& snapshot)
+{
+	terrainMesh->updateMeshFromHeights(&snapshot.terrainHeights);
+	waterMesh->updateMeshFromHeights(&snapshot.terrainHeights, &snapshot.waterHeights, &snapshot.velocities, &snapshot.suspendedSedimentAmounts);
+}
+
+CheckpointRunState getRunState()
+{
+	CheckpointRunState runState;
+	runState.timePast = timePast;
+	runState.randomEngine = gen;
+	return runState;
+}
 
-	terrainMesh->updateMeshFromHeights(&erosionModel->terrainHeights);
-	waterMesh->updateMeshFromHeights(&erosionModel->terrainHeights, &erosionModel->waterHeights, &erosionModel->velocities, &erosionModel->suspendedSedimentAmounts);
+// the model takes over the checkpoint's fields, parameters and run state, the checkpoint is spent afterwards.
+// everything is read before anything is applied, so on false the model is left as it was
+bool restoreCheckpoint(Checkpoint* checkpoint)
+{
+	ErosionParameters parameters = *erosionModel;
+	CheckpointRunState runState;
+	if (!checkpoint->readParameters(parameters) || !checkpoint->readRunState(runState))
+		return false;
+	if (!checkpoint->restoreFields(erosionModel))
+		return false;
+
+	(ErosionParameters&)*erosionModel = parameters;
+	timePast = runState.timePast;
+	gen = runState.randomEngine;
+	erosionModel->convergence->reset();
+	return true;
 }
 
+// opens a checkpoint that fits the current map, nullptr if there is none
+Checkpoint* openCheckpoint(const std::string& filePath)
+{
+	Checkpoint* checkpoint = new Checkpoint();
+	if (!checkpoint->open(filePath))
+	{
+		delete checkpoint;
+		return nullptr;
+	}
+	if (checkpoint->getWidth() != erosionModel->width || checkpoint->getLength() != erosionModel->length)
+	{
+		printf("Failed to load the checkpoint %s: it is %dx%d, the map is %dx%d\n", filePath.c_str(),
+			checkpoint->getWidth(), checkpoint->getLength(), erosionModel->width, erosionModel->length);
+		delete checkpoint;
+		return nullptr;
+	}
+	return checkpoint;
+}
+
+// the time fraction of the way through times once sorted, times are reordered
+float getPercentile(std::vector<float>& times, float fraction)
+{
+	if (times.empty()) return 0.0f;
+	size_t index = std::min(times.size() - 1, (size_t)(fraction * times.size()));
+	std::nth_element(times.begin(), times.begin() + index, times.end());
+	return times[index];
+}
+
+// reads the recording back through its index and checks the frame at step against the model,
+// which has to be in the state that frame was recorded from
+bool verifyRecording(const std::string& filePath, long long step, float maxError)
+{
+	FrameRecording recording;
+	if (!recording.open(filePath))
+		return false;
+	int frame = recording.findFrame(step);
+	if (frame < 0 || recording.getFrameStep(frame) != step)
+		return false;
+
+	int width = erosionModel->width;
+	int length = erosionModel->length;
+	for (int i = 0; i < (int)CheckpointFieldId::COUNT; i++)
+	{
+		CheckpointFieldId id = (CheckpointFieldId)i;
+		if (!recording.hasField(id)) continue;
+
+		int componentCount = getCheckpointElementSize(id) / sizeof(float);
+		std::vector<float> plane((size_t)width * length * componentCount);
+		std::vector<float*> columns(width);
+		for (int x = 0; x < width; x++)
+		{
+			columns[x] = &plane[(size_t)x * length * componentCount];
+		}
+		if (!recording.readField(frame, id, (void* const*)columns.data()))
+			return false;
+
+		// non finite values are stored as they are, everything else within the bound
+		const float* const* original = (const float* const*)getCheckpointFieldColumns(erosionModel, id);
+		for (int x = 0; x < width; x++)
+		{
+			for (int j = 0; j < length * componentCount; j++)
+			{
+				if (!(std::abs(original[x][j] - columns[x][j]) <= maxError) && std::memcmp(&original[x][j], &columns[x][j], sizeof(float)) != 0)
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+// runs the simulation without rendering until maxSteps or, if asked for, until it converged.
+// with snapshots or a history, the time of every step is kept to show what capturing costs
+void runHeadless(float dt)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	erosionModel->isModelRunning = true;
+	erosionModel->pauseOnConvergence = runOptions.stopOnConvergence;
+
+	SnapshotWriter* snapshotWriter = runOptions.snapshotInterval > 0 ? new SnapshotWriter(runOptions.snapshotPrefix, runOptions.compressCheckpoints) : nullptr;
+	if (runOptions.historyInterval > 0)
+		history = new SimulationHistory((size_t)runOptions.historyBudgetMB << 20, runOptions.historyInterval);
+	std::vector<float> stepTimes;
+	std::vector<float> captureStepTimes;
+
+	FrameRecorder* recorder = nullptr;
+	if (!runOptions.recordPath.empty())
+	{
+		FieldCodecOptions options;
+		options.mode = runOptions.recordMaxError > 0.0f ? FieldCodecMode::ERROR_BOUNDED : FieldCodecMode::LOSSLESS;
+		options.maxError = runOptions.recordMaxError;
+		recorder = new FrameRecorder();
+		if (recorder->open(runOptions.recordPath, erosionModel->width, erosionModel->length, runOptions.recordFields, options))
+			recorder->record(erosionModel, 0, timePast);
+	}
+
+	int steps = 0;
+	while (steps < runOptions.maxSteps && erosionModel->isModelRunning)
+	{
+		auto stepStartTime = std::chrono::high_resolution_clock::now();
+		stepModel(dt);
+		steps++;
+
+		if (recorder && steps % runOptions.recordInterval == 0)
+			recorder->record(erosionModel, steps, timePast);
+
+		bool capturing = snapshotWriter && steps % runOptions.snapshotInterval == 0;
+		if (capturing)
+			snapshotWriter->capture(erosionModel, getRunState(), steps);
+		if (history && history->afterStep(erosionModel, getRunState()))
+			capturing = true;
+
+		if (snapshotWriter || history)
+		{
+			float stepMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - stepStartTime).count();
+			(capturing ? captureStepTimes : stepTimes).push_back(stepMs);
+		}
+	}
+
+	// the recording always ends with the final state, so it can be checked against the model
+	if (recorder && steps % runOptions.recordInterval != 0)
+		recorder->record(erosionModel, steps, timePast);
+
+	float seconds = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+	printf("Ran %d steps in %.2fs (%.2f ms/step)\n", steps, seconds, 1000.0f * seconds / std::max(1, steps));
+
+	if (snapshotWriter)
+	{
+		snapshotWriter->finish();
+		SnapshotWriterStats stats = snapshotWriter->getStats();
+		delete snapshotWriter;
+
+		printf("Snapshots: %d written, %d failed, %.1f MB in %.2fs of background writing\n", stats.writtenCount, stats.failedCount,
+			stats.writtenBytes / (1024.0f * 1024.0f), stats.writeSeconds);
+		printf("Snapshot capture: copy %.2f ms mean, %.2f ms max, waited for a buffer %.2f ms mean, %.2f ms max\n",
+			stats.totalCopyMs / std::max(1, stats.capturedCount), stats.maxCopyMs, stats.totalWaitMs / std::max(1, stats.capturedCount), stats.maxWaitMs);
+	}
+
+	if (history)
+	{
+		SimulationHistoryStats stats = history->getStats();
+		delete history;
+		history = nullptr;
+
+		printf("History: %d states kept of %d captured, %d skipped, %d evicted, %.1f of %.1f MB\n", (int)stats.steps.size(), stats.capturedCount,
+			stats.skippedCount, stats.evictedCount, stats.storedBytes / (1024.0f * 1024.0f), stats.budget / (1024.0f * 1024.0f));
+		printf("History capture: copy %.2f ms mean, %.2f ms max, encoded in the background in %.2f ms mean\n",
+			stats.totalCopyMs / std::max(1, stats.capturedCount), stats.maxCopyMs, stats.totalEncodeMs / std::max(1, stats.capturedCount));
+	}
+
+	if (!captureStepTimes.empty())
+	{
+		printf("Step time: p50 %.2f ms, p99 %.2f ms, max %.2f ms, with a capture p50 %.2f ms, max %.2f ms\n",
+			getPercentile(stepTimes, 0.5f), getPercentile(stepTimes, 0.99f), getPercentile(stepTimes, 1.0f),
+			getPercentile(captureStepTimes, 0.5f), getPercentile(captureStepTimes, 1.0f));
+	}
+
+	if (recorder)
+	{
+		bool recorded = recorder->finish() && recorder->getStats().frameCount > 0;
+		FrameRecorderStats stats = recorder->getStats();
+		delete recorder;
+
+		long long tiles = std::max(1LL, stats.storedTiles + stats.referencedTiles);
+		printf("Recorded %d frames (%d keyframes) to %s, %.1f MB for %.1f MB of fields, %.1f%% of tiles stored, %.2fs encoding\n",
+			stats.frameCount, stats.keyframeCount, runOptions.recordPath.c_str(), stats.writtenBytes / (1024.0f * 1024.0f),
+			stats.rawBytes / (1024.0f * 1024.0f), 100.0f * stats.storedTiles / tiles, stats.encodeSeconds);
+		if (recorded)
+			printf("Recording read back: last frame %s\n", verifyRecording(runOptions.recordPath, steps, runOptions.recordMaxError) ? "matches the model" : "MISMATCH");
+	}
+}
+
+// encodes and decodes every field of the model, losslessly and within a few error bounds,
+// and prints the compression ratio and throughput of each
+void benchmarkFieldCodec()
+{
+	struct BenchmarkedField
+	{
+		const char* name;
+		float* const* columns;
+		int componentCount;
+	};
+	BenchmarkedField fields[] = {
+		{ "terrain", erosionModel->terrainHeights, 1 },
+		{ "water", erosionModel->waterHeights, 1 },
+		{ "sediment", erosionModel->suspendedSedimentAmounts, 1 },
+		{ "flux", (float* const*)erosionModel->outflowFlux, 4 },
+		{ "velocity", (float* const*)erosionModel->velocities, 2 },
+		{ "hardness", erosionModel->terrainHardness, 1 },
+	};
+	FieldCodecOptions optionSets[] = {
+		{ FieldCodecMode::LOSSLESS, 0.0f },
+		{ FieldCodecMode::ERROR_BOUNDED, 0.001f },
+		{ FieldCodecMode::ERROR_BOUNDED, 0.01f },
+	};
+
+	int width = erosionModel->width;
+	int length = erosionModel->length;
+	for (const BenchmarkedField& field : fields)
+	{
+		std::vector<float> decodedPlane((size_t)width * length * field.componentCount);
+		std::vector<float*> decodedColumns(width);
+		for (int x = 0; x < width; x++)
+		{
+			decodedColumns[x] = &decodedPlane[(size_t)x * length * field.componentCount];
+		}
+		float megabytes = sizeof(float) * decodedPlane.size() / (1024.0f * 1024.0f);
+
+		for (const FieldCodecOptions& options : optionSets)
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			std::vector<uint8_t> encoded = encodeField(field.columns, width, length, field.componentCount, options);
+			auto encodedTime = std::chrono::high_resolution_clock::now();
+			bool decoded = decodeField(encoded.data(), encoded.size(), decodedColumns.data(), width, length, field.componentCount);
+			auto decodedTime = std::chrono::high_resolution_clock::now();
+
+			// lossless has to match bit for bit, with a bound the largest error is shown
+			float maxError = 0.0f;
+			bool matches = decoded;
+			for (int x = 0; x < width && decoded; x++)
+			{
+				const float* original = field.columns[x];
+				for (int i = 0; i < length * field.componentCount; i++)
+				{
+					if (options.mode == FieldCodecMode::LOSSLESS)
+						matches &= std::memcmp(&original[i], &decodedColumns[x][i], sizeof(float)) == 0;
+					else if (std::isfinite(original[i]))
+						maxError = std::max(maxError, std::abs(original[i] - decodedColumns[x][i]));
+				}
+			}
+
+			char mode[32];
+			char result[32];
+			if (options.mode == FieldCodecMode::LOSSLESS)
+			{
+				snprintf(mode, sizeof(mode), "lossless");
+				snprintf(result, sizeof(result), matches ? "exact" : "MISMATCH");
+			}
+			else
+			{
+				snprintf(mode, sizeof(mode), "e=%g", options.maxError);
+				snprintf(result, sizeof(result), decoded ? "max error %g" : "MISMATCH", maxError);
+			}
+
+			float encodeSeconds = std::chrono::duration<float>(encodedTime - startTime).count();
+			float decodeSeconds = std::chrono::duration<float>(decodedTime - encodedTime).count();
+			printf("%-9s %-9s %7.2fx  encode %7.1f MB/s  decode %7.1f MB/s  %s\n", field.name, mode,
+				sizeof(float) * decodedPlane.size() / (float)encoded.size(), megabytes / encodeSeconds, megabytes / decodeSeconds, result);
+		}
+	}
+}
+
+// runs the water part of the simulation on a pyramid of coarse grids, from the
+// coarsest to the finest, so rivers and lakes are close to equilibrium before
+// the full resolution model starts
+void warmStartModel(float dt)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	// the coarse levels are only ever seen by this function, the ui keeps reading the fine model
+	ErosionModel* fineModel = erosionModel;
+	std::vector<ErosionModel*> pyramid = buildModelPyramid(fineModel, fineModel->warmStartLevels);
+
+	for (int level = (int)pyramid.size() - 1; level >= 0; level--)
+	{
+		ErosionModel* coarseModel = pyramid[level];
+
+		std::vector<float> previousWater;
+		getMeanWaterChange(coarseModel, previousWater);
+
+		int steps = 0;
+		float residual = INFINITY;
+		while (residual > fineModel->warmStartTolerance && steps < fineModel->warmStartMaxSteps)
+		{
+			addPrecipitation(coarseModel, dt);
+			calculateModelOutflowFlux(coarseModel, dt);
+			calculateModelWaterHeights(coarseModel, dt);
+			evaporate(coarseModel, dt);
+
+			residual = getMeanWaterChange(coarseModel, previousWater);
+			steps++;
+		}
+
+		printf("Warm start level %d (%dx%d): %d steps, residual %f\n", level + 1, coarseModel->width, coarseModel->length, steps, residual);
+
+		prolongWaterState(coarseModel, level == 0 ? fineModel : pyramid[level - 1]);
+	}
+
+	for (ErosionModel* model : pyramid)
+	{
+		delete model;
+	}
+	erosionModel->convergence->wakeAll();
+
+	float seconds = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+	printf("Warm start done in %.2fs\n", seconds);
+}
+
+// anything that rebuilds the model runs on the simulation thread between two steps
 void HandleHeightmapResets()
 {
-	if (simParams->regenerateHeightMapRequested || window.getKeyDown(GLFW_KEY_R)) {
+	// R makes a new map when it is generated, loaded maps can only go back to how they were
+	if (window.getKeyDown(GLFW_KEY_R))
+	{
+		if (simParams->showRegenButton)
+			simParams->regenerateHeightMapRequested = true;
+		else
+			simParams->resetTerrainRequested = true;
+	}
+
+	if (simParams->regenerateHeightMapRequested) {
 		simParams->regenerateHeightMapRequested = false;
-		map.changeSeed();
-		resetModel();
+		simulationThread->enqueue([]() {
+			map.changeSeed();
+			pristine.capture(map.getGrid());
+			resetModel();
+		}, true);
+	}
+
+	if (simParams->resetTerrainRequested)
+	{
+		simParams->resetTerrainRequested = false;
+		simulationThread->enqueue([]() {
+			auto startTime = std::chrono::high_resolution_clock::now();
+			resetModel();
+			float seconds = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+			printf("Reset the terrain in %.1f ms\n", seconds * 1000.0f);
+		}, true);
 	}
 
 	if (simParams->saveHeightMapRequested)
 	{
 		simParams->saveHeightMapRequested = false;
-		std::vector<double> buffer(3 * map.getWidth() * map.getLength());
-
-		for (int y = 0; y < map.getLength(); y++) {
-			for (int x = 0; x < map.getWidth(); x++) {
-				double color = std::clamp((double)(erosionModel->terrainHeights[x][y] + minHeight) / (double)(maxHeight + minHeight), 0.0, 1.0);
-				buffer[3 * y * map.getWidth() + 3 * x + 0] = color;
-				buffer[3 * y * map.getWidth() + 3 * x + 1] = color;
-				buffer[3 * y * map.getWidth() + 3 * x + 2] = color;
-			}
+		SimulationSnapshot& snapshot = simulationThread->getSnapshot();
+		std::string fileName = std::string(simParams->fileSaveName) + getHeightMapExtension(simParams->saveFormat);
+		float seconds;
+		if (writeHeightMap(fileName, simParams->saveFormat, snapshot.terrainHeights, snapshot.width, snapshot.length, &seconds))
+			printf("Saved the height map to %s in %.1f ms\n", fileName.c_str(), seconds * 1000.0f);
+	}
+
+	if (simParams->exportMeshRequested)
+	{
+		simParams->exportMeshRequested = false;
+		SimulationSnapshot& snapshot = simulationThread->getSnapshot();
+		std::string fileName = std::string(simParams->exportFileName) + (simParams->exportFormat == MeshExportFormat::OBJ ? ".obj" : ".glb");
+
+		MeshExportStats stats;
+		exportTerrainMesh(fileName, simParams->exportFormat, snapshot.terrainHeights, simParams->exportWater ? snapshot.waterHeights : nullptr,
+			snapshot.width, snapshot.length, simParams->exportMaxError, &stats);
+		simParams->exportedTriangles = stats.triangleCount;
+		simParams->exportSeconds = stats.seconds;
+	}
+
+	if (simParams->saveCheckpointRequested)
+	{
+		simParams->saveCheckpointRequested = false;
+		std::string fileName = simParams->checkpointFileName;
+		bool compressed = simParams->compressCheckpoints;
+		simulationThread->inspect([fileName, compressed]() {
+			if (saveCheckpoint(fileName, erosionModel, getRunState(), compressed))
+				printf("Saved checkpoint to %s\n", fileName.c_str());
+		});
+	}
+
+	if (simParams->loadCheckpointRequested)
+	{
+		simParams->loadCheckpointRequested = false;
+		Checkpoint* checkpoint = openCheckpoint(simParams->checkpointFileName);
+		// the model gets the parameters with the fields, the ui copy only once they were restored.
+		// the original heights stay the map's, deposition is still shown against where the run started
+		ErosionParameters parameters = editedParameters;
+		if (checkpoint && !checkpoint->readParameters(parameters))
+		{
+			delete checkpoint;
+			checkpoint = nullptr;
+		}
+		if (checkpoint)
+		{
+			simulationThread->enqueue([checkpoint, parameters]() {
+				// the kept states led up to a different run
+				if (restoreCheckpoint(checkpoint))
+				{
+					history->clear();
+					std::lock_guard<std::mutex> lock(restoredParametersMutex);
+					restoredParameters = parameters;
+				}
+				else
+				{
+					printf("The checkpoint could not be restored, the fields stay as they were\n");
+				}
+				delete checkpoint;
+			});
 		}
-		std::string fileName = std::string(simParams->fileSaveName) + ".ppm";
-		save_ppm(fileName, buffer, map.getWidth(), map.getLength());
-		buffer.clear();
 	}
 
+	{
+		std::lock_guard<std::mutex> lock(restoredParametersMutex);
+		if (restoredParameters)
+		{
+			editedParameters = *restoredParameters;
+			restoredParameters.reset();
+		}
+	}
+
+	if (simParams->hydrologyPrepassRequested)
+	{
+		simParams->hydrologyPrepassRequested = false;
+		simulationThread->enqueue([]() {
+			runHydrologyPrepass(0.033333f);
+			erosionModel->convergence->wakeAll();
+		});
+	}
 
+	if (simParams->warmStartRequested)
+	{
+		simParams->warmStartRequested = false;
+		simulationThread->enqueue([]() {
+			warmStartModel(0.033333f);
+		});
+	}
+
+	if (simParams->removeWaterSourcesRequested)
+	{
+		simParams->removeWaterSourcesRequested = false;
+		simulationThread->removeWaterSources();
+	}
+
+	if (simParams->undoRequested)
+	{
+		simParams->undoRequested = false;
+		simulationThread->undo();
+	}
+
+	if (simParams->redoRequested)
+	{
+		simParams->redoRequested = false;
+		simulationThread->redo();
+	}
+
+
+}
+// jumps pause the run on the kept state, resuming carries on from whatever state it is on
+void HandleTimeline()
+{
+	if (simParams->timelineJumpRequested)
+	{
+		simParams->timelineJumpRequested = false;
+		editedParameters.isModelRunning = false;
+		// paused before the restore is queued, so no step slips in between and drops the later states
+		simulationThread->publishParameters(editedParameters);
+
+		long long step = simParams->historySteps[simParams->timelineIndex];
+		simulationThread->enqueue([step]() {
+			CheckpointRunState runState;
+			if (!history->restore(step, erosionModel, runState))
+			{
+				printf("Failed to restore the state of step %lld\n", step);
+				return;
+			}
+			timePast = runState.timePast;
+			gen = runState.randomEngine;
+			erosionModel->convergence->reset();
+		});
+	}
+
+	if (simParams->timelineResumeRequested)
+	{
+		simParams->timelineResumeRequested = false;
+		editedParameters.isModelRunning = true;
+	}
+
+	history->setInterval(simParams->historyInterval);
+	size_t budget = (size_t)std::max(1, simParams->historyBudgetMB) << 20;
+	SimulationHistoryStats stats = history->getStats();
+	if (stats.budget != budget)
+		history->setBudget(budget);
+
+	// while running the timeline follows the newest state
+	if (editedParameters.isModelRunning)
+		simParams->timelineIndex = (int)stats.steps.size() - 1;
+	simParams->historySteps = std::move(stats.steps);
+	simParams->historyMegabytes = stats.storedBytes / (1024.0f * 1024.0f);
+	simParams->historyCopyMs = stats.totalCopyMs / std::max(1, stats.capturedCount);
+	simParams->historySkipped = stats.skippedCount;
 }
+
 void HandleKeyboardInputs()
 {
 	if (window.getKeyDown(GLFW_KEY_SPACE)) {
-		erosionModel->castRays = !erosionModel->castRays;
-		if (!erosionModel->castRays)
+		editedParameters.castRays = !editedParameters.castRays;
+		if (!editedParameters.castRays)
 			cursorOverPosition = glm::vec3(INT_MIN);
 	}
 
 	if (window.getKeyDown(GLFW_KEY_ENTER)) {
-		erosionModel->ToggleModelRunning();
+		editedParameters.ToggleModelRunning();
 	}
 
 	if (window.getKeyDown(GLFW_KEY_P)) {
-		erosionModel->ToggleModelRaining();
+		editedParameters.ToggleModelRaining();
 	}
 
 	if (window.getKeyDown(GLFW_KEY_V)) {
-		erosionModel->ToggleWaterDebugMode();
+		editedParameters.ToggleWaterDebugMode();
 	}
 
 	if (window.getKeyDown(GLFW_KEY_B)) {
-		erosionModel->ToggleTerrainDebugMode();
+		editedParameters.ToggleTerrainDebugMode();
 	}
 
-	if (window.getKeyDown(GLFW_KEY_TAB) && erosionModel->castRays) {
-		erosionModel->TogglePaintMode();
+	if (window.getKeyDown(GLFW_KEY_TAB) && editedParameters.castRays) {
+		editedParameters.TogglePaintMode();
+	}
+
+	// ctrl+z undoes the last brush stroke, ctrl+y or ctrl+shift+z redoes it
+	if (window.getKey(GLFW_KEY_LEFT_CONTROL) || window.getKey(GLFW_KEY_RIGHT_CONTROL)) {
+		bool shift = window.getKey(GLFW_KEY_LEFT_SHIFT) || window.getKey(GLFW_KEY_RIGHT_SHIFT);
+		if (window.getKeyDown(GLFW_KEY_Z))
+			(shift ? simParams->redoRequested : simParams->undoRequested) = true;
+		if (window.getKeyDown(GLFW_KEY_Y))
+			simParams->redoRequested = true;
+	}
+
+	if (window.getKeyDown(GLFW_KEY_F)) {
+		simParams->fastForward = !simParams->fastForward;
+		printf("Fast forward %s\n", simParams->fastForward ? "Enabled" : "Disabled");
+	}
+}
+// brush strokes and water sources are sent to the simulation as commands
+void HandlePainting()
+{
+	if (window.getMouseButton(GLFW_MOUSE_BUTTON_LEFT) && editedParameters.paintMode != PaintMode::WATER_SOURCE)
+		simulationThread->stampBrush(cursorOverPosition);
+
+	if (window.getMouseButtonUp(GLFW_MOUSE_BUTTON_LEFT))
+		simulationThread->endBrushStroke();
+
+	if (window.getMouseButtonDown(GLFW_MOUSE_BUTTON_LEFT))
+	{
+		if (editedParameters.paintMode == PaintMode::WATER_SOURCE)
+		{
+			for (int y = 0; y < map.getLength(); y++)
+			{
+				for (int x = 0; x < map.getWidth(); x++)
+				{
+					glm::vec3 mapPos = terrainMesh->getPositionAtIndex(x, y);
+					if (glm::length(glm::vec2(cursorOverPosition.x, cursorOverPosition.z) - glm::vec2(mapPos.x, mapPos.z)) < 0.5f)
+					{
+						WaterSource source = WaterSource();
+						source.position = mapPos;
+						source.intensity = editedParameters.brushIntensity;
+						source.radius = editedParameters.brushRadius;
+
+						simulationThread->addWaterSource(source);
+					}
+				}
+			}
+		}
 	}
 }
 void HandleCamera(float deltaTime)
@@ -603,13 +1274,13 @@ void HandleCamera(float deltaTime)
 
 	if (window.getMouseScrollY() != 0 && !camera.inFreeView())
 	{
-		erosionModel->brushRadius += window.getMouseScrollY();
-		erosionModel->brushRadius = std::clamp(erosionModel->brushRadius, 1.0f, 50.0f);
+		editedParameters.brushRadius += window.getMouseScrollY();
+		editedParameters.brushRadius = std::clamp(editedParameters.brushRadius, 1.0f, 50.0f);
 	}
 
 	camera.update(deltaTime);
 
-	if (erosionModel->castRays && !camera.inFreeView())
+	if (editedParameters.castRays && !camera.inFreeView())
 		raycastThroughScene();
 }
 
@@ -622,10 +1293,19 @@ void UpdateShaders(glm::mat4& view, glm::mat4& proj, glm::mat4& model, float& de
 	mainShader.setMat4("model", model);
 	mainShader.setMat4("view", view);
 	mainShader.setMat4("projection", proj);
-	mainShader.setUniformBool("checkMousePos", erosionModel->castRays);
+	mainShader.setUniformBool("checkMousePos", editedParameters.castRays);
 	mainShader.setUniformVector3("cursorOverTerrainPos", cursorOverPosition);
-	mainShader.setUniformFloat("brushRadius", &erosionModel->brushRadius);
-	mainShader.setUniformInt("debugMode", (int)erosionModel->terrainDebugMode);
+	mainShader.setUniformFloat("brushRadius", &editedParameters.brushRadius);
+	mainShader.setUniformInt("debugMode", (int)editedParameters.terrainDebugMode);
+
+	heightfieldTextures->bind();
+	mainShader.setUniformBool("useHeightTextures", simParams->useHeightTextures);
+	mainShader.setUniformInt("gridWidth", map.getWidth());
+	mainShader.setUniformInt("gridLength", map.getLength());
+	mainShader.setUniformInt("chunkCountX", terrainMesh->getChunkCountX());
+	mainShader.setUniformInt("chunkSize", MESH_CHUNK_SIZE);
+	mainShader.setTexture("terrainHeightTexture", HEIGHTFIELD_TEXTURE_UNIT);
+	mainShader.setTexture("originalTerrainHeightTexture", HEIGHTFIELD_TEXTURE_UNIT + 1);
 
 
 	mainShader.setTexture("texture0", 0);
@@ -644,7 +1324,16 @@ void UpdateShaders(glm::mat4& view, glm::mat4& proj, glm::mat4& model, float& de
 	waterShader.setMat4("projection", proj);
 	waterShader.setUniformVector3("viewerPosition", camera.getPosition());
 	waterShader.setUniformFloat("deltaTime", &deltaTime);
-	waterShader.setUniformInt("waterDebugMode", (int)erosionModel->waterDebugMode);
+	waterShader.setUniformInt("waterDebugMode", (int)editedParameters.waterDebugMode);
+	waterShader.setUniformBool("useHeightTextures", simParams->useHeightTextures);
+	waterShader.setUniformInt("gridWidth", map.getWidth());
+	waterShader.setUniformInt("gridLength", map.getLength());
+	waterShader.setUniformInt("chunkCountX", waterMesh->getChunkCountX());
+	waterShader.setUniformInt("chunkSize", MESH_CHUNK_SIZE);
+	waterShader.setTexture("terrainHeightTexture", HEIGHTFIELD_TEXTURE_UNIT);
+	waterShader.setTexture("waterHeightTexture", HEIGHTFIELD_TEXTURE_UNIT + 2);
+	waterShader.setTexture("velocityTexture", HEIGHTFIELD_TEXTURE_UNIT + 3);
+	waterShader.setTexture("sedimentTexture", HEIGHTFIELD_TEXTURE_UNIT + 4);
 	waterNormalTexture.use();
 	waterShader.setTexture("texture0", GL_TEXTURE0);
 
@@ -655,12 +1344,85 @@ void UpdateShaders(glm::mat4& view, glm::mat4& proj, glm::mat4& model, float& de
 
 int main(int argc, char* argv[])
 {
-	if (argc <= 1)
+	// options start with -- and can go anywhere, the rest are positional
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--headless")
+			runOptions.headless = true;
+		else if (arg == "--steps" && i + 1 < argc)
+			runOptions.maxSteps = std::stoi(argv[++i]);
+		else if (arg == "--until-converged")
+			runOptions.stopOnConvergence = true;
+		else if (arg == "--export" && i + 1 < argc)
+			runOptions.exportPath = argv[++i];
+		else if (arg == "--save-heightmap" && i + 1 < argc)
+			runOptions.saveHeightMapPath = argv[++i];
+		else if (arg == "--export-error" && i + 1 < argc)
+			runOptions.exportMaxError = std::stof(argv[++i]);
+		else if (arg == "--export-water")
+			runOptions.exportWater = true;
+		else if (arg == "--resume" && i + 1 < argc)
+			runOptions.resumePath = argv[++i];
+		else if (arg == "--checkpoint" && i + 1 < argc)
+			runOptions.checkpointPath = argv[++i];
+		else if (arg == "--snapshot-every" && i + 1 < argc)
+			runOptions.snapshotInterval = std::stoi(argv[++i]);
+		else if (arg == "--snapshot-prefix" && i + 1 < argc)
+			runOptions.snapshotPrefix = argv[++i];
+		else if (arg == "--compress-checkpoints")
+			runOptions.compressCheckpoints = true;
+		else if (arg == "--benchmark-codec")
+			runOptions.benchmarkCodec = true;
+		else if (arg == "--history-every" && i + 1 < argc)
+			runOptions.historyInterval = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--history-budget" && i + 1 < argc)
+			runOptions.historyBudgetMB = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--crop" && i + 1 < argc)
+		{
+			DemImportOptions& options = runOptions.importOptions;
+			if (std::sscanf(argv[++i], "%d,%d,%d,%d", &options.cropX, &options.cropY, &options.cropWidth, &options.cropLength) != 4)
+				printf("--crop takes x,y,width,length\n");
+		}
+		else if (arg == "--resample" && i + 1 < argc)
+		{
+			DemImportOptions& options = runOptions.importOptions;
+			if (std::sscanf(argv[++i], "%d,%d", &options.targetWidth, &options.targetLength) != 2)
+				printf("--resample takes width,length\n");
+		}
+		else if (arg == "--record" && i + 1 < argc)
+			runOptions.recordPath = argv[++i];
+		else if (arg == "--record-every" && i + 1 < argc)
+			runOptions.recordInterval = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--record-error" && i + 1 < argc)
+			runOptions.recordMaxError = std::stof(argv[++i]);
+		else if (arg == "--record-fields" && i + 1 < argc)
+		{
+			// comma separated names, like terrain,water
+			runOptions.recordFields.clear();
+			std::stringstream names(argv[++i]);
+			std::string name;
+			while (std::getline(names, name, ','))
+			{
+				CheckpointFieldId id = findCheckpointField(name);
+				if (id == CheckpointFieldId::COUNT)
+					printf("Unknown field %s, fields are terrain, water, sediment, flux, velocity and hardness\n", name.c_str());
+				else if (std::find(runOptions.recordFields.begin(), runOptions.recordFields.end(), id) == runOptions.recordFields.end())
+					runOptions.recordFields.push_back(id);
+			}
+		}
+		else
+			args.push_back(arg);
+	}
+
+	if (args.size() <= 1)
 	{
 		printf("Invalid arguments, possible commands: \n");
 		printf("default (n (1 - 11)) (randomness factor(0-4)) \n");
-		printf("heightmap (filepath) \n");
+		printf("heightmap (filepath, an image, a .tif DEM or raw .r32/.raw/.npy) [--crop x,y,width,length] [--resample width,length]\n");
 		printf("obj (filepath) (slopeHeight)\n");
+		printf("options: [--resume checkpoint] --headless [--steps n] [--until-converged] [--export file.glb|file.obj [--export-error e] [--export-water]] [--save-heightmap file.pgm|file.png|file.pfm] [--checkpoint file] [--snapshot-every n [--snapshot-prefix path]] [--compress-checkpoints] [--benchmark-codec] [--record file [--record-every n] [--record-fields a,b] [--record-error e]] [--history-every n [--history-budget mb]]\n");
 		return -1;
 	}
 
@@ -668,59 +1430,170 @@ int main(int argc, char* argv[])
 	{
 		printf(argv[i]);
 	}
-	if (std::string(argv[1]) == "default")
+	if (args[1] == "default")
 	{
-		map.setHeightRange(std::stoi(argv[4]), std::stoi(argv[5]));
-		map.createProceduralHeightMap(std::pow(2, std::stoi(argv[2])), std::stoi(argv[3]));
+		map.setHeightRange(std::stoi(args[4]), std::stoi(args[5]));
+		map.createProceduralHeightMap(std::pow(2, std::stoi(args[2])), std::stoi(args[3]));
 	}
-	else if (std::string(argv[1]) == "heightmap")
+	else if (args[1] == "heightmap")
 	{
-		map.setHeightRange(std::stoi(argv[3]), std::stoi(argv[4]));
-		map.loadHeightMapFromFile(std::string(argv[2]));
+		map.setHeightRange(std::stoi(args[3]), std::stoi(args[4]));
+		map.setImportOptions(runOptions.importOptions);
+		map.loadHeightMapFromFile(args[2]);
 	}
-	else if (std::string(argv[1]) == "obj")
+	else if (args[1] == "obj")
 	{
-		map.setHeightRange(std::stoi(argv[3]), std::stoi(argv[4]));
-		map.loadHeightMapFromOBJFile(std::string(argv[2]), argc == 6 ? std::stoi(argv[5]) : 0);
+		map.setHeightRange(std::stoi(args[3]), std::stoi(args[4]));
+		map.loadHeightMapFromOBJFile(args[2], args.size() == 6 ? std::stoi(args[5]) : 0);
 	}
 
 	distr = std::uniform_int_distribution(0, map.getWidth() * map.getLength());
 	erosionModel = new ErosionModel(map.getWidth(), map.getLength());
-	simParams = new SimulationParametersUI(std::string(argv[1]) == "default");
+	simParams = new SimulationParametersUI(args[1] == "default");
 	initModel();
+	if (!runOptions.resumePath.empty())
+	{
+		Checkpoint* checkpoint = openCheckpoint(runOptions.resumePath);
+		if (!checkpoint)
+			return -1;
+		bool restored = restoreCheckpoint(checkpoint);
+		delete checkpoint;
+		if (!restored)
+			return -1;
+	}
+	editedParameters = *erosionModel;
+
+	if (runOptions.headless)
+	{
+		glfwHideWindow(window.getGlfwWindow());
+		runHeadless(0.033333f);
+		if (!runOptions.exportPath.empty())
+		{
+			MeshExportStats stats;
+			if (exportTerrainMesh(runOptions.exportPath, getMeshExportFormat(runOptions.exportPath), erosionModel->terrainHeights,
+				runOptions.exportWater ? erosionModel->waterHeights : nullptr, erosionModel->width, erosionModel->length, runOptions.exportMaxError, &stats))
+				printf("Exported %d triangles to %s in %.2fs\n", stats.triangleCount, runOptions.exportPath.c_str(), stats.seconds);
+		}
+		if (!runOptions.saveHeightMapPath.empty())
+		{
+			float seconds;
+			if (writeHeightMap(runOptions.saveHeightMapPath, getHeightMapFormat(runOptions.saveHeightMapPath), erosionModel->terrainHeights,
+				erosionModel->width, erosionModel->length, &seconds))
+				printf("Saved the height map to %s in %.1f ms\n", runOptions.saveHeightMapPath.c_str(), seconds * 1000.0f);
+		}
+		if (!runOptions.checkpointPath.empty() && saveCheckpoint(runOptions.checkpointPath, erosionModel, getRunState(), runOptions.compressCheckpoints))
+			printf("Saved checkpoint to %s\n", runOptions.checkpointPath.c_str());
+		if (runOptions.benchmarkCodec)
+			benchmarkFieldCodec();
+		glfwTerminate();
+		return 0;
+	}
 
-	terrainMesh = new TerrainMesh(map.getWidth(), map.getLength(), &erosionModel->terrainHeights, mainShader);
+	terrainMesh = new TerrainMesh(map.getWidth(), map.getLength(), &erosionModel->terrainHeights, pristine.getTerrain(), mainShader);
 	waterMesh = new WaterMesh(map.getWidth(), map.getLength(), &erosionModel->terrainHeights, &erosionModel->waterHeights, waterShader);
 
 	terrainMesh->init();
 	waterMesh->init();
+	heightfieldTextures = new HeightfieldTextures(map.getWidth(), map.getLength());
+
+	// the viewer keeps recent states, so the timeline can jump back to them
+	history = new SimulationHistory();
+	simulationThread = new SimulationThread(erosionModel, [](float dt) {
+		stepModel(dt);
+		history->afterStep(erosionModel, getRunState());
+	}, paint, 0.033333f);
+	simulationThread->start();
 
 	glm::mat4 proj = glm::mat4(1.0f);
 	proj = glm::perspective(glm::radians(fov), window.getAspectRatio(), 0.1f, 1000.0f);
 
 	auto currentTime = std::chrono::high_resolution_clock::now();
+	auto lastRenderTime = currentTime;
+	long long lastStepCount = 0;
+	int lastResetCount = 0;
+	int lastConvergedEventCount = 0;
+	bool usingHeightTextures = false;
 	while (!window.shouldWindowClose())
 	{
 		auto newTime = std::chrono::high_resolution_clock::now();
 		float deltaTime =
 			std::chrono::duration<float, std::chrono::seconds::period>(newTime - currentTime).count();
 		currentTime = newTime;
-		timePast += deltaTime;
 
 		HandleHeightmapResets();
+		HandleTimeline();
 		// stop taking input
 		if (!window.showSaveMenu) {
 			HandleKeyboardInputs();
 			HandleCamera(deltaTime);
 		}
+		HandlePainting();
 
-		if (erosionModel->isModelRunning)
+		simulationThread->publishParameters(editedParameters);
+
+		// fast forward only presents every few seconds, but keeps polling input
+		float timeSinceRender = std::chrono::duration<float, std::chrono::seconds::period>(newTime - lastRenderTime).count();
+		if (simParams->fastForward && timeSinceRender < simParams->fastForwardInterval)
+		{
+			window.updateInput();
+			window.pollEvents();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+
+		// meshes are only rebuilt when the simulation published something new
+		bool hasNewSnapshot = simulationThread->updateSnapshot();
+		SimulationSnapshot& snapshot = simulationThread->getSnapshot();
+		simParams->uploadedChunks = 0;
+		simParams->uploadedTexels = 0;
+		if (hasNewSnapshot)
 		{
-			//printf("Frame time: %f\n", deltaTime);
-			//printf("Time to render 1 simulation second: %f\n", deltaTime * 60.f);
-			updateModel(0.033333f);
+			if (snapshot.stats.resetCount != lastResetCount)
+			{
+				lastResetCount = snapshot.stats.resetCount;
+				terrainMesh->setOriginalHeights(pristine.getTerrain());
+				if (usingHeightTextures)
+					heightfieldTextures->uploadOriginalHeights(terrainMesh->getOriginalHeights());
+			}
+			updateMeshes(snapshot);
+			simParams->uploadedChunks = terrainMesh->lastUploadedChunks + waterMesh->lastUploadedChunks;
+			if (usingHeightTextures)
+			{
+				heightfieldTextures->upload(snapshot);
+				simParams->uploadedTexels = heightfieldTextures->lastUploadedTexels;
+			}
+
+			// the simulation paused itself, keep the ui copy in sync
+			if (snapshot.stats.convergedEventCount != lastConvergedEventCount)
+			{
+				lastConvergedEventCount = snapshot.stats.convergedEventCount;
+				if (editedParameters.pauseOnConvergence)
+					editedParameters.isModelRunning = false;
+			}
 		}
 
+		// the render path that takes over is brought up to date in full
+		if (simParams->useHeightTextures != usingHeightTextures)
+		{
+			usingHeightTextures = simParams->useHeightTextures;
+			terrainMesh->setUseHeightTextures(usingHeightTextures);
+			waterMesh->setUseHeightTextures(usingHeightTextures);
+			if (usingHeightTextures)
+			{
+				heightfieldTextures->uploadAll(snapshot);
+				heightfieldTextures->uploadOriginalHeights(terrainMesh->getOriginalHeights());
+			}
+			else
+			{
+				rebuildMeshes(snapshot);
+			}
+		}
+
+		simParams->stepsPerFrame = (int)(snapshot.stats.stepCount - lastStepCount);
+		simParams->stepsPerSecond = timeSinceRender > 0.0f ? simParams->stepsPerFrame / timeSinceRender : 0.0f;
+		lastStepCount = snapshot.stats.stepCount;
+		lastRenderTime = newTime;
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		ImGui_ImplOpenGL3_NewFrame();
@@ -730,9 +1603,23 @@ int main(int argc, char* argv[])
 		glm::mat4 model = glm::mat4(1.0f);
 		glm::mat4 view = camera.getViewMatrix();
 
+		// chunks get coarser with distance, as long as the error stays below a few pixels
+		float pixelsPerUnit = window.getHeight() / (2.0f * tanf(glm::radians(fov) / 2.0f));
+		terrainMesh->selectLods(camera.getPosition(), pixelsPerUnit, simParams->lodPixelError);
+		waterMesh->selectLods(camera.getPosition(), pixelsPerUnit, simParams->lodPixelError);
+
+		auto cullStartTime = std::chrono::high_resolution_clock::now();
+		Frustum frustum(proj * view * model);
+		terrainMesh->cullChunks(frustum);
+		waterMesh->cullChunks(frustum);
+		simParams->cullTimeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - cullStartTime).count();
+		simParams->visibleChunks = terrainMesh->lastVisibleChunks + waterMesh->lastVisibleChunks;
+		simParams->chunkCount = terrainMesh->getChunkCount() + waterMesh->getChunkCount();
+
 		UpdateShaders(view, proj, model, deltaTime);
+		simParams->drawnTriangles = terrainMesh->lastDrawnTriangles + waterMesh->lastDrawnTriangles;
 
-		window.Menu(erosionModel, simParams);
+		window.Menu(&editedParameters, simParams, &snapshot.stats);
 
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -743,6 +1630,10 @@ int main(int argc, char* argv[])
 		window.pollEvents();
 	}
 
+	simulationThread->stop();
+	delete simulationThread;
+	delete history;
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
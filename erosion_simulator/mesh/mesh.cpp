@@ -1,6 +1,8 @@
 #include "mesh.h"
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <execution>
 
 Mesh::Mesh(int width, int length, Shader shader)
 	: width(width), length(length), shader(shader)
@@ -51,7 +53,7 @@ void Mesh::init()
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indexCount, indices, GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertexCount, vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertexCount, vertices, GL_DYNAMIC_DRAW);
 
 	glEnableVertexAttribArray(shader.getAttribLocation("pos"));
 	glEnableVertexAttribArray(shader.getAttribLocation("normal"));
@@ -70,7 +72,32 @@ void Mesh::draw()
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 
-	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+	// meshes that are not height grids, like the skybox, have no chunks
+	lastDrawnTriangles = 0;
+	if (chunks.empty())
+	{
+		glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+		lastDrawnTriangles = indexCount / 3;
+	}
+	else
+	{
+		drawCounts.clear();
+		drawOffsets.clear();
+		drawBaseVertices.clear();
+		for (const MeshChunk& chunk : chunks)
+		{
+			if (!chunk.visible) continue;
+
+			IndexPattern pattern = getChunkIndices(chunk);
+			if (pattern.count == 0) continue;
+
+			drawCounts.push_back(pattern.count);
+			drawOffsets.push_back((const GLvoid*)(sizeof(uint32_t) * pattern.offset));
+			drawBaseVertices.push_back(chunk.baseVertex);
+			lastDrawnTriangles += pattern.count / 3;
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), (GLsizei)drawCounts.size(), drawBaseVertices.data());
+	}
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
@@ -131,69 +158,18 @@ void Mesh::calculateIndices()
 
 void Mesh::calculateNormals()
 {
-	for (int y = 0; y < length; y++)
+	calculateNormals(DirtyRect{ 0, 0, width - 1, length - 1 });
+}
+
+void Mesh::calculateNormals(DirtyRect rect)
+{
+	forEachRow(rect, [&](int y)
 	{
-		for (int x = 0; x < width; x++)
+		for (int x = rect.minX; x <= rect.maxX; x++)
 		{
-			glm::vec3 center = vertices[y * width + x].pos;
-
-			glm::vec3 top = y == length - 1 ? glm::vec3(0) : vertices[(y + 1) * width + x].pos;
-			glm::vec3 bottom = y == 0 ? glm::vec3(0) : vertices[(y - 1) * width + x].pos;
-			glm::vec3 right = x == width - 1 ? glm::vec3(0) : vertices[y * width + x + 1].pos;
-			glm::vec3 left = x == 0 ? glm::vec3(0) : vertices[y * width + x - 1].pos;
-
-			glm::vec3 v1 = normalize(right - center);
-			glm::vec3 v2 = normalize(top - center);
-			glm::vec3 v3 = normalize(left - center);
-			glm::vec3 v4 = normalize(bottom - center);
-
-			glm::vec3 normal1 = cross(v2, v1);
-			glm::vec3 normal2 = cross(v3, v2);
-			glm::vec3 normal3 = cross(v4, v3);
-			glm::vec3 normal4 = cross(v1, v4);
-
-			glm::vec3 normal = glm::vec3(0);
-			
-			if (x == 0 || x == width - 1 || y == 0 || y == length - 1)
-			{
-				if (top == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal3;
-					if (right != glm::vec3(0))
-						normal += normal4;
-				}
-				else if (bottom == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal2;
-					if (right != glm::vec3(0))
-						normal += normal1;
-				}
-
-				if (left == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal1;
-					if (bottom != glm::vec3(0))
-						normal += normal4;
-				} 
-				else if (right == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal2;
-					if (bottom != glm::vec3(0))
-						normal += normal3;
-				}
-			}
-			else
-			{
-				normal = normal1 + normal2 + normal3 + normal4;
-			}
-
-			vertices[y * width + x].normal = glm::normalize(normal);
+			vertices[y * width + x].normal = getCentralDifferenceNormal(x, y, [&](int x, int y) { return getSurfaceHeight(x, y); });
 		}
-	}
+	});
 }
 
 void Mesh::updateMeshFromMap(HeightMap* heightMap)
@@ -216,13 +192,285 @@ void Mesh::updateMeshFromHeights(float*** heights)
 
 void Mesh::update()
 {
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);	
-		void* data = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-		memcpy(data, vertices, sizeof(vertices[0]) * vertexCount);
-		glUnmapBuffer(GL_ARRAY_BUFFER);
+	if (chunks.empty())
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			void* data = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+			memcpy(data, vertices, sizeof(vertices[0]) * vertexCount);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+
+	for (MeshChunk& chunk : chunks)
+	{
+		chunk.outdated = true;
+	}
+	uploadOutdatedChunks();
+}
+
+void Mesh::initChunks()
+{
+	chunkCountX = (width - 1 + MESH_CHUNK_SIZE - 1) / MESH_CHUNK_SIZE;
+	chunkCountY = (length - 1 + MESH_CHUNK_SIZE - 1) / MESH_CHUNK_SIZE;
+	chunks.clear();
+	indexPatterns.clear();
+
+	// only the last row and column of chunks can have other sizes, so there are at most four pattern sets
+	std::vector<glm::ivec2> patternSetSizes;
+	patternIndices.clear();
+	for (int cy = 0; cy < chunkCountY; cy++)
+	{
+		for (int cx = 0; cx < chunkCountX; cx++)
+		{
+			MeshChunk chunk;
+			chunk.x = cx * MESH_CHUNK_SIZE;
+			chunk.y = cy * MESH_CHUNK_SIZE;
+			chunk.sizeX = std::min(MESH_CHUNK_SIZE, width - 1 - chunk.x);
+			chunk.sizeY = std::min(MESH_CHUNK_SIZE, length - 1 - chunk.y);
+			chunk.baseVertex = (uint32_t)chunks.size() * MESH_CHUNK_VERTICES;
+
+			glm::ivec2 size = glm::ivec2(chunk.sizeX, chunk.sizeY);
+			auto patternSet = std::find(patternSetSizes.begin(), patternSetSizes.end(), size);
+			chunk.patternSet = (int)(patternSet - patternSetSizes.begin());
+			if (patternSet == patternSetSizes.end())
+			{
+				patternSetSizes.push_back(size);
+				for (int lod = 0; lod < MESH_LOD_COUNT; lod++)
+				{
+					for (int stitchMask = 0; stitchMask < STITCH_MASK_COUNT; stitchMask++)
+					{
+						IndexPattern pattern;
+						pattern.offset = (uint32_t)patternIndices.size();
+						buildChunkIndices(chunk.sizeX, chunk.sizeY, lod, stitchMask, patternIndices);
+						pattern.count = (uint32_t)patternIndices.size() - pattern.offset;
+						indexPatterns.push_back(pattern);
+					}
+				}
+			}
+
+			chunks.push_back(chunk);
+		}
+	}
+
+	onChunksCreated();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(patternIndices[0]) * patternIndices.size(), patternIndices.data(), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)getPackedVertexSize() * MESH_CHUNK_VERTICES * chunks.size(), nullptr, GL_DYNAMIC_DRAW);
+	uploadOutdatedChunks();
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+}
+
+void Mesh::uploadChunks(const DirtyRegion& region, int margin)
+{
+	for (const DirtyRect& rect : region.getRects())
+	{
+		DirtyRect grown = rect.expanded(margin, width, length);
+
+		// vertices on a chunk border are in both chunks
+		int minChunkX = std::max(grown.minX - 1, 0) / MESH_CHUNK_SIZE;
+		int minChunkY = std::max(grown.minY - 1, 0) / MESH_CHUNK_SIZE;
+		int maxChunkX = std::min(grown.maxX / MESH_CHUNK_SIZE, chunkCountX - 1);
+		int maxChunkY = std::min(grown.maxY / MESH_CHUNK_SIZE, chunkCountY - 1);
+		for (int cy = minChunkY; cy <= maxChunkY; cy++)
+		{
+			for (int cx = minChunkX; cx <= maxChunkX; cx++)
+			{
+				chunks[cy * chunkCountX + cx].outdated = true;
+			}
+		}
+	}
+
+	uploadOutdatedChunks();
+}
+
+void Mesh::uploadOutdatedChunks()
+{
+	lastUploadedChunks = 0;
+	outdatedChunks.clear();
+	for (MeshChunk& chunk : chunks)
+	{
+		if (chunk.outdated)
+			outdatedChunks.push_back(&chunk);
+	}
+	if (outdatedChunks.empty()) return;
+
+	size_t chunkBytes = (size_t)getPackedVertexSize() * MESH_CHUNK_VERTICES;
+	if (!useHeightTextures && packedVertices.size() < chunkBytes * outdatedChunks.size())
+		packedVertices.resize(chunkBytes * outdatedChunks.size());
+
+	// every chunk has its own vertices and slot in packedVertices
+	std::for_each(std::execution::par, outdatedChunks.begin(), outdatedChunks.end(), [&](MeshChunk*& chunk)
+	{
+		updateChunkErrors(*chunk);
+		onChunkUpdated(*chunk);
+		chunk->outdated = false;
+		if (!useHeightTextures)
+			packChunkVertices(*chunk, &packedVertices[chunkBytes * (&chunk - outdatedChunks.data())]);
+	});
+	if (useHeightTextures) return;
+
+	// neighbouring chunks in the list are neighbours in the vertex buffer, so runs go up in one call
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	for (size_t first = 0; first < outdatedChunks.size();)
+	{
+		size_t last = first;
+		while (last + 1 < outdatedChunks.size() && outdatedChunks[last + 1] == outdatedChunks[last] + 1)
+			last++;
+
+		size_t count = last - first + 1;
+		glBufferSubData(GL_ARRAY_BUFFER, getPackedVertexSize() * outdatedChunks[first]->baseVertex, chunkBytes * count, &packedVertices[chunkBytes * first]);
+		lastUploadedChunks += (int)count;
+		first = last + 1;
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+// measures how far each level strays from the full detail surface, and the chunk's bounds
+void Mesh::updateChunkErrors(MeshChunk& chunk)
+{
+	int stride = MESH_CHUNK_STRIDE;
+	float heights[MESH_CHUNK_VERTICES];
+	float minHeight = INFINITY;
+	float maxHeight = -INFINITY;
+	for (int y = 0; y <= chunk.sizeY; y++)
+	{
+		for (int x = 0; x <= chunk.sizeX; x++)
+		{
+			float height = getSurfaceHeight(chunk.x + x, chunk.y + y);
+			heights[y * stride + x] = height;
+			minHeight = std::min(minHeight, height);
+			maxHeight = std::max(maxHeight, height);
+		}
+	}
+
+	glm::vec3 first = vertices[chunk.y * width + chunk.x].pos;
+	glm::vec3 last = vertices[(chunk.y + chunk.sizeY) * width + chunk.x + chunk.sizeX].pos;
+	chunk.boundsMin = glm::vec3(first.x, minHeight, first.z);
+	chunk.boundsMax = glm::vec3(last.x, maxHeight, last.z);
+
+	// a level is never more exact than the finer ones, so the coarsest good enough level can be searched from the top
+	chunk.lodErrors[0] = 0.0f;
+	for (int lod = 1; lod < MESH_LOD_COUNT; lod++)
+	{
+		int step = 1 << lod;
+		float error = chunk.lodErrors[lod - 1];
+		for (int y = 0; y <= chunk.sizeY; y++)
+		{
+			int y0 = y / step * step;
+			int y1 = std::min(y0 + step, chunk.sizeY);
+			float ty = y1 == y0 ? 0.0f : (float)(y - y0) / (y1 - y0);
+			for (int x = 0; x <= chunk.sizeX; x++)
+			{
+				int x0 = x / step * step;
+				int x1 = std::min(x0 + step, chunk.sizeX);
+				float tx = x1 == x0 ? 0.0f : (float)(x - x0) / (x1 - x0);
+
+				float bottom = glm::mix(heights[y0 * stride + x0], heights[y0 * stride + x1], tx);
+				float top = glm::mix(heights[y1 * stride + x0], heights[y1 * stride + x1], tx);
+				error = std::max(error, std::abs(heights[y * stride + x] - glm::mix(bottom, top, ty)));
+			}
+		}
+		chunk.lodErrors[lod] = error;
+	}
+}
+
+void Mesh::packChunkVertices(const MeshChunk& chunk, uint8_t* destination)
+{
+	Vertex* packed = (Vertex*)destination;
+	for (int y = 0; y <= chunk.sizeY; y++)
+	{
+		Vertex* row = &vertices[(chunk.y + y) * width + chunk.x];
+		std::copy(row, row + chunk.sizeX + 1, packed + y * MESH_CHUNK_STRIDE);
+	}
+}
+
+IndexPattern Mesh::getChunkIndices(const MeshChunk& chunk)
+{
+	return getPattern(chunk);
+}
+
+const IndexPattern& Mesh::getPattern(const MeshChunk& chunk)
+{
+	return indexPatterns[(chunk.patternSet * MESH_LOD_COUNT + chunk.lod) * STITCH_MASK_COUNT + chunk.stitchMask];
+}
+
+float Mesh::getSurfaceHeight(int x, int y)
+{
+	return vertices[y * width + x].pos.y;
+}
+
+void Mesh::cullChunks(const Frustum& frustum)
+{
+	lastVisibleChunks = 0;
+	for (MeshChunk& chunk : chunks)
+	{
+		chunk.visible = frustum.intersectsBox(chunk.boundsMin, chunk.boundsMax);
+		if (chunk.visible)
+			lastVisibleChunks++;
+	}
+}
+
+void Mesh::selectLods(glm::vec3 cameraPosition, float pixelsPerUnit, float maxPixelError)
+{
+	for (MeshChunk& chunk : chunks)
+	{
+		glm::vec3 closest = glm::clamp(cameraPosition, chunk.boundsMin, chunk.boundsMax);
+		float distance = std::max(glm::length(closest - cameraPosition), 0.001f);
+
+		chunk.lod = 0;
+		for (int lod = MESH_LOD_COUNT - 1; lod > 0; lod--)
+		{
+			if (chunk.lodErrors[lod] * pixelsPerUnit / distance <= maxPixelError)
+			{
+				chunk.lod = lod;
+				break;
+			}
+		}
+	}
+
+	// the stitching only bridges one level, so neighbours are pulled down until they are at most one apart
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int cy = 0; cy < chunkCountY; cy++)
+		{
+			for (int cx = 0; cx < chunkCountX; cx++)
+			{
+				MeshChunk& chunk = chunks[cy * chunkCountX + cx];
+				int finest = chunk.lod;
+				if (cx > 0) finest = std::min(finest, chunks[cy * chunkCountX + cx - 1].lod);
+				if (cx < chunkCountX - 1) finest = std::min(finest, chunks[cy * chunkCountX + cx + 1].lod);
+				if (cy > 0) finest = std::min(finest, chunks[(cy - 1) * chunkCountX + cx].lod);
+				if (cy < chunkCountY - 1) finest = std::min(finest, chunks[(cy + 1) * chunkCountX + cx].lod);
+
+				if (chunk.lod > finest + 1)
+				{
+					chunk.lod = finest + 1;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	for (int cy = 0; cy < chunkCountY; cy++)
+	{
+		for (int cx = 0; cx < chunkCountX; cx++)
+		{
+			MeshChunk& chunk = chunks[cy * chunkCountX + cx];
+			chunk.stitchMask = 0;
+			if (cx > 0 && chunks[cy * chunkCountX + cx - 1].lod > chunk.lod) chunk.stitchMask |= STITCH_LEFT;
+			if (cx < chunkCountX - 1 && chunks[cy * chunkCountX + cx + 1].lod > chunk.lod) chunk.stitchMask |= STITCH_RIGHT;
+			if (cy > 0 && chunks[(cy - 1) * chunkCountX + cx].lod > chunk.lod) chunk.stitchMask |= STITCH_BOTTOM;
+			if (cy < chunkCountY - 1 && chunks[(cy + 1) * chunkCountX + cx].lod > chunk.lod) chunk.stitchMask |= STITCH_TOP;
+		}
+	}
+}
+
 void Mesh::clearData()
 {
 	delete vertices; 
@@ -1,8 +1,14 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <execution>
+#include <numeric>
 #include <vector>
 #include "height_map/height_map.h"
 #include "shader/shader.h"
+#include "simulation/dirty_region.h"
+#include "camera/frustum.h"
+#include "mesh_chunk.h"
 
 struct Vertex 
 {
@@ -21,9 +27,19 @@ public:
 	Mesh(int width, int length, Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount, Shader shader);
 	~Mesh();
 	virtual void init();
-	void draw();
+	virtual void draw();
 	void updateMeshFromMap(HeightMap* heightMap);
 	virtual void updateMeshFromHeights(float*** heights);
+	// picks the coarsest level per chunk that stays within maxPixelError pixels on screen,
+	// pixelsPerUnit is how many pixels one unit covers at a distance of one
+	void selectLods(glm::vec3 cameraPosition, float pixelsPerUnit, float maxPixelError);
+	// only chunks whose bounds touch the frustum are drawn
+	void cullChunks(const Frustum& frustum);
+	// draws the static grid displaced by HeightfieldTextures instead of the vertices. the vertices
+	// then only keep their heights, for picking and the chunks' bounds, and are not uploaded
+	void setUseHeightTextures(bool use) { useHeightTextures = use; }
+	int getChunkCount() { return (int)chunks.size(); }
+	int getChunkCountX() { return chunkCountX; }
 
 	Vertex* vertices;
 	uint32_t vertexCount = 0;
@@ -31,17 +47,81 @@ public:
 	uint32_t* indices;
 	uint32_t indexCount = 0;
 	Shader shader;
+
+	// chunks sent to the gpu by the last update
+	int lastUploadedChunks = 0;
+	// triangles submitted by the last draw
+	int lastDrawnTriangles = 0;
+	// chunks that passed the last cull
+	int lastVisibleChunks = 0;
 protected:
 	int width, length;
 	virtual void calculateVertices(HeightMap* map);
 	virtual void calculateVertices(float*** height);
 	virtual void calculateIndices();
 	virtual void calculateNormals();
+	virtual void calculateNormals(DirtyRect rect);
+
+	// runs rowFunction(y) for every row of rect, spread over all cores
+	template <typename RowFunction>
+	void forEachRow(DirtyRect rect, RowFunction rowFunction)
+	{
+		rows.resize(rect.maxY - rect.minY + 1);
+		std::iota(rows.begin(), rows.end(), rect.minY);
+		std::for_each(std::execution::par, rows.begin(), rows.end(), rowFunction);
+	}
+	// normal from central differences of heightAt(x, y), one sided on the edges
+	template <typename HeightFunction>
+	glm::vec3 getCentralDifferenceNormal(int x, int y, HeightFunction heightAt)
+	{
+		int left = std::max(x - 1, 0);
+		int right = std::min(x + 1, width - 1);
+		int bottom = std::max(y - 1, 0);
+		int top = std::min(y + 1, length - 1);
+		float dx = (heightAt(right, y) - heightAt(left, y)) / (right - left);
+		float dz = (heightAt(x, top) - heightAt(x, bottom)) / (top - bottom);
+		return glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+	}
 
+	// height the surface is drawn at, the level errors are measured against it
+	virtual float getSurfaceHeight(int x, int y);
 
 	void update();
+	// splits the grid into chunks and fills the vertex and index buffers, call with the vertex array bound
+	void initChunks();
+	// uploads the chunks the region grown by margin touches
+	void uploadChunks(const DirtyRegion& region, int margin);
+	// rebuilds and packs the outdated chunks in parallel, then uploads them
+	void uploadOutdatedChunks();
+	void updateChunkErrors(MeshChunk& chunk);
+	virtual void onChunksCreated() {}
+	// called for every chunk whose vertices were rebuilt, before it is uploaded.
+	// chunks are updated in parallel, so only touch what belongs to this one
+	virtual void onChunkUpdated(MeshChunk&) {}
+	// index range drawn for a chunk, empty ranges are skipped
+	virtual IndexPattern getChunkIndices(const MeshChunk& chunk);
+	// the pattern matching the chunk's level and stitched edges
+	const IndexPattern& getPattern(const MeshChunk& chunk);
+	// the gpu side vertex format, written into the chunk's MESH_CHUNK_VERTICES slots
+	virtual uint32_t getPackedVertexSize() { return sizeof(Vertex); }
+	virtual void packChunkVertices(const MeshChunk& chunk, uint8_t* destination);
 	void clearData();
 	uint32_t VAO, VBO, EBO;
+	bool useHeightTextures = false;
+
+	std::vector<MeshChunk> chunks;
+	int chunkCountX = 0;
+	int chunkCountY = 0;
+	// by pattern set, level and stitch mask, the indices stay around for meshes that filter them
+	std::vector<IndexPattern> indexPatterns;
+	std::vector<uint32_t> patternIndices;
+	std::vector<MeshChunk*> outdatedChunks;
+	std::vector<uint8_t> packedVertices;
+	std::vector<int> rows;
+	// arguments of the multi draw, one entry per visible chunk
+	std::vector<int> drawCounts;
+	std::vector<const void*> drawOffsets;
+	std::vector<int> drawBaseVertices;
 private:
 
 };
@@ -0,0 +1,57 @@
+#include "mesh_chunk.h"
+
+// grid lines of a level, every step-th vertex and always the last one
+static std::vector<int> getLodCoordinates(int size, int step)
+{
+	std::vector<int> coordinates;
+	for (int c = 0; c < size; c += step)
+		coordinates.push_back(c);
+	coordinates.push_back(size);
+	return coordinates;
+}
+
+// moves a vertex on a stitched edge down onto the grid line of the next coarser level
+static int snapToCoarser(int c, int size, int step)
+{
+	return c == size ? size : c / (2 * step) * (2 * step);
+}
+
+void buildChunkIndices(int sizeX, int sizeY, int lod, int stitchMask, std::vector<uint32_t>& indices)
+{
+	int step = 1 << lod;
+	int stride = MESH_CHUNK_STRIDE;
+	std::vector<int> xs = getLodCoordinates(sizeX, step);
+	std::vector<int> ys = getLodCoordinates(sizeY, step);
+
+	auto getIndex = [&](int x, int y) -> uint32_t
+	{
+		if ((y == 0 && (stitchMask & STITCH_BOTTOM)) || (y == sizeY && (stitchMask & STITCH_TOP)))
+			x = snapToCoarser(x, sizeX, step);
+		if ((x == 0 && (stitchMask & STITCH_LEFT)) || (x == sizeX && (stitchMask & STITCH_RIGHT)))
+			y = snapToCoarser(y, sizeY, step);
+		return y * stride + x;
+	};
+
+	// snapping collapses some triangles along the stitched edges. the ones that only
+	// look flat from above, where two stitched edges meet, close the gap to the inner vertex
+	auto addTriangle = [&](uint32_t a, uint32_t b, uint32_t c)
+	{
+		if (a == b || b == c || a == c) return;
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	};
+
+	for (size_t j = 0; j + 1 < ys.size(); j++)
+	{
+		for (size_t i = 0; i + 1 < xs.size(); i++)
+		{
+			int x0 = xs[i], x1 = xs[i + 1];
+			int y0 = ys[j], y1 = ys[j + 1];
+
+			// same winding as Mesh::calculateIndices
+			addTriangle(getIndex(x0, y0), getIndex(x0, y1), getIndex(x1, y0));
+			addTriangle(getIndex(x1, y1), getIndex(x1, y0), getIndex(x0, y1));
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// cells along the side of a render chunk
+const int MESH_CHUNK_SIZE = 32;
+// detail levels per chunk, level n only keeps every 2^n-th vertex
+const int MESH_LOD_COUNT = 6;
+// vertex slots per chunk. smaller chunks are padded, so the shaders can find a
+// vertex's cell from gl_VertexID alone
+const int MESH_CHUNK_STRIDE = MESH_CHUNK_SIZE + 1;
+const int MESH_CHUNK_VERTICES = MESH_CHUNK_STRIDE * MESH_CHUNK_STRIDE;
+
+// the edges of a chunk that meet a coarser neighbour
+enum StitchEdge
+{
+	STITCH_LEFT = 1,
+	STITCH_RIGHT = 2,
+	STITCH_BOTTOM = 4,
+	STITCH_TOP = 8,
+	STITCH_MASK_COUNT = 16,
+};
+
+// square of the grid with its own copy of its vertices, including the border
+// it shares with its neighbours, so it can be uploaded on its own
+struct MeshChunk
+{
+	// first cell and size in cells, the last row and column can be smaller
+	int x = 0;
+	int y = 0;
+	int sizeX = 0;
+	int sizeY = 0;
+
+	// offset of the chunk's vertices in the vertex buffer, rows are MESH_CHUNK_STRIDE apart
+	uint32_t baseVertex = 0;
+	// which set of index patterns fits the chunk's size
+	int patternSet = 0;
+
+	// largest height difference to the full detail surface, per level
+	float lodErrors[MESH_LOD_COUNT] = {};
+	// world space box around the drawn surface, refreshed whenever the chunk is uploaded
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+
+	int lod = 0;
+	int stitchMask = 0;
+	// inside the view frustum
+	bool visible = true;
+	// the vertices changed since the chunk was last uploaded
+	bool outdated = true;
+
+	int getVertexCount() const { return (sizeX + 1) * (sizeY + 1); }
+};
+
+// range of the shared index buffer
+struct IndexPattern
+{
+	uint32_t offset = 0;
+	uint32_t count = 0;
+};
+
+// appends the triangles of a sizeX by sizeY chunk at the given level. edges in
+// stitchMask snap their vertices onto the next coarser level so they meet the
+// neighbour without cracks. indices are local to the chunk's vertex slots
+void buildChunkIndices(int sizeX, int sizeY, int lod, int stitchMask, std::vector<uint32_t>& indices);
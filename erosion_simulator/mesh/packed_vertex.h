@@ -0,0 +1,39 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <cstddef>
+#include <cstdint>
+
+// the vertex formats the gpu sees. x and z are not stored, the shaders rebuild
+// them from gl_VertexID, and the heights are half floats
+
+// normal folded onto an octahedron around the y axis, two snorm16 values
+inline void encodeOctahedralNormal(glm::vec3 normal, int16_t* encoded)
+{
+	float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	glm::vec2 folded = sum > 0.0f ? glm::vec2(normal.x, normal.z) / sum : glm::vec2(0.0f);
+	// the lower half is mirrored into the corners
+	if (normal.y < 0.0f)
+	{
+		glm::vec2 signs = glm::vec2(folded.x >= 0.0f ? 1.0f : -1.0f, folded.y >= 0.0f ? 1.0f : -1.0f);
+		folded = (1.0f - glm::abs(glm::vec2(folded.y, folded.x))) * signs;
+	}
+	encoded[0] = (int16_t)glm::packSnorm1x16(folded.x);
+	encoded[1] = (int16_t)glm::packSnorm1x16(folded.y);
+}
+
+struct PackedTerrainVertex
+{
+	// height, original height
+	uint16_t heights[2];
+	int16_t normal[2];
+};
+
+struct PackedWaterVertex
+{
+	// floor height, water height
+	uint16_t heights[2];
+	int16_t normal[2];
+	// velocity x, velocity y, sediment, unused
+	uint16_t flow[4];
+};
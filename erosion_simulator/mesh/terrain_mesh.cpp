@@ -1,18 +1,8 @@
 #include "terrain_mesh.h"
 
-TerrainMesh::TerrainMesh(int width, int length, float*** terrainHeights, Shader shader)
-	:Mesh(width, length, shader)
+TerrainMesh::TerrainMesh(int width, int length, float*** terrainHeights, std::shared_ptr<const HeightGrid> originalHeights, Shader shader)
+	:Mesh(width, length, shader), originalHeights(originalHeights)
 {
-	originalHeights = new float[width * length];
-
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			originalHeights[y * width + x] = (*terrainHeights)[x][y];
-		}
-	}
-
 	calculateVertices(terrainHeights);
 	updateOriginalHeights();
 	calculateIndices();
@@ -20,18 +10,8 @@ TerrainMesh::TerrainMesh(int width, int length, float*** terrainHeights, Shader
 }
 
 TerrainMesh::TerrainMesh(int width, int length, HeightMap* heightMap, Shader shader)
-	:Mesh(width, length, shader)
+	:Mesh(width, length, shader), originalHeights(heightMap->getGrid())
 {
-	originalHeights = new float[width * length];
-
-	for (int y = 0; y < length; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			originalHeights[y * length + x] = heightMap->samplePoint(x,y);
-		}
-	}
-
 	calculateVertices(heightMap); 
 	updateOriginalHeights();
 	calculateIndices();
@@ -44,32 +24,47 @@ TerrainMesh::~TerrainMesh()
 
 void TerrainMesh::updateMeshFromHeights(float*** heights)
 {
-	clearData();
-	calculateVertices(heights);
-	updateOriginalHeights();
-	calculateIndices();
-	calculateNormals();
+	fillVertices(*heights, DirtyRect{ 0, 0, width - 1, length - 1 });
 	update();
 }
 
-void TerrainMesh::updateOriginalHeights()
+void TerrainMesh::updateMeshFromHeights(float*** heights, const DirtyRegion& region)
 {
-	for (int y = 0; y < length; y++)
+	lastUploadedChunks = 0;
+	if (region.isEmpty()) return;
+
+	// normals depend on the neighbours, so they change one cell further out
+	for (const DirtyRect& rect : region.getRects())
 	{
-		for (int x = 0; x < width; x++)
+		fillVertices(*heights, rect.expanded(1, width, length));
+	}
+
+	uploadChunks(region, 1);
+}
+
+void TerrainMesh::fillVertices(float** heights, DirtyRect rect)
+{
+	forEachRow(rect, [&](int y)
+	{
+		for (int x = rect.minX; x <= rect.maxX; x++)
 		{
-			vertices[y * width + x].height = originalHeights[y * width + x];
+			Vertex& vertex = vertices[y * width + x];
+			vertex.pos.y = heights[x][y];
+			vertex.height = originalHeights->columns[x][y];
+			// the height texture path derives the normals in the shader
+			if (!useHeightTextures)
+				vertex.normal = getCentralDifferenceNormal(x, y, [&](int x, int y) { return heights[x][y]; });
 		}
-	}
+	});
 }
 
-void TerrainMesh::updateOriginalHeights(float*** heights)
+void TerrainMesh::updateOriginalHeights()
 {
 	for (int y = 0; y < length; y++)
 	{
 		for (int x = 0; x < width; x++)
 		{
-			originalHeights[y * length + x] = (*heights)[x][y];
+			vertices[y * width + x].height = originalHeights->columns[x][y];
 		}
 	}
 }
@@ -78,26 +73,34 @@ void TerrainMesh::init()
 {
 	glBindVertexArray(VAO);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indexCount, indices, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertexCount, vertices, GL_STATIC_DRAW);
+	initChunks();
 
-	glEnableVertexAttribArray(shader.getAttribLocation("pos"));
-	glEnableVertexAttribArray(shader.getAttribLocation("normal"));
-	glEnableVertexAttribArray(shader.getAttribLocation("uv"));
-	glEnableVertexAttribArray(shader.getAttribLocation("originalHeight"));
-	glVertexAttribPointer(shader.getAttribLocation("pos"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(0));
-	glVertexAttribPointer(shader.getAttribLocation("normal"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos)));
-	glVertexAttribPointer(shader.getAttribLocation("uv"), 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal)));
-	glVertexAttribPointer(shader.getAttribLocation("originalHeight"), 1, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal) + sizeof(vertices[0].uv)));
+	glEnableVertexAttribArray(shader.getAttribLocation("heights"));
+	glEnableVertexAttribArray(shader.getAttribLocation("packedNormal"));
+	glVertexAttribPointer(shader.getAttribLocation("heights"), 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedTerrainVertex), (const GLvoid*)offsetof(PackedTerrainVertex, heights));
+	glVertexAttribPointer(shader.getAttribLocation("packedNormal"), 2, GL_SHORT, GL_TRUE, sizeof(PackedTerrainVertex), (const GLvoid*)offsetof(PackedTerrainVertex, normal));
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 }
 
+void TerrainMesh::packChunkVertices(const MeshChunk& chunk, uint8_t* destination)
+{
+	PackedTerrainVertex* packed = (PackedTerrainVertex*)destination;
+	for (int y = 0; y <= chunk.sizeY; y++)
+	{
+		const Vertex* row = &vertices[(chunk.y + y) * width + chunk.x];
+		PackedTerrainVertex* packedRow = packed + y * MESH_CHUNK_STRIDE;
+		for (int x = 0; x <= chunk.sizeX; x++)
+		{
+			packedRow[x].heights[0] = glm::packHalf1x16(row[x].pos.y);
+			packedRow[x].heights[1] = glm::packHalf1x16(row[x].height);
+			encodeOctahedralNormal(row[x].normal, packedRow[x].normal);
+		}
+	}
+}
+
 glm::vec3 TerrainMesh::getNormalAtIndex(int x, int y)
 {
 	return vertices[y * width + x].normal;
@@ -1,22 +1,35 @@
 #pragma once
 #include "mesh.h"
+#include "packed_vertex.h"
+#include "height_map/height_grid.h"
+#include <memory>
 
 class TerrainMesh :  public Mesh
 {
 public:
-	TerrainMesh(int width, int length, float*** terrainHeights, Shader shader);
+	TerrainMesh(int width, int length, float*** terrainHeights, std::shared_ptr<const HeightGrid> originalHeights, Shader shader);
 	TerrainMesh(int width, int length, HeightMap* heightMap, Shader shader);
 	~TerrainMesh();	
 
 	virtual void updateMeshFromHeights(float*** heights) override;
+	// only rebuilds and uploads the chunks the region touches
+	void updateMeshFromHeights(float*** heights, const DirtyRegion& region);
 	void updateOriginalHeights();
-	void updateOriginalHeights(float*** heights);
+	// keeps a reference to the grid instead of copying it, it is never written to while shared
+	void setOriginalHeights(std::shared_ptr<const HeightGrid> heights) { originalHeights = heights; }
 	virtual void init() override;
 
+	// columns [x][y] in one plane, the terrain the current run started from
+	const float* getOriginalHeights() { return originalHeights->plane.data(); }
 	glm::vec3 getNormalAtIndex(int x, int y);
 	glm::vec3 getPositionAtIndex(int x, int y);
+protected:
+	virtual uint32_t getPackedVertexSize() override { return sizeof(PackedTerrainVertex); }
+	virtual void packChunkVertices(const MeshChunk& chunk, uint8_t* destination) override;
 private:
+	// writes the heights, original heights and normals of the cells in rect in one parallel pass
+	void fillVertices(float** heights, DirtyRect rect);
 
-	float* originalHeights;
+	std::shared_ptr<const HeightGrid> originalHeights;
 };
 
@@ -2,6 +2,8 @@
 #include "glad/glad.h"
 #include "shader/shader.h"
 #include "mesh.h"
+#include <algorithm>
+#include <numeric>
 
 WaterMesh::WaterMesh(int width, int length, float*** waterFloor, float*** waterHeight, Shader shader)
 	:Mesh(width, length, shader)
@@ -14,45 +16,50 @@ WaterMesh::WaterMesh(int width, int length, float*** waterFloor, float*** waterH
 
 void WaterMesh::updateMeshFromHeights(float*** waterFloor, float*** waterHeight, glm::vec2*** waterVelocities, float*** sediments)
 {
-	clearData();
-	calculateVertices(waterFloor);
-	changeVerticesWaterHeight(waterHeight);
-	changeVerticesWaterVelocities(waterVelocities);
-	changeVerticesWaterSediment(sediments);
-	calculateIndices();
-	calculateNormals();
+	fillVertices(*waterFloor, *waterHeight, *waterVelocities, *sediments, DirtyRect{ 0, 0, width - 1, length - 1 });
 	update();
 }
 
-void WaterMesh::changeVerticesWaterHeight(float*** waterHeight)
+void WaterMesh::updateMeshFromHeights(float*** waterFloor, float*** waterHeight, glm::vec2*** waterVelocities, float*** sediments, const DirtyRegion& region)
 {
-	for (int y = 0; y < length; y++)
+	lastUploadedChunks = 0;
+	if (region.isEmpty()) return;
+
+	// normals depend on the neighbours, so they change one cell further out
+	for (const DirtyRect& rect : region.getRects())
 	{
-		for (int x = 0; x < width; x++)
-		{
-			vertices[y * width + x].height = (*waterHeight)[x][y];
-		}
+		fillVertices(*waterFloor, *waterHeight, *waterVelocities, *sediments, rect.expanded(1, width, length));
 	}
+
+	uploadChunks(region, 1);
 }
 
-void WaterMesh::changeVerticesWaterVelocities(glm::vec2*** waterVelocities)
+void WaterMesh::fillVertices(float** waterFloor, float** waterHeight, glm::vec2** waterVelocities, float** sediments, DirtyRect rect)
 {
-	for (int y = 0; y < length; y++)
+	forEachRow(rect, [&](int y)
 	{
-		for (int x = 0; x < width; x++)
+		for (int x = rect.minX; x <= rect.maxX; x++)
 		{
-			vertices[y * width + x].velocity = (*waterVelocities)[x][y];
+			Vertex& vertex = vertices[y * width + x];
+			vertex.pos.y = waterFloor[x][y];
+			vertex.height = waterHeight[x][y];
+			// the height texture path reads the rest from its textures
+			if (useHeightTextures) continue;
+
+			vertex.velocity = waterVelocities[x][y];
+			vertex.currentSediment = sediments[x][y];
+			vertex.normal = getCentralDifferenceNormal(x, y, [&](int x, int y) { return waterFloor[x][y] + waterHeight[x][y]; });
 		}
-	}
+	});
 }
 
-void WaterMesh::changeVerticesWaterSediment(float*** sediments)
+void WaterMesh::changeVerticesWaterHeight(float*** waterHeight)
 {
 	for (int y = 0; y < length; y++)
 	{
 		for (int x = 0; x < width; x++)
 		{
-			vertices[y * width + x].currentSediment = (*sediments)[x][y];
+			vertices[y * width + x].height = (*waterHeight)[x][y];
 		}
 	}
 }
@@ -61,93 +68,160 @@ void WaterMesh::init()
 {
 	glBindVertexArray(VAO);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indexCount, indices, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertexCount, vertices, GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(shader.getAttribLocation("pos"));
-	glEnableVertexAttribArray(shader.getAttribLocation("normal"));
-	glEnableVertexAttribArray(shader.getAttribLocation("uv"));
-	glEnableVertexAttribArray(shader.getAttribLocation("height"));
-	glEnableVertexAttribArray(shader.getAttribLocation("velocity"));
-	glEnableVertexAttribArray(shader.getAttribLocation("sediment"));
-	glVertexAttribPointer(shader.getAttribLocation("pos"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(0));
-	glVertexAttribPointer(shader.getAttribLocation("normal"), 3, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos)));
-	glVertexAttribPointer(shader.getAttribLocation("uv"), 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal)));
-	glVertexAttribPointer(shader.getAttribLocation("height"), 1, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal) + sizeof(vertices[0].uv)));
-	glVertexAttribPointer(shader.getAttribLocation("velocity"), 2, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal) + sizeof(vertices[0].uv) + sizeof(vertices[0].height)));
-	glVertexAttribPointer(shader.getAttribLocation("sediment"), 1, GL_FLOAT, GL_FALSE, sizeof(vertices[0]), (const GLvoid*)(sizeof(vertices[0].pos) + sizeof(vertices[0].normal) + sizeof(vertices[0].uv) + sizeof(vertices[0].height) + sizeof(vertices[0].velocity)));
+	initChunks();
+
+	glEnableVertexAttribArray(shader.getAttribLocation("heights"));
+	glEnableVertexAttribArray(shader.getAttribLocation("packedNormal"));
+	glEnableVertexAttribArray(shader.getAttribLocation("flow"));
+	glVertexAttribPointer(shader.getAttribLocation("heights"), 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedWaterVertex), (const GLvoid*)offsetof(PackedWaterVertex, heights));
+	glVertexAttribPointer(shader.getAttribLocation("packedNormal"), 2, GL_SHORT, GL_TRUE, sizeof(PackedWaterVertex), (const GLvoid*)offsetof(PackedWaterVertex, normal));
+	glVertexAttribPointer(shader.getAttribLocation("flow"), 4, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedWaterVertex), (const GLvoid*)offsetof(PackedWaterVertex, flow));
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 }
 
-void WaterMesh::calculateNormals()
+float WaterMesh::getSurfaceHeight(int x, int y)
+{
+	return vertices[y * width + x].pos.y + vertices[y * width + x].height;
+}
+
+void WaterMesh::draw()
+{
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	updateWetIndices();
+	glBindVertexArray(0);
+
+	Mesh::draw();
+}
+
+void WaterMesh::onChunksCreated()
+{
+	wetChunks.assign(chunks.size(), WetChunk());
+}
+
+void WaterMesh::onChunkUpdated(MeshChunk& chunk)
 {
-	for (int y = 1; y < (length - 1); y++)
+	WetChunk& wet = wetChunks[&chunk - chunks.data()];
+
+	wet.wetVertices.resize(MESH_CHUNK_VERTICES);
+	wet.wetVertexCount = 0;
+	for (int y = 0; y <= chunk.sizeY; y++)
 	{
-		for (int x = 1; x < (width - 1); x++)
+		for (int x = 0; x <= chunk.sizeX; x++)
 		{
-			glm::vec3 center = vertices[y * width + x].pos;
-
-			glm::vec3 top = y == length - 1 ? glm::vec3(0) : vertices[(y + 1) * width + x].pos + vertices[(y + 1) * width + x].height * glm::vec3(0,1,0);
-			glm::vec3 bottom = y == 0 ? glm::vec3(0) : vertices[(y - 1) * width + x].pos + vertices[(y - 1) * width + x].height * glm::vec3(0, 1, 0);
-			glm::vec3 right = x == width - 1 ? glm::vec3(0) : vertices[y * width + x + 1].pos + vertices[y * width + x + 1].height * glm::vec3(0, 1, 0);
-			glm::vec3 left = x == 0 ? glm::vec3(0) : vertices[y * width + x - 1].pos + vertices[y * width + x - 1].height * glm::vec3(0, 1, 0);
-
-			glm::vec3 v1 = normalize(right - center);
-			glm::vec3 v2 = normalize(top - center);
-			glm::vec3 v3 = normalize(left - center);
-			glm::vec3 v4 = normalize(bottom - center);
-
-			glm::vec3 normal1 = cross(v2, v1);
-			glm::vec3 normal2 = cross(v3, v2);
-			glm::vec3 normal3 = cross(v4, v3);
-			glm::vec3 normal4 = cross(v1, v4);
-
-			glm::vec3 normal = glm::vec3(0);
-
-			if (x == 0 || x == width - 1 || y == 0 || y == length - 1)
-			{
-				if (top == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal3;
-					if (right != glm::vec3(0))
-						normal += normal4;
-				}
-				else if (bottom == glm::vec3(0))
-				{
-					if (left != glm::vec3(0))
-						normal += normal2;
-					if (right != glm::vec3(0))
-						normal += normal1;
-				}
-
-				if (left == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal1;
-					if (bottom != glm::vec3(0))
-						normal += normal4;
-				}
-				else if (right == glm::vec3(0))
-				{
-					if (top != glm::vec3(0))
-						normal += normal2;
-					if (bottom != glm::vec3(0))
-						normal += normal3;
-				}
-			}
-			else
-			{
-				normal = normal1 + normal2 + normal3 + normal4;
-			}
-
-			vertices[y * width + x].normal = glm::normalize(normal);
+			uint8_t isWet = vertices[(chunk.y + y) * width + chunk.x + x].height >= MIN_VISIBLE_WATER_HEIGHT;
+			uint8_t& wetVertex = wet.wetVertices[y * MESH_CHUNK_STRIDE + x];
+			if (wetVertex != isWet)
+				wet.wetChanged = true;
+			wetVertex = isWet;
+			wet.wetVertexCount += isWet;
 		}
 	}
 }
+
+void WaterMesh::packChunkVertices(const MeshChunk& chunk, uint8_t* destination)
+{
+	PackedWaterVertex* packed = (PackedWaterVertex*)destination;
+	for (int y = 0; y <= chunk.sizeY; y++)
+	{
+		const Vertex* row = &vertices[(chunk.y + y) * width + chunk.x];
+		PackedWaterVertex* packedRow = packed + y * MESH_CHUNK_STRIDE;
+		for (int x = 0; x <= chunk.sizeX; x++)
+		{
+			packedRow[x].heights[0] = glm::packHalf1x16(row[x].pos.y);
+			packedRow[x].heights[1] = glm::packHalf1x16(row[x].height);
+			encodeOctahedralNormal(row[x].normal, packedRow[x].normal);
+			packedRow[x].flow[0] = glm::packHalf1x16(row[x].velocity.x);
+			packedRow[x].flow[1] = glm::packHalf1x16(row[x].velocity.y);
+			packedRow[x].flow[2] = glm::packHalf1x16(row[x].currentSediment);
+			packedRow[x].flow[3] = 0;
+		}
+	}
+}
+
+IndexPattern WaterMesh::getChunkIndices(const MeshChunk& chunk)
+{
+	const WetChunk& wet = wetChunks[&chunk - chunks.data()];
+	if (wet.wetVertexCount == 0)
+		return IndexPattern();
+	if (wet.wetVertexCount == chunk.getVertexCount())
+		return getPattern(chunk);
+	return wet.range;
+}
+
+void WaterMesh::updateWetIndices()
+{
+	auto isPartlyWet = [&](size_t i) { return wetChunks[i].wetVertexCount > 0 && wetChunks[i].wetVertexCount < chunks[i].getVertexCount(); };
+
+	bool repack = false;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		const MeshChunk& chunk = chunks[i];
+		WetChunk& wet = wetChunks[i];
+		if (!chunk.visible || !isPartlyWet(i)) continue;
+
+		if (wet.wetChanged || wet.lod != chunk.lod || wet.stitchMask != chunk.stitchMask)
+		{
+			compactWetTriangles(chunk, wet);
+			repack = true;
+		}
+		else if (!wet.isPacked)
+		{
+			repack = true;
+		}
+	}
+	if (!repack) return;
+
+	uint32_t wetIndexOffset = (uint32_t)patternIndices.size();
+	wetIndices.clear();
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		WetChunk& wet = wetChunks[i];
+		wet.isPacked = chunks[i].visible && isPartlyWet(i);
+		if (!wet.isPacked) continue;
+
+		wet.range.offset = wetIndexOffset + (uint32_t)wetIndices.size();
+		wet.range.count = (uint32_t)wet.indices.size();
+		wetIndices.insert(wetIndices.end(), wet.indices.begin(), wet.indices.end());
+	}
+
+	// a bigger buffer needs the patterns again
+	if (wetIndices.size() > wetIndexCapacity)
+	{
+		wetIndexCapacity = std::max((uint32_t)wetIndices.size(), 2 * wetIndexCapacity);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * (patternIndices.size() + wetIndexCapacity), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * patternIndices.size(), patternIndices.data());
+	}
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * wetIndexOffset, sizeof(uint32_t) * wetIndices.size(), wetIndices.data());
+}
+
+// a prefix sum over the wet flags of the pattern's triangles gives every wet triangle its place in the compacted list
+void WaterMesh::compactWetTriangles(const MeshChunk& chunk, WetChunk& wet)
+{
+	const IndexPattern& pattern = getPattern(chunk);
+	const uint32_t* indices = &patternIndices[pattern.offset];
+	uint32_t triangleCount = pattern.count / 3;
+
+	// one extra entry ends up holding the total
+	triangleOffsets.assign(triangleCount + 1, 0);
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		triangleOffsets[t] = wet.wetVertices[indices[3 * t]] | wet.wetVertices[indices[3 * t + 1]] | wet.wetVertices[indices[3 * t + 2]];
+	}
+	std::exclusive_scan(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin(), 0u);
+
+	wet.indices.resize(3 * triangleOffsets[triangleCount]);
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		if (triangleOffsets[t + 1] == triangleOffsets[t]) continue;
+
+		std::copy(indices + 3 * t, indices + 3 * t + 3, &wet.indices[3 * triangleOffsets[t]]);
+	}
+
+	wet.lod = chunk.lod;
+	wet.stitchMask = chunk.stitchMask;
+	wet.wetChanged = false;
+}
\ No newline at end of file
@@ -1,6 +1,28 @@
 #pragma once
 #include "terrain_mesh.h"
+#include "packed_vertex.h"
 #include "shader/shader.h"
+#include <cstdint>
+#include <vector>
+
+// water.frag leaves anything thinner than this transparent, so triangles with only such vertices are never drawn
+const float MIN_VISIBLE_WATER_HEIGHT = 0.15f;
+
+// the vertices of a chunk that hold visible water, and the wet triangles of the pattern the chunk was last drawn with
+struct WetChunk
+{
+	// by vertex slot
+	std::vector<uint8_t> wetVertices;
+	int wetVertexCount = 0;
+	bool wetChanged = true;
+
+	int lod = -1;
+	int stitchMask = -1;
+	std::vector<uint32_t> indices;
+	// where the wet triangles are in the index buffer
+	IndexPattern range;
+	bool isPacked = false;
+};
 
 class WaterMesh : public Mesh
 {
@@ -8,11 +30,32 @@ public:
 	WaterMesh(int width, int length, float*** waterFloor, float*** waterHeight, Shader shader);
 
 	void updateMeshFromHeights(float*** waterFloor, float*** waterHeight, glm::vec2*** waterVelocities, float*** sediment);
+	// only rebuilds and uploads the chunks the region touches
+	void updateMeshFromHeights(float*** waterFloor, float*** waterHeight, glm::vec2*** waterVelocities, float*** sediment, const DirtyRegion& region);
 	void changeVerticesWaterHeight(float*** waterHeight);
-	void changeVerticesWaterVelocities(glm::vec2*** waterVelocities);
-	void changeVerticesWaterSediment(float*** sediments);
 	virtual void init() override;
-	virtual void calculateNormals() override;
+	virtual void draw() override;
+protected:
+	// the water is drawn on top of its floor
+	virtual float getSurfaceHeight(int x, int y) override;
+	virtual void onChunksCreated() override;
+	virtual void onChunkUpdated(MeshChunk& chunk) override;
+	// dry chunks draw nothing, wet ones their pattern and the rest only their wet triangles
+	virtual IndexPattern getChunkIndices(const MeshChunk& chunk) override;
+	virtual uint32_t getPackedVertexSize() override { return sizeof(PackedWaterVertex); }
+	virtual void packChunkVertices(const MeshChunk& chunk, uint8_t* destination) override;
 private:
+	// writes the fields and normals of the cells in rect in one parallel pass
+	void fillVertices(float** waterFloor, float** waterHeight, glm::vec2** waterVelocities, float** sediments, DirtyRect rect);
+	// compacts the partly wet, visible chunks whose wetness or pattern changed, and uploads
+	// all wet triangles behind the patterns in the index buffer. needs the vertex array bound
+	void updateWetIndices();
+	void compactWetTriangles(const MeshChunk& chunk, WetChunk& wet);
+
+	std::vector<WetChunk> wetChunks;
+	std::vector<uint32_t> wetIndices;
+	// room for wet indices in the index buffer
+	uint32_t wetIndexCapacity = 0;
+	std::vector<uint32_t> triangleOffsets;
 };
 
@@ -1,8 +1,6 @@
 #version 330 core
-layout (location = 0) in vec3 pos;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec2 uv;
-layout (location = 3) in float originalHeight;
+layout (location = 0) in vec2 heights;
+layout (location = 1) in vec2 packedNormal;
 
 out vec3 fragPos;
 out vec3 fragNormal;
@@ -13,11 +11,62 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// the heights come from textures instead of the vertices, texel (y, x) is cell [x][y]
+uniform bool useHeightTextures;
+uniform sampler2D terrainHeightTexture;
+uniform sampler2D originalTerrainHeightTexture;
+uniform int gridWidth;
+uniform int gridLength;
+// every chunk has (chunkSize + 1)^2 vertex slots, in rows of chunkCountX chunks
+uniform int chunkCountX;
+uniform int chunkSize;
+
+ivec2 vertexCell()
+{
+	int stride = chunkSize + 1;
+	int chunk = gl_VertexID / (stride * stride);
+	int slot = gl_VertexID % (stride * stride);
+	return ivec2(chunk % chunkCountX, chunk / chunkCountX) * chunkSize + ivec2(slot % stride, slot / stride);
+}
+
+vec3 decodeOctahedralNormal(vec2 encoded)
+{
+	vec3 n = vec3(encoded.x, 1.0 - abs(encoded.x) - abs(encoded.y), encoded.y);
+	if (n.y < 0.0)
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+float terrainHeightAt(ivec2 c)
+{
+	c = clamp(c, ivec2(0), ivec2(gridWidth - 1, gridLength - 1));
+	return texelFetch(terrainHeightTexture, c.yx, 0).r;
+}
+
 void main()
 {
-	fragPos = pos;
-	fragNormal = normal;
-	texCoord = uv;
-	fragOriginalHeight = originalHeight;
-	gl_Position = projection * view * model * vec4(pos, 1.0);
-}
\ No newline at end of file
+	ivec2 c = vertexCell();
+	float height = heights.x;
+	fragOriginalHeight = heights.y;
+	fragNormal = decodeOctahedralNormal(packedNormal);
+
+	if (useHeightTextures)
+	{
+		height = terrainHeightAt(c);
+
+		// central differences, one sided on the edges
+		ivec2 left = max(c - ivec2(1, 0), ivec2(0));
+		ivec2 right = min(c + ivec2(1, 0), ivec2(gridWidth - 1, gridLength - 1));
+		ivec2 bottom = max(c - ivec2(0, 1), ivec2(0));
+		ivec2 top = min(c + ivec2(0, 1), ivec2(gridWidth - 1, gridLength - 1));
+		float dx = (terrainHeightAt(right) - terrainHeightAt(left)) / float(right.x - left.x);
+		float dz = (terrainHeightAt(top) - terrainHeightAt(bottom)) / float(top.y - bottom.y);
+		fragNormal = normalize(vec3(-dx, 1.0, -dz));
+
+		fragOriginalHeight = texelFetch(originalTerrainHeightTexture, c.yx, 0).r;
+	}
+
+	fragPos = vec3(c.x - gridWidth / 2, height, c.y - gridLength / 2);
+	texCoord = vec2(float(c.x) / gridWidth, float(c.y) / gridLength) / (10.0 / gridWidth);
+	gl_Position = projection * view * model * vec4(fragPos, 1.0);
+}
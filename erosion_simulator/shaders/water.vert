@@ -1,11 +1,9 @@
 #version 330
 
-layout (location = 0) in vec3 pos;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec2 uv;
-layout (location = 3) in float height;
-layout (location = 4) in vec2 velocity;
-layout (location = 5) in float sediment;
+layout (location = 0) in vec2 heights;
+layout (location = 1) in vec2 packedNormal;
+// velocity, sediment
+layout (location = 2) in vec4 flow;
 
 out vec3 fragNormal;
 out vec3 fragPos;
@@ -18,19 +16,79 @@ uniform mat4 model;
 uniform mat4 projection;
 uniform mat4 view;
 
+// the fields come from textures instead of the vertices, texel (y, x) is cell [x][y]
+uniform bool useHeightTextures;
+uniform sampler2D terrainHeightTexture;
+uniform sampler2D waterHeightTexture;
+uniform sampler2D velocityTexture;
+uniform sampler2D sedimentTexture;
+uniform int gridWidth;
+uniform int gridLength;
+// every chunk has (chunkSize + 1)^2 vertex slots, in rows of chunkCountX chunks
+uniform int chunkCountX;
+uniform int chunkSize;
+
+ivec2 vertexCell()
+{
+	int stride = chunkSize + 1;
+	int chunk = gl_VertexID / (stride * stride);
+	int slot = gl_VertexID % (stride * stride);
+	return ivec2(chunk % chunkCountX, chunk / chunkCountX) * chunkSize + ivec2(slot % stride, slot / stride);
+}
+
+vec3 decodeOctahedralNormal(vec2 encoded)
+{
+	vec3 n = vec3(encoded.x, 1.0 - abs(encoded.x) - abs(encoded.y), encoded.y);
+	if (n.y < 0.0)
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+float surfaceHeightAt(ivec2 c)
+{
+	c = clamp(c, ivec2(0), ivec2(gridWidth - 1, gridLength - 1));
+	return texelFetch(terrainHeightTexture, c.yx, 0).r + texelFetch(waterHeightTexture, c.yx, 0).r;
+}
+
 void main()
 {
-	gl_Position = projection * view * model * vec4(pos.x, pos.y + height, pos.z, 1.0);
+	ivec2 c = vertexCell();
+	vec3 floorPos = vec3(c.x - gridWidth / 2, heights.x, c.y - gridLength / 2);
+	float waterHeight = heights.y;
+	vec3 surfaceNormal = decodeOctahedralNormal(packedNormal);
+	vec2 waterUv = vec2(float(c.x) / gridWidth, float(c.y) / gridLength) / (10.0 / gridWidth);
+	vec2 waterVelocity = flow.xy;
+	float waterSediment = flow.z;
+
+	if (useHeightTextures)
+	{
+		floorPos.y = texelFetch(terrainHeightTexture, c.yx, 0).r;
+		waterHeight = texelFetch(waterHeightTexture, c.yx, 0).r;
+
+		// central differences of the water surface, one sided on the edges
+		ivec2 left = max(c - ivec2(1, 0), ivec2(0));
+		ivec2 right = min(c + ivec2(1, 0), ivec2(gridWidth - 1, gridLength - 1));
+		ivec2 bottom = max(c - ivec2(0, 1), ivec2(0));
+		ivec2 top = min(c + ivec2(0, 1), ivec2(gridWidth - 1, gridLength - 1));
+		float dx = (surfaceHeightAt(right) - surfaceHeightAt(left)) / float(right.x - left.x);
+		float dz = (surfaceHeightAt(top) - surfaceHeightAt(bottom)) / float(top.y - bottom.y);
+		surfaceNormal = normalize(vec3(-dx, 1.0, -dz));
+
+		waterVelocity = texelFetch(velocityTexture, c.yx, 0).rg;
+		waterSediment = texelFetch(sedimentTexture, c.yx, 0).r;
+	}
+
+	gl_Position = projection * view * model * vec4(floorPos.x, floorPos.y + waterHeight, floorPos.z, 1.0);
 	
-	fragNormal = mat3(transpose(inverse(model))) * normal;
+	fragNormal = mat3(transpose(inverse(model))) * surfaceNormal;
 	
-	fragPos = pos;
+	fragPos = floorPos;
 	
-	texCoord = uv;
+	texCoord = waterUv;
 
-	fragWaterHeight = height;
+	fragWaterHeight = waterHeight;
 
-	fragWaterVelocity = velocity;
+	fragWaterVelocity = waterVelocity;
 
-	fragSediment = sediment;
-}
\ No newline at end of file
+	fragSediment = waterSediment;
+}
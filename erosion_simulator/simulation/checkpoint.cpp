@@ -0,0 +1,510 @@
+#include "checkpoint.h"
+#include "io/field_codec.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <sstream>
+#include <type_traits>
+
+// the file is a header, a table of fields, the parameters and run state as text, the water
+// sources, and then one plane per field, columns [x][y] one after another, either raw or encoded
+struct CheckpointSection
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	int32_t width;
+	int32_t length;
+	uint32_t fieldCount;
+	uint32_t waterSourceCount;
+	CheckpointSection fieldTable;
+	CheckpointSection parameters;
+	CheckpointSection runState;
+	CheckpointSection waterSources;
+};
+
+enum class CheckpointEncoding : uint32_t
+{
+	RAW,
+	// lossless io/field_codec stream, floats of elementSize / 4 components
+	FIELD_CODEC,
+};
+
+struct CheckpointField
+{
+	uint32_t id;
+	uint32_t elementSize;
+	CheckpointEncoding encoding;
+	uint32_t reserved;
+	CheckpointSection plane;
+};
+
+static const char CHECKPOINT_MAGIC[8] = { 'E', 'R', 'O', 'S', 'C', 'K', 'P', 'T' };
+
+static const uint32_t FIELD_ELEMENT_SIZES[] = {
+	sizeof(float),
+	sizeof(float),
+	sizeof(float),
+	sizeof(FlowFlux),
+	sizeof(glm::vec2),
+	sizeof(float),
+};
+
+static const char* const FIELD_NAMES[] = {
+	"terrain",
+	"water",
+	"sediment",
+	"flux",
+	"velocity",
+	"hardness",
+};
+
+uint32_t getCheckpointElementSize(CheckpointFieldId id)
+{
+	return FIELD_ELEMENT_SIZES[(int)id];
+}
+
+const char* getCheckpointFieldName(CheckpointFieldId id)
+{
+	return FIELD_NAMES[(int)id];
+}
+
+CheckpointFieldId findCheckpointField(const std::string& name)
+{
+	for (int id = 0; id < (int)CheckpointFieldId::COUNT; id++)
+	{
+		if (name == FIELD_NAMES[id])
+			return (CheckpointFieldId)id;
+	}
+	return CheckpointFieldId::COUNT;
+}
+
+void* const* getCheckpointFieldColumns(ErosionModel* model, CheckpointFieldId id)
+{
+	switch (id)
+	{
+	case CheckpointFieldId::TERRAIN_HEIGHTS: return (void* const*)model->terrainHeights;
+	case CheckpointFieldId::WATER_HEIGHTS: return (void* const*)model->waterHeights;
+	case CheckpointFieldId::SUSPENDED_SEDIMENT: return (void* const*)model->suspendedSedimentAmounts;
+	case CheckpointFieldId::OUTFLOW_FLUX: return (void* const*)model->outflowFlux;
+	case CheckpointFieldId::VELOCITIES: return (void* const*)model->velocities;
+	default: return (void* const*)model->terrainHardness;
+	}
+}
+
+// calls visit(name, member) for every parameter that shapes the simulation, in both directions.
+// names are stored with the values, so parameters can be added without a new version
+template <typename Parameters, typename Visitor>
+static void visitStoredParameters(Parameters& parameters, Visitor visit)
+{
+	visit("simulationSpeed", parameters.simulationSpeed);
+	visit("rainIntensity", parameters.rainIntensity);
+	visit("rainAmount", parameters.rainAmount);
+	visit("evaporationRate", parameters.evaporationRate);
+	visit("fluidDensity", parameters.fluidDensity);
+	visit("sedimentCapacity", parameters.sedimentCapacity);
+	visit("maxErosionDepth", parameters.maxErosionDepth);
+	visit("slippageAngle", parameters.slippageAngle);
+	visit("seaLevel", parameters.seaLevel);
+	visit("useSedimentSlippage", parameters.useSedimentSlippage);
+	visit("useHydrologyPrepass", parameters.useHydrologyPrepass);
+	visit("isRaining", parameters.isRaining);
+	visit("generateWaves", parameters.generateWaves);
+	visit("waveStrength", parameters.waveStrength);
+	visit("waveInterval", parameters.waveInterval);
+	visit("waveDirection", parameters.waveDirection);
+	visit("warmStartLevels", parameters.warmStartLevels);
+	visit("warmStartMaxSteps", parameters.warmStartMaxSteps);
+	visit("warmStartTolerance", parameters.warmStartTolerance);
+	visit("useTileThrottling", parameters.useTileThrottling);
+	visit("pauseOnConvergence", parameters.pauseOnConvergence);
+	visit("convergedUpdateInterval", parameters.convergedUpdateInterval);
+	visit("convergenceWaterTolerance", parameters.convergenceWaterTolerance);
+	visit("convergenceTerrainTolerance", parameters.convergenceTerrainTolerance);
+	visit("convergenceSedimentTolerance", parameters.convergenceSedimentTolerance);
+}
+
+static std::string writeParameters(const ErosionParameters& parameters)
+{
+	std::ostringstream text;
+	text.precision(9);
+	visitStoredParameters(parameters, [&](const char* name, auto& value)
+	{
+		if constexpr (std::is_enum_v<std::remove_reference_t<decltype(value)>>)
+			text << name << " " << (int)value << "\n";
+		else
+			text << name << " " << value << "\n";
+	});
+	return text.str();
+}
+
+static uint64_t alignPlane(uint64_t offset)
+{
+	return (offset + CHECKPOINT_PLANE_ALIGNMENT - 1) / CHECKPOINT_PLANE_ALIGNMENT * CHECKPOINT_PLANE_ALIGNMENT;
+}
+
+// column x of a field, length cells long
+using CheckpointColumnFunction = std::function<const void*(CheckpointFieldId id, int x)>;
+
+static bool writeCheckpoint(const std::string& filePath, const ErosionParameters& modelParameters, int width, int length,
+	const CheckpointRunState& runState, bool compressed, CheckpointColumnFunction getColumn)
+{
+	std::string parameters = writeParameters(modelParameters);
+	std::ostringstream runStateText;
+	runStateText.precision(9);
+	runStateText << runState.timePast << "\n" << runState.randomEngine;
+	std::string runStateString = runStateText.str();
+
+	// everything up to the planes is laid out before writing, the field table is written
+	// again at the end, once the size of every plane is known
+	CheckpointHeader header = {};
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.headerSize = sizeof(CheckpointHeader);
+	header.width = width;
+	header.length = length;
+	header.fieldCount = (uint32_t)CheckpointFieldId::COUNT;
+	header.waterSourceCount = (uint32_t)modelParameters.waterSources.size();
+	header.fieldTable = { sizeof(CheckpointHeader), sizeof(CheckpointField) * header.fieldCount };
+	header.parameters = { header.fieldTable.offset + header.fieldTable.size, parameters.size() };
+	header.runState = { header.parameters.offset + header.parameters.size, runStateString.size() };
+	header.waterSources = { header.runState.offset + header.runState.size, sizeof(WaterSource) * modelParameters.waterSources.size() };
+
+	// a checkpoint that is being written never replaces a good one
+	std::string temporaryPath = filePath + ".tmp";
+	std::ofstream file(temporaryPath, std::ios_base::out | std::ios_base::binary);
+	if (!file)
+	{
+		printf("Failed to write the checkpoint to %s\n", filePath.c_str());
+		return false;
+	}
+
+	CheckpointField fields[(int)CheckpointFieldId::COUNT] = {};
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)fields, sizeof(fields));
+	file.write(parameters.data(), parameters.size());
+	file.write(runStateString.data(), runStateString.size());
+	file.write((const char*)modelParameters.waterSources.data(), header.waterSources.size);
+
+	// encoded planes are aligned as well, it costs little and keeps the layout the same
+	std::vector<char> padding(CHECKPOINT_PLANE_ALIGNMENT, 0);
+	std::vector<const float*> columns(width);
+	uint64_t written = header.waterSources.offset + header.waterSources.size;
+	for (uint32_t i = 0; i < header.fieldCount; i++)
+	{
+		CheckpointField& field = fields[i];
+		field.id = i;
+		field.elementSize = FIELD_ELEMENT_SIZES[i];
+		field.encoding = compressed ? CheckpointEncoding::FIELD_CODEC : CheckpointEncoding::RAW;
+		field.plane.offset = alignPlane(written);
+		file.write(padding.data(), field.plane.offset - written);
+
+		if (compressed)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				columns[x] = (const float*)getColumn((CheckpointFieldId)i, x);
+			}
+			std::vector<uint8_t> encoded = encodeField(columns.data(), width, length, field.elementSize / sizeof(float), FieldCodecOptions());
+			file.write((const char*)encoded.data(), encoded.size());
+			field.plane.size = encoded.size();
+		}
+		else
+		{
+			size_t columnSize = (size_t)field.elementSize * length;
+			for (int x = 0; x < width; x++)
+			{
+				file.write((const char*)getColumn((CheckpointFieldId)i, x), columnSize);
+			}
+			field.plane.size = (uint64_t)columnSize * width;
+		}
+		written = field.plane.offset + field.plane.size;
+	}
+
+	file.seekp(header.fieldTable.offset);
+	file.write((const char*)fields, sizeof(fields));
+	file.close();
+
+	std::error_code error;
+	if (file.fail() || (std::filesystem::rename(temporaryPath, filePath, error), error))
+	{
+		printf("Failed to write the checkpoint to %s\n", filePath.c_str());
+		std::filesystem::remove(temporaryPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool saveCheckpoint(const std::string& filePath, ErosionModel* model, const CheckpointRunState& runState, bool compressed)
+{
+	// the model may still live in the file it is saved over
+	model->ownFields();
+	return writeCheckpoint(filePath, *model, model->width, model->length, runState, compressed, [&](CheckpointFieldId id, int x)
+	{
+		return getCheckpointFieldColumns(model, id)[x];
+	});
+}
+
+bool saveCheckpoint(const std::string& filePath, const CheckpointState& state, bool compressed)
+{
+	return writeCheckpoint(filePath, state.parameters, state.width, state.length, state.runState, compressed, [&](CheckpointFieldId id, int x)
+	{
+		return state.getPlane(id) + (size_t)FIELD_ELEMENT_SIZES[(int)id] * x * state.length;
+	});
+}
+
+void CheckpointState::copyFrom(ErosionModel* model, const CheckpointRunState& runState)
+{
+	parameters = *model;
+	this->runState = runState;
+	if (width != model->width || length != model->length)
+	{
+		width = model->width;
+		length = model->length;
+		terrainHeights.resize((size_t)width * length);
+		waterHeights.resize((size_t)width * length);
+		suspendedSedimentAmounts.resize((size_t)width * length);
+		outflowFlux.resize((size_t)width * length);
+		velocities.resize((size_t)width * length);
+		terrainHardness.resize((size_t)width * length);
+		columns.resize(width);
+		std::iota(columns.begin(), columns.end(), 0);
+	}
+
+	std::for_each(std::execution::par, columns.begin(), columns.end(), [&](int x)
+	{
+		size_t start = (size_t)x * length;
+		std::copy(model->terrainHeights[x], model->terrainHeights[x] + length, terrainHeights.begin() + start);
+		std::copy(model->waterHeights[x], model->waterHeights[x] + length, waterHeights.begin() + start);
+		std::copy(model->suspendedSedimentAmounts[x], model->suspendedSedimentAmounts[x] + length, suspendedSedimentAmounts.begin() + start);
+		std::copy(model->outflowFlux[x], model->outflowFlux[x] + length, outflowFlux.begin() + start);
+		std::copy(model->velocities[x], model->velocities[x] + length, velocities.begin() + start);
+		std::copy(model->terrainHardness[x], model->terrainHardness[x] + length, terrainHardness.begin() + start);
+	});
+}
+
+size_t CheckpointState::getSize() const
+{
+	return (size_t)width * length * (4 * sizeof(float) + sizeof(FlowFlux) + sizeof(glm::vec2));
+}
+
+const uint8_t* CheckpointState::getPlane(CheckpointFieldId id) const
+{
+	switch (id)
+	{
+	case CheckpointFieldId::TERRAIN_HEIGHTS: return (const uint8_t*)terrainHeights.data();
+	case CheckpointFieldId::WATER_HEIGHTS: return (const uint8_t*)waterHeights.data();
+	case CheckpointFieldId::SUSPENDED_SEDIMENT: return (const uint8_t*)suspendedSedimentAmounts.data();
+	case CheckpointFieldId::OUTFLOW_FLUX: return (const uint8_t*)outflowFlux.data();
+	case CheckpointFieldId::VELOCITIES: return (const uint8_t*)velocities.data();
+	default: return (const uint8_t*)terrainHardness.data();
+	}
+}
+
+Checkpoint::~Checkpoint()
+{
+	delete file;
+}
+
+static bool isInFile(const CheckpointSection& section, size_t fileSize)
+{
+	return section.offset <= fileSize && section.size <= fileSize - section.offset;
+}
+
+bool Checkpoint::open(const std::string& filePath)
+{
+	delete file;
+	file = new MappedFile();
+	if (!file->open(filePath))
+	{
+		delete file;
+		file = nullptr;
+		return false;
+	}
+
+	auto fail = [&](const char* reason)
+	{
+		printf("Failed to load the checkpoint %s: %s\n", filePath.c_str(), reason);
+		delete file;
+		file = nullptr;
+		return false;
+	};
+
+	if (file->getSize() < sizeof(CheckpointHeader))
+		return fail("too short");
+	const CheckpointHeader* header = (const CheckpointHeader*)file->getData();
+	if (std::memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0)
+		return fail("not a checkpoint");
+	if (header->version != CHECKPOINT_VERSION)
+		return fail("written by a different version");
+	if (header->width <= 0 || header->length <= 0 ||
+		!isInFile(header->fieldTable, file->getSize()) || header->fieldTable.size < sizeof(CheckpointField) * header->fieldCount ||
+		!isInFile(header->parameters, file->getSize()) || !isInFile(header->runState, file->getSize()) ||
+		!isInFile(header->waterSources, file->getSize()) || header->waterSources.size < sizeof(WaterSource) * header->waterSourceCount)
+		return fail("corrupted header");
+
+	width = header->width;
+	length = header->length;
+	std::fill(std::begin(planes), std::end(planes), nullptr);
+
+	// unknown fields are skipped, every known one has to be there
+	const CheckpointField* fields = (const CheckpointField*)(file->getData() + header->fieldTable.offset);
+	for (uint32_t i = 0; i < header->fieldCount; i++)
+	{
+		const CheckpointField& field = fields[i];
+		if (field.id >= (uint32_t)CheckpointFieldId::COUNT) continue;
+
+		bool isRaw = field.encoding == CheckpointEncoding::RAW;
+		if (field.elementSize != FIELD_ELEMENT_SIZES[field.id] || (!isRaw && field.encoding != CheckpointEncoding::FIELD_CODEC) ||
+			(isRaw && field.plane.size != (uint64_t)field.elementSize * width * length) ||
+			field.plane.offset % CHECKPOINT_PLANE_ALIGNMENT != 0 || !isInFile(field.plane, file->getSize()))
+			return fail("corrupted field table");
+		planes[field.id] = file->getData() + field.plane.offset;
+		planeSizes[field.id] = field.plane.size;
+		encodedPlanes[field.id] = !isRaw;
+	}
+	for (void* plane : planes)
+	{
+		if (!plane)
+			return fail("a field is missing");
+	}
+	return true;
+}
+
+// a whole token as a number, false if it is not one or has anything after it
+template <typename Number>
+static bool parseNumber(const std::string& text, Number& value)
+{
+	const char* end = text.data() + text.size();
+	std::from_chars_result result = std::from_chars(text.data(), end, value);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+bool Checkpoint::readParameters(ErosionParameters& parameters) const
+{
+	if (!file) return false;
+	const CheckpointHeader* header = (const CheckpointHeader*)file->getData();
+
+	// read into a copy, so a corrupted block leaves the parameters as they were
+	ErosionParameters parsed = parameters;
+	std::istringstream text(std::string((const char*)file->getData() + header->parameters.offset, header->parameters.size));
+	std::string name;
+	std::string value;
+	bool valid = true;
+	while (valid && text >> name >> value)
+	{
+		visitStoredParameters(parsed, [&](const char* storedName, auto& member)
+		{
+			using Member = std::remove_reference_t<decltype(member)>;
+			if (name != storedName) return;
+
+			if constexpr (std::is_enum_v<Member>)
+			{
+				int number;
+				valid = parseNumber(value, number);
+				if (valid) member = (Member)number;
+			}
+			else if constexpr (std::is_same_v<Member, bool>)
+			{
+				valid = value == "0" || value == "1";
+				member = value == "1";
+			}
+			else
+			{
+				Member number;
+				valid = parseNumber(value, number);
+				if (valid) member = number;
+			}
+		});
+	}
+	if (!valid)
+	{
+		printf("Failed to load the checkpoint: the parameter %s has the value %s\n", name.c_str(), value.c_str());
+		return false;
+	}
+
+	const WaterSource* sources = (const WaterSource*)(file->getData() + header->waterSources.offset);
+	parsed.waterSources.assign(sources, sources + header->waterSourceCount);
+	parameters = parsed;
+	return true;
+}
+
+bool Checkpoint::readRunState(CheckpointRunState& runState) const
+{
+	if (!file) return false;
+	const CheckpointHeader* header = (const CheckpointHeader*)file->getData();
+
+	std::istringstream text(std::string((const char*)file->getData() + header->runState.offset, header->runState.size));
+	// the engines read with their own stream flags, which do not skip whitespace
+	CheckpointRunState parsed;
+	text >> parsed.timePast >> std::ws >> parsed.randomEngine;
+	if (text.fail())
+	{
+		printf("Failed to load the checkpoint: the run state is corrupted\n");
+		return false;
+	}
+	runState = parsed;
+	return true;
+}
+
+bool Checkpoint::restoreFields(ErosionModel* model)
+{
+	if (!file) return false;
+	if (std::find(std::begin(encodedPlanes), std::end(encodedPlanes), true) == std::end(encodedPlanes))
+	{
+		model->adoptFields(file, (float*)planes[(int)CheckpointFieldId::TERRAIN_HEIGHTS], (float*)planes[(int)CheckpointFieldId::WATER_HEIGHTS],
+			(float*)planes[(int)CheckpointFieldId::SUSPENDED_SEDIMENT], (FlowFlux*)planes[(int)CheckpointFieldId::OUTFLOW_FLUX],
+			(glm::vec2*)planes[(int)CheckpointFieldId::VELOCITIES], (float*)planes[(int)CheckpointFieldId::TERRAIN_HARDNESS]);
+		file = nullptr;
+		return true;
+	}
+
+	// encoded planes cannot be used in place. all of them are decoded before the model is
+	// touched, so a corrupted one leaves it as it was
+	std::vector<std::vector<uint8_t>> decodedPlanes((int)CheckpointFieldId::COUNT);
+	for (int id = 0; id < (int)CheckpointFieldId::COUNT; id++)
+	{
+		if (!encodedPlanes[id]) continue;
+
+		size_t columnSize = (size_t)FIELD_ELEMENT_SIZES[id] * length;
+		decodedPlanes[id].resize(columnSize * width);
+		std::vector<float*> columns(width);
+		for (int x = 0; x < width; x++)
+		{
+			columns[x] = (float*)(decodedPlanes[id].data() + columnSize * x);
+		}
+		if (!decodeField((const uint8_t*)planes[id], planeSizes[id], columns.data(), width, length, FIELD_ELEMENT_SIZES[id] / sizeof(float)))
+		{
+			printf("Failed to load the checkpoint: the %s field could not be decoded\n", FIELD_NAMES[id]);
+			return false;
+		}
+	}
+
+	std::vector<int> xs(width);
+	std::iota(xs.begin(), xs.end(), 0);
+	for (int id = 0; id < (int)CheckpointFieldId::COUNT; id++)
+	{
+		void* const* columns = getCheckpointFieldColumns(model, (CheckpointFieldId)id);
+		const uint8_t* plane = encodedPlanes[id] ? decodedPlanes[id].data() : (const uint8_t*)planes[id];
+		size_t columnSize = (size_t)FIELD_ELEMENT_SIZES[id] * length;
+		std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
+		{
+			std::memcpy(columns[x], plane + columnSize * x, columnSize);
+		});
+	}
+
+	delete file;
+	file = nullptr;
+	return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "erosion_model.h"
+#include <random>
+#include <string>
+
+const uint32_t CHECKPOINT_VERSION = 2;
+// planes start on page boundaries, so a mapped plane can be used in place
+const uint64_t CHECKPOINT_PLANE_ALIGNMENT = 4096;
+
+// the planes a checkpoint holds, in the order they are stored
+enum class CheckpointFieldId : uint32_t
+{
+	TERRAIN_HEIGHTS,
+	WATER_HEIGHTS,
+	SUSPENDED_SEDIMENT,
+	OUTFLOW_FLUX,
+	VELOCITIES,
+	TERRAIN_HARDNESS,
+	COUNT,
+};
+
+// bytes of one cell of a field
+uint32_t getCheckpointElementSize(CheckpointFieldId id);
+// short lowercase name, like "terrain" or "velocity"
+const char* getCheckpointFieldName(CheckpointFieldId id);
+// the field with that short name, COUNT if there is none
+CheckpointFieldId findCheckpointField(const std::string& name);
+// the model's columns [x][y] of a field
+void* const* getCheckpointFieldColumns(ErosionModel* model, CheckpointFieldId id);
+
+// everything of a run that is not part of the model
+struct CheckpointRunState
+{
+	float timePast = 0.0f;
+	std::default_random_engine randomEngine;
+};
+
+// a copy of everything a checkpoint holds, taken so it can be written while the model moves on.
+// the planes are columns [x][y] one after another
+struct CheckpointState
+{
+	int width = 0;
+	int length = 0;
+	ErosionParameters parameters;
+	CheckpointRunState runState;
+
+	std::vector<float> terrainHeights;
+	std::vector<float> waterHeights;
+	std::vector<float> suspendedSedimentAmounts;
+	std::vector<FlowFlux> outflowFlux;
+	std::vector<glm::vec2> velocities;
+	std::vector<float> terrainHardness;
+
+	// copies the columns in parallel, the planes are only reallocated when the size changed
+	void copyFrom(ErosionModel* model, const CheckpointRunState& runState);
+	// bytes of all planes together
+	size_t getSize() const;
+	const uint8_t* getPlane(CheckpointFieldId id) const;
+
+private:
+	// column indices to run the copy over
+	std::vector<int> columns;
+};
+
+// writes every field, the simulation parameters, the water sources and the run state.
+// the file is written next to filePath and renamed over it once complete. compressed planes
+// are encoded losslessly, they take less space but have to be decoded instead of mapped.
+// a model restored from a mapped checkpoint is given its own columns first, so it can be
+// saved over the file it came from
+bool saveCheckpoint(const std::string& filePath, ErosionModel* model, const CheckpointRunState& runState, bool compressed = false);
+bool saveCheckpoint(const std::string& filePath, const CheckpointState& state, bool compressed = false);
+
+// a checkpoint mapped into memory. raw planes are handed to a model as they are, pages
+// are only read in once touched and only copied once the simulation writes to them
+class Checkpoint
+{
+public:
+	Checkpoint() = default;
+	~Checkpoint();
+
+	// owns the mapping, which a model may take over
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	// false if the file could not be mapped or is not a checkpoint this version can read
+	bool open(const std::string& filePath);
+
+	int getWidth() const { return width; }
+	int getLength() const { return length; }
+
+	// the simulation parameters and water sources it was saved with, parameters that only
+	// steer the viewer, like the brush or debug modes, are left as they are.
+	// false, with parameters untouched, if a value is not a number
+	bool readParameters(ErosionParameters& parameters) const;
+	bool readRunState(CheckpointRunState& runState) const;
+	// points the fields of model, which has to be the checkpoint's size, into the mapped planes.
+	// the model takes over the mapping, the checkpoint can only be restored once. if any plane
+	// is compressed, all are decoded first and then copied into the model's columns. false, with
+	// the model untouched, if one is corrupted or the checkpoint was already restored
+	bool restoreFields(ErosionModel* model);
+
+private:
+	MappedFile* file = nullptr;
+	int width = 0;
+	int length = 0;
+	void* planes[6] = {};
+	uint64_t planeSizes[6] = {};
+	bool encodedPlanes[6] = {};
+};
@@ -0,0 +1,224 @@
+#include "convergence.h"
+#include "erosion_model.h"
+#include <algorithm>
+#include <cmath>
+
+// checks in a row a tile has to stay below the tolerances before it is throttled
+const int QUIET_CHECKS_TO_CONVERGE = 2;
+
+ConvergenceMonitor::ConvergenceMonitor(int width, int length)
+	: width(width), length(length)
+{
+	tileCountX = (width + SIMULATION_TILE_SIZE - 1) / SIMULATION_TILE_SIZE;
+	tileCountY = (length + SIMULATION_TILE_SIZE - 1) / SIMULATION_TILE_SIZE;
+	tiles = std::vector<SimulationTile>(tileCountX * tileCountY);
+	activeTileCount = tileCountX * tileCountY;
+}
+
+void ConvergenceMonitor::reset()
+{
+	wakeAll();
+	hasBaseline = false;
+	step = 0;
+	lastCheckStep = 0;
+	waterResidualHistory.clear();
+	terrainResidualHistory.clear();
+	sedimentFluxHistory.clear();
+}
+
+void ConvergenceMonitor::wakeAll()
+{
+	for (SimulationTile& tile : tiles)
+	{
+		tile.converged = false;
+		tile.quietChecks = 0;
+		tile.moving = true;
+		tile.active = true;
+	}
+	converged = false;
+}
+
+void ConvergenceMonitor::wakeArea(int minX, int minY, int maxX, int maxY)
+{
+	int minTileX = std::max(0, minX / SIMULATION_TILE_SIZE);
+	int minTileY = std::max(0, minY / SIMULATION_TILE_SIZE);
+	int maxTileX = std::min(tileCountX - 1, maxX / SIMULATION_TILE_SIZE);
+	int maxTileY = std::min(tileCountY - 1, maxY / SIMULATION_TILE_SIZE);
+
+	for (int tileX = minTileX; tileX <= maxTileX; tileX++)
+	{
+		for (int tileY = minTileY; tileY <= maxTileY; tileY++)
+		{
+			SimulationTile& tile = tiles[tileX * tileCountY + tileY];
+			tile.converged = false;
+			tile.quietChecks = 0;
+			tile.moving = true;
+			tile.active = true;
+			converged = false;
+		}
+	}
+}
+
+void ConvergenceMonitor::beginStep(ErosionModel* model)
+{
+	if (haveParametersChanged(model))
+		wakeAll();
+
+	bool updateAll = !model->useTileThrottling || step % model->convergedUpdateInterval == 0;
+
+	activeTileCount = 0;
+	for (int tileX = 0; tileX < tileCountX; tileX++)
+	{
+		for (int tileY = 0; tileY < tileCountY; tileY++)
+		{
+			SimulationTile& tile = tiles[tileX * tileCountY + tileY];
+			tile.moving = !tile.converged;
+
+			// tiles next to a moving tile keep exchanging water with it
+			for (int j = -1; j <= 1 && !tile.moving; j++)
+			{
+				for (int i = -1; i <= 1 && !tile.moving; i++)
+				{
+					int neighbourX = tileX + i;
+					int neighbourY = tileY + j;
+					if (neighbourX < 0 || neighbourX >= tileCountX || neighbourY < 0 || neighbourY >= tileCountY) continue;
+					if (!tiles[neighbourX * tileCountY + neighbourY].converged)
+						tile.moving = true;
+				}
+			}
+			tile.active = updateAll || tile.moving;
+
+			if (tile.active)
+			{
+				tile.updatedSteps++;
+				activeTileCount++;
+			}
+		}
+	}
+}
+
+void ConvergenceMonitor::endStep(ErosionModel* model)
+{
+	if (step % model->convergedUpdateInterval == 0)
+		measure(model);
+	step++;
+}
+
+bool ConvergenceMonitor::consumeConvergedEvent()
+{
+	bool event = convergedEvent;
+	convergedEvent = false;
+	return event;
+}
+
+void ConvergenceMonitor::measure(ErosionModel* model)
+{
+	if (!hasBaseline)
+	{
+		previousWater = std::vector<float>(width * length);
+		previousTerrain = std::vector<float>(width * length);
+	}
+
+	float maxWaterChange = 0.0f;
+	float maxTerrainChange = 0.0f;
+	float totalSedimentFlux = 0.0f;
+	int checkedSteps = std::max(1, step - lastCheckStep);
+	lastCheckStep = step;
+	convergedTileCount = 0;
+
+	for (int tileX = 0; tileX < tileCountX; tileX++)
+	{
+		for (int tileY = 0; tileY < tileCountY; tileY++)
+		{
+			SimulationTile& tile = tiles[tileX * tileCountY + tileY];
+
+			float waterChange = 0.0f;
+			float terrainChange = 0.0f;
+			float sedimentFlux = 0.0f;
+
+			int maxX = std::min(width, (tileX + 1) * SIMULATION_TILE_SIZE);
+			int maxY = std::min(length, (tileY + 1) * SIMULATION_TILE_SIZE);
+			for (int x = tileX * SIMULATION_TILE_SIZE; x < maxX; x++)
+			{
+				for (int y = tileY * SIMULATION_TILE_SIZE; y < maxY; y++)
+				{
+					float& water = previousWater[x * length + y];
+					float& terrain = previousTerrain[x * length + y];
+					waterChange = std::max(waterChange, std::abs(model->waterHeights[x][y] - water));
+					terrainChange = std::max(terrainChange, std::abs(model->terrainHeights[x][y] - terrain));
+					sedimentFlux += glm::length(model->velocities[x][y]) * model->suspendedSedimentAmounts[x][y];
+					water = model->waterHeights[x][y];
+					terrain = model->terrainHeights[x][y];
+				}
+			}
+
+			if (hasBaseline)
+			{
+				// water moves every step, the terrain and sediment only in the steps the tile was updated
+				int steps = std::max(1, tile.updatedSteps);
+				int cells = (maxX - tileX * SIMULATION_TILE_SIZE) * (maxY - tileY * SIMULATION_TILE_SIZE);
+				tile.maxWaterChange = waterChange / checkedSteps;
+				tile.maxTerrainChange = terrainChange / steps;
+				tile.sedimentFluxChange = std::abs(sedimentFlux - tile.sedimentFlux) / (steps * cells);
+
+				bool quiet = tile.maxWaterChange < model->convergenceWaterTolerance && tile.maxTerrainChange < model->convergenceTerrainTolerance &&
+					tile.sedimentFluxChange < model->convergenceSedimentTolerance;
+				tile.quietChecks = quiet ? tile.quietChecks + 1 : 0;
+				tile.converged = tile.quietChecks >= QUIET_CHECKS_TO_CONVERGE;
+			}
+			tile.sedimentFlux = sedimentFlux;
+			tile.updatedSteps = 0;
+
+			maxWaterChange = std::max(maxWaterChange, tile.maxWaterChange);
+			maxTerrainChange = std::max(maxTerrainChange, tile.maxTerrainChange);
+			totalSedimentFlux += tile.sedimentFlux;
+			if (tile.converged)
+				convergedTileCount++;
+		}
+	}
+
+	if (hasBaseline)
+	{
+		pushHistory(waterResidualHistory, maxWaterChange);
+		pushHistory(terrainResidualHistory, maxTerrainChange);
+		pushHistory(sedimentFluxHistory, totalSedimentFlux);
+	}
+	hasBaseline = true;
+
+	bool wasConverged = converged;
+	converged = convergedTileCount == tileCountX * tileCountY;
+	if (converged && !wasConverged)
+	{
+		convergedEvent = true;
+		convergedEventCount++;
+	}
+}
+
+bool ConvergenceMonitor::haveParametersChanged(ErosionModel* model)
+{
+	std::vector<float> signature{
+		(float)model->isRaining,
+		(float)model->rainIntensity,
+		(float)model->rainAmount,
+		(float)model->simulationSpeed,
+		model->evaporationRate,
+		model->seaLevel,
+		model->slippageAngle,
+		model->sedimentCapacity,
+		(float)model->useSedimentSlippage,
+		(float)model->generateWaves,
+		(float)model->waterSources.size(),
+		(float)model->useTileThrottling,
+	};
+
+	bool changed = !parameterSignature.empty() && signature != parameterSignature;
+	parameterSignature = signature;
+	return changed;
+}
+
+void ConvergenceMonitor::pushHistory(std::vector<float>& history, float value)
+{
+	if (history.size() >= CONVERGENCE_HISTORY_SIZE)
+		history.erase(history.begin());
+	history.push_back(value);
+}
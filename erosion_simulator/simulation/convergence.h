@@ -0,0 +1,93 @@
+#pragma once
+#include <vector>
+
+struct ErosionModel;
+
+// side of the square tiles the simulation is throttled by
+const int SIMULATION_TILE_SIZE = 32;
+// number of residual samples kept for the UI
+const int CONVERGENCE_HISTORY_SIZE = 200;
+
+struct SimulationTile
+{
+	// per step rates measured at the last check
+	float maxWaterChange = 0.0f;
+	float maxTerrainChange = 0.0f;
+	float sedimentFlux = 0.0f;
+	float sedimentFluxChange = 0.0f;
+
+	int updatedSteps = 0;
+	int quietChecks = 0;
+	bool converged = false;
+	// not converged or next to a tile that is not, changes by more than the tolerances
+	bool moving = true;
+	bool active = true;
+};
+
+// tracks how much every tile of the model still changes. water keeps flowing
+// everywhere, but erosion, transport and slippage of converged tiles only run
+// every convergedUpdateInterval steps, unless a neighbour is still moving, and
+// the whole map converging raises a one time event
+class ConvergenceMonitor
+{
+public:
+	ConvergenceMonitor(int width, int length);
+
+	void reset();
+	void wakeAll();
+	// wakes the tiles overlapping the cell rectangle
+	void wakeArea(int minX, int minY, int maxX, int maxY);
+
+	// decides which tiles the erosion kernels update this step
+	void beginStep(ErosionModel* model);
+	// measures the residuals every convergedUpdateInterval steps
+	void endStep(ErosionModel* model);
+
+	bool isTileActive(int tileX, int tileY) { return tiles[tileX * tileCountY + tileY].active; }
+	// active this step for more than the update every convergedUpdateInterval steps
+	bool isTileMoving(int tileX, int tileY) { return tiles[tileX * tileCountY + tileY].moving; }
+	bool hasConverged() { return converged; }
+	// true once every time the whole map converges
+	bool consumeConvergedEvent();
+	// how often the map converged so far, survives resets so other threads can spot new events
+	int getConvergedEventCount() { return convergedEventCount; }
+
+	int getTileCountX() { return tileCountX; }
+	int getTileCountY() { return tileCountY; }
+	int getActiveTileCount() { return activeTileCount; }
+	int getConvergedTileCount() { return convergedTileCount; }
+	int getStep() { return step; }
+
+	const std::vector<float>& getWaterResidualHistory() { return waterResidualHistory; }
+	const std::vector<float>& getTerrainResidualHistory() { return terrainResidualHistory; }
+	const std::vector<float>& getSedimentFluxHistory() { return sedimentFluxHistory; }
+
+private:
+	void measure(ErosionModel* model);
+	bool haveParametersChanged(ErosionModel* model);
+	void pushHistory(std::vector<float>& history, float value);
+
+	int width, length;
+	int tileCountX, tileCountY;
+	std::vector<SimulationTile> tiles;
+
+	// water and terrain at the last check, indexed x * length + y
+	std::vector<float> previousWater;
+	std::vector<float> previousTerrain;
+	bool hasBaseline = false;
+
+	std::vector<float> parameterSignature;
+
+	int step = 0;
+	// step of the last check
+	int lastCheckStep = 0;
+	int activeTileCount = 0;
+	int convergedTileCount = 0;
+	bool converged = false;
+	bool convergedEvent = false;
+	int convergedEventCount = 0;
+
+	std::vector<float> waterResidualHistory;
+	std::vector<float> terrainResidualHistory;
+	std::vector<float> sedimentFluxHistory;
+};
@@ -0,0 +1,86 @@
+#include "dirty_region.h"
+#include <algorithm>
+
+bool DirtyRect::contains(const DirtyRect& other) const
+{
+	return other.minX >= minX && other.maxX <= maxX && other.minY >= minY && other.maxY <= maxY;
+}
+
+DirtyRect DirtyRect::expanded(int margin, int width, int length) const
+{
+	return DirtyRect{
+		std::max(0, minX - margin),
+		std::max(0, minY - margin),
+		std::min(width - 1, maxX + margin),
+		std::min(length - 1, maxY + margin),
+	};
+}
+
+// true if the union of a and b is exactly a rectangle
+static bool canMerge(const DirtyRect& a, const DirtyRect& b)
+{
+	if (a.minX == b.minX && a.maxX == b.maxX)
+		return a.maxY + 1 >= b.minY && b.maxY + 1 >= a.minY;
+	if (a.minY == b.minY && a.maxY == b.maxY)
+		return a.maxX + 1 >= b.minX && b.maxX + 1 >= a.minX;
+	return false;
+}
+
+void DirtyRegion::add(DirtyRect rect)
+{
+	if (rect.isEmpty()) return;
+
+	// keep merging until the rectangle does not touch anything it can be joined with
+	bool merged = true;
+	while (merged)
+	{
+		merged = false;
+		for (size_t i = 0; i < rects.size(); i++)
+		{
+			if (rects[i].contains(rect))
+				return;
+
+			if (rect.contains(rects[i]) || canMerge(rect, rects[i]))
+			{
+				rect.minX = std::min(rect.minX, rects[i].minX);
+				rect.minY = std::min(rect.minY, rects[i].minY);
+				rect.maxX = std::max(rect.maxX, rects[i].maxX);
+				rect.maxY = std::max(rect.maxY, rects[i].maxY);
+				rects.erase(rects.begin() + i);
+				merged = true;
+				break;
+			}
+		}
+	}
+	rects.push_back(rect);
+
+	if (rects.size() > MAX_DIRTY_RECTS)
+	{
+		DirtyRect bounds = getBounds();
+		rects.clear();
+		rects.push_back(bounds);
+	}
+}
+
+void DirtyRegion::add(const DirtyRegion& other)
+{
+	for (const DirtyRect& rect : other.rects)
+	{
+		add(rect);
+	}
+}
+
+DirtyRect DirtyRegion::getBounds() const
+{
+	if (rects.empty()) return DirtyRect{};
+
+	DirtyRect bounds = rects[0];
+	for (const DirtyRect& rect : rects)
+	{
+		bounds.minX = std::min(bounds.minX, rect.minX);
+		bounds.minY = std::min(bounds.minY, rect.minY);
+		bounds.maxX = std::max(bounds.maxX, rect.maxX);
+		bounds.maxY = std::max(bounds.maxY, rect.maxY);
+	}
+	return bounds;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+
+// more rectangles than this are collapsed into their bounds
+const int MAX_DIRTY_RECTS = 32;
+
+// inclusive cell rectangle
+struct DirtyRect
+{
+	int minX = 0;
+	int minY = 0;
+	int maxX = -1;
+	int maxY = -1;
+
+	bool isEmpty() const { return minX > maxX || minY > maxY; }
+	bool contains(const DirtyRect& other) const;
+	// grows the rectangle by margin cells, clamped to the grid
+	DirtyRect expanded(int margin, int width, int length) const;
+};
+
+// set of cell rectangles that changed since it was last cleared. neighbouring
+// rectangles with the same span are merged so whole rows of tiles stay one rectangle
+class DirtyRegion
+{
+public:
+	void add(DirtyRect rect);
+	void add(const DirtyRegion& other);
+	void clear() { rects.clear(); }
+
+	bool isEmpty() const { return rects.empty(); }
+	const std::vector<DirtyRect>& getRects() const { return rects; }
+	DirtyRect getBounds() const;
+
+private:
+	std::vector<DirtyRect> rects;
+};
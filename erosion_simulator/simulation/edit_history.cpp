@@ -0,0 +1,195 @@
+#include "edit_history.h"
+#include "simulation/convergence.h"
+#include <algorithm>
+
+static float** getEditColumns(ErosionModel* model, EditField field)
+{
+	return field == EditField::TERRAIN ? model->terrainHeights : model->waterHeights;
+}
+
+EditHistory::EditHistory(size_t budget)
+	: budget(budget)
+{
+}
+
+void EditHistory::resize(int width, int length)
+{
+	clear();
+	this->width = width;
+	this->length = length;
+	tilesX = (width + EDIT_TILE_SIZE - 1) / EDIT_TILE_SIZE;
+	tilesY = (length + EDIT_TILE_SIZE - 1) / EDIT_TILE_SIZE;
+	for (std::vector<int>& tiles : strokeTiles)
+	{
+		tiles.assign((size_t)tilesX * tilesY, -1);
+	}
+}
+
+DirtyRect EditHistory::getTileRect(int tile) const
+{
+	int minX = tile % tilesX * EDIT_TILE_SIZE;
+	int minY = tile / tilesX * EDIT_TILE_SIZE;
+	return DirtyRect{ minX, minY, std::min(width, minX + EDIT_TILE_SIZE) - 1, std::min(length, minY + EDIT_TILE_SIZE) - 1 };
+}
+
+void EditHistory::beforeEdit(ErosionModel* model, EditField field, DirtyRect rect)
+{
+	if (rect.isEmpty()) return;
+	if (model->width != width || model->length != length)
+		resize(model->width, model->length);
+
+	if (!isStrokeOpen)
+	{
+		isStrokeOpen = true;
+		for (const EditEntry& entry : redoEntries)
+		{
+			storedBytes -= entry.bytes;
+		}
+		redoEntries.clear();
+		for (std::vector<int>& tiles : strokeTiles)
+		{
+			std::fill(tiles.begin(), tiles.end(), -1);
+		}
+		undoEntries.emplace_back();
+	}
+
+	float** columns = getEditColumns(model, field);
+	int rectLength = rect.maxY - rect.minY + 1;
+	editCells.resize((size_t)(rect.maxX - rect.minX + 1) * rectLength);
+	for (int x = rect.minX; x <= rect.maxX; x++)
+	{
+		std::copy(columns[x] + rect.minY, columns[x] + rect.maxY + 1, editCells.begin() + (size_t)(x - rect.minX) * rectLength);
+	}
+}
+
+void EditHistory::afterEdit(ErosionModel* model, EditField field, DirtyRect rect)
+{
+	if (rect.isEmpty() || !isStrokeOpen) return;
+
+	EditEntry& entry = undoEntries.back();
+	std::vector<int>& tiles = strokeTiles[(int)field];
+	float** columns = getEditColumns(model, field);
+	int rectLength = rect.maxY - rect.minY + 1;
+	for (int tileY = rect.minY / EDIT_TILE_SIZE; tileY <= rect.maxY / EDIT_TILE_SIZE; tileY++)
+	{
+		for (int tileX = rect.minX / EDIT_TILE_SIZE; tileX <= rect.maxX / EDIT_TILE_SIZE; tileX++)
+		{
+			int tile = tileY * tilesX + tileX;
+			DirtyRect tileRect = getTileRect(tile);
+			int tileLength = tileRect.maxY - tileRect.minY + 1;
+			if (tiles[tile] < 0)
+			{
+				tiles[tile] = (int)entry.tiles.size();
+				EditTile editTile{ field, tile, {} };
+				editTile.changes.assign((size_t)(tileRect.maxX - tileRect.minX + 1) * tileLength, 0.0f);
+
+				size_t bytes = editTile.changes.size() * sizeof(float);
+				entry.bytes += bytes;
+				storedBytes += bytes;
+				entry.tiles.push_back(std::move(editTile));
+			}
+
+			std::vector<float>& changes = entry.tiles[tiles[tile]].changes;
+			int minY = std::max(rect.minY, tileRect.minY);
+			int maxY = std::min(rect.maxY, tileRect.maxY);
+			for (int x = std::max(rect.minX, tileRect.minX); x <= std::min(rect.maxX, tileRect.maxX); x++)
+			{
+				const float* before = editCells.data() + (size_t)(x - rect.minX) * rectLength;
+				float* change = changes.data() + (size_t)(x - tileRect.minX) * tileLength;
+				for (int y = minY; y <= maxY; y++)
+				{
+					change[y - tileRect.minY] += columns[x][y] - before[y - rect.minY];
+				}
+			}
+		}
+	}
+	evict();
+}
+
+void EditHistory::applyTiles(ErosionModel* model, const EditEntry& entry, float sign, DirtyRegion& terrain, DirtyRegion& water)
+{
+	for (const EditTile& editTile : entry.tiles)
+	{
+		float** columns = getEditColumns(model, editTile.field);
+		DirtyRect tileRect = getTileRect(editTile.tile);
+		int tileLength = tileRect.maxY - tileRect.minY + 1;
+		for (int x = tileRect.minX; x <= tileRect.maxX; x++)
+		{
+			const float* change = editTile.changes.data() + (size_t)(x - tileRect.minX) * tileLength;
+			for (int y = tileRect.minY; y <= tileRect.maxY; y++)
+			{
+				columns[x][y] += sign * change[y - tileRect.minY];
+			}
+			if (editTile.field == EditField::WATER)
+			{
+				std::for_each(columns[x] + tileRect.minY, columns[x] + tileRect.maxY + 1, [](float& height) { height = std::max(height, 0.0f); });
+			}
+		}
+
+		model->convergence->wakeArea(tileRect.minX, tileRect.minY, tileRect.maxX, tileRect.maxY);
+		(editTile.field == EditField::TERRAIN ? terrain : water).add(tileRect);
+	}
+}
+
+bool EditHistory::undo(ErosionModel* model, DirtyRegion& terrain, DirtyRegion& water)
+{
+	isStrokeOpen = false;
+	// the tiles were cut for a grid of another size
+	if (model->width != width || model->length != length)
+	{
+		clear();
+		return false;
+	}
+	if (undoEntries.empty()) return false;
+
+	applyTiles(model, undoEntries.back(), -1.0f, terrain, water);
+	redoEntries.push_back(std::move(undoEntries.back()));
+	undoEntries.pop_back();
+	return true;
+}
+
+bool EditHistory::redo(ErosionModel* model, DirtyRegion& terrain, DirtyRegion& water)
+{
+	isStrokeOpen = false;
+	if (model->width != width || model->length != length)
+	{
+		clear();
+		return false;
+	}
+	if (redoEntries.empty()) return false;
+
+	applyTiles(model, redoEntries.back(), 1.0f, terrain, water);
+	undoEntries.push_back(std::move(redoEntries.back()));
+	redoEntries.pop_back();
+	evict();
+	return true;
+}
+
+void EditHistory::clear()
+{
+	undoEntries.clear();
+	redoEntries.clear();
+	isStrokeOpen = false;
+	storedBytes = 0;
+}
+
+void EditHistory::setBudget(size_t budget)
+{
+	this->budget = budget;
+	evict();
+}
+
+void EditHistory::evict()
+{
+	// what there is to redo goes before any step that can still be undone
+	while (storedBytes > budget && !redoEntries.empty())
+	{
+		storedBytes -= redoEntries.front().bytes;
+		redoEntries.erase(redoEntries.begin());
+	}
+	while (storedBytes > budget && undoEntries.size() > 1)
+	{
+		storedBytes -= undoEntries.front().bytes;
+		undoEntries.pop_front();
+	}
+}
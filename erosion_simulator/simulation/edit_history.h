@@ -0,0 +1,85 @@
+#pragma once
+#include "erosion_model.h"
+#include "simulation/dirty_region.h"
+#include <deque>
+#include <vector>
+
+// cells on a side of the tiles an edit keeps
+const int EDIT_TILE_SIZE = 32;
+const size_t DEFAULT_EDIT_HISTORY_BUDGET = 64 * 1024 * 1024;
+
+// the fields a brush writes to
+enum class EditField
+{
+	TERRAIN,
+	WATER,
+};
+
+// undo and redo of brush strokes. every time the brush paints, what it changed is added to the
+// tiles of the stroke it touched, so an entry only holds those tiles and everything painted between
+// pressing and releasing the brush is one entry. undoing takes the change back off the model and
+// redoing adds it again, what the simulation did to the cells since is kept either way. water
+// never goes below zero, so taking back added water that already drained is not undone exactly.
+// the oldest entries are dropped once the kept tiles outgrow the budget. only touched by the
+// simulation thread
+class EditHistory
+{
+public:
+	EditHistory(size_t budget = DEFAULT_EDIT_HISTORY_BUDGET);
+
+	// call before painting rect of field, keeps its cells to tell what the brush changed. the first
+	// edit after a stroke was closed opens a new entry and drops everything there was to redo
+	void beforeEdit(ErosionModel* model, EditField field, DirtyRect rect);
+	// call once rect was painted, adds what changed in it since beforeEdit to the open stroke
+	void afterEdit(ErosionModel* model, EditField field, DirtyRect rect);
+	// closes the open stroke, the next edit starts a new entry
+	void endStroke() { isStrokeOpen = false; }
+	// false if there is nothing to undo. adds the cells that changed to terrain or water
+	bool undo(ErosionModel* model, DirtyRegion& terrain, DirtyRegion& water);
+	bool redo(ErosionModel* model, DirtyRegion& terrain, DirtyRegion& water);
+	// forgets every entry, for when the model was rebuilt
+	void clear();
+
+	void setBudget(size_t budget);
+	int getUndoCount() const { return (int)undoEntries.size(); }
+	int getRedoCount() const { return (int)redoEntries.size(); }
+	size_t getStoredBytes() const { return storedBytes; }
+
+private:
+	struct EditTile
+	{
+		EditField field;
+		int tile;
+		// what the stroke added to every cell of the tile, column after column
+		std::vector<float> changes;
+	};
+	struct EditEntry
+	{
+		std::vector<EditTile> tiles;
+		size_t bytes = 0;
+	};
+
+	void resize(int width, int length);
+	DirtyRect getTileRect(int tile) const;
+	// adds the changes of every tile of entry to the model, or takes them off it
+	void applyTiles(ErosionModel* model, const EditEntry& entry, float sign, DirtyRegion& terrain, DirtyRegion& water);
+	// drops the oldest entries until the tiles fit the budget, the newest always stays
+	void evict();
+
+	size_t budget;
+	int width = 0;
+	int length = 0;
+	int tilesX = 0;
+	int tilesY = 0;
+
+	// oldest first, while a stroke is open it is the last of them
+	std::deque<EditEntry> undoEntries;
+	// the last undone first
+	std::vector<EditEntry> redoEntries;
+	bool isStrokeOpen = false;
+	// per field, where each tile is in the open stroke's entry, -1 if the stroke did not touch it
+	std::vector<int> strokeTiles[2];
+	// the cells of the rect being painted, as they were before, column after column
+	std::vector<float> editCells;
+	size_t storedBytes = 0;
+};
@@ -0,0 +1,407 @@
+#include "frame_recorder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <numeric>
+
+// the file is a header naming the recorded fields, the frames one after another and, once
+// finished, the index and a trailer pointing at it. a frame is a header, a table with the
+// offset and size of every tile of every field, and then the tiles it stored itself
+struct RecordingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	int32_t width;
+	int32_t length;
+	uint32_t tileSize;
+	uint32_t mode;
+	float maxError;
+	uint32_t fieldCount;
+	uint32_t fieldIds[(int)CheckpointFieldId::COUNT];
+};
+
+struct RecordingFrameHeader
+{
+	char magic[4];
+	uint32_t isKeyframe;
+	int64_t step;
+	float timePast;
+	// tiles of every field, the table has one entry for each
+	uint32_t tileCount;
+	// bytes of the tiles stored after the table
+	uint64_t dataSize;
+};
+
+struct RecordingTile
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct RecordingIndexEntry
+{
+	int64_t step;
+	float timePast;
+	uint32_t isKeyframe;
+	uint64_t offset;
+};
+
+struct RecordingTrailer
+{
+	uint64_t indexOffset;
+	uint64_t frameCount;
+	char magic[8];
+};
+
+static const char RECORDING_MAGIC[8] = { 'E', 'R', 'O', 'S', 'R', 'E', 'C', 'D' };
+static const char FRAME_MAGIC[4] = { 'F', 'R', 'M', 'E' };
+static const char INDEX_MAGIC[8] = { 'E', 'R', 'O', 'S', 'I', 'N', 'D', 'X' };
+
+FrameRecorder::~FrameRecorder()
+{
+	finish();
+}
+
+bool FrameRecorder::open(const std::string& filePath, int width, int length, const std::vector<CheckpointFieldId>& fields,
+	FieldCodecOptions options, int keyframeInterval)
+{
+	finish();
+	this->filePath = filePath;
+	this->width = width;
+	this->length = length;
+	this->fields = fields;
+	this->options = options;
+	this->keyframeInterval = std::max(keyframeInterval, 1);
+	frames.clear();
+	stats = FrameRecorderStats();
+
+	referencePlanes.assign(fields.size(), std::vector<float>());
+	referenceColumns.assign(fields.size(), std::vector<float*>(width));
+	storedTiles.assign(fields.size(), std::vector<StoredTile>(getFieldTileCount(width, length)));
+	for (size_t f = 0; f < fields.size(); f++)
+	{
+		size_t columnSize = (size_t)length * getCheckpointElementSize(fields[f]) / sizeof(float);
+		referencePlanes[f].resize(columnSize * width);
+		for (int x = 0; x < width; x++)
+		{
+			referenceColumns[f][x] = referencePlanes[f].data() + columnSize * x;
+		}
+	}
+
+	file.open(filePath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	if (!file)
+	{
+		printf("Failed to write the recording to %s\n", filePath.c_str());
+		return false;
+	}
+
+	RecordingHeader header = {};
+	std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.headerSize = sizeof(RecordingHeader);
+	header.width = width;
+	header.length = length;
+	header.tileSize = FIELD_CODEC_TILE_SIZE;
+	header.mode = (uint32_t)options.mode;
+	header.maxError = options.maxError;
+	header.fieldCount = (uint32_t)fields.size();
+	for (size_t f = 0; f < fields.size(); f++)
+	{
+		header.fieldIds[f] = (uint32_t)fields[f];
+	}
+	file.write((const char*)&header, sizeof(header));
+	fileSize = sizeof(header);
+	finished = false;
+	return true;
+}
+
+bool FrameRecorder::record(ErosionModel* model, long long step, float timePast)
+{
+	if (finished) return false;
+	auto startTime = std::chrono::steady_clock::now();
+
+	bool isKeyframe = frames.size() % keyframeInterval == 0;
+	int tileCount = getFieldTileCount(width, length);
+
+	// every tile of every field is compared with what was last stored for it, and encoded
+	// only if it changed. an empty encoding means the tile points back at the stored one
+	std::vector<std::vector<uint8_t>> encodedTiles(fields.size() * tileCount);
+	std::vector<int> tileIndices((int)encodedTiles.size());
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		int f = i / tileCount;
+		int componentCount = getCheckpointElementSize(fields[f]) / sizeof(float);
+		const float* const* columns = (const float* const*)getCheckpointFieldColumns(model, fields[f]);
+		float* const* reference = referenceColumns[f].data();
+		FieldTileArea area = getFieldTileArea(i % tileCount, width, length);
+		size_t rowStart = (size_t)area.y * componentCount;
+		size_t rowSize = (size_t)area.length * componentCount;
+
+		// with an error bound, a tile that drifted less than the bound from the stored one is
+		// unchanged, non finite values have to match bit for bit either way
+		bool changed = isKeyframe;
+		if (!changed && options.mode == FieldCodecMode::LOSSLESS)
+		{
+			changed = !isFieldTileEqual(columns, reference, componentCount, area);
+		}
+		else if (!changed)
+		{
+			for (int x = area.x; x < area.x + area.width && !changed; x++)
+			{
+				for (size_t j = rowStart; j < rowStart + rowSize && !changed; j++)
+				{
+					changed = !(std::abs(columns[x][j] - reference[x][j]) <= options.maxError) &&
+						std::memcmp(&columns[x][j], &reference[x][j], sizeof(float)) != 0;
+				}
+			}
+		}
+		if (!changed) return;
+
+		encodedTiles[i] = encodeFieldTile(columns, componentCount, area, options);
+
+		// the reference is what the reader will see, with an error bound that is not the field itself
+		if (options.mode == FieldCodecMode::LOSSLESS)
+		{
+			for (int x = area.x; x < area.x + area.width; x++)
+			{
+				std::copy(columns[x] + rowStart, columns[x] + rowStart + rowSize, reference[x] + rowStart);
+			}
+		}
+		else
+		{
+			decodeFieldTile(encodedTiles[i].data(), encodedTiles[i].size(), reference, componentCount, area);
+		}
+	});
+
+	// stored tiles go after the table in order, so their offsets are known before writing
+	uint64_t frameOffset = fileSize;
+	uint64_t dataOffset = frameOffset + sizeof(RecordingFrameHeader) + sizeof(RecordingTile) * encodedTiles.size();
+	uint64_t dataSize = 0;
+	std::vector<RecordingTile> table(encodedTiles.size());
+	for (size_t i = 0; i < encodedTiles.size(); i++)
+	{
+		StoredTile& stored = storedTiles[i / tileCount][i % tileCount];
+		if (!encodedTiles[i].empty())
+		{
+			stored = { dataOffset + dataSize, encodedTiles[i].size() };
+			dataSize += encodedTiles[i].size();
+			stats.storedTiles++;
+		}
+		else
+		{
+			stats.referencedTiles++;
+		}
+		table[i] = { stored.offset, stored.size };
+	}
+
+	RecordingFrameHeader frameHeader = {};
+	std::memcpy(frameHeader.magic, FRAME_MAGIC, sizeof(frameHeader.magic));
+	frameHeader.isKeyframe = isKeyframe;
+	frameHeader.step = step;
+	frameHeader.timePast = timePast;
+	frameHeader.tileCount = (uint32_t)table.size();
+	frameHeader.dataSize = dataSize;
+
+	file.write((const char*)&frameHeader, sizeof(frameHeader));
+	file.write((const char*)table.data(), sizeof(RecordingTile) * table.size());
+	for (const std::vector<uint8_t>& encoded : encodedTiles)
+	{
+		file.write((const char*)encoded.data(), encoded.size());
+	}
+	if (!file)
+	{
+		// the references no longer match the file, nothing more can be appended
+		printf("Failed to write the recording to %s\n", filePath.c_str());
+		file.close();
+		finished = true;
+		return false;
+	}
+
+	fileSize = dataOffset + dataSize;
+	frames.push_back({ step, timePast, isKeyframe, frameOffset });
+	stats.frameCount++;
+	stats.keyframeCount += isKeyframe;
+	stats.writtenBytes = fileSize;
+	for (CheckpointFieldId id : fields)
+	{
+		stats.rawBytes += (uint64_t)getCheckpointElementSize(id) * width * length;
+	}
+	stats.encodeSeconds += std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+	return true;
+}
+
+bool FrameRecorder::finish()
+{
+	if (finished) return true;
+	finished = true;
+
+	std::vector<RecordingIndexEntry> index;
+	for (const RecordedFrame& frame : frames)
+	{
+		index.push_back({ frame.step, frame.timePast, frame.isKeyframe, frame.offset });
+	}
+	RecordingTrailer trailer = { fileSize, frames.size(), {} };
+	std::memcpy(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic));
+
+	file.write((const char*)index.data(), sizeof(RecordingIndexEntry) * index.size());
+	file.write((const char*)&trailer, sizeof(trailer));
+	file.close();
+	if (file.fail())
+	{
+		printf("Failed to write the recording to %s\n", filePath.c_str());
+		return false;
+	}
+	stats.writtenBytes = fileSize + sizeof(RecordingIndexEntry) * index.size() + sizeof(trailer);
+	return true;
+}
+
+FrameRecording::~FrameRecording()
+{
+	delete file;
+}
+
+bool FrameRecording::open(const std::string& filePath)
+{
+	delete file;
+	file = new MappedFile();
+	frames.clear();
+	if (!file->open(filePath))
+		return false;
+
+	auto fail = [&](const char* reason)
+	{
+		printf("Failed to load the recording %s: %s\n", filePath.c_str(), reason);
+		delete file;
+		file = nullptr;
+		return false;
+	};
+
+	if (file->getSize() < sizeof(RecordingHeader))
+		return fail("too short");
+	const RecordingHeader* header = (const RecordingHeader*)file->getData();
+	if (std::memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0)
+		return fail("not a recording");
+	if (header->version != RECORDING_VERSION)
+		return fail("written by a different version");
+	if (header->width <= 0 || header->length <= 0 || header->tileSize != FIELD_CODEC_TILE_SIZE ||
+		header->headerSize < sizeof(RecordingHeader) || header->headerSize > file->getSize() ||
+		header->fieldCount > (uint32_t)CheckpointFieldId::COUNT)
+		return fail("corrupted header");
+
+	width = header->width;
+	length = header->length;
+	fields.clear();
+	for (uint32_t f = 0; f < header->fieldCount; f++)
+	{
+		if (header->fieldIds[f] >= (uint32_t)CheckpointFieldId::COUNT)
+			return fail("corrupted header");
+		fields.push_back((CheckpointFieldId)header->fieldIds[f]);
+	}
+
+	// a recording that did not finish has no index, its frames are found one after another
+	if (!readIndex())
+		scanFrames();
+	return true;
+}
+
+bool FrameRecording::isValidFrame(uint64_t offset) const
+{
+	uint64_t size = file->getSize();
+	if (offset > size || size - offset < sizeof(RecordingFrameHeader))
+		return false;
+
+	RecordingFrameHeader frameHeader;
+	std::memcpy(&frameHeader, file->getData() + offset, sizeof(frameHeader));
+	uint64_t tableSize = sizeof(RecordingTile) * frameHeader.tileCount;
+	return std::memcmp(frameHeader.magic, FRAME_MAGIC, sizeof(frameHeader.magic)) == 0 &&
+		frameHeader.tileCount == fields.size() * getFieldTileCount(width, length) &&
+		size - offset - sizeof(frameHeader) >= tableSize && size - offset - sizeof(frameHeader) - tableSize >= frameHeader.dataSize;
+}
+
+bool FrameRecording::readIndex()
+{
+	const uint8_t* data = file->getData();
+	uint64_t size = file->getSize();
+	const RecordingHeader* header = (const RecordingHeader*)data;
+	if (size - header->headerSize < sizeof(RecordingTrailer))
+		return false;
+
+	RecordingTrailer trailer;
+	std::memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+	uint64_t indexEnd = size - sizeof(trailer);
+	if (std::memcmp(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic)) != 0 || trailer.indexOffset > indexEnd ||
+		(indexEnd - trailer.indexOffset) / sizeof(RecordingIndexEntry) != trailer.frameCount)
+		return false;
+
+	for (uint64_t i = 0; i < trailer.frameCount; i++)
+	{
+		RecordingIndexEntry entry;
+		std::memcpy(&entry, data + trailer.indexOffset + i * sizeof(entry), sizeof(entry));
+		if (!isValidFrame(entry.offset))
+		{
+			frames.clear();
+			return false;
+		}
+		frames.push_back({ entry.step, entry.timePast, entry.isKeyframe != 0, entry.offset });
+	}
+	return true;
+}
+
+void FrameRecording::scanFrames()
+{
+	const RecordingHeader* header = (const RecordingHeader*)file->getData();
+	uint64_t offset = header->headerSize;
+	while (isValidFrame(offset))
+	{
+		RecordingFrameHeader frameHeader;
+		std::memcpy(&frameHeader, file->getData() + offset, sizeof(frameHeader));
+		frames.push_back({ frameHeader.step, frameHeader.timePast, frameHeader.isKeyframe != 0, offset });
+		offset += sizeof(frameHeader) + sizeof(RecordingTile) * frameHeader.tileCount + frameHeader.dataSize;
+	}
+}
+
+bool FrameRecording::hasField(CheckpointFieldId id) const
+{
+	return std::find(fields.begin(), fields.end(), id) != fields.end();
+}
+
+int FrameRecording::findFrame(long long step) const
+{
+	auto next = std::upper_bound(frames.begin(), frames.end(), step, [](long long step, const RecordedFrame& frame)
+	{
+		return step < frame.step;
+	});
+	return (int)(next - frames.begin()) - 1;
+}
+
+bool FrameRecording::readField(int frame, CheckpointFieldId id, void* const* columns) const
+{
+	auto field = std::find(fields.begin(), fields.end(), id);
+	if (field == fields.end() || frame < 0 || frame >= (int)frames.size())
+		return false;
+
+	const uint8_t* data = file->getData();
+	uint64_t size = file->getSize();
+	int tileCount = getFieldTileCount(width, length);
+	int componentCount = getCheckpointElementSize(id) / sizeof(float);
+	const uint8_t* table = data + frames[frame].offset + sizeof(RecordingFrameHeader) + sizeof(RecordingTile) * tileCount * (field - fields.begin());
+
+	std::vector<int> tileIndices(tileCount);
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::vector<uint8_t> decoded(tileCount, 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		RecordingTile stored;
+		std::memcpy(&stored, table + sizeof(RecordingTile) * i, sizeof(stored));
+		if (stored.offset > size || stored.size > size - stored.offset)
+			return;
+
+		FieldTileArea area = getFieldTileArea(i, width, length);
+		decoded[i] = decodeFieldTile(data + stored.offset, stored.size, (float* const*)columns, componentCount, area);
+	});
+	return std::all_of(decoded.begin(), decoded.end(), [](uint8_t tileDecoded) { return tileDecoded != 0; });
+}
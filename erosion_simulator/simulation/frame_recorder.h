@@ -0,0 +1,116 @@
+#pragma once
+#include "simulation/checkpoint.h"
+#include "io/field_codec.h"
+#include "io/mapped_file.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+const uint32_t RECORDING_VERSION = 1;
+// frames between two that store every tile
+const int DEFAULT_RECORDING_KEYFRAME_INTERVAL = 16;
+
+struct FrameRecorderStats
+{
+	int frameCount = 0;
+	int keyframeCount = 0;
+	// tiles encoded into the file, and tiles that pointed back at an earlier frame's copy
+	long long storedTiles = 0;
+	long long referencedTiles = 0;
+	uint64_t writtenBytes = 0;
+	// what the recorded fields of every frame would have taken raw
+	uint64_t rawBytes = 0;
+	float encodeSeconds = 0.0f;
+};
+
+struct RecordedFrame
+{
+	long long step;
+	float timePast;
+	bool isKeyframe;
+	// where the frame starts in the file
+	uint64_t offset;
+};
+
+// appends selected fields of a running model to one file every time record is called.
+// the fields are cut into tiles of FIELD_CODEC_TILE_SIZE, and a frame stores only the tiles
+// that changed since they were last stored, every other one points at the earlier copy.
+// every keyframeInterval frames all tiles are stored again. finish writes an index of the
+// frames at the end, a file without one, from a run that did not finish, can still be read
+class FrameRecorder
+{
+public:
+	// writes the index if it was not yet
+	~FrameRecorder();
+
+	// false if the file could not be created
+	bool open(const std::string& filePath, int width, int length, const std::vector<CheckpointFieldId>& fields,
+		FieldCodecOptions options, int keyframeInterval = DEFAULT_RECORDING_KEYFRAME_INTERVAL);
+	// call between two steps
+	bool record(ErosionModel* model, long long step, float timePast);
+	bool finish();
+
+	FrameRecorderStats getStats() const { return stats; }
+
+private:
+	struct StoredTile
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	std::ofstream file;
+	std::string filePath;
+	int width = 0;
+	int length = 0;
+	std::vector<CheckpointFieldId> fields;
+	FieldCodecOptions options;
+	int keyframeInterval = DEFAULT_RECORDING_KEYFRAME_INTERVAL;
+
+	// per field, the planes as the reader sees them, columns [x][y] one after another,
+	// and where each tile was last stored
+	std::vector<std::vector<float>> referencePlanes;
+	std::vector<std::vector<float*>> referenceColumns;
+	std::vector<std::vector<StoredTile>> storedTiles;
+	std::vector<RecordedFrame> frames;
+	uint64_t fileSize = 0;
+	bool finished = true;
+
+	FrameRecorderStats stats;
+};
+
+// a recording mapped into memory. any frame can be read on its own, the tiles it points at
+// are decoded wherever in the file they were stored
+class FrameRecording
+{
+public:
+	~FrameRecording();
+
+	// false if the file could not be mapped or is not a recording this version can read
+	bool open(const std::string& filePath);
+
+	int getWidth() const { return width; }
+	int getLength() const { return length; }
+	int getFrameCount() const { return (int)frames.size(); }
+	long long getFrameStep(int frame) const { return frames[frame].step; }
+	float getFrameTime(int frame) const { return frames[frame].timePast; }
+	bool isKeyframe(int frame) const { return frames[frame].isKeyframe; }
+	bool hasField(CheckpointFieldId id) const;
+	// the last frame recorded at or before step, -1 if there is none
+	int findFrame(long long step) const;
+
+	// decodes one field of a frame into columns [x][y] of the recording's size,
+	// false if the field was not recorded or its tiles are corrupted
+	bool readField(int frame, CheckpointFieldId id, void* const* columns) const;
+
+private:
+	bool readIndex();
+	void scanFrames();
+	bool isValidFrame(uint64_t offset) const;
+
+	MappedFile* file = nullptr;
+	int width = 0;
+	int length = 0;
+	std::vector<CheckpointFieldId> fields;
+	std::vector<RecordedFrame> frames;
+};
@@ -0,0 +1,243 @@
+#include "hydrology.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+std::vector<bool> findOceanCells(ErosionModel* model)
+{
+	int width = model->width;
+	int length = model->length;
+	std::vector<bool> isOcean(width * length, false);
+	std::queue<int> open;
+
+	for (int x = 0; x < width; x++)
+	{
+		for (int y = 0; y < length; y++)
+		{
+			bool onBorder = x == 0 || y == 0 || x == width - 1 || y == length - 1;
+			if (onBorder && model->terrainHeights[x][y] < model->seaLevel)
+			{
+				isOcean[x * length + y] = true;
+				open.push(x * length + y);
+			}
+		}
+	}
+
+	while (!open.empty())
+	{
+		int cell = open.front();
+		open.pop();
+		int x = cell / length;
+		int y = cell % length;
+
+		for (int j = -1; j <= 1; j++)
+		{
+			for (int i = -1; i <= 1; i++)
+			{
+				if (abs(i) == abs(j)) continue;
+				if (!model->isInBounds(x + i, y + j)) continue;
+
+				int neighbour = (x + i) * length + y + j;
+				if (!isOcean[neighbour] && model->terrainHeights[x + i][y + j] < model->seaLevel)
+				{
+					isOcean[neighbour] = true;
+					open.push(neighbour);
+				}
+			}
+		}
+	}
+
+	return isOcean;
+}
+
+DrainageGraph computeDrainage(ErosionModel* model)
+{
+	int width = model->width;
+	int length = model->length;
+	int cellCount = width * length;
+
+	DrainageGraph graph;
+	graph.isOcean = findOceanCells(model);
+	graph.filledHeights = std::vector<float>(cellCount);
+	graph.receivers = std::vector<int>(cellCount, -1);
+	graph.floodOrder.reserve(cellCount);
+
+	std::vector<int> parents(cellCount, -1);
+	std::vector<bool> closed(cellCount, false);
+
+	typedef std::pair<float, int> QueueEntry;
+	std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> open;
+	// cells inside a depression are flooded at the level of the cell that reached them,
+	// they do not need the heap
+	std::queue<int> pit;
+
+	bool hasOcean = std::find(graph.isOcean.begin(), graph.isOcean.end(), true) != graph.isOcean.end();
+	for (int x = 0; x < width; x++)
+	{
+		for (int y = 0; y < length; y++)
+		{
+			int cell = x * length + y;
+			bool onBorder = x == 0 || y == 0 || x == width - 1 || y == length - 1;
+			if (hasOcean ? graph.isOcean[cell] : onBorder)
+			{
+				graph.filledHeights[cell] = hasOcean ? model->seaLevel : model->terrainHeights[x][y];
+				closed[cell] = true;
+				open.push(QueueEntry(graph.filledHeights[cell], cell));
+			}
+		}
+	}
+
+	// 4-connected like the outflow pipes, so no lake drains through a diagonal gap
+	while (!open.empty() || !pit.empty())
+	{
+		int cell;
+		if (!pit.empty())
+		{
+			cell = pit.front();
+			pit.pop();
+		}
+		else
+		{
+			cell = open.top().second;
+			open.pop();
+		}
+		graph.floodOrder.push_back(cell);
+
+		int x = cell / length;
+		int y = cell % length;
+		for (int j = -1; j <= 1; j++)
+		{
+			for (int i = -1; i <= 1; i++)
+			{
+				if (abs(i) == abs(j)) continue;
+				if (!model->isInBounds(x + i, y + j)) continue;
+
+				int neighbour = (x + i) * length + y + j;
+				if (closed[neighbour]) continue;
+
+				closed[neighbour] = true;
+				parents[neighbour] = cell;
+				if (model->terrainHeights[x + i][y + j] <= graph.filledHeights[cell])
+				{
+					graph.filledHeights[neighbour] = graph.filledHeights[cell];
+					pit.push(neighbour);
+				}
+				else
+				{
+					graph.filledHeights[neighbour] = model->terrainHeights[x + i][y + j];
+					open.push(QueueEntry(graph.filledHeights[neighbour], neighbour));
+				}
+			}
+		}
+	}
+
+	// steepest descent over the 8 neighbours, flats drain towards the cell they were flooded from
+	for (int x = 0; x < width; x++)
+	{
+		for (int y = 0; y < length; y++)
+		{
+			int cell = x * length + y;
+			if (parents[cell] == -1) continue;
+
+			float steepest = 0.0f;
+			int receiver = parents[cell];
+			for (int j = -1; j <= 1; j++)
+			{
+				for (int i = -1; i <= 1; i++)
+				{
+					if (i == 0 && j == 0) continue;
+					if (!model->isInBounds(x + i, y + j)) continue;
+
+					int neighbour = (x + i) * length + y + j;
+					float slope = (graph.filledHeights[cell] - graph.filledHeights[neighbour]) / (abs(i) + abs(j) == 2 ? 1.41421356f : 1.0f);
+					if (slope > steepest)
+					{
+						steepest = slope;
+						receiver = neighbour;
+					}
+				}
+			}
+
+			graph.receivers[cell] = receiver;
+		}
+	}
+
+	return graph;
+}
+
+void seedLakesAndRivers(ErosionModel* model, float rainPerStep, float dt)
+{
+	int width = model->width;
+	int length = model->length;
+
+	DrainageGraph graph = computeDrainage(model);
+
+	// water volume (in cell heights) every cell receives per step
+	std::vector<float> discharge(width * length, rainPerStep);
+	for (WaterSource waterSource : model->waterSources)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			for (int y = 0; y < length; y++)
+			{
+				glm::vec2 mapPos = model->getCellPosition(x, y);
+				if (glm::length(glm::vec2(waterSource.position.x, waterSource.position.z) - mapPos) < waterSource.radius)
+					discharge[x * length + y] += dt * waterSource.intensity;
+			}
+		}
+	}
+
+	for (int i = (int)graph.floodOrder.size() - 1; i >= 0; i--)
+	{
+		int cell = graph.floodOrder[i];
+		if (graph.receivers[cell] != -1)
+			discharge[graph.receivers[cell]] += discharge[cell];
+	}
+
+	for (int x = 0; x < width; x++)
+	{
+		for (int y = 0; y < length; y++)
+		{
+			int cell = x * length + y;
+			float terrainHeight = model->terrainHeights[x][y];
+
+			model->outflowFlux[x][y] = FlowFlux{};
+			model->velocities[x][y] = glm::vec2(0.0f);
+
+			if (graph.isOcean[cell])
+			{
+				model->waterHeights[x][y] = model->seaLevel - terrainHeight;
+				continue;
+			}
+
+			float lakeDepth = graph.filledHeights[cell] - terrainHeight;
+			int receiver = graph.receivers[cell];
+			if (receiver == -1 || discharge[cell] <= 0.0f)
+			{
+				model->waterHeights[x][y] = lakeDepth;
+				continue;
+			}
+
+			// steady state: what flows out in one step is what arrives from upstream
+			float outflow = discharge[cell] * model->area / dt;
+			int dx = receiver / length - x;
+			int dy = receiver % length - y;
+			float share = dx != 0 && dy != 0 ? 0.5f : 1.0f;
+
+			FlowFlux& flux = model->outflowFlux[x][y];
+			if (dx == -1) flux.left = share * outflow;
+			if (dx == 1) flux.right = share * outflow;
+			if (dy == -1) flux.bottom = share * outflow;
+			if (dy == 1) flux.top = share * outflow;
+
+			// critical depth for the discharge per unit width, q = sqrt(g) * d^1.5
+			float unitDischarge = outflow / model->lx;
+			float riverDepth = std::pow(unitDischarge / std::sqrt(GRAVITY_ACCELERATION), 2.0f / 3.0f);
+			float waterHeight = std::max(lakeDepth, riverDepth);
+
+			model->waterHeights[x][y] = waterHeight;
+			model->velocities[x][y] = glm::vec2(flux.right - flux.left, flux.top - flux.bottom) / (model->lx * std::max(1.0f, waterHeight));
+		}
+	}
+}
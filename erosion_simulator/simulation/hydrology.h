@@ -0,0 +1,28 @@
+#pragma once
+#include "erosion_model.h"
+#include <vector>
+
+// drainage of the terrain computed by a priority-flood from the ocean.
+// cells are indexed x * length + y like the model columns
+struct DrainageGraph
+{
+	std::vector<bool> isOcean;
+	// terrain with every closed depression filled up to its spill level
+	std::vector<float> filledHeights;
+	// cells in the order they were flooded, every cell comes after its receiver
+	std::vector<int> floodOrder;
+	// D8 neighbour each cell drains into, -1 for the ocean
+	std::vector<int> receivers;
+};
+
+// marks cells below sea level that are connected to the border of the map
+std::vector<bool> findOceanCells(ErosionModel* model);
+
+// priority-flood (Barnes et al. 2014) seeded with the ocean, or with the map
+// border when there is no ocean, followed by D8 routing on the filled surface
+DrainageGraph computeDrainage(ErosionModel* model);
+
+// fills lakes to their spill level and seeds the outflow flux and depth of
+// rivers with the steady discharge of rain and water sources.
+// rainPerStep is the mean rain height a cell receives every step
+void seedLakesAndRivers(ErosionModel* model, float rainPerStep, float dt);
@@ -0,0 +1,91 @@
+#include "pristine_state.h"
+#include <algorithm>
+#include <cstring>
+#include <execution>
+#include <numeric>
+
+void PristineState::capture(std::shared_ptr<const HeightGrid> terrain)
+{
+	std::lock_guard<std::mutex> lock(terrainMutex);
+	this->terrain = terrain;
+	hasWater = false;
+	hasSettled = false;
+}
+
+std::shared_ptr<const HeightGrid> PristineState::getTerrain()
+{
+	std::lock_guard<std::mutex> lock(terrainMutex);
+	return terrain;
+}
+
+void PristineState::computeWater(float seaLevel)
+{
+	water.resize(terrain->plane.size());
+	std::transform(std::execution::par, terrain->plane.begin(), terrain->plane.end(), water.begin(), [seaLevel](float height)
+	{
+		return seaLevel > height ? seaLevel - height : 0.0f;
+	});
+	waterSeaLevel = seaLevel;
+	hasWater = true;
+}
+
+void PristineState::restore(ErosionModel* model)
+{
+	// only the simulation thread captures, so it can read the terrain without the lock
+	if (!hasWater || waterSeaLevel != model->seaLevel)
+		computeWater(model->seaLevel);
+
+	std::vector<int> xs(model->width);
+	std::iota(xs.begin(), xs.end(), 0);
+	std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
+	{
+		int length = model->length;
+		memcpy(model->terrainHeights[x], terrain->columns[x], length * sizeof(float));
+		memcpy(model->waterHeights[x], water.data() + (size_t)x * length, length * sizeof(float));
+		std::fill(model->suspendedSedimentAmounts[x], model->suspendedSedimentAmounts[x] + length, 0.0f);
+		std::fill(model->outflowFlux[x], model->outflowFlux[x] + length, FlowFlux{});
+		std::fill(model->velocities[x], model->velocities[x] + length, glm::vec2(0.0f));
+		std::fill(model->terrainHardness[x], model->terrainHardness[x] + length, 0.1f);
+	});
+}
+
+void PristineState::captureSettled(ErosionModel* model, std::vector<float> signature)
+{
+	size_t cellCount = (size_t)model->width * model->length;
+	settledWater.resize(cellCount);
+	settledFlux.resize(cellCount);
+	settledVelocities.resize(cellCount);
+
+	std::vector<int> xs(model->width);
+	std::iota(xs.begin(), xs.end(), 0);
+	std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
+	{
+		size_t column = (size_t)x * model->length;
+		std::copy(model->waterHeights[x], model->waterHeights[x] + model->length, settledWater.begin() + column);
+		std::copy(model->outflowFlux[x], model->outflowFlux[x] + model->length, settledFlux.begin() + column);
+		std::copy(model->velocities[x], model->velocities[x] + model->length, settledVelocities.begin() + column);
+	});
+	settledSignature = std::move(signature);
+	hasSettled = true;
+}
+
+bool PristineState::restoreSettled(ErosionModel* model, const std::vector<float>& signature)
+{
+	if (!hasSettled || signature != settledSignature || settledWater.size() != (size_t)model->width * model->length)
+		return false;
+
+	std::vector<int> xs(model->width);
+	std::iota(xs.begin(), xs.end(), 0);
+	std::for_each(std::execution::par, xs.begin(), xs.end(), [&](int x)
+	{
+		int length = model->length;
+		size_t column = (size_t)x * length;
+		memcpy(model->terrainHeights[x], terrain->columns[x], length * sizeof(float));
+		memcpy(model->waterHeights[x], settledWater.data() + column, length * sizeof(float));
+		memcpy(model->outflowFlux[x], settledFlux.data() + column, length * sizeof(FlowFlux));
+		memcpy(model->velocities[x], settledVelocities.data() + column, length * sizeof(glm::vec2));
+		std::fill(model->suspendedSedimentAmounts[x], model->suspendedSedimentAmounts[x] + length, 0.0f);
+		std::fill(model->terrainHardness[x], model->terrainHardness[x] + length, 0.1f);
+	});
+	return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "erosion_model.h"
+#include "height_map/height_grid.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// the terrain a run starts from and the sea water resting on it. resets copy both back into the
+// model column by column, in parallel, instead of sampling the height map and recomputing the
+// water cell by cell. the terrain is the height map's own grid, shared read-only with the meshes.
+// the lakes and rivers the hydrology prepass settled on it are kept too, so a reset only runs the
+// prepass again when something it depends on changed, at the cost of the water, flux and
+// velocity planes held next to the model
+class PristineState
+{
+public:
+	// the water is worked out again on the next restore
+	void capture(std::shared_ptr<const HeightGrid> terrain);
+	// copies terrain and water into the model and clears sediment, flux, velocity and hardness
+	void restore(ErosionModel* model);
+	// keeps the water, flux and velocities of model, just settled from restore for the prepass
+	// parameters in signature
+	void captureSettled(ErosionModel* model, std::vector<float> signature);
+	// like restore, with the settled water, flux and velocities kept for signature.
+	// false if none are, for this terrain and these parameters
+	bool restoreSettled(ErosionModel* model, const std::vector<float>& signature);
+
+	// safe to call from the render thread while the simulation captures a new terrain
+	std::shared_ptr<const HeightGrid> getTerrain();
+
+private:
+	void computeWater(float seaLevel);
+
+	std::mutex terrainMutex;
+	std::shared_ptr<const HeightGrid> terrain;
+	// columns [x][y] like the terrain, for the sea level it was computed with
+	std::vector<float> water;
+	float waterSeaLevel = 0.0f;
+	bool hasWater = false;
+
+	std::vector<float> settledSignature;
+	std::vector<float> settledWater;
+	std::vector<FlowFlux> settledFlux;
+	std::vector<glm::vec2> settledVelocities;
+	bool hasSettled = false;
+};
@@ -0,0 +1,318 @@
+#include "simulation_history.h"
+#include "io/field_codec.h"
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <numeric>
+
+SimulationHistory::SimulationHistory(size_t budget, int interval)
+	: budget(budget), interval(std::max(interval, 1))
+{
+	thread = std::thread(&SimulationHistory::run, this);
+}
+
+SimulationHistory::~SimulationHistory()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	captured.notify_one();
+	thread.join();
+}
+
+bool SimulationHistory::afterStep(ErosionModel* model, const CheckpointRunState& runState)
+{
+	step++;
+
+	// the run moved on from a restored state, what was kept after it is no longer its future
+	if (restoredStep >= 0)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		waitUntilIdle(lock);
+		while (!entries.empty() && entries.back().step > restoredStep)
+		{
+			release(entries.back());
+			entries.pop_back();
+		}
+		restoredStep = -1;
+		needsFullCapture = true;
+	}
+
+	markMovingTiles(model);
+	if (step % interval != 0)
+		return false;
+
+	// the encoder only touches the capture while it has one, so it can be filled without the lock
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (hasCapture)
+		{
+			stats.skippedCount++;
+			return false;
+		}
+	}
+
+	// a new size, or marks that are not of what changed since the last entry, store every tile
+	bool copyAll = needsFullCapture || model->width != captureWidth || model->length != captureLength;
+	auto startTime = std::chrono::steady_clock::now();
+	copyChangedTiles(model, copyAll);
+	float copyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	needsFullCapture = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		captureWidth = model->width;
+		captureLength = model->length;
+		captureStep = step;
+		captureRunState = runState;
+		captureBytes = 0;
+		for (const std::vector<float>& tile : capturedTiles)
+		{
+			captureBytes += tile.size() * sizeof(float);
+		}
+		evict();
+		hasCapture = true;
+		stats.capturedCount++;
+		stats.totalCopyMs += copyMs;
+		stats.maxCopyMs = std::max(stats.maxCopyMs, copyMs);
+	}
+	captured.notify_one();
+	return true;
+}
+
+bool SimulationHistory::restore(long long step, ErosionModel* model, CheckpointRunState& runState)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	waitUntilIdle(lock);
+
+	auto entry = std::find_if(entries.begin(), entries.end(), [&](const HistoryEntry& entry) { return entry.step == step; });
+	int tileCount = getFieldTileCount(model->width, model->length);
+	if (entry == entries.end() || entry->tiles.size() != (size_t)tileCount * (int)CheckpointFieldId::COUNT)
+		return false;
+
+	// every tile is decoded on the side first, so one that fails leaves the model as it was
+	std::vector<int> tileIndices((int)entry->tiles.size());
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::vector<std::vector<float>> decodedTiles(tileIndices.size());
+	std::vector<uint8_t> decoded(tileIndices.size(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		int componentCount = getCheckpointElementSize((CheckpointFieldId)(i / tileCount)) / sizeof(float);
+		FieldTileArea area = getFieldTileArea(i % tileCount, model->width, model->length);
+		size_t columnSize = (size_t)area.length * componentCount;
+		decodedTiles[i].resize(columnSize * area.width);
+		float* columns[FIELD_CODEC_TILE_SIZE];
+		for (int x = 0; x < area.width; x++)
+		{
+			columns[x] = decodedTiles[i].data() + columnSize * x;
+		}
+		const std::vector<uint8_t>& tile = *entry->tiles[i];
+		decoded[i] = decodeFieldTile(tile.data(), tile.size(), columns, componentCount, FieldTileArea{ 0, 0, area.width, area.length });
+	});
+	if (!std::all_of(decoded.begin(), decoded.end(), [](uint8_t tileDecoded) { return tileDecoded != 0; }))
+		return false;
+
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		CheckpointFieldId id = (CheckpointFieldId)(i / tileCount);
+		int componentCount = getCheckpointElementSize(id) / sizeof(float);
+		FieldTileArea area = getFieldTileArea(i % tileCount, model->width, model->length);
+		float* const* columns = (float* const*)getCheckpointFieldColumns(model, id);
+		size_t columnSize = (size_t)area.length * componentCount;
+		for (int x = 0; x < area.width; x++)
+		{
+			const float* column = decodedTiles[i].data() + columnSize * x;
+			std::copy(column, column + columnSize, columns[area.x + x] + (size_t)area.y * componentCount);
+		}
+	});
+
+	runState = entry->runState;
+	this->step = step;
+	restoredStep = step;
+	needsFullCapture = true;
+	return true;
+}
+
+void SimulationHistory::clear()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	waitUntilIdle(lock);
+	entries.clear();
+	storedBytes = 0;
+	step = 0;
+	restoredStep = -1;
+	needsFullCapture = true;
+}
+
+void SimulationHistory::setBudget(size_t budget)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->budget = budget;
+	evict();
+}
+
+void SimulationHistory::setInterval(int interval)
+{
+	this->interval = std::max(interval, 1);
+}
+
+SimulationHistoryStats SimulationHistory::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	SimulationHistoryStats copy = stats;
+	for (const HistoryEntry& entry : entries)
+	{
+		copy.steps.push_back(entry.step);
+	}
+	copy.storedBytes = storedBytes + captureBytes;
+	copy.budget = budget;
+	return copy;
+}
+
+void SimulationHistory::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		captured.wait(lock, [&] { return stopping || hasCapture; });
+		if (stopping)
+			return;
+		lock.unlock();
+
+		auto startTime = std::chrono::steady_clock::now();
+		std::vector<StoredTile> tiles;
+		encode(tiles);
+		float encodeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+		lock.lock();
+		// tiles that did not change are the ones the last entry holds
+		for (size_t i = 0; i < tiles.size(); i++)
+		{
+			if (tiles[i])
+				storedBytes += tiles[i]->size();
+			else
+				tiles[i] = entries.back().tiles[i];
+		}
+		entries.push_back({ captureStep, captureRunState, std::move(tiles) });
+		captureBytes = 0;
+		evict();
+
+		stats.totalEncodeMs += encodeMs;
+		hasCapture = false;
+		encoded.notify_all();
+	}
+}
+
+void SimulationHistory::markMovingTiles(ErosionModel* model)
+{
+	int tilesX = (model->width + FIELD_CODEC_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE;
+	int tileCount = getFieldTileCount(model->width, model->length);
+	if (changedTiles.size() != (size_t)tileCount)
+	{
+		changedTiles.assign(tileCount, 1);
+		needsFullCapture = true;
+	}
+
+	// slippage reaches one cell past the tiles it runs on
+	ConvergenceMonitor* convergence = model->convergence;
+	for (int tileY = 0; tileY < convergence->getTileCountY(); tileY++)
+	{
+		for (int tileX = 0; tileX < convergence->getTileCountX(); tileX++)
+		{
+			if (!convergence->isTileMoving(tileX, tileY)) continue;
+
+			int minX = std::max(0, tileX * SIMULATION_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE;
+			int minY = std::max(0, tileY * SIMULATION_TILE_SIZE - 1) / FIELD_CODEC_TILE_SIZE;
+			int maxX = std::min(model->width - 1, (tileX + 1) * SIMULATION_TILE_SIZE) / FIELD_CODEC_TILE_SIZE;
+			int maxY = std::min(model->length - 1, (tileY + 1) * SIMULATION_TILE_SIZE) / FIELD_CODEC_TILE_SIZE;
+			for (int y = minY; y <= maxY; y++)
+			{
+				std::fill(changedTiles.begin() + y * tilesX + minX, changedTiles.begin() + y * tilesX + maxX + 1, 1);
+			}
+		}
+	}
+}
+
+void SimulationHistory::copyChangedTiles(ErosionModel* model, bool copyAll)
+{
+	int tileCount = getFieldTileCount(model->width, model->length);
+	size_t totalTiles = (size_t)tileCount * (int)CheckpointFieldId::COUNT;
+	capturedTiles.resize(totalTiles);
+
+	std::vector<int> tileIndices((int)totalTiles);
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		std::vector<float>& tile = capturedTiles[i];
+		if (!copyAll && !changedTiles[i % tileCount])
+		{
+			tile = std::vector<float>();
+			return;
+		}
+
+		CheckpointFieldId id = (CheckpointFieldId)(i / tileCount);
+		int componentCount = getCheckpointElementSize(id) / sizeof(float);
+		FieldTileArea area = getFieldTileArea(i % tileCount, model->width, model->length);
+		const float* const* columns = (const float* const*)getCheckpointFieldColumns(model, id);
+		size_t columnSize = (size_t)area.length * componentCount;
+		tile.resize(columnSize * area.width);
+		for (int x = 0; x < area.width; x++)
+		{
+			const float* column = columns[area.x + x] + (size_t)area.y * componentCount;
+			std::copy(column, column + columnSize, tile.data() + columnSize * x);
+		}
+	});
+	std::fill(changedTiles.begin(), changedTiles.end(), 0);
+}
+
+void SimulationHistory::encode(std::vector<StoredTile>& tiles)
+{
+	int tileCount = getFieldTileCount(captureWidth, captureLength);
+
+	tiles.assign(capturedTiles.size(), nullptr);
+	std::vector<int> tileIndices((int)tiles.size());
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	std::for_each(std::execution::par, tileIndices.begin(), tileIndices.end(), [&](int i)
+	{
+		std::vector<float>& tile = capturedTiles[i];
+		if (tile.empty())
+			return;
+
+		// the copied tile is a field of its own, columns one after another
+		int componentCount = getCheckpointElementSize((CheckpointFieldId)(i / tileCount)) / sizeof(float);
+		FieldTileArea area = getFieldTileArea(i % tileCount, captureWidth, captureLength);
+		const float* columns[FIELD_CODEC_TILE_SIZE];
+		for (int x = 0; x < area.width; x++)
+		{
+			columns[x] = tile.data() + (size_t)area.length * componentCount * x;
+		}
+		tiles[i] = std::make_shared<const std::vector<uint8_t>>(encodeFieldTile(columns, componentCount,
+			FieldTileArea{ 0, 0, area.width, area.length }, FieldCodecOptions()));
+		tile = std::vector<float>();
+	});
+}
+
+void SimulationHistory::evict()
+{
+	while (storedBytes + captureBytes > budget && entries.size() > 1)
+	{
+		release(entries.front());
+		entries.pop_front();
+		stats.evictedCount++;
+	}
+}
+
+void SimulationHistory::release(const HistoryEntry& entry)
+{
+	for (const StoredTile& tile : entry.tiles)
+	{
+		if (tile.use_count() == 1)
+			storedBytes -= tile->size();
+	}
+}
+
+void SimulationHistory::waitUntilIdle(std::unique_lock<std::mutex>& lock)
+{
+	encoded.wait(lock, [&] { return !hasCapture; });
+}
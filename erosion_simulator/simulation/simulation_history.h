@@ -0,0 +1,115 @@
+#pragma once
+#include "simulation/checkpoint.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const size_t DEFAULT_HISTORY_BUDGET = 256 * 1024 * 1024;
+// steps between two kept states
+const int DEFAULT_HISTORY_INTERVAL = 10;
+
+struct SimulationHistoryStats
+{
+	// step of every kept state, oldest first
+	std::vector<long long> steps;
+	// encoded tiles, and the changed tiles copied for the encoder while it has them
+	size_t storedBytes = 0;
+	size_t budget = 0;
+
+	int capturedCount = 0;
+	// captures dropped because the encoder was still busy with the last one
+	int skippedCount = 0;
+	int evictedCount = 0;
+	// what capturing cost the step, and the encoding it handed off
+	float totalCopyMs = 0.0f;
+	float maxCopyMs = 0.0f;
+	float totalEncodeMs = 0.0f;
+};
+
+// recent states of the simulation kept in memory, so the run can jump back to any of them and
+// go on from there. after every step the tiles of FIELD_CODEC_TILE_SIZE the convergence monitor
+// found moving are marked, and every few steps only the marked tiles are copied, then encoded on
+// a thread of its own. the other tiles are shared with the state before. a converged tile keeps
+// the copy from when it settled, it has drifted by less than the tolerances per step since. no
+// full copy of the model is kept, the copied tiles count against the budget until they are
+// encoded, and the oldest states are dropped once everything outgrows it
+class SimulationHistory
+{
+public:
+	SimulationHistory(size_t budget = DEFAULT_HISTORY_BUDGET, int interval = DEFAULT_HISTORY_INTERVAL);
+	~SimulationHistory();
+
+	// simulation side, call after every step. true if the state was captured, the step
+	// never waits for the encoder, a capture that would have to is skipped instead
+	bool afterStep(ErosionModel* model, const CheckpointRunState& runState);
+	// simulation side, decodes the state kept for step back into the model. the states after
+	// it stay until the run moves on from it, so the timeline can still be scrubbed both ways.
+	// false if no state is kept for step or it could not be decoded, the model is left as it was
+	bool restore(long long step, ErosionModel* model, CheckpointRunState& runState);
+	// simulation side, forgets every state, for when the model was rebuilt
+	void clear();
+
+	void setBudget(size_t budget);
+	void setInterval(int interval);
+	SimulationHistoryStats getStats();
+
+private:
+	using StoredTile = std::shared_ptr<const std::vector<uint8_t>>;
+	struct HistoryEntry
+	{
+		long long step;
+		CheckpointRunState runState;
+		// every tile of every field, shared with the entries before and after that did not change it
+		std::vector<StoredTile> tiles;
+	};
+
+	void run();
+	// marks the tiles overlapping a moving simulation tile, or a cell slippage reaches from one
+	void markMovingTiles(ErosionModel* model);
+	// copies the marked tiles of every field, or all of them, and clears the marks
+	void copyChangedTiles(ErosionModel* model, bool copyAll);
+	void encode(std::vector<StoredTile>& tiles);
+	// drops the oldest entries until the tiles fit the budget, the newest always stays
+	void evict();
+	// takes the tiles only this entry holds off the stored bytes, before it is dropped
+	void release(const HistoryEntry& entry);
+	void waitUntilIdle(std::unique_lock<std::mutex>& lock);
+
+	size_t budget;
+	std::atomic<int> interval;
+
+	// only touched by the simulation thread
+	long long step = 0;
+	// the state the run was last restored to, entries after it go once the run moves on
+	long long restoredStep = -1;
+	// per tile, shared by all fields, set if it moved since the last capture
+	std::vector<uint8_t> changedTiles;
+	// the marks are not of what changed since the last entry, after a restore or clear
+	bool needsFullCapture = true;
+
+	std::thread thread;
+	std::mutex mutex;
+	// signalled when a capture is handed over or the thread should stop
+	std::condition_variable captured;
+	// signalled when the encoder is done with a capture
+	std::condition_variable encoded;
+	bool stopping = false;
+	bool hasCapture = false;
+	// the capture being handed over. a tile is empty if it did not change since the last entry,
+	// the others hold their cells column by column
+	std::vector<std::vector<float>> capturedTiles;
+	int captureWidth = 0;
+	int captureLength = 0;
+	long long captureStep = 0;
+	CheckpointRunState captureRunState;
+	size_t captureBytes = 0;
+
+	std::deque<HistoryEntry> entries;
+	size_t storedBytes = 0;
+	SimulationHistoryStats stats;
+};
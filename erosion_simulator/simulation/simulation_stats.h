@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+
+// what the ui shows about the simulation, copied out with every snapshot
+struct SimulationStats
+{
+	// steps taken since the thread started
+	long long stepCount = 0;
+	// bumped every time the model is rebuilt from the height map
+	int resetCount = 0;
+	// time the last ui command waited in the queue
+	float commandLatencyMs = 0.0f;
+	// brush strokes that can be undone and redone, and the tiles they keep
+	int undoCount = 0;
+	int redoCount = 0;
+	size_t editHistoryBytes = 0;
+
+	int tileCount = 0;
+	int activeTileCount = 0;
+	int convergedTileCount = 0;
+	bool converged = false;
+	int convergedEventCount = 0;
+
+	std::vector<float> waterResidualHistory;
+	std::vector<float> terrainResidualHistory;
+	std::vector<float> sedimentFluxHistory;
+};
@@ -0,0 +1,406 @@
+#include "simulation_thread.h"
+
+void SimulationSnapshot::resize(int width, int length)
+{
+	this->width = width;
+	this->length = length;
+
+	terrainPlane.assign(width * length, 0.0f);
+	waterPlane.assign(width * length, 0.0f);
+	velocityPlane.assign(width * length, glm::vec2(0.0f));
+	sedimentPlane.assign(width * length, 0.0f);
+
+	terrainColumns.resize(width);
+	waterColumns.resize(width);
+	velocityColumns.resize(width);
+	sedimentColumns.resize(width);
+	for (int x = 0; x < width; x++)
+	{
+		terrainColumns[x] = &terrainPlane[x * length];
+		waterColumns[x] = &waterPlane[x * length];
+		velocityColumns[x] = &velocityPlane[x * length];
+		sedimentColumns[x] = &sedimentPlane[x * length];
+	}
+
+	terrainHeights = terrainColumns.data();
+	waterHeights = waterColumns.data();
+	velocities = velocityColumns.data();
+	suspendedSedimentAmounts = sedimentColumns.data();
+}
+
+void SimulationSnapshot::copyFrom(ErosionModel* model, const DirtyRegion& region)
+{
+	DirtyRegion copyRegion = region;
+	if (width != model->width || length != model->length)
+	{
+		resize(model->width, model->length);
+		copyRegion.clear();
+		copyRegion.add(DirtyRect{ 0, 0, width - 1, length - 1 });
+	}
+
+	// columns are contiguous in y
+	for (const DirtyRect& rect : copyRegion.getRects())
+	{
+		for (int x = rect.minX; x <= rect.maxX; x++)
+		{
+			std::copy(model->terrainHeights[x] + rect.minY, model->terrainHeights[x] + rect.maxY + 1, terrainHeights[x] + rect.minY);
+			std::copy(model->waterHeights[x] + rect.minY, model->waterHeights[x] + rect.maxY + 1, waterHeights[x] + rect.minY);
+			std::copy(model->velocities[x] + rect.minY, model->velocities[x] + rect.maxY + 1, velocities[x] + rect.minY);
+			std::copy(model->suspendedSedimentAmounts[x] + rect.minY, model->suspendedSedimentAmounts[x] + rect.maxY + 1, suspendedSedimentAmounts[x] + rect.minY);
+		}
+	}
+
+	ConvergenceMonitor* convergence = model->convergence;
+	stats.tileCount = convergence->getTileCountX() * convergence->getTileCountY();
+	stats.activeTileCount = convergence->getActiveTileCount();
+	stats.convergedTileCount = convergence->getConvergedTileCount();
+	stats.converged = convergence->hasConverged();
+	stats.convergedEventCount = convergence->getConvergedEventCount();
+	stats.waterResidualHistory = convergence->getWaterResidualHistory();
+	stats.terrainResidualHistory = convergence->getTerrainResidualHistory();
+	stats.sedimentFluxHistory = convergence->getSedimentFluxHistory();
+}
+
+SimulationThread::SimulationThread(ErosionModel* model, StepFunction step, PaintFunction paint, float dt)
+	: model(model), step(step), paint(paint), dt(dt)
+{
+	publishedParameters = *model;
+
+	// the renderer may read before the first publish
+	for (int i = 0; i < 3; i++)
+	{
+		snapshots.getBuffer(i).copyFrom(model, DirtyRegion());
+	}
+}
+
+SimulationThread::~SimulationThread()
+{
+	stop();
+}
+
+void SimulationThread::start()
+{
+	if (running) return;
+
+	running = true;
+	thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+	if (!running) return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	wake.notify_one();
+	thread.join();
+}
+
+void SimulationThread::publishParameters(const ErosionParameters& parameters)
+{
+	if (parameters == publishedParameters)
+	{
+		flushCommands();
+		return;
+	}
+	publishedParameters = parameters;
+
+	SimulationCommand command;
+	command.type = CommandType::SET_PARAMETERS;
+	command.parameters = parameters;
+	push(std::move(command));
+}
+
+void SimulationThread::stampBrush(glm::vec3 position)
+{
+	// holding still is covered by the stroke repeating its last stamp
+	glm::vec2 brushPosition = glm::vec2(position.x, position.z);
+	if (brushPosition == lastBrushPosition) return;
+	lastBrushPosition = brushPosition;
+
+	SimulationCommand command;
+	command.type = CommandType::BRUSH_STAMP;
+	command.position = brushPosition;
+	push(std::move(command));
+}
+
+void SimulationThread::endBrushStroke()
+{
+	lastBrushPosition = glm::vec2(INFINITY);
+
+	SimulationCommand command;
+	command.type = CommandType::BRUSH_END;
+	push(std::move(command));
+}
+
+void SimulationThread::addWaterSource(WaterSource source)
+{
+	SimulationCommand command;
+	command.type = CommandType::ADD_WATER_SOURCE;
+	command.source = source;
+	push(std::move(command));
+}
+
+void SimulationThread::removeWaterSources()
+{
+	SimulationCommand command;
+	command.type = CommandType::REMOVE_WATER_SOURCES;
+	push(std::move(command));
+}
+
+void SimulationThread::undo()
+{
+	SimulationCommand command;
+	command.type = CommandType::UNDO;
+	push(std::move(command));
+}
+
+void SimulationThread::redo()
+{
+	SimulationCommand command;
+	command.type = CommandType::REDO;
+	push(std::move(command));
+}
+
+void SimulationThread::enqueue(std::function<void()> task, bool resetsModel)
+{
+	SimulationCommand command;
+	command.type = CommandType::TASK;
+	command.task = std::move(task);
+	command.resetsModel = resetsModel;
+	push(std::move(command));
+}
+
+void SimulationThread::inspect(std::function<void()> task)
+{
+	SimulationCommand command;
+	command.type = CommandType::INSPECT;
+	command.task = std::move(task);
+	push(std::move(command));
+}
+
+void SimulationThread::push(SimulationCommand command)
+{
+	command.time = std::chrono::steady_clock::now();
+	heldBackCommands.push_back(std::move(command));
+	flushCommands();
+}
+
+void SimulationThread::flushCommands()
+{
+	if (heldBackCommands.empty()) return;
+
+	// keep the order, whatever did not fit is retried next time
+	size_t pushed = 0;
+	while (pushed < heldBackCommands.size() && commands.push(std::move(heldBackCommands[pushed])))
+		pushed++;
+	heldBackCommands.erase(heldBackCommands.begin(), heldBackCommands.begin() + pushed);
+
+	// taking the lock makes sure a paused simulation thread is either waiting or sees the command
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+	}
+	wake.notify_one();
+}
+
+void SimulationThread::run()
+{
+	std::chrono::duration<float> stepDuration(dt);
+	auto lastPaintTime = std::chrono::steady_clock::now();
+
+	bool unpublished = true;
+	while (running)
+	{
+		if (applyCommands())
+			unpublished = true;
+
+		// a paused model keeps taking brush strokes, at the rate a running one would
+		auto now = std::chrono::steady_clock::now();
+		bool paintDue = model->isModelRunning || now - lastPaintTime >= stepDuration;
+		if (paintDue && !stroke.positions.empty())
+		{
+			lastPaintTime = now;
+
+			DirtyRegion painted;
+			painted.add(paint(dt, stroke, edits));
+			bool paintsTerrain = model->paintMode == PaintMode::TERRAIN_ADD || model->paintMode == PaintMode::TERRAIN_REMOVE;
+			markDirty(paintsTerrain ? painted : DirtyRegion(), paintsTerrain ? DirtyRegion() : painted);
+			unpublished = true;
+		}
+
+		if (model->isModelRunning)
+		{
+			step(dt);
+			stepCount++;
+			markActiveTilesDirty();
+			unpublished = true;
+		}
+
+		// merge the stamps of this step into the last one, a released brush stops painting
+		if (paintDue)
+		{
+			if (stroke.isHeld && !stroke.positions.empty())
+			{
+				stroke.positions.erase(stroke.positions.begin(), stroke.positions.end() - 1);
+			}
+			else
+			{
+				stroke.positions.clear();
+				// the whole drag is one entry to undo
+				edits.endStroke();
+			}
+		}
+
+		// while running, only copy out a new snapshot once the last one was picked up
+		if (unpublished && (!model->isModelRunning || !snapshots.hasUnread()))
+		{
+			publishSnapshot();
+			unpublished = false;
+		}
+
+		if (!model->isModelRunning)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			auto hasWork = [&] { return !running || !commands.isEmpty(); };
+			if (stroke.positions.empty())
+				wake.wait(lock, hasWork);
+			else
+				wake.wait_for(lock, stepDuration - (std::chrono::steady_clock::now() - lastPaintTime), hasWork);
+		}
+	}
+}
+
+bool SimulationThread::applyCommands()
+{
+	bool modelChanged = false;
+	SimulationCommand command;
+	while (commands.pop(command))
+	{
+		switch (command.type)
+		{
+		case CommandType::SET_PARAMETERS:
+		{
+			std::vector<WaterSource> sources = std::move(model->waterSources);
+			static_cast<ErosionParameters&>(*model) = command.parameters;
+			model->waterSources = std::move(sources);
+			break;
+		}
+		case CommandType::BRUSH_STAMP:
+			stroke.isHeld = true;
+			stroke.positions.push_back(command.position);
+			break;
+		case CommandType::BRUSH_END:
+			stroke.isHeld = false;
+			break;
+		case CommandType::ADD_WATER_SOURCE:
+			model->waterSources.push_back(command.source);
+			break;
+		case CommandType::REMOVE_WATER_SOURCES:
+			model->waterSources.clear();
+			break;
+		case CommandType::UNDO:
+		case CommandType::REDO:
+		{
+			DirtyRegion terrain;
+			DirtyRegion water;
+			bool applied = command.type == CommandType::UNDO ? edits.undo(model, terrain, water) : edits.redo(model, terrain, water);
+			if (applied)
+			{
+				markDirty(terrain, water);
+				modelChanged = true;
+			}
+			break;
+		}
+		case CommandType::TASK:
+		{
+			command.task();
+			// the edits were made to a model that is gone
+			edits.clear();
+			if (command.resetsModel)
+				resetCount++;
+			modelChanged = true;
+
+			DirtyRegion everything;
+			everything.add(DirtyRect{ 0, 0, model->width - 1, model->length - 1 });
+			markDirty(everything, everything);
+			break;
+		}
+		case CommandType::INSPECT:
+			command.task();
+			break;
+		}
+
+		commandLatencyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - command.time).count();
+	}
+	return modelChanged;
+}
+
+void SimulationThread::markDirty(const DirtyRegion& terrain, const DirtyRegion& water)
+{
+	for (DirtyRegion& stale : staleRegions)
+	{
+		stale.add(terrain);
+		stale.add(water);
+	}
+	pendingTerrainDirty.add(terrain);
+	pendingWaterDirty.add(water);
+}
+
+// the erosion kernels only write to active tiles, slippage also reaches one cell into the neighbours.
+// water flows in throttled tiles too, but by less than the tolerance, so they are redrawn with the
+// rest every convergedUpdateInterval steps, when all tiles are active
+void SimulationThread::markActiveTilesDirty()
+{
+	ConvergenceMonitor* convergence = model->convergence;
+	int slippageMargin = model->useSedimentSlippage ? 1 : 0;
+
+	DirtyRegion terrain;
+	DirtyRegion water;
+	for (int tileY = 0; tileY < convergence->getTileCountY(); tileY++)
+	{
+		for (int tileX = 0; tileX < convergence->getTileCountX(); tileX++)
+		{
+			if (!convergence->isTileActive(tileX, tileY)) continue;
+
+			DirtyRect tile{
+				tileX * SIMULATION_TILE_SIZE,
+				tileY * SIMULATION_TILE_SIZE,
+				std::min(model->width, (tileX + 1) * SIMULATION_TILE_SIZE) - 1,
+				std::min(model->length, (tileY + 1) * SIMULATION_TILE_SIZE) - 1,
+			};
+			water.add(tile);
+			terrain.add(tile.expanded(slippageMargin, model->width, model->length));
+		}
+	}
+	markDirty(terrain, water);
+}
+
+void SimulationThread::publishSnapshot()
+{
+	int index = snapshots.getWriteIndex();
+	SimulationSnapshot& snapshot = snapshots.getWriteBuffer();
+	snapshot.copyFrom(model, staleRegions[index]);
+	staleRegions[index].clear();
+
+	snapshot.terrainDirty = pendingTerrainDirty;
+	snapshot.waterDirty = pendingWaterDirty;
+	pendingTerrainDirty.clear();
+	pendingWaterDirty.clear();
+
+	snapshot.stats.stepCount = stepCount;
+	snapshot.stats.resetCount = resetCount;
+	snapshot.stats.commandLatencyMs = commandLatencyMs;
+	snapshot.stats.undoCount = edits.getUndoCount();
+	snapshot.stats.redoCount = edits.getRedoCount();
+	snapshot.stats.editHistoryBytes = edits.getStoredBytes();
+
+	// the renderer never saw the snapshot that was replaced, its changes go into the next one
+	if (snapshots.publish())
+	{
+		SimulationSnapshot& dropped = snapshots.getWriteBuffer();
+		pendingTerrainDirty.add(dropped.terrainDirty);
+		pendingWaterDirty.add(dropped.waterDirty);
+	}
+}
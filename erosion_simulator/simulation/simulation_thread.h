@@ -0,0 +1,166 @@
+#pragma once
+#include "erosion_model.h"
+#include "simulation/dirty_region.h"
+#include "simulation/edit_history.h"
+#include "simulation/simulation_stats.h"
+#include "simulation/spsc_queue.h"
+#include "simulation/triple_buffer.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// commands the ui can fit in the queue before it has to hold them back
+const int COMMAND_QUEUE_SIZE = 1024;
+
+enum class CommandType
+{
+	SET_PARAMETERS,
+	BRUSH_STAMP,
+	BRUSH_END,
+	ADD_WATER_SOURCE,
+	REMOVE_WATER_SOURCES,
+	UNDO,
+	REDO,
+	// runs a function that rebuilds the model, like resets and warm starts
+	TASK,
+	// runs a function that only reads the model, like saving it
+	INSPECT,
+};
+
+// an edit from the ui, applied by the simulation between two steps
+struct SimulationCommand
+{
+	CommandType type = CommandType::TASK;
+	std::chrono::steady_clock::time_point time;
+
+	ErosionParameters parameters;
+	glm::vec2 position = glm::vec2(0.0f);
+	WaterSource source = WaterSource();
+	std::function<void()> task;
+	bool resetsModel = false;
+};
+
+// brush positions stamped since the last step. while the mouse is held the
+// last position keeps painting, so a long drag costs one merged stamp per step
+struct BrushStroke
+{
+	bool isHeld = false;
+	std::vector<glm::vec2> positions;
+};
+
+// the fields the renderer needs, copied out of the model in one go.
+// the planes are contiguous, the column pointers let the meshes index them [x][y]
+struct SimulationSnapshot
+{
+	int width = 0;
+	int length = 0;
+
+	float** terrainHeights = nullptr;
+	float** waterHeights = nullptr;
+	glm::vec2** velocities = nullptr;
+	float** suspendedSedimentAmounts = nullptr;
+
+	// cells that changed since the snapshot the renderer picked up before this one
+	DirtyRegion terrainDirty;
+	DirtyRegion waterDirty;
+
+	SimulationStats stats;
+
+	void resize(int width, int length);
+	// copies the cells in region, everything if the size changed
+	void copyFrom(ErosionModel* model, const DirtyRegion& region);
+
+private:
+	std::vector<float> terrainPlane;
+	std::vector<float> waterPlane;
+	std::vector<glm::vec2> velocityPlane;
+	std::vector<float> sedimentPlane;
+
+	std::vector<float*> terrainColumns;
+	std::vector<float*> waterColumns;
+	std::vector<glm::vec2*> velocityColumns;
+	std::vector<float*> sedimentColumns;
+};
+
+// steps the model on its own thread. the ui hands over its edits through a
+// lock free command queue that is drained between steps, the renderer picks up
+// the newest complete snapshot from a triple buffer without ever blocking
+class SimulationThread
+{
+public:
+	using StepFunction = std::function<void(float dt)>;
+	// returns the cells the stroke touched, edits has to see every rectangle before it is painted
+	using PaintFunction = std::function<DirtyRect(float dt, const BrushStroke& stroke, EditHistory& edits)>;
+
+	SimulationThread(ErosionModel* model, StepFunction step, PaintFunction paint, float dt);
+	~SimulationThread();
+
+	void start();
+	void stop();
+
+	// ui side, only sends the parameters if something changed. the water sources
+	// of the simulation are kept, they have their own commands.
+	// call every frame, it also retries commands that did not fit in the queue
+	void publishParameters(const ErosionParameters& parameters);
+	void stampBrush(glm::vec3 position);
+	void endBrushStroke();
+	void addWaterSource(WaterSource source);
+	void removeWaterSources();
+	// takes back or puts back a whole brush stroke
+	void undo();
+	void redo();
+	// runs task on the simulation thread between two steps
+	void enqueue(std::function<void()> task, bool resetsModel = false);
+	// runs task on the simulation thread between two steps, nothing is republished after it
+	void inspect(std::function<void()> task);
+
+	// render side, true if a newer snapshot was swapped in
+	bool updateSnapshot() { return snapshots.update(); }
+	SimulationSnapshot& getSnapshot() { return snapshots.getReadBuffer(); }
+
+private:
+	void run();
+	void push(SimulationCommand command);
+	void flushCommands();
+	bool applyCommands();
+	void markDirty(const DirtyRegion& terrain, const DirtyRegion& water);
+	void markActiveTilesDirty();
+	void publishSnapshot();
+
+	ErosionModel* model;
+	StepFunction step;
+	PaintFunction paint;
+	float dt;
+
+	std::thread thread;
+	std::atomic<bool> running = false;
+
+	SpscQueue<SimulationCommand, COMMAND_QUEUE_SIZE> commands;
+	// only used to sleep while the model is paused
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	// only touched by the ui, commands that did not fit in the queue yet
+	std::vector<SimulationCommand> heldBackCommands;
+	ErosionParameters publishedParameters;
+	glm::vec2 lastBrushPosition = glm::vec2(INFINITY);
+
+	// only touched by the simulation thread
+	BrushStroke stroke;
+	EditHistory edits;
+	long long stepCount = 0;
+	int resetCount = 0;
+	float commandLatencyMs = 0.0f;
+	// cells every snapshot buffer is behind on, by buffer index
+	DirtyRegion staleRegions[3];
+	// cells changed since the last snapshot the renderer picked up
+	DirtyRegion pendingTerrainDirty;
+	DirtyRegion pendingWaterDirty;
+
+	TripleBuffer<SimulationSnapshot> snapshots;
+};
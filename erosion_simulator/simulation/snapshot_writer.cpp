@@ -0,0 +1,107 @@
+#include "snapshot_writer.h"
+#include <chrono>
+#include <filesystem>
+
+SnapshotWriter::SnapshotWriter(const std::string& pathPrefix, bool compressed, int bufferCount)
+	: pathPrefix(pathPrefix), compressed(compressed), buffers(std::max(bufferCount, 1))
+{
+	for (int i = 0; i < (int)buffers.size(); i++)
+	{
+		freeBuffers.push_back(i);
+	}
+	thread = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	queuedChanged.notify_one();
+	thread.join();
+}
+
+void SnapshotWriter::capture(ErosionModel* model, const CheckpointRunState& runState, long long step)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	int buffer;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		bufferFreed.wait(lock, [&] { return !freeBuffers.empty(); });
+		buffer = freeBuffers.back();
+		freeBuffers.pop_back();
+	}
+	auto copyStartTime = std::chrono::steady_clock::now();
+
+	// the buffer belongs to this thread until it is queued
+	buffers[buffer].copyFrom(model, runState);
+
+	auto endTime = std::chrono::steady_clock::now();
+	float waitMs = std::chrono::duration<float, std::milli>(copyStartTime - startTime).count();
+	float copyMs = std::chrono::duration<float, std::milli>(endTime - copyStartTime).count();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(QueuedSnapshot{ buffer, step });
+
+		stats.capturedCount++;
+		stats.totalWaitMs += waitMs;
+		stats.maxWaitMs = std::max(stats.maxWaitMs, waitMs);
+		stats.totalCopyMs += copyMs;
+		stats.maxCopyMs = std::max(stats.maxCopyMs, copyMs);
+	}
+	queuedChanged.notify_one();
+}
+
+void SnapshotWriter::finish()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	bufferFreed.wait(lock, [&] { return queue.empty() && writingCount == 0; });
+}
+
+SnapshotWriterStats SnapshotWriter::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+void SnapshotWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		queuedChanged.wait(lock, [&] { return stopping || !queue.empty(); });
+		// whatever was captured before stopping is still written
+		if (queue.empty()) return;
+
+		QueuedSnapshot snapshot = queue.front();
+		queue.pop_front();
+		writingCount++;
+		lock.unlock();
+
+		auto startTime = std::chrono::steady_clock::now();
+		char stepText[32];
+		snprintf(stepText, sizeof(stepText), "_%06lld.ckpt", snapshot.step);
+		const CheckpointState& state = buffers[snapshot.buffer];
+		std::string filePath = pathPrefix + stepText;
+		bool written = saveCheckpoint(filePath, state, compressed);
+		std::error_code error;
+		uint64_t fileSize = written ? std::filesystem::file_size(filePath, error) : 0;
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+		lock.lock();
+		writingCount--;
+		freeBuffers.push_back(snapshot.buffer);
+		if (written)
+		{
+			stats.writtenCount++;
+			stats.writtenBytes += error ? state.getSize() : fileSize;
+		}
+		else
+		{
+			stats.failedCount++;
+		}
+		stats.writeSeconds += seconds;
+		bufferFreed.notify_all();
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "simulation/checkpoint.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// buffers a run can have captured before it has to wait for the writer
+const int DEFAULT_SNAPSHOT_BUFFERS = 2;
+
+struct SnapshotWriterStats
+{
+	int capturedCount = 0;
+	int writtenCount = 0;
+	int failedCount = 0;
+	uint64_t writtenBytes = 0;
+	float writeSeconds = 0.0f;
+
+	// what capturing cost the step, copying the model and waiting for a free buffer
+	float totalCopyMs = 0.0f;
+	float maxCopyMs = 0.0f;
+	float totalWaitMs = 0.0f;
+	float maxWaitMs = 0.0f;
+};
+
+// writes checkpoints of a running model on its own thread. at a step boundary the model is
+// copied into a buffer of a small recycled pool, and the thread writes the buffers in order.
+// when every buffer is still waiting to be written, capture blocks until one is free,
+// so a slow disk slows the run down instead of piling up copies in memory
+class SnapshotWriter
+{
+public:
+	// files are named pathPrefix_<step>.ckpt, compressed ones are encoded on the writer thread
+	SnapshotWriter(const std::string& pathPrefix, bool compressed = false, int bufferCount = DEFAULT_SNAPSHOT_BUFFERS);
+	// writes whatever is still queued
+	~SnapshotWriter();
+
+	// simulation side, call between two steps
+	void capture(ErosionModel* model, const CheckpointRunState& runState, long long step);
+	// blocks until every captured snapshot is written
+	void finish();
+
+	SnapshotWriterStats getStats();
+
+private:
+	struct QueuedSnapshot
+	{
+		int buffer;
+		long long step;
+	};
+
+	void run();
+
+	std::string pathPrefix;
+	bool compressed;
+	std::vector<CheckpointState> buffers;
+
+	std::thread thread;
+	std::mutex mutex;
+	// signalled when a snapshot is queued or the writer should stop
+	std::condition_variable queuedChanged;
+	// signalled when a buffer was written and is free again
+	std::condition_variable bufferFreed;
+	bool stopping = false;
+	std::vector<int> freeBuffers;
+	std::deque<QueuedSnapshot> queue;
+	// snapshots the thread is writing, their buffers are neither free nor queued
+	int writingCount = 0;
+
+	SnapshotWriterStats stats;
+};
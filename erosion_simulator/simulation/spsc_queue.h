@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// lock free bounded queue for exactly one producer and one consumer thread.
+// one slot stays empty to tell a full queue from an empty one
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+	// producer side, false if the queue is full
+	bool push(T&& item)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) % Capacity;
+		if (next == head.load(std::memory_order_acquire))
+			return false;
+
+		items[tail] = std::move(item);
+		this->tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, false if the queue is empty
+	bool pop(T& item)
+	{
+		size_t head = this->head.load(std::memory_order_relaxed);
+		if (head == tail.load(std::memory_order_acquire))
+			return false;
+
+		item = std::move(items[head]);
+		this->head.store((head + 1) % Capacity, std::memory_order_release);
+		return true;
+	}
+
+	bool isEmpty() { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+private:
+	T items[Capacity];
+	std::atomic<size_t> head = 0;
+	std::atomic<size_t> tail = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+
+// lock free single producer, single consumer triple buffer. the producer fills
+// the write buffer and publishes it, the consumer picks up the newest published
+// buffer. neither side ever waits for the other, unread buffers are overwritten
+template <typename T>
+class TripleBuffer
+{
+public:
+	// producer side
+	T& getWriteBuffer() { return buffers[writeIndex]; }
+	int getWriteIndex() { return writeIndex; }
+	// true if the buffer published before was never picked up, it is the
+	// write buffer again afterwards
+	bool publish()
+	{
+		int previous = middle.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel);
+		writeIndex = previous & INDEX_MASK;
+		return (previous & FRESH_BIT) != 0;
+	}
+	// true while the consumer has not picked up the last published buffer
+	bool hasUnread() { return (middle.load(std::memory_order_acquire) & FRESH_BIT) != 0; }
+
+	// consumer side, swaps in the newest published buffer if there is one
+	bool update()
+	{
+		if (!hasUnread()) return false;
+
+		int previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & INDEX_MASK;
+		return true;
+	}
+	T& getReadBuffer() { return buffers[readIndex]; }
+
+	// only safe while neither side is using the buffers
+	T& getBuffer(int index) { return buffers[index]; }
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int FRESH_BIT = 4;
+
+	T buffers[3];
+	int writeIndex = 0;
+	std::atomic<int> middle = 1;
+	int readIndex = 2;
+};
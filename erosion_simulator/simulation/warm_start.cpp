@@ -0,0 +1,156 @@
+#include "warm_start.h"
+#include <algorithm>
+#include <cmath>
+
+std::vector<ErosionModel*> buildModelPyramid(ErosionModel* model, int levels)
+{
+	std::vector<ErosionModel*> pyramid;
+
+	ErosionModel* current = model;
+	for (int i = 0; i < levels; i++)
+	{
+		if ((current->width + 1) / 2 < WARM_START_MIN_SIZE || (current->length + 1) / 2 < WARM_START_MIN_SIZE)
+			break;
+
+		current = createCoarseModel(current);
+		pyramid.push_back(current);
+	}
+
+	return pyramid;
+}
+
+ErosionModel* createCoarseModel(ErosionModel* fine)
+{
+	ErosionModel* coarse = new ErosionModel((fine->width + 1) / 2, (fine->length + 1) / 2);
+
+	coarse->simulationSpeed = fine->simulationSpeed;
+	coarse->rainIntensity = fine->rainIntensity;
+	coarse->rainAmount = fine->rainAmount;
+	coarse->evaporationRate = fine->evaporationRate;
+	coarse->fluidDensity = fine->fluidDensity;
+	coarse->sedimentCapacity = fine->sedimentCapacity;
+	coarse->maxErosionDepth = fine->maxErosionDepth;
+	coarse->slippageAngle = fine->slippageAngle;
+	coarse->seaLevel = fine->seaLevel;
+	coarse->isRaining = fine->isRaining;
+	coarse->generateWaves = fine->generateWaves;
+	coarse->waveStrength = fine->waveStrength;
+	coarse->waveInterval = fine->waveInterval;
+	coarse->waveDirection = fine->waveDirection;
+	coarse->waterSources = fine->waterSources;
+
+	// a coarse cell sits in the middle of the 2x2 fine cells it covers
+	coarse->lx = fine->lx * 2.0f;
+	coarse->ly = fine->ly * 2.0f;
+	coarse->area = coarse->lx * coarse->ly;
+	coarse->gridOrigin = fine->gridOrigin + 0.5f * glm::vec2(fine->lx, fine->ly);
+
+	for (int y = 0; y < coarse->length; y++)
+	{
+		for (int x = 0; x < coarse->width; x++)
+		{
+			float terrain = 0.0f;
+			float water = 0.0f;
+			int count = 0;
+
+			for (int j = 0; j <= 1; j++)
+			{
+				for (int i = 0; i <= 1; i++)
+				{
+					int fx = 2 * x + i;
+					int fy = 2 * y + j;
+					if (fx >= fine->width || fy >= fine->length) continue;
+
+					terrain += fine->terrainHeights[fx][fy];
+					water += fine->waterHeights[fx][fy];
+					count++;
+				}
+			}
+
+			coarse->terrainHeights[x][y] = terrain / count;
+			coarse->waterHeights[x][y] = water / count;
+			coarse->suspendedSedimentAmounts[x][y] = 0.0f;
+			coarse->outflowFlux[x][y] = FlowFlux{};
+			coarse->velocities[x][y] = glm::vec2(0.0f);
+			coarse->terrainHardness[x][y] = 0.1f;
+		}
+	}
+
+	return coarse;
+}
+
+void prolongWaterState(ErosionModel* coarse, ErosionModel* fine)
+{
+	// coarse cells are twice as wide, so half of their flux goes through each fine face
+	float fluxScale = fine->lx / coarse->lx;
+
+	for (int y = 0; y < fine->length; y++)
+	{
+		for (int x = 0; x < fine->width; x++)
+		{
+			// fine cell center in coarse cell coordinates
+			float cx = std::clamp((x + 0.5f) / 2.0f - 0.5f, 0.0f, coarse->width - 1.0f);
+			float cy = std::clamp((y + 0.5f) / 2.0f - 0.5f, 0.0f, coarse->length - 1.0f);
+			int x0 = (int)cx;
+			int y0 = (int)cy;
+			int x1 = std::min(x0 + 1, coarse->width - 1);
+			int y1 = std::min(y0 + 1, coarse->length - 1);
+			float tx = cx - x0;
+			float ty = cy - y0;
+
+			// interpolate the water surface of wet neighbours only,
+			// dry coarse cells would otherwise leave puddles on fine slopes
+			int xs[4] = { x0, x1, x0, x1 };
+			int ys[4] = { y0, y0, y1, y1 };
+			float weights[4] = { (1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty };
+
+			float surface = 0.0f;
+			float wetWeight = 0.0f;
+			glm::vec2 velocity = glm::vec2(0.0f);
+			for (int k = 0; k < 4; k++)
+			{
+				velocity += weights[k] * coarse->velocities[xs[k]][ys[k]];
+				if (coarse->waterHeights[xs[k]][ys[k]] <= 0.0f) continue;
+
+				surface += weights[k] * (coarse->terrainHeights[xs[k]][ys[k]] + coarse->waterHeights[xs[k]][ys[k]]);
+				wetWeight += weights[k];
+			}
+
+			float waterHeight = 0.0f;
+			if (wetWeight > 0.0f)
+				waterHeight = std::max(0.0f, surface / wetWeight - fine->terrainHeights[x][y]);
+
+			FlowFlux coarseFlux = coarse->outflowFlux[std::min(x / 2, coarse->width - 1)][std::min(y / 2, coarse->length - 1)];
+			FlowFlux flux;
+			flux.left = coarseFlux.left * fluxScale;
+			flux.right = coarseFlux.right * fluxScale;
+			flux.top = coarseFlux.top * fluxScale;
+			flux.bottom = coarseFlux.bottom * fluxScale;
+
+			fine->waterHeights[x][y] = waterHeight;
+			fine->outflowFlux[x][y] = waterHeight > 0.0f ? flux : FlowFlux{};
+			fine->velocities[x][y] = waterHeight > 0.0f ? velocity : glm::vec2(0.0f);
+		}
+	}
+}
+
+float getMeanWaterChange(ErosionModel* model, std::vector<float>& previousWater)
+{
+	int cellCount = model->width * model->length;
+	bool first = (int)previousWater.size() != cellCount;
+	previousWater.resize(cellCount);
+
+	double change = 0.0;
+	for (int x = 0; x < model->width; x++)
+	{
+		for (int y = 0; y < model->length; y++)
+		{
+			float& previous = previousWater[x * model->length + y];
+			if (!first)
+				change += std::abs(model->waterHeights[x][y] - previous);
+			previous = model->waterHeights[x][y];
+		}
+	}
+
+	return first ? INFINITY : (float)(change / cellCount);
+}
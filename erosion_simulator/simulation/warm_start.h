@@ -0,0 +1,22 @@
+#pragma once
+#include "erosion_model.h"
+#include <vector>
+
+// smallest grid side a coarse level is allowed to have
+const int WARM_START_MIN_SIZE = 16;
+
+// builds the restriction pyramid used by the coarse-to-fine warm start.
+// pyramid[0] is half the resolution of model, every next level halves it again.
+// levels own their memory and have to be deleted by the caller
+std::vector<ErosionModel*> buildModelPyramid(ErosionModel* model, int levels);
+
+// averages terrain and water of 2x2 blocks of the fine model into a new model
+// with twice the cell size
+ErosionModel* createCoarseModel(ErosionModel* fine);
+
+// interpolates the water surface, outflow flux and velocity of the coarse model
+// onto the next finer level. terrain and sediment of the fine level are kept
+void prolongWaterState(ErosionModel* coarse, ErosionModel* fine);
+
+// mean absolute water height change since the last call, previousWater is updated
+float getMeanWaterChange(ErosionModel* model, std::vector<float>& previousWater);
@@ -1,4 +1,7 @@
 #pragma once
+#include "export/mesh_export.h"
+#include "io/height_map_writer.h"
+#include "simulation/simulation_history.h"
 
 struct SimulationParametersUI
 {
@@ -7,9 +10,69 @@ struct SimulationParametersUI
 		showRegenButton = enableRegenerate;
 	}
 
+	// writes the terrain as a 16 bit or float image, the extension follows the format
 	bool saveHeightMapRequested = false;
-	char* fileSaveName = new char(100);
+	char fileSaveName[100] = "heightmap";
+	HeightMapFormat saveFormat = HeightMapFormat::PGM;
+
+	// writes the terrain, and the water if asked, as a simplified mesh
+	bool exportMeshRequested = false;
+	char exportFileName[100] = "terrain";
+	MeshExportFormat exportFormat = MeshExportFormat::GLTF_BINARY;
+	bool exportWater = true;
+	// how far the simplified mesh may be from the grid, in height units
+	float exportMaxError = 0.25f;
+	int exportedTriangles = 0;
+	float exportSeconds = 0.0f;
+
+	// saves or restores the whole simulation, fields, parameters and water sources
+	bool saveCheckpointRequested = false;
+	bool loadCheckpointRequested = false;
+	char checkpointFileName[100] = "simulation.ckpt";
+	// compressed checkpoints are smaller but are decoded on load instead of mapped
+	bool compressCheckpoints = false;
+
+	// the timeline of kept states, filled in every frame. jumping to one pauses the run there
+	std::vector<long long> historySteps;
+	int timelineIndex = 0;
+	bool timelineJumpRequested = false;
+	bool timelineResumeRequested = false;
+	int historyInterval = DEFAULT_HISTORY_INTERVAL;
+	int historyBudgetMB = (int)(DEFAULT_HISTORY_BUDGET >> 20);
+	float historyMegabytes = 0.0f;
+	float historyCopyMs = 0.0f;
+	int historySkipped = 0;
 
 	bool showRegenButton = false;
 	bool regenerateHeightMapRequested = false;
+	// back to the terrain and sea the run started from
+	bool resetTerrainRequested = false;
+
+	// when fast forwarding, frames are only presented every fastForwardInterval seconds
+	bool fastForward = false;
+	float fastForwardInterval = 2.0f;
+	// simulation steps between the last two presented frames
+	int stepsPerFrame = 0;
+	float stepsPerSecond = 0.0f;
+	// chunks of both meshes uploaded for the last frame
+	int uploadedChunks = 0;
+	// draw a static grid displaced by the fields as textures, instead of rebuilding vertices
+	bool useHeightTextures = false;
+	// texels of all fields uploaded for the last frame
+	int uploadedTexels = 0;
+	// triangles of both meshes drawn for the last frame
+	int drawnTriangles = 0;
+	// chunks of both meshes that passed the frustum cull, and how long it took
+	int visibleChunks = 0;
+	int chunkCount = 0;
+	float cullTimeMs = 0.0f;
+	// how far in pixels a chunk's detail level may stray from the full grid
+	float lodPixelError = 2.0f;
+
+	bool warmStartRequested = false;
+	bool hydrologyPrepassRequested = false;
+	bool removeWaterSourcesRequested = false;
+	// take back or put back the last brush stroke
+	bool undoRequested = false;
+	bool redoRequested = false;
 };
\ No newline at end of file
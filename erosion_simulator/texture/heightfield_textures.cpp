@@ -0,0 +1,96 @@
+#include "heightfield_textures.h"
+#include "glad/glad.h"
+#include <vector>
+
+HeightfieldTextures::HeightfieldTextures(int width, int length)
+	: width(width), length(length)
+{
+	terrainTexture = createTexture(GL_R32F, GL_RED);
+	originalTerrainTexture = createTexture(GL_R32F, GL_RED);
+	waterTexture = createTexture(GL_R32F, GL_RED);
+	velocityTexture = createTexture(GL_RG32F, GL_RG);
+	sedimentTexture = createTexture(GL_R32F, GL_RED);
+}
+
+HeightfieldTextures::~HeightfieldTextures()
+{
+	uint32_t textures[] = { terrainTexture, originalTerrainTexture, waterTexture, velocityTexture, sedimentTexture };
+	glDeleteTextures(5, textures);
+}
+
+uint32_t HeightfieldTextures::createTexture(int internalFormat, int format)
+{
+	uint32_t texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	// only read with texelFetch, but without mipmaps the default filter leaves the texture incomplete
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, length, width, 0, format, GL_FLOAT, nullptr);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+void HeightfieldTextures::upload(const SimulationSnapshot& snapshot)
+{
+	lastUploadedTexels = 0;
+	for (const DirtyRect& rect : snapshot.terrainDirty.getRects())
+	{
+		uploadRect(terrainTexture, GL_RED, snapshot.terrainHeights[0], sizeof(float), rect);
+	}
+	for (const DirtyRect& rect : snapshot.waterDirty.getRects())
+	{
+		uploadRect(waterTexture, GL_RED, snapshot.waterHeights[0], sizeof(float), rect);
+		uploadRect(velocityTexture, GL_RG, snapshot.velocities[0], sizeof(glm::vec2), rect);
+		uploadRect(sedimentTexture, GL_RED, snapshot.suspendedSedimentAmounts[0], sizeof(float), rect);
+	}
+}
+
+void HeightfieldTextures::uploadAll(const SimulationSnapshot& snapshot)
+{
+	lastUploadedTexels = 0;
+	DirtyRect everything{ 0, 0, width - 1, length - 1 };
+	uploadRect(terrainTexture, GL_RED, snapshot.terrainHeights[0], sizeof(float), everything);
+	uploadRect(waterTexture, GL_RED, snapshot.waterHeights[0], sizeof(float), everything);
+	uploadRect(velocityTexture, GL_RG, snapshot.velocities[0], sizeof(glm::vec2), everything);
+	uploadRect(sedimentTexture, GL_RED, snapshot.suspendedSedimentAmounts[0], sizeof(float), everything);
+}
+
+void HeightfieldTextures::uploadOriginalHeights(const float* originalHeights)
+{
+	glBindTexture(GL_TEXTURE_2D, originalTerrainTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, length, width, GL_RED, GL_FLOAT, originalHeights);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void HeightfieldTextures::uploadRect(uint32_t texture, int format, const void* plane, int texelSize, const DirtyRect& rect)
+{
+	if (rect.isEmpty()) return;
+
+	const char* first = (const char*)plane + (size_t)texelSize * (rect.minX * length + rect.minY);
+	int rectWidth = rect.maxY - rect.minY + 1;
+	int rectHeight = rect.maxX - rect.minX + 1;
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, length);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect.minY, rect.minX, rectWidth, rectHeight, format, GL_FLOAT, first);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	lastUploadedTexels += rectWidth * rectHeight;
+}
+
+void HeightfieldTextures::bind()
+{
+	uint32_t textures[] = { terrainTexture, originalTerrainTexture, waterTexture, velocityTexture, sedimentTexture };
+	for (int i = 0; i < 5; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + HEIGHTFIELD_TEXTURE_UNIT + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
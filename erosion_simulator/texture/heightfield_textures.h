@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include "simulation/simulation_thread.h"
+
+// first texture unit the fields are bound to, in the order terrain, original terrain, water, velocity, sediment
+const int HEIGHTFIELD_TEXTURE_UNIT = 3;
+
+// the simulation fields as float textures, for meshes that displace a static grid in the
+// vertex shader. texel (y, x) holds cell [x][y], so every grid column is one texture row
+class HeightfieldTextures
+{
+public:
+	HeightfieldTextures(int width, int length);
+	~HeightfieldTextures();
+
+	// uploads the cells the snapshot marked dirty
+	void upload(const SimulationSnapshot& snapshot);
+	void uploadAll(const SimulationSnapshot& snapshot);
+	// columns [x][y] in one plane, like TerrainMesh and the snapshot keep them
+	void uploadOriginalHeights(const float* originalHeights);
+
+	void bind();
+
+	// texels sent by the last upload
+	int lastUploadedTexels = 0;
+
+private:
+	uint32_t createTexture(int internalFormat, int format);
+	// needs the fields' columns to be one contiguous plane, like the snapshot's
+	void uploadRect(uint32_t texture, int format, const void* plane, int texelSize, const DirtyRect& rect);
+
+	int width, length;
+	uint32_t terrainTexture, originalTerrainTexture, waterTexture, velocityTexture, sedimentTexture;
+};
@@ -1,5 +1,6 @@
 #include "window.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -154,26 +155,44 @@ void Window::scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 }
 
 
-void Window::Menu(ErosionModel* model, SimulationParametersUI* params)
+void Window::Menu(ErosionParameters* model, SimulationParametersUI* params, const SimulationStats* stats)
 {
     if (ImGui::BeginMainMenuBar())
     {
         if (ImGui::BeginMenu("File"))
         {
             ImGui::MenuItem("Save Height Map", NULL, &showSaveMenu);
+            ImGui::MenuItem("Export Mesh", NULL, &showExportMenu);
+            ImGui::MenuItem("Checkpoint", NULL, &showCheckpointMenu);
             if (params->showRegenButton) {
-                if (ImGui::MenuItem("Regenerate Heightmap", NULL))
+                if (ImGui::MenuItem("Regenerate Heightmap", "R"))
                 {
                     params->regenerateHeightMapRequested = true;
                 }
             }
+            if (ImGui::MenuItem("Reset Terrain", params->showRegenButton ? NULL : "R"))
+            {
+                params->resetTerrainRequested = true;
+            }
 
             ImGui::EndMenu();
         }
+        if (ImGui::BeginMenu("Edit"))
+        {
+            if (ImGui::MenuItem("Undo Stroke", "Ctrl+Z", false, stats->undoCount > 0))
+                params->undoRequested = true;
+            if (ImGui::MenuItem("Redo Stroke", "Ctrl+Y", false, stats->redoCount > 0))
+                params->redoRequested = true;
+            ImGui::Separator();
+            ImGui::Text("%d to undo, %d to redo, %.1f MB", stats->undoCount, stats->redoCount, stats->editHistoryBytes / (1024.0f * 1024.0f));
+            ImGui::EndMenu();
+        }
         if (ImGui::BeginMenu("Tools"))
         {
             ImGui::MenuItem("Simulation Parameters", NULL, &showSimulationParameters);
             ImGui::MenuItem("Paint Brush Settings", NULL, &showPaintBrushMenu);
+            ImGui::MenuItem("Timeline", NULL, &showTimelineMenu);
+            ImGui::MenuItem("Frame Statistics", NULL, &showStatsOverlay);
             ImGui::EndMenu();
         }
         if (ImGui::BeginMenu("Debug")) 
@@ -223,12 +242,38 @@ void Window::Menu(ErosionModel* model, SimulationParametersUI* params)
         ImGui::EndMainMenuBar();
     }   
 
-    if (showSimulationParameters) ShowSimulationParameters(model, params, &showSimulationParameters);
+    if (showSimulationParameters) ShowSimulationParameters(model, params, stats, &showSimulationParameters);
     if (showPaintBrushMenu) ShowPaintBrushMenu(model, params, &showPaintBrushMenu);
     if (showSaveMenu) ShowSaveMenu(params, &showSaveMenu);
+    if (showExportMenu) ShowExportMenu(params, &showExportMenu);
+    if (showCheckpointMenu) ShowCheckpointMenu(params, &showCheckpointMenu);
+    if (showTimelineMenu) ShowTimelineMenu(params, &showTimelineMenu);
+    if (showStatsOverlay) ShowStatsOverlay(params, stats);
 }
 
-void Window::ShowSimulationParameters(ErosionModel* model, SimulationParametersUI* params, bool *open)
+// the per frame numbers, in a corner under the menu bar where they stay visible while the scene is looked at
+void Window::ShowStatsOverlay(SimulationParametersUI* params, const SimulationStats* stats)
+{
+    const float margin = 10.0f;
+    const ImGuiViewport* viewport = ImGui::GetMainViewport();
+    ImGui::SetNextWindowPos(ImVec2(viewport->WorkPos.x + viewport->WorkSize.x - margin, viewport->WorkPos.y + margin), ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+    ImGui::SetNextWindowBgAlpha(0.35f);
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings |
+        ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoMove;
+    if (ImGui::Begin("Frame Statistics", NULL, flags))
+    {
+        ImGui::Text("%.1f fps, %.2f ms", ImGui::GetIO().Framerate, 1000.0f / ImGui::GetIO().Framerate);
+        ImGui::Text("Steps/Frame: %d (%.0f steps/s)", params->stepsPerFrame, params->stepsPerSecond);
+        ImGui::Text("Command Latency: %.2f ms", stats->commandLatencyMs);
+        ImGui::Text("Uploaded Chunks: %d, Texels: %d", params->uploadedChunks, params->uploadedTexels);
+        ImGui::Text("Triangles: %d", params->drawnTriangles);
+        ImGui::Text("Visible Chunks: %d / %d", params->visibleChunks, params->chunkCount);
+        ImGui::Text("Cull Time: %.3f ms", params->cullTimeMs);
+    }
+    ImGui::End();
+}
+
+void Window::ShowSimulationParameters(ErosionParameters* model, SimulationParametersUI* params, const SimulationStats* stats, bool *open)
 {
     static std::string waterDirText = "North";
     if (ImGui::Begin("Simulation Parameters", open))
@@ -236,10 +281,15 @@ void Window::ShowSimulationParameters(ErosionModel* model, SimulationParametersU
         ImGui::Checkbox("Enable Simulation", &model->isModelRunning);
         ImGui::Checkbox("Enable Rain", &model->isRaining);
         ImGui::Checkbox("Enable Sediment Slippage", &model->useSedimentSlippage);
+        ImGui::Checkbox("Fill Lakes On Reset", &model->useHydrologyPrepass);
 
         ImGui::Spacing();
 
         ImGui::SliderInt("Simulation Speed", &model->simulationSpeed, 1, 10);
+        ImGui::Checkbox("Fast Forward", &params->fastForward);
+        ImGui::SliderFloat("Fast Forward Interval (s)", &params->fastForwardInterval, 0.5f, 30.0f, "%.1f");
+        ImGui::Checkbox("Displace From Height Textures", &params->useHeightTextures);
+        ImGui::SliderFloat("LOD Pixel Error", &params->lodPixelError, 0.0f, 16.0f, "%.1f");
         ImGui::SliderInt("Rain Intensity", &model->rainIntensity, 1, 10);
         ImGui::SliderInt("Rain Amount", &model->rainAmount, 1, 10);
 
@@ -281,11 +331,47 @@ void Window::ShowSimulationParameters(ErosionModel* model, SimulationParametersU
             model->waveDirection = WaveDirection::WEST;
         }
 
+        ImGui::Spacing();
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        ImGui::Text("Warm Start");
+        ImGui::SliderInt("Coarse Levels", &model->warmStartLevels, 1, 6);
+        ImGui::SliderInt("Max Steps Per Level", &model->warmStartMaxSteps, 100, 10000);
+        if (ImGui::Button("Warm Start Water"))
+        {
+            params->warmStartRequested = true;
+        }
+        if (ImGui::Button("Seed Lakes And Rivers"))
+        {
+            params->hydrologyPrepassRequested = true;
+        }
+
+        ImGui::Spacing();
+        ImGui::Spacing();
+        ImGui::Spacing();
+
+        ImGui::Text("Convergence");
+        ImGui::Checkbox("Throttle Converged Tiles", &model->useTileThrottling);
+        ImGui::Checkbox("Pause When Converged", &model->pauseOnConvergence);
+        ImGui::SliderInt("Converged Update Interval", &model->convergedUpdateInterval, 1, 64);
+        ImGui::SliderFloat("Water Tolerance", &model->convergenceWaterTolerance, 0.0001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Terrain Tolerance", &model->convergenceTerrainTolerance, 0.00001f, 0.01f, "%.5f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Sediment Tolerance", &model->convergenceSedimentTolerance, 0.00001f, 0.01f, "%.5f", ImGuiSliderFlags_Logarithmic);
+        ImGui::Text("Active Tiles: %d / %d, Converged: %d%s", stats->activeTileCount, stats->tileCount, stats->convergedTileCount, stats->converged ? " (steady)" : "");
+
+        const std::vector<float>& waterHistory = stats->waterResidualHistory;
+        const std::vector<float>& terrainHistory = stats->terrainResidualHistory;
+        const std::vector<float>& sedimentHistory = stats->sedimentFluxHistory;
+        ImGui::PlotLines("Max dWater", waterHistory.data(), (int)waterHistory.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+        ImGui::PlotLines("Max dTerrain", terrainHistory.data(), (int)terrainHistory.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+        ImGui::PlotLines("Sediment Flux", sedimentHistory.data(), (int)sedimentHistory.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(0, 40));
+
         ImGui::End();
     }
 }
 
-void Window::ShowPaintBrushMenu(ErosionModel* model, SimulationParametersUI* params, bool* open)
+void Window::ShowPaintBrushMenu(ErosionParameters* model, SimulationParametersUI* params, bool* open)
 {
     static std::string currentBrush = "Water Add";
     if (ImGui::Begin("Paint Brush Settings", open))
@@ -329,7 +415,7 @@ void Window::ShowPaintBrushMenu(ErosionModel* model, SimulationParametersUI* par
 
         if(ImGui::Button("Remove All Sources"))
         {
-            model->waterSources.clear();
+            params->removeWaterSourcesRequested = true;
         }
         
 
@@ -341,7 +427,12 @@ void Window::ShowSaveMenu(SimulationParametersUI* params, bool* open)
 {
     if (ImGui::Begin("Save Heightmap", open))
     {
-        ImGui::InputText("File Name", params->fileSaveName, 100);
+        ImGui::InputText("File Name", params->fileSaveName, sizeof(params->fileSaveName));
+
+        int format = (int)params->saveFormat;
+        ImGui::Combo("Format", &format, "PGM 16 bit (.pgm)\0PNG 16 bit (.png)\0PFM 32 bit float (.pfm)\0");
+        params->saveFormat = (HeightMapFormat)format;
+
         if (ImGui::Button("Save"))
         {
             params->saveHeightMapRequested = true;
@@ -352,6 +443,51 @@ void Window::ShowSaveMenu(SimulationParametersUI* params, bool* open)
     }
 }
 
+void Window::ShowExportMenu(SimulationParametersUI* params, bool* open)
+{
+    if (ImGui::Begin("Export Mesh", open))
+    {
+        ImGui::InputText("File Name", params->exportFileName, sizeof(params->exportFileName));
+
+        int format = (int)params->exportFormat;
+        ImGui::Combo("Format", &format, "glTF Binary (.glb)\0OBJ (.obj)\0");
+        params->exportFormat = (MeshExportFormat)format;
+
+        ImGui::SliderFloat("Max Error", &params->exportMaxError, 0.01f, 4.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        ImGui::Checkbox("Include Water", &params->exportWater);
+
+        if (ImGui::Button("Export"))
+        {
+            params->exportMeshRequested = true;
+        }
+        if (params->exportedTriangles > 0)
+            ImGui::Text("Last Export: %d triangles in %.2f s", params->exportedTriangles, params->exportSeconds);
+
+        ImGui::End();
+    }
+}
+
+void Window::ShowCheckpointMenu(SimulationParametersUI* params, bool* open)
+{
+    if (ImGui::Begin("Checkpoint", open))
+    {
+        ImGui::InputText("File Name", params->checkpointFileName, sizeof(params->checkpointFileName));
+        ImGui::Checkbox("Compress", &params->compressCheckpoints);
+
+        if (ImGui::Button("Save"))
+        {
+            params->saveCheckpointRequested = true;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load"))
+        {
+            params->loadCheckpointRequested = true;
+        }
+
+        ImGui::End();
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 
@@ -369,3 +505,36 @@ void Window::framebuffer_size_callback(GLFWwindow* window, int width, int height
 
 }
 
+
+void Window::ShowTimelineMenu(SimulationParametersUI* params, bool* open)
+{
+    if (ImGui::Begin("Timeline", open))
+    {
+        int stateCount = (int)params->historySteps.size();
+        if (stateCount == 0)
+        {
+            ImGui::Text("No states kept yet");
+        }
+        else
+        {
+            params->timelineIndex = std::clamp(params->timelineIndex, 0, stateCount - 1);
+            char stepText[32];
+            snprintf(stepText, sizeof(stepText), "Step %lld", params->historySteps[params->timelineIndex]);
+            if (ImGui::SliderInt("State", &params->timelineIndex, 0, stateCount - 1, stepText))
+            {
+                params->timelineJumpRequested = true;
+            }
+            if (ImGui::Button("Resume From Here"))
+            {
+                params->timelineResumeRequested = true;
+            }
+        }
+
+        ImGui::InputInt("Steps Between States", &params->historyInterval);
+        ImGui::InputInt("Memory Budget (MB)", &params->historyBudgetMB);
+        ImGui::Text("%d states, %.1f / %d MB, capture %.2f ms, %d skipped", stateCount, params->historyMegabytes,
+            params->historyBudgetMB, params->historyCopyMs, params->historySkipped);
+
+        ImGui::End();
+    }
+}
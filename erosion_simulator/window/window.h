@@ -6,6 +6,7 @@
 #include "GLFW/glfw3.h"
 #include "erosion_model.h"
 #include "simulation_parameters_ui.h"
+#include "simulation/simulation_stats.h"
 
 const int SIMULATION_PARAMETER_WINDOW_WIDTH = 600;
 
@@ -44,10 +45,14 @@ public:
 	double getMouseScrollY() { return mouseScrollY; }
 	
 	
-	void Menu(ErosionModel*, SimulationParametersUI*);
+	void Menu(ErosionParameters*, SimulationParametersUI*, const SimulationStats*);
 	bool showSimulationParameters;
 	bool showPaintBrushMenu;
 	bool showSaveMenu;
+	bool showExportMenu = false;
+	bool showCheckpointMenu = false;
+	bool showTimelineMenu = false;
+	bool showStatsOverlay = true;
 
 private:
 	int width;
@@ -73,9 +78,13 @@ private:
 	double mouseDeltaY = 0;
 
 	
-	void ShowSimulationParameters(ErosionModel* model, SimulationParametersUI* params, bool* open);
-	void ShowPaintBrushMenu(ErosionModel* model, SimulationParametersUI* params, bool* open);
+	void ShowSimulationParameters(ErosionParameters* model, SimulationParametersUI* params, const SimulationStats* stats, bool* open);
+	void ShowPaintBrushMenu(ErosionParameters* model, SimulationParametersUI* params, bool* open);
 	void ShowSaveMenu(SimulationParametersUI* params, bool* open);
+	void ShowExportMenu(SimulationParametersUI* params, bool* open);
+	void ShowCheckpointMenu(SimulationParametersUI* params, bool* open);
+	void ShowTimelineMenu(SimulationParametersUI* params, bool* open);
+	void ShowStatsOverlay(SimulationParametersUI* params, const SimulationStats* stats);
 
 	static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 	static void cursor_position_callback(GLFWwindow* window, double xPos, double yPos);